@@ -0,0 +1,367 @@
+/****************************************************************************************/
+/*  arena.h
+/*
+/*  Author: rtxa
+/*  Description: Allocator for the short lived geometry of a native stage, released all
+/*  at once when the stage is done, like GBSP_FreeBSP() does for the whole BSP
+/*
+/*	The arena hands out big blocks, one per thread at a time: a thread bumps a pointer
+/*	through its own block without locking and only takes the lock to get the next one,
+/*	so the workers don't fight over malloc and a long run doesn't fragment the heap.
+/*	Sizes are rounded up to a few classes, what's freed goes to a list of its class
+/*	kept by the freeing thread and is handed out again before bumping, so pieces made
+/*	and dropped over and over don't pile up. A thread gives its lists back to the arena
+/*	when it ends or moves on to another arena, and takes them from there once its own
+/*	run dry: the threads ParallelFor() starts on every call reuse what the ones before
+/*	them freed. The blocks are only given back by Reset() or the arena going away; the
+/*	arena never runs destructors, whoever uses it runs them before that.
+/*
+/*	A stage makes its arena the current one of a thread with ArenaScope while it works,
+/*	containers using ArenaAllocator pick the current arena of the thread making them
+/*	and the heap when there's none. Worker threads don't inherit it: a job that makes
+/*	containers opens its own ArenaScope, or hands the arena to ArenaAllocator itself.
+/*	A thread bumps through a block of one arena at a time, going back and forth between
+/*	two of them leaves the rest of its block unused.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_ARENA_H
+#define GBSPTOOLS_ARENA_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include "basetype.h"
+
+#define ARENA_BLOCK_SIZE		(1 << 20)		// bytes per block
+#define ARENA_ALIGN				16				// of everything handed out
+#define ARENA_CLASSES			27				// 32, 48, 64, 96 ... 256 KB, bigger ones get a block of their own
+
+namespace GBSPTools {
+	typedef struct {
+		long long	Allocated;			// bytes carved out of the blocks, reused ones count once
+		long long	Reserved;			// bytes of the blocks held now
+		long long	PeakReserved;		// most bytes the blocks ever took
+		int32		Blocks;
+	} ArenaStats;
+
+	class Arena {
+	public:
+		explicit Arena(size_t blockSize = ARENA_BLOCK_SIZE) : blockSize(blockSize), id(NextId()) {
+			Registry& registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.Mutex);
+			registry.Arenas[id] = this;
+		}
+
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		~Arena() {
+			Registry& registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.Mutex);
+			registry.Arenas.erase(id);
+			FreeBlocks();
+		}
+
+		//========================================================================================
+		//	Alloc()
+		//	At least size bytes aligned to ARENA_ALIGN, from the free list or the block of
+		//	the calling thread. Safe to call from any number of threads.
+		//========================================================================================
+		void* Alloc(size_t size) {
+			Cursor& cursor = GetCursor();
+			const int c = SizeClass(size);
+			if (c == ARENA_CLASSES) {
+				return AllocBlock(size, nullptr);
+			}
+			Claim(cursor);
+			if (cursor.Free[c] == nullptr && (sharedClasses.load(std::memory_order_relaxed) >> c & 1)) {
+				std::lock_guard<std::mutex> lock(mutex);
+				cursor.Free[c] = shared[c];
+				shared[c] = nullptr;
+				sharedClasses &= ~(1u << c);
+			}
+			if (cursor.Free[c] != nullptr) {
+				FreeItem* item = cursor.Free[c];
+				cursor.Free[c] = item->Next;
+				return item;
+			}
+			size = ClassSize(c);
+			if (cursor.Next == nullptr || size > (size_t)(cursor.End - cursor.Next)) {
+				cursor.Next = (char*)AllocBlock(blockSize, &cursor.Current);
+				cursor.End = cursor.Next + blockSize;
+				cursor.Current->Used = 0;
+			}
+			void* p = cursor.Next;
+			cursor.Next += size;
+			cursor.Current->Used += size;
+			return p;
+		}
+
+		// Hands p, of size bytes, out again later. It must come from Alloc() of this arena.
+		void Free(void* p, size_t size) {
+			Cursor& cursor = GetCursor();
+			const int c = SizeClass(size);
+			if (c == ARENA_CLASSES) {
+				return;				// its block stays until Reset()
+			}
+			Claim(cursor);
+			FreeItem* item = (FreeItem*)p;
+			item->Next = cursor.Free[c];
+			cursor.Free[c] = item;
+		}
+
+		template <typename T, typename... Args>
+		T* New(Args&&... args) {
+			static_assert(alignof(T) <= ARENA_ALIGN, "type too aligned for the arena");
+			return new (Alloc(sizeof(T))) T(std::forward<Args>(args)...);
+		}
+
+		// Gives every block back, no thread may be using the arena or what it handed out
+		void Reset() {
+			Registry& registry = GetRegistry();
+			std::lock_guard<std::mutex> lock(registry.Mutex);
+			registry.Arenas.erase(id);
+			FreeBlocks();
+			id = NextId();			// the threads' cursors and free lists point into freed blocks
+			registry.Arenas[id] = this;
+		}
+
+		ArenaStats GetStats() const {
+			std::lock_guard<std::mutex> lock(mutex);
+			ArenaStats stats;
+			stats.Allocated = 0;
+			stats.Reserved = reserved;
+			stats.PeakReserved = peakReserved;
+			stats.Blocks = 0;
+			for (const Block* block = blocks; block != nullptr; block = block->Next) {
+				stats.Allocated += (long long)block->Used;
+				stats.Blocks++;
+			}
+			return stats;
+		}
+
+		// The arena of the calling thread, null when it has none
+		static Arena* GetCurrent() {
+			return CurrentSlot();
+		}
+
+	private:
+		friend class ArenaScope;
+
+		struct Block {
+			Block*		Next;
+			size_t		Size;			// bytes after the header
+			size_t		Used;			// written by the thread bumping through the block only
+			size_t		Padding;		// keeps what follows the header aligned to ARENA_ALIGN
+		};
+
+		struct FreeItem {
+			FreeItem*	Next;
+		};
+
+		// What a thread has of the arena, good while Owner is the id of the arena. The free
+		// lists go back to it when the thread ends.
+		struct Cursor {
+			uint64_t	Owner = 0;
+			Block*		Current = nullptr;
+			char*		Next = nullptr;
+			char*		End = nullptr;
+			FreeItem*	Free[ARENA_CLASSES] = {};
+
+			~Cursor() { GiveBack(*this); }
+		};
+
+		// The live arenas by id, so a thread can tell whether the arena its free lists
+		// came from is still there, with the same blocks
+		struct Registry {
+			std::mutex	Mutex;
+			std::unordered_map<uint64_t, Arena*> Arenas;
+		};
+
+		const size_t blockSize;
+		std::atomic<uint64_t> id;
+		mutable std::mutex mutex;
+		Block* blocks = nullptr;
+		long long reserved = 0;
+		long long peakReserved = 0;
+		FreeItem* shared[ARENA_CLASSES] = {};		// given back by the threads, under mutex
+		std::atomic<uint32_t> sharedClasses{ 0 };	// a bit for each of them that isn't empty
+
+		static uint64_t NextId() {
+			static std::atomic<uint64_t> next{ 1 };
+			return next++;
+		}
+
+		static Registry& GetRegistry() {
+			static Registry registry;
+			return registry;
+		}
+
+		// Makes cursor one of this arena, the free lists it had go back to their own first
+		void Claim(Cursor& cursor) {
+			const uint64_t owner = id.load(std::memory_order_relaxed);
+			if (cursor.Owner != owner) {
+				GiveBack(cursor);
+				cursor = Cursor();
+				cursor.Owner = owner;
+			}
+		}
+
+		// Moves the free lists of cursor to the arena they came from, they're dropped when
+		// it was reset or is gone
+		static void GiveBack(Cursor& cursor) {
+			bool any = false;
+			for (int c = 0; c < ARENA_CLASSES; c++) {
+				any |= cursor.Free[c] != nullptr;
+			}
+			if (!any) {
+				return;
+			}
+
+			Registry& registry = GetRegistry();
+			std::lock_guard<std::mutex> registryLock(registry.Mutex);
+			auto found = registry.Arenas.find(cursor.Owner);
+			if (found != registry.Arenas.end()) {
+				Arena* arena = found->second;
+				std::lock_guard<std::mutex> lock(arena->mutex);
+				for (int c = 0; c < ARENA_CLASSES; c++) {
+					if (cursor.Free[c] == nullptr) {
+						continue;
+					}
+					FreeItem* last = cursor.Free[c];
+					while (last->Next != nullptr) {
+						last = last->Next;
+					}
+					last->Next = arena->shared[c];
+					arena->shared[c] = cursor.Free[c];
+					arena->sharedClasses |= 1u << c;
+				}
+			}
+			for (int c = 0; c < ARENA_CLASSES; c++) {
+				cursor.Free[c] = nullptr;
+			}
+		}
+
+		static Cursor& GetCursor() {
+			static thread_local Cursor cursor;
+			return cursor;
+		}
+
+		static Arena*& CurrentSlot() {
+			static thread_local Arena* current = nullptr;
+			return current;
+		}
+
+		// 32, 48, 64, 96, 128... every one a multiple of ARENA_ALIGN
+		static size_t ClassSize(int c) {
+			return (size_t)(c & 1 ? 3 : 2) << (c / 2 + 4);
+		}
+
+		static int SizeClass(size_t size) {
+			int c = 0;
+			while (c < ARENA_CLASSES && ClassSize(c) < size) {
+				c++;
+			}
+			return c;
+		}
+
+		// A new block of size bytes, which becomes *current when asked
+		void* AllocBlock(size_t size, Block** current) {
+			Block* block = (Block*)malloc(sizeof(Block) + size);
+			if (block == nullptr) {
+				throw std::bad_alloc();
+			}
+			block->Size = size;
+			block->Used = size;
+			std::lock_guard<std::mutex> lock(mutex);
+			block->Next = blocks;
+			blocks = block;
+			reserved += (long long)(sizeof(Block) + size);
+			peakReserved = reserved > peakReserved ? reserved : peakReserved;
+			if (current != nullptr) {
+				*current = block;
+			}
+			return block + 1;
+		}
+
+		void FreeBlocks() {
+			std::lock_guard<std::mutex> lock(mutex);
+			while (blocks != nullptr) {
+				Block* next = blocks->Next;
+				free(blocks);
+				blocks = next;
+			}
+			reserved = 0;
+			for (int c = 0; c < ARENA_CLASSES; c++) {
+				shared[c] = nullptr;
+			}
+			sharedClasses = 0;
+		}
+	};
+
+	// Makes arena the current one of the calling thread until the end of the scope
+	class ArenaScope {
+	public:
+		explicit ArenaScope(Arena& arena) : previous(Arena::CurrentSlot()) { Arena::CurrentSlot() = &arena; }
+		~ArenaScope() { Arena::CurrentSlot() = previous; }
+
+		ArenaScope(const ArenaScope&) = delete;
+		ArenaScope& operator=(const ArenaScope&) = delete;
+
+	private:
+		Arena* previous;
+	};
+
+	// For containers of stage geometry
+	template <typename T>
+	class ArenaAllocator {
+		static_assert(alignof(T) <= ARENA_ALIGN, "type too aligned for the arena");
+
+	public:
+		typedef T value_type;
+		typedef std::true_type propagate_on_container_copy_assignment;
+		typedef std::true_type propagate_on_container_move_assignment;
+		typedef std::true_type propagate_on_container_swap;
+
+		ArenaAllocator() : arena(Arena::GetCurrent()) {}
+		explicit ArenaAllocator(Arena* arena) : arena(arena) {}
+
+		template <typename U>
+		ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.GetArena()) {}
+
+		T* allocate(size_t n) {
+			if (arena != nullptr) {
+				return (T*)arena->Alloc(n * sizeof(T));
+			}
+			return (T*)::operator new(n * sizeof(T));
+		}
+
+		void deallocate(T* p, size_t n) {
+			if (arena != nullptr) {
+				arena->Free(p, n * sizeof(T));
+			}
+			else {
+				::operator delete(p);
+			}
+		}
+
+		Arena* GetArena() const { return arena; }
+
+		template <typename U>
+		bool operator==(const ArenaAllocator<U>& other) const { return arena == other.GetArena(); }
+		template <typename U>
+		bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.GetArena(); }
+
+	private:
+		Arena* arena;
+	};
+};
+
+#endif // GBSPTOOLS_ARENA_H
@@ -0,0 +1,186 @@
+/****************************************************************************************/
+/*  asynclog.h
+/*
+/*  Author: rtxa
+/*  Description: Buffered output written to the console by a background thread, so a
+/*  verbose compile doesn't wait on a slow console for every line
+/*
+/*	Text goes into a fixed ring buffer without taking any lock; the writer thread wakes
+/*	up every few milliseconds (or as soon as the ring is half full) to drain it. When
+/*	the console can't keep up and the ring is full, whole messages are dropped and a
+/*	note with how many were lost is written in their place, so memory stays bounded.
+/*	Messages that must not be lost (errors) wait for room instead. Flush() returns once
+/*	everything written before it reached the console: call it before printing directly,
+/*	or the two outputs come out of order.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_ASYNCLOG_H
+#define GBSPTOOLS_ASYNCLOG_H
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define ASYNCLOG_DEFAULT_SIZE		1024		// kilobytes
+#define ASYNCLOG_MAX_MESSAGE		4096		// formatted on the stack, longer ones on the heap
+#define ASYNCLOG_WAKE_INTERVAL		5			// milliseconds
+
+namespace GBSPTools {
+	class AsyncLog {
+	public:
+		AsyncLog() {}
+		~AsyncLog() { Stop(); }
+
+		AsyncLog(const AsyncLog&) = delete;
+		AsyncLog& operator=(const AsyncLog&) = delete;
+
+		bool IsRunning() const { return running; }
+		size_t GetDropped() const { return dropped; }
+
+		// Starts the writer thread with a ring of at least size bytes
+		void Start(FILE* output, size_t size) {
+			Stop();
+			size_t capacity = 4096;
+			while (capacity < size) {
+				capacity <<= 1;
+			}
+			ring.assign(capacity, '\0');
+			mask = capacity - 1;
+			head = 0;
+			tail = 0;
+			dropped = 0;
+			pendingDrops = 0;
+			out = output;
+			running = true;
+			writer = std::thread([this]() { Drain(); });
+		}
+
+		// Writes everything left and stops the writer thread
+		void Stop() {
+			if (!running) {
+				return;
+			}
+			running = false;
+			wake.notify_one();
+			writer.join();
+		}
+
+		//========================================================================================
+		//	Write()
+		//	Queues size bytes of text. Only one thread may write at a time. Without room for
+		//	it, the text is dropped unless keep is set, which waits for the writer instead.
+		//========================================================================================
+		void Write(const char* text, size_t size, bool keep) {
+			if (!running) {
+				fwrite(text, 1, size, out);
+				return;
+			}
+			if (size > ring.size() / 2) {
+				size = ring.size() / 2;
+			}
+
+			// tell about what was lost first, once there is room for it
+			if (pendingDrops > 0) {
+				char note[64];
+				int length = snprintf(note, sizeof(note), "\n[%zu log messages dropped]\n", pendingDrops);
+				if (Reserve(length + size, false)) {
+					Append(note, (size_t)length);
+					pendingDrops = 0;
+				}
+				else if (!keep) {
+					pendingDrops++;
+					dropped++;
+					return;
+				}
+			}
+
+			if (!Reserve(size, keep)) {
+				pendingDrops++;
+				dropped++;
+				return;
+			}
+			Append(text, size);
+
+			// no need to wait for the next interval when the ring fills up
+			if (head - tail > ring.size() / 2) {
+				wake.notify_one();
+			}
+		}
+
+		// Returns once everything written so far reached the output
+		void Flush() {
+			if (!running) {
+				fflush(out);
+				return;
+			}
+			const size_t target = head;
+			wake.notify_one();
+			while (tail < target) {
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+		}
+
+	private:
+		std::vector<char> ring;
+		size_t mask = 0;
+		std::atomic<size_t> head{ 0 };		// written by the callers, never wraps (it's a count)
+		std::atomic<size_t> tail{ 0 };		// written by the writer thread
+		std::atomic<size_t> dropped{ 0 };
+		size_t pendingDrops = 0;
+		std::atomic<bool> running{ false };
+		FILE* out = stdout;
+		std::thread writer;
+		std::mutex wakeLock;
+		std::condition_variable wake;
+
+		bool Reserve(size_t size, bool wait) {
+			while (ring.size() - (head - tail) < size) {
+				if (!wait) {
+					return false;
+				}
+				wake.notify_one();
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			}
+			return true;
+		}
+
+		void Append(const char* text, size_t size) {
+			size_t start = head & mask;
+			size_t first = size < ring.size() - start ? size : ring.size() - start;
+			memcpy(&ring[start], text, first);
+			memcpy(&ring[0], text + first, size - first);
+			head.store(head + size, std::memory_order_release);
+		}
+
+		void Drain() {
+			for (;;) {
+				const bool last = !running;
+				const size_t end = head.load(std::memory_order_acquire);
+				size_t start = tail;
+				if (start != end) {
+					// the text may wrap around the end of the ring
+					size_t offset = start & mask;
+					size_t first = end - start < ring.size() - offset ? end - start : ring.size() - offset;
+					fwrite(&ring[offset], 1, first, out);
+					fwrite(&ring[0], 1, end - start - first, out);
+					fflush(out);
+					tail.store(end, std::memory_order_release);
+				}
+				if (last) {
+					return;
+				}
+
+				std::unique_lock<std::mutex> guard(wakeLock);
+				wake.wait_for(guard, std::chrono::milliseconds(ASYNCLOG_WAKE_INTERVAL));
+			}
+		}
+	};
+};
+
+#endif // GBSPTOOLS_ASYNCLOG_H
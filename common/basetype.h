@@ -28,7 +28,11 @@ extern "C" {
 
 /******** The Genesis Calling Conventions ***********/ 
 
+#ifdef _MSC_VER
 #define	GENESISCC	_fastcall
+#else
+#define	GENESISCC
+#endif
 
 #if	defined(BUILDGENESIS) && defined(GENESISDLLVERSION)
   #define GENESISAPI	_declspec(dllexport)
@@ -52,10 +56,18 @@ typedef float geFloat;
 #define NULL	((void *)0)
 #endif
 
+#ifdef _WIN32
 typedef signed long     int32;
+#else
+typedef signed int      int32;		// long is 64 bits on LP64 systems
+#endif
 typedef signed short    int16;
 typedef signed char     int8 ;
+#ifdef _WIN32
 typedef unsigned long  uint32;
+#else
+typedef unsigned int   uint32;
+#endif
 typedef unsigned short uint16;
 typedef unsigned char  uint8 ;
 
@@ -0,0 +1,329 @@
+/****************************************************************************************/
+/*  bitset.h
+/*
+/*  Author: rtxa
+/*  Description: Fixed size bit sets and the SIMD kernels the vis works them with
+/*
+/*	Vis spends its time and-ing, or-ing and counting one bit per cluster over and
+/*	over, so the words of a BitSet start on a cache line and are padded to a whole
+/*	number of them: the kernels never see a partial vector and two sets never share
+/*	a line between threads. The kernels come in scalar, SSE2 and AVX2 versions and
+/*	GetBitKernels() picks the best one the processor has at run time, so a single
+/*	build runs everywhere.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_BITSET_H
+#define GBSPTOOLS_BITSET_H
+
+#include <stdint.h>
+#include <string.h>
+#include <utility>
+#include "basetype.h"
+#include "platform.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BITSET_X86 1
+#include <immintrin.h>
+#if defined(__GNUC__)
+// lets the SIMD kernels be built without -msse2 / -mavx2, they're only called when supported
+#define BITSET_TARGET_SSE2 __attribute__((target("sse2")))
+#define BITSET_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define BITSET_TARGET_SSE2
+#define BITSET_TARGET_AVX2
+#endif
+#endif
+
+#define BITSET_ALIGNMENT		64
+#define BITSET_LINE_WORDS		(BITSET_ALIGNMENT / 8)
+
+#define BITSET_SCALAR			0
+#define BITSET_SSE2				1
+#define BITSET_AVX2				2
+
+namespace GBSPTools {
+	// Every kernel works on numWords 64 bit words, dst may be a but must not partly overlap it
+	typedef struct {
+		const char*	Name;
+		int			Level;
+		void		(*And)(uint64_t* dst, const uint64_t* a, const uint64_t* b, int32 numWords);		// dst = a & b
+		void		(*AndNot)(uint64_t* dst, const uint64_t* a, const uint64_t* b, int32 numWords);		// dst = a & ~b
+		void		(*Or)(uint64_t* dst, const uint64_t* a, int32 numWords);							// dst |= a
+		bool		(*AnyAndNot)(const uint64_t* a, const uint64_t* b, int32 numWords);					// a & ~b has a bit set
+		int32		(*Count)(const uint64_t* a, int32 numWords);
+	} BitKernels;
+
+	struct BitScalar {
+		static void And(uint64_t* dst, const uint64_t* a, const uint64_t* b, int32 numWords) {
+			for (int32 i = 0; i < numWords; i++) {
+				dst[i] = a[i] & b[i];
+			}
+		}
+
+		static void AndNot(uint64_t* dst, const uint64_t* a, const uint64_t* b, int32 numWords) {
+			for (int32 i = 0; i < numWords; i++) {
+				dst[i] = a[i] & ~b[i];
+			}
+		}
+
+		static void Or(uint64_t* dst, const uint64_t* a, int32 numWords) {
+			for (int32 i = 0; i < numWords; i++) {
+				dst[i] |= a[i];
+			}
+		}
+
+		static bool AnyAndNot(const uint64_t* a, const uint64_t* b, int32 numWords) {
+			for (int32 i = 0; i < numWords; i++) {
+				if (a[i] & ~b[i]) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// no popcnt instruction before SSE4.2, count the bits in parallel within the word
+		static int32 Count(const uint64_t* a, int32 numWords) {
+			int32 count = 0;
+			for (int32 i = 0; i < numWords; i++) {
+				uint64_t x = a[i];
+				x = x - ((x >> 1) & 0x5555555555555555ull);
+				x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+				x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+				count += (int32)((x * 0x0101010101010101ull) >> 56);
+			}
+			return count;
+		}
+	};
+
+#ifdef BITSET_X86
+	struct BitSse2 {
+		enum { Words = 2 };
+
+		BITSET_TARGET_SSE2 static void And(uint64_t* dst, const uint64_t* a, const uint64_t* b, int32 numWords) {
+			int32 i = 0;
+			for (; i + Words <= numWords; i += Words) {
+				_mm_storeu_si128((__m128i*)(dst + i), _mm_and_si128(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+			}
+			BitScalar::And(dst + i, a + i, b + i, numWords - i);
+		}
+
+		BITSET_TARGET_SSE2 static void AndNot(uint64_t* dst, const uint64_t* a, const uint64_t* b, int32 numWords) {
+			int32 i = 0;
+			for (; i + Words <= numWords; i += Words) {
+				_mm_storeu_si128((__m128i*)(dst + i), _mm_andnot_si128(_mm_loadu_si128((const __m128i*)(b + i)), _mm_loadu_si128((const __m128i*)(a + i))));
+			}
+			BitScalar::AndNot(dst + i, a + i, b + i, numWords - i);
+		}
+
+		BITSET_TARGET_SSE2 static void Or(uint64_t* dst, const uint64_t* a, int32 numWords) {
+			int32 i = 0;
+			for (; i + Words <= numWords; i += Words) {
+				_mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_loadu_si128((const __m128i*)(dst + i)), _mm_loadu_si128((const __m128i*)(a + i))));
+			}
+			BitScalar::Or(dst + i, a + i, numWords - i);
+		}
+
+		BITSET_TARGET_SSE2 static bool AnyAndNot(const uint64_t* a, const uint64_t* b, int32 numWords) {
+			const __m128i zero = _mm_setzero_si128();
+			int32 i = 0;
+			for (; i + Words <= numWords; i += Words) {
+				__m128i bits = _mm_andnot_si128(_mm_loadu_si128((const __m128i*)(b + i)), _mm_loadu_si128((const __m128i*)(a + i)));
+				if (_mm_movemask_epi8(_mm_cmpeq_epi8(bits, zero)) != 0xffff) {
+					return true;
+				}
+			}
+			return BitScalar::AnyAndNot(a + i, b + i, numWords - i);
+		}
+
+		// the scalar bit trick on both halves, then the byte sums are added by sad
+		BITSET_TARGET_SSE2 static int32 Count(const uint64_t* a, int32 numWords) {
+			const __m128i m1 = _mm_set1_epi8(0x55);
+			const __m128i m2 = _mm_set1_epi8(0x33);
+			const __m128i m4 = _mm_set1_epi8(0x0f);
+			__m128i sum = _mm_setzero_si128();
+			int32 i = 0;
+			for (; i + Words <= numWords; i += Words) {
+				__m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+				x = _mm_sub_epi8(x, _mm_and_si128(_mm_srli_epi64(x, 1), m1));
+				x = _mm_add_epi8(_mm_and_si128(x, m2), _mm_and_si128(_mm_srli_epi64(x, 2), m2));
+				x = _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi64(x, 4)), m4);
+				sum = _mm_add_epi64(sum, _mm_sad_epu8(x, _mm_setzero_si128()));
+			}
+			int32 count = _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+			return count + BitScalar::Count(a + i, numWords - i);
+		}
+	};
+
+	struct BitAvx2 {
+		enum { Words = 4 };
+
+		BITSET_TARGET_AVX2 static void And(uint64_t* dst, const uint64_t* a, const uint64_t* b, int32 numWords) {
+			int32 i = 0;
+			for (; i + Words <= numWords; i += Words) {
+				_mm256_storeu_si256((__m256i*)(dst + i), _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i))));
+			}
+			BitScalar::And(dst + i, a + i, b + i, numWords - i);
+		}
+
+		BITSET_TARGET_AVX2 static void AndNot(uint64_t* dst, const uint64_t* a, const uint64_t* b, int32 numWords) {
+			int32 i = 0;
+			for (; i + Words <= numWords; i += Words) {
+				_mm256_storeu_si256((__m256i*)(dst + i), _mm256_andnot_si256(_mm256_loadu_si256((const __m256i*)(b + i)), _mm256_loadu_si256((const __m256i*)(a + i))));
+			}
+			BitScalar::AndNot(dst + i, a + i, b + i, numWords - i);
+		}
+
+		BITSET_TARGET_AVX2 static void Or(uint64_t* dst, const uint64_t* a, int32 numWords) {
+			int32 i = 0;
+			for (; i + Words <= numWords; i += Words) {
+				_mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(dst + i)), _mm256_loadu_si256((const __m256i*)(a + i))));
+			}
+			BitScalar::Or(dst + i, a + i, numWords - i);
+		}
+
+		BITSET_TARGET_AVX2 static bool AnyAndNot(const uint64_t* a, const uint64_t* b, int32 numWords) {
+			int32 i = 0;
+			for (; i + Words <= numWords; i += Words) {
+				// testc is set when every bit of a is in b
+				if (!_mm256_testc_si256(_mm256_loadu_si256((const __m256i*)(b + i)), _mm256_loadu_si256((const __m256i*)(a + i)))) {
+					return true;
+				}
+			}
+			return BitScalar::AnyAndNot(a + i, b + i, numWords - i);
+		}
+
+		// bits per nibble from a 16 entry table, then the byte sums are added by sad
+		BITSET_TARGET_AVX2 static int32 Count(const uint64_t* a, int32 numWords) {
+			const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+			const __m256i low = _mm256_set1_epi8(0x0f);
+			__m256i sum = _mm256_setzero_si256();
+			int32 i = 0;
+			for (; i + Words <= numWords; i += Words) {
+				__m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+				__m256i bits = _mm256_add_epi8(_mm256_shuffle_epi8(table, _mm256_and_si256(x, low)), _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+				sum = _mm256_add_epi64(sum, _mm256_sad_epu8(bits, _mm256_setzero_si256()));
+			}
+			__m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+			int32 count = _mm_cvtsi128_si32(half) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(half, half));
+			return count + BitScalar::Count(a + i, numWords - i);
+		}
+	};
+#endif
+
+	// Best level the processor running the tools has
+	inline int GetBitKernelsLevel() {
+#ifdef BITSET_X86
+		if (CpuHasAvx2()) {
+			return BITSET_AVX2;
+		}
+		if (CpuHasSse2()) {
+			return BITSET_SSE2;
+		}
+#endif
+		return BITSET_SCALAR;
+	}
+
+	//========================================================================================
+	//	GetBitKernels()
+	//	The kernels of the given level, or of the best one below it the processor has
+	//========================================================================================
+	inline const BitKernels& GetBitKernels(int level) {
+		static const BitKernels scalar = { "scalar", BITSET_SCALAR, BitScalar::And, BitScalar::AndNot, BitScalar::Or, BitScalar::AnyAndNot, BitScalar::Count };
+#ifdef BITSET_X86
+		static const BitKernels sse2 = { "sse2", BITSET_SSE2, BitSse2::And, BitSse2::AndNot, BitSse2::Or, BitSse2::AnyAndNot, BitSse2::Count };
+		static const BitKernels avx2 = { "avx2", BITSET_AVX2, BitAvx2::And, BitAvx2::AndNot, BitAvx2::Or, BitAvx2::AnyAndNot, BitAvx2::Count };
+		int best = GetBitKernelsLevel();
+		if (level > best) {
+			level = best;
+		}
+		if (level == BITSET_AVX2) {
+			return avx2;
+		}
+		if (level == BITSET_SSE2) {
+			return sse2;
+		}
+#endif
+		return scalar;
+	}
+
+	inline const BitKernels& GetBitKernels() {
+		static const BitKernels& best = GetBitKernels(BITSET_AVX2);
+		return best;
+	}
+
+	//========================================================================================
+	//	BitSet
+	//	numBits bits on whole cache lines, all zero until set
+	//========================================================================================
+	class BitSet {
+	public:
+		BitSet() {}
+		explicit BitSet(int32 numBits) { Resize(numBits); }
+		~BitSet() { AlignedFree(words); }
+
+		BitSet(const BitSet& other) { *this = other; }
+		BitSet(BitSet&& other) { Swap(other); }
+
+		BitSet& operator=(const BitSet& other) {
+			if (this != &other) {
+				if (numWords != other.numWords) {
+					Allocate(other.numWords);
+				}
+				numBits = other.numBits;
+				if (numWords) {
+					memcpy(words, other.words, numWords * sizeof(uint64_t));
+				}
+			}
+			return *this;
+		}
+
+		BitSet& operator=(BitSet&& other) {
+			Swap(other);
+			return *this;
+		}
+
+		void Resize(int32 newNumBits) {
+			int32 newNumWords = ((newNumBits + 63) / 64 + BITSET_LINE_WORDS - 1) & ~(BITSET_LINE_WORDS - 1);
+			if (newNumWords != numWords) {
+				Allocate(newNumWords);
+			}
+			numBits = newNumBits;
+			Clear();
+		}
+
+		void Clear() {
+			if (numWords) {
+				memset(words, 0, numWords * sizeof(uint64_t));
+			}
+		}
+
+		bool Test(int32 index) const { return (words[index >> 6] >> (index & 63)) & 1; }
+		void Set(int32 index) { words[index >> 6] |= (uint64_t)1 << (index & 63); }
+		int32 Count() const { return GetBitKernels().Count(words, numWords); }
+
+		uint64_t* GetWords() { return words; }
+		const uint64_t* GetWords() const { return words; }
+		int32 GetNumWords() const { return numWords; }		// padded to whole cache lines
+		int32 GetNumBits() const { return numBits; }
+
+		void Swap(BitSet& other) {
+			std::swap(words, other.words);
+			std::swap(numWords, other.numWords);
+			std::swap(numBits, other.numBits);
+		}
+
+	private:
+		uint64_t* words = nullptr;
+		int32 numWords = 0;
+		int32 numBits = 0;
+
+		void Allocate(int32 newNumWords) {
+			AlignedFree(words);
+			words = newNumWords ? (uint64_t*)AlignedAlloc(newNumWords * sizeof(uint64_t), BITSET_ALIGNMENT) : nullptr;
+			numWords = words ? newNumWords : 0;
+		}
+	};
+};
+
+#endif // GBSPTOOLS_BITSET_H
@@ -0,0 +1,603 @@
+/****************************************************************************************/
+/*  bspfile.h
+/*
+/*  Author: rtxa
+/*  Description: Zero copy access to the chunks of a Genesis3D .BSP file
+/*
+/*	A .BSP is a list of chunks, each one a GBSP_Chunk header (type, element size and
+/*	element count) followed by its elements, terminated by a GBSP_CHUNK_END chunk.
+/*	BspFile maps the file and hands out typed spans right over the mapping. Chunks
+/*	that get replaced live in memory until the file is saved, saving gathers the
+/*	untouched chunks from the mapping and the replaced ones from memory in one write.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_BSPFILE_H
+#define GBSPTOOLS_BSPFILE_H
+
+#include <string.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "basetype.h"
+#include "vec3d.h"
+#include "mappedfile.h"
+#include "platform.h"
+#include "utils.h"
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+#define GBSP_VERSION				15
+#define GBSP_TAG					"GBSP"
+
+#define GBSP_CHUNK_HEADER			0
+#define GBSP_CHUNK_MODELS			1
+#define GBSP_CHUNK_NODES			2
+#define GBSP_CHUNK_BNODES			3
+#define GBSP_CHUNK_LEAFS			4
+#define GBSP_CHUNK_CLUSTERS			5
+#define GBSP_CHUNK_AREAS			6
+#define GBSP_CHUNK_AREA_PORTALS		7
+#define GBSP_CHUNK_LEAF_SIDES		8
+#define GBSP_CHUNK_PORTALS			9
+#define GBSP_CHUNK_PLANES			10
+#define GBSP_CHUNK_FACES			11
+#define GBSP_CHUNK_LEAF_FACES		12
+#define GBSP_CHUNK_VERT_INDEX		13
+#define GBSP_CHUNK_VERTS			14
+#define GBSP_CHUNK_RGB_VERTS		15
+#define GBSP_CHUNK_ENTDATA			16
+#define GBSP_CHUNK_TEXINFO			17
+#define GBSP_CHUNK_TEXTURES			18
+#define GBSP_CHUNK_TEXDATA			19
+#define GBSP_CHUNK_LIGHTDATA		20
+#define GBSP_CHUNK_VISDATA			21
+#define GBSP_CHUNK_SKYDATA			22
+#define GBSP_CHUNK_PALETTES			23
+#define GBSP_CHUNK_MOTIONS			24
+#define GBSP_CHUNK_END				0xffff
+
+// Leaf contents
+#define BSP_CONTENTS_SOLID2			(1<<0)
+#define BSP_CONTENTS_WINDOW2		(1<<1)
+#define BSP_CONTENTS_EMPTY2			(1<<2)
+#define BSP_CONTENTS_TRANSLUCENT2	(1<<3)
+#define BSP_CONTENTS_WAVY2			(1<<4)
+#define BSP_CONTENTS_DETAIL2		(1<<5)
+#define BSP_CONTENTS_CLIP2			(1<<6)
+#define BSP_CONTENTS_HINT2			(1<<7)
+#define BSP_CONTENTS_AREA2			(1<<8)
+
+// TexInfo flags
+#define TEXINFO_MIRROR				(1<<0)
+#define TEXINFO_FULLBRIGHT			(1<<1)
+#define TEXINFO_SKY					(1<<2)
+#define TEXINFO_LIGHT				(1<<3)
+#define TEXINFO_TRANS				(1<<4)
+#define TEXINFO_GOURAUD				(1<<5)
+#define TEXINFO_FLAT				(1<<6)
+#define TEXINFO_NO_LIGHTMAP			(1<<15)
+
+#define MAX_LTYPE_INDEX				4
+
+typedef struct {
+	int32		Type;
+	int32		Size;					// size of one element
+	int32		Elements;
+} GBSP_Chunk;
+
+typedef struct {
+	char		TAG[5];
+	int32		Version;
+	uint16		BSPTime[8];				// SYSTEMTIME
+} GBSP_Header;
+
+typedef struct {
+	int32		RootNode[2];
+	geVec3d		Mins;
+	geVec3d		Maxs;
+	geVec3d		Origin;
+	int32		FirstFace;
+	int32		NumFaces;
+	int32		FirstLeaf;
+	int32		NumLeafs;
+	int32		FirstCluster;
+	int32		NumClusters;
+	int32		Areas[2];
+	int32		Motion;					// runtime pointer, meaningless on disk
+} GFX_Model;
+
+typedef struct {
+	int32		Children[2];			// negative values are leafs: -(Leaf + 1)
+	int32		NumFaces;
+	int32		FirstFace;
+	int32		PlaneNum;
+	geVec3d		Mins;
+	geVec3d		Maxs;
+} GFX_Node;
+
+typedef struct {
+	int32		Children[2];
+	int32		PlaneNum;
+} GFX_BNode;
+
+typedef struct {
+	int32		Contents;
+	geVec3d		Mins;
+	geVec3d		Maxs;
+	int32		FirstFace;
+	int32		NumFaces;
+	int32		FirstPortal;
+	int32		NumPortals;
+	int32		Cluster;
+	int32		Area;
+	int32		FirstSide;
+	int32		NumSides;
+} GFX_Leaf;
+
+typedef struct {
+	int32		VisOfs;
+} GFX_Cluster;
+
+typedef struct {
+	int32		NumAreaPortals;
+	int32		FirstAreaPortal;
+} GFX_Area;
+
+typedef struct {
+	int32		ModelNum;
+	int32		Area;
+} GFX_AreaPortal;
+
+typedef struct {
+	int32		PlaneNum;
+	int32		PlaneSide;
+} GFX_LeafSide;
+
+typedef struct {
+	geVec3d		Origin;
+	int32		LeafTo;
+} GFX_Portal;
+
+typedef struct {
+	geVec3d		Normal;
+	geFloat		Dist;
+	int32		Type;
+} GFX_Plane;
+
+typedef struct {
+	int32		FirstVert;
+	int32		NumVerts;
+	int32		PlaneNum;
+	int32		PlaneSide;
+	int32		TexInfo;
+	int32		LightOfs;				// -1 when the face has no lightmap
+	int32		LWidth;
+	int32		LHeight;
+	uint8		LTypes[MAX_LTYPE_INDEX];	// light styles, 255 marks unused slots
+} GFX_Face;
+
+typedef struct {
+	geVec3d		Vecs[2];
+	geFloat		Shift[2];
+	uint32		Flags;
+	int32		FaceLight;
+	geFloat		ReflectiveScale;
+	geFloat		Alpha;
+	geFloat		MipMapBias;
+	int32		Texture;
+} GFX_TexInfo;
+
+typedef struct {
+	char		Name[32];
+	uint32		Flags;
+	int32		Width;
+	int32		Height;
+	int32		Offset;
+	int32		PaletteIndex;
+} GFX_Texture;
+
+typedef struct {
+	geVec3d		Axis;
+	geFloat		Dpm;
+	int32		Textures[6];
+	geFloat		DrawScale;
+} GFX_SkyData;
+
+typedef struct {
+	uint8		RGB[256][3];
+} GFX_Palette;
+
+namespace GBSPTools {
+	//========================================================================================
+	//	Span
+	//	Typed view over elements owned by someone else (usually the file mapping)
+	//========================================================================================
+	template <typename T>
+	class Span {
+	public:
+		Span() {}
+		Span(T* data, int32 count) : data(data), count(count) {}
+
+		T* begin() const { return data; }
+		T* end() const { return data + count; }
+		T& operator[](int32 index) const { return data[index]; }
+		T* GetData() const { return data; }
+		int32 size() const { return count; }
+		bool empty() const { return count == 0; }
+
+	private:
+		T* data = nullptr;
+		int32 count = 0;
+	};
+
+	inline const char* GetChunkName(int32 type) {
+		static const char* names[] = {
+			"header", "models", "nodes", "bnodes", "leafs", "clusters", "areas", "area portals",
+			"leaf sides", "portals", "planes", "faces", "leaf faces", "vert index", "verts",
+			"rgb verts", "entdata", "texinfo", "textures", "texdata", "lightdata", "visdata",
+			"skydata", "palettes", "motions"
+		};
+		if (type >= 0 && type < (int32)(sizeof(names) / sizeof(names[0]))) {
+			return names[type];
+		}
+		return type == GBSP_CHUNK_END ? "end" : "unknown";
+	}
+
+	class BspFile {
+	public:
+		typedef struct {
+			GBSP_Chunk		Header;
+			size_t			FileOffset;		// offset of the data in the mapped file
+			const uint8*	Data;			// mapping or Owned
+			std::vector<uint8> Owned;		// replaced contents, empty when mapped
+			bool			Modified;
+		} Chunk;
+
+		BspFile() {}
+		BspFile(const BspFile&) = delete;
+		BspFile& operator=(const BspFile&) = delete;
+
+		//========================================================================================
+		//	Open()
+		//	Maps a .bsp and indexes its chunks, nothing is copied
+		//========================================================================================
+		bool Open(const std::string& path) {
+			Close();
+			if (!file.Open(path)) {
+				error = "unable to open " + path;
+				return false;
+			}
+			filePath = path;
+
+			const uint8* data = file.GetData();
+			size_t size = file.GetSize();
+			size_t pos = 0;
+
+			for (;;) {
+				Chunk chunk;
+				if (size - pos < sizeof(GBSP_Chunk)) {
+					error = path + ": missing end chunk";
+					return false;
+				}
+				memcpy(&chunk.Header, data + pos, sizeof(GBSP_Chunk));
+				pos += sizeof(GBSP_Chunk);
+
+				if (chunk.Header.Type == GBSP_CHUNK_END) {
+					break;
+				}
+
+				if (chunk.Header.Size < 0 || chunk.Header.Elements < 0 ||
+					(chunk.Header.Size && (size_t)chunk.Header.Elements > (size - pos) / chunk.Header.Size)) {
+					error = path + ": bad " + GetChunkName(chunk.Header.Type) + " chunk";
+					return false;
+				}
+
+				chunk.FileOffset = pos;
+				chunk.Data = data + pos;
+				chunk.Modified = false;
+				pos += (size_t)chunk.Header.Size * chunk.Header.Elements;
+				chunks.push_back(std::move(chunk));
+			}
+
+			const GBSP_Header* header = GetChunkData<GBSP_Header>(GBSP_CHUNK_HEADER).GetData();
+			if (header == nullptr || memcmp(header->TAG, GBSP_TAG, 4) != 0) {
+				error = path + " is not a Genesis3D .bsp file";
+				return false;
+			}
+			if (header->Version != GBSP_VERSION) {
+				error = path + ": unsupported version " + std::to_string(header->Version);
+				return false;
+			}
+
+			return true;
+		}
+
+		void Close() {
+			chunks.clear();
+			file.Close();
+			filePath.clear();
+		}
+
+		const std::string& GetError() const { return error; }
+		const std::string& GetPath() const { return filePath; }
+		const std::vector<Chunk>& GetChunks() const { return chunks; }
+
+		const Chunk* FindChunk(int32 type) const {
+			for (const Chunk& chunk : chunks) {
+				if (chunk.Header.Type == type) {
+					return &chunk;
+				}
+			}
+			return nullptr;
+		}
+
+		//========================================================================================
+		//	GetChunkData()
+		//	Typed span over a chunk, empty when the chunk is missing or its element size
+		//	doesn't match T (use uint8 for the raw byte chunks like vis or light data)
+		//========================================================================================
+		template <typename T>
+		Span<const T> GetChunkData(int32 type) const {
+			const Chunk* chunk = FindChunk(type);
+			if (chunk == nullptr) {
+				return Span<const T>();
+			}
+			if (sizeof(T) == 1) {
+				return Span<const T>((const T*)chunk->Data, chunk->Header.Size * chunk->Header.Elements);
+			}
+			if (chunk->Header.Size != (int32)sizeof(T)) {
+				return Span<const T>();
+			}
+			return Span<const T>((const T*)chunk->Data, chunk->Header.Elements);
+		}
+
+		//========================================================================================
+		//	SetChunkData()
+		//	Replaces (or adds, before the end chunk) the contents of a chunk
+		//========================================================================================
+		template <typename T>
+		void SetChunkData(int32 type, const T* elements, int32 count) {
+			std::vector<uint8> bytes(sizeof(T) * count);
+			if (count) {
+				memcpy(bytes.data(), elements, bytes.size());
+			}
+			SetChunkBytes(type, sizeof(T) == 1 ? 1 : (int32)sizeof(T), count, std::move(bytes));
+		}
+
+		template <typename T>
+		void SetChunkData(int32 type, const std::vector<T>& elements) {
+			SetChunkData(type, elements.data(), (int32)elements.size());
+		}
+
+		void SetChunkBytes(int32 type, int32 elementSize, int32 count, std::vector<uint8>&& bytes) {
+			Chunk* chunk = nullptr;
+			for (Chunk& c : chunks) {
+				if (c.Header.Type == type) {
+					chunk = &c;
+					break;
+				}
+			}
+			if (chunk == nullptr) {
+				chunks.push_back(Chunk());
+				chunk = &chunks.back();
+				chunk->Header.Type = type;
+				chunk->FileOffset = 0;
+			}
+			chunk->Header.Size = elementSize;
+			chunk->Header.Elements = count;
+			chunk->Owned = std::move(bytes);
+			chunk->Data = chunk->Owned.data();
+			chunk->Modified = true;
+		}
+
+		//========================================================================================
+		//	Detach()
+		//	Copies every chunk still on the mapping into memory and unmaps the file, so the
+		//	BSP can stay around while its file is overwritten
+		//========================================================================================
+		void Detach() {
+			for (Chunk& chunk : chunks) {
+				if (chunk.Owned.empty() && chunk.Data != nullptr) {
+					size_t bytes = (size_t)chunk.Header.Size * chunk.Header.Elements;
+					chunk.Owned.assign(chunk.Data, chunk.Data + bytes);
+					chunk.Data = chunk.Owned.data();
+				}
+			}
+			file.Close();
+		}
+
+		//========================================================================================
+		//	Save()
+		//	Writes every chunk to path with a single gather write, through a temporary file
+		//	that then replaces it. Saving over the mapped file remaps it.
+		//========================================================================================
+		bool Save(const std::string& destPath) {
+			// destPath may be our own filePath, which reopening clears
+			const std::string path(destPath);
+			if (file.GetData() != nullptr && path == filePath) {
+				// the mapping has to go before its file is replaced
+				Detach();
+				return SaveCopy(path) && Open(path);
+			}
+
+			if (!SaveCopy(path)) {
+				return false;
+			}
+			for (Chunk& chunk : chunks) {
+				chunk.Modified = false;
+			}
+			return true;
+		}
+
+		//========================================================================================
+		//	SaveCopy()
+		//	Like Save() but the BSP stays as it is, modified chunks included, so path must not
+		//	be the mapped file
+		//========================================================================================
+		bool SaveCopy(const std::string& path) {
+			const std::string outPath = path + ".tmp";
+			if (!WriteChunks(outPath)) {
+				remove(outPath.c_str());
+				return false;
+			}
+			if (!CommitFile(outPath, path)) {
+				remove(outPath.c_str());
+				error = "unable to replace " + path;
+				return false;
+			}
+			return true;
+		}
+
+		// Bytes Save() writes
+		size_t GetSize() const {
+			size_t size = sizeof(GBSP_Chunk);
+			for (const Chunk& chunk : chunks) {
+				size += sizeof(GBSP_Chunk) + (size_t)chunk.Header.Size * chunk.Header.Elements;
+			}
+			return size;
+		}
+
+		//========================================================================================
+		//	Update()
+		//	Writes back only the modified chunks into the mapped file when their sizes didn't
+		//	change, the rest of the file isn't touched. Falls back to a full Save() otherwise.
+		//========================================================================================
+		bool Update() {
+			bool inPlace = file.GetData() != nullptr;
+			for (const Chunk& chunk : chunks) {
+				if (chunk.Modified && (chunk.FileOffset == 0 || chunk.Owned.size() != GetMappedSize(chunk))) {
+					inPlace = false;
+					break;
+				}
+			}
+
+			if (!inPlace) {
+				return Save(filePath);
+			}
+
+			FILE* fp = fopen(filePath.c_str(), "r+b");
+			if (fp == nullptr) {
+				error = "unable to write " + filePath;
+				return false;
+			}
+			bool ok = true;
+			for (Chunk& chunk : chunks) {
+				if (!chunk.Modified) {
+					continue;
+				}
+				// the element size may have changed even if the byte count didn't
+				if (SeekFile(fp, (long long)(chunk.FileOffset - sizeof(GBSP_Chunk))) != 0 ||
+					fwrite(&chunk.Header, sizeof(GBSP_Chunk), 1, fp) != 1 ||
+					fwrite(chunk.Owned.data(), 1, chunk.Owned.size(), fp) != chunk.Owned.size()) {
+					ok = false;
+					break;
+				}
+				chunk.Modified = false;
+			}
+			if (fclose(fp) != 0 || !ok) {
+				error = "unable to write " + filePath;
+				return false;
+			}
+			return true;
+		}
+
+	private:
+		MappedFile file;
+		std::string filePath;
+		std::string error;
+		std::vector<Chunk> chunks;
+
+		size_t GetMappedSize(const Chunk& chunk) const {
+			// size the chunk had in the file, the header in memory may already be replaced
+			GBSP_Chunk header;
+			memcpy(&header, file.GetData() + chunk.FileOffset - sizeof(GBSP_Chunk), sizeof(GBSP_Chunk));
+			return (size_t)header.Size * header.Elements;
+		}
+
+		bool WriteChunks(const std::string& path) {
+			static const GBSP_Chunk endChunk = { GBSP_CHUNK_END, 0, 0 };
+
+			// one segment for each header and each chunk data
+			std::vector<std::pair<const void*, size_t>> segments;
+			segments.reserve(chunks.size() * 2 + 1);
+			for (const Chunk& chunk : chunks) {
+				segments.push_back(std::make_pair((const void*)&chunk.Header, sizeof(GBSP_Chunk)));
+				size_t bytes = (size_t)chunk.Header.Size * chunk.Header.Elements;
+				if (bytes) {
+					segments.push_back(std::make_pair((const void*)chunk.Data, bytes));
+				}
+			}
+			segments.push_back(std::make_pair((const void*)&endChunk, sizeof(GBSP_Chunk)));
+
+			if (!GatherWrite(path, segments)) {
+				error = "unable to write " + path;
+				return false;
+			}
+			return true;
+		}
+
+		static bool GatherWrite(const std::string& path, const std::vector<std::pair<const void*, size_t>>& segments) {
+#ifdef _WIN32
+			HANDLE handle = CreateFileA(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (handle == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+			// WriteFileGather() needs page aligned unbuffered buffers, which the mapping
+			// offsets aren't, so the segments go one after the other on the same handle
+			bool ok = true;
+			for (const auto& segment : segments) {
+				const uint8* data = (const uint8*)segment.first;
+				size_t left = segment.second;
+				while (ok && left) {
+					DWORD chunkSize = left > 0x40000000 ? 0x40000000 : (DWORD)left;
+					DWORD written = 0;
+					ok = WriteFile(handle, data, chunkSize, &written, NULL) && written;
+					data += written;
+					left -= written;
+				}
+			}
+			return CloseHandle(handle) && ok;
+#else
+			int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (fd < 0) {
+				return false;
+			}
+			std::vector<struct iovec> iov(segments.size());
+			for (size_t i = 0; i < segments.size(); i++) {
+				iov[i].iov_base = (void*)segments[i].first;
+				iov[i].iov_len = segments[i].second;
+			}
+
+			// writev() may stop short, resume from wherever it left
+			size_t first = 0;
+			bool ok = true;
+			while (first < iov.size()) {
+				int count = (int)(iov.size() - first);
+				count = count > IOV_MAX ? IOV_MAX : count;
+				ssize_t written = writev(fd, &iov[first], count);
+				if (written < 0) {
+					if (errno == EINTR) {
+						continue;
+					}
+					ok = false;
+					break;
+				}
+				while (first < iov.size() && (size_t)written >= iov[first].iov_len) {
+					written -= iov[first].iov_len;
+					first++;
+				}
+				if (first < iov.size()) {
+					iov[first].iov_base = (uint8*)iov[first].iov_base + written;
+					iov[first].iov_len -= written;
+				}
+			}
+			return close(fd) == 0 && ok;
+#endif
+		}
+	};
+};
+
+#endif // GBSPTOOLS_BSPFILE_H
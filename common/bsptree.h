@@ -0,0 +1,117 @@
+/****************************************************************************************/
+/*  bsptree.h
+/*
+/*  Author: rtxa
+/*  Description: Point and line queries against the node tree of a .BSP
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_BSPTREE_H
+#define GBSPTOOLS_BSPTREE_H
+
+#include "bspfile.h"
+#include "mathlib.h"
+
+#define BSPTREE_MAX_STACK	256
+
+namespace GBSPTools {
+	class BspTree {
+	public:
+		bool Init(const BspFile& bsp, int32 model = 0) {
+			nodes = bsp.GetChunkData<GFX_Node>(GBSP_CHUNK_NODES);
+			leafs = bsp.GetChunkData<GFX_Leaf>(GBSP_CHUNK_LEAFS);
+			planes = bsp.GetChunkData<GFX_Plane>(GBSP_CHUNK_PLANES);
+			Span<const GFX_Model> models = bsp.GetChunkData<GFX_Model>(GBSP_CHUNK_MODELS);
+			if (nodes.empty() || leafs.empty() || planes.empty() || model >= models.size()) {
+				return false;
+			}
+			root = models[model].RootNode[0];
+			return true;
+		}
+
+		// Signed distance from a plane, with the usual shortcut for axial planes
+		geFloat PlaneDist(const GFX_Plane& plane, const geVec3d& p) const {
+			if (plane.Type < 3) {
+				return VectorToSUB(p, plane.Type) * VectorToSUB(plane.Normal, plane.Type) - plane.Dist;
+			}
+			return geVec3d_DotProduct(&p, &plane.Normal) - plane.Dist;
+		}
+
+		int32 FindLeaf(const geVec3d& p) const {
+			int32 node = root;
+			while (node >= 0) {
+				const GFX_Node& n = nodes[node];
+				node = n.Children[PlaneDist(planes[n.PlaneNum], p) < 0.0f ? 1 : 0];
+			}
+			return -(node + 1);
+		}
+
+		bool IsSolid(int32 leaf) const {
+			return (leafs[leaf].Contents & BSP_CONTENTS_SOLID2) != 0;
+		}
+
+		//========================================================================================
+		//	IsLineBlocked()
+		//	True when any solid leaf lies on the segment start-end. The segment is split
+		//	at each plane it crosses and the near half is walked first, so hits near the
+		//	start (the usual case for shadow rays from a surface) exit early.
+		//========================================================================================
+		bool IsLineBlocked(const geVec3d& start, const geVec3d& end) const {
+			struct StackEntry {
+				int32 node;
+				geVec3d p1;
+				geVec3d p2;
+			} stack[BSPTREE_MAX_STACK];
+			int sp = 0;
+
+			stack[sp++] = { root, start, end };
+			while (sp) {
+				StackEntry e = stack[--sp];
+
+				if (e.node < 0) {
+					if (IsSolid(-(e.node + 1))) {
+						return true;
+					}
+					continue;
+				}
+
+				const GFX_Node& node = nodes[e.node];
+				const GFX_Plane& plane = planes[node.PlaneNum];
+				geFloat d1 = PlaneDist(plane, e.p1);
+				geFloat d2 = PlaneDist(plane, e.p2);
+
+				if (d1 >= 0.0f && d2 >= 0.0f) {
+					stack[sp++] = { node.Children[0], e.p1, e.p2 };
+					continue;
+				}
+				if (d1 < 0.0f && d2 < 0.0f) {
+					stack[sp++] = { node.Children[1], e.p1, e.p2 };
+					continue;
+				}
+				if (sp + 2 > BSPTREE_MAX_STACK) {
+					// absurdly deep tree, be conservative
+					return true;
+				}
+
+				int side = d1 < 0.0f ? 1 : 0;
+				geFloat frac = d1 / (d1 - d2);
+				geVec3d mid;
+				geVec3d_Subtract(&e.p2, &e.p1, &mid);
+				geVec3d_AddScaled(&e.p1, &mid, frac, &mid);
+
+				// far half first so the near half is popped next
+				stack[sp++] = { node.Children[side ^ 1], mid, e.p2 };
+				stack[sp++] = { node.Children[side], e.p1, mid };
+			}
+			return false;
+		}
+
+	private:
+		Span<const GFX_Node> nodes;
+		Span<const GFX_Leaf> leafs;
+		Span<const GFX_Plane> planes;
+		int32 root = 0;
+	};
+};
+
+#endif // GBSPTOOLS_BSPTREE_H
@@ -0,0 +1,676 @@
+/****************************************************************************************/
+/*  bvh.h
+/*
+/*  Author: rtxa
+/*  Description: Bounding volume hierarchy over the faces of a .BSP for occlusion tests
+/*
+/*	Built once with the surface area heuristic, then flattened into an array of
+/*	32 byte nodes (one cache line holds two siblings). Leafs point to a run of at
+/*	most BVH_MAX_LEAF_TRIS triangles. Queries only answer "is anything in between",
+/*	so traversal stops at the first hit. Packets of 4 (SSE) or 8 (AVX) segments
+/*	walk the tree together, which pays off when they share an origin like the
+/*	shadow rays of one lightmap sample do. The AVX walk is built whatever the
+/*	compiler flags and only taken when the processor running the tools has AVX.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_BVH_H
+#define GBSPTOOLS_BVH_H
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "platform.h"
+#include "bspfile.h"
+#include "vec3d.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SSE 1
+#include <emmintrin.h>
+#endif
+
+#if defined(BVH_SSE) && (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__))
+#define BVH_AVX 1
+#include <immintrin.h>
+#if defined(__GNUC__)
+// lets the AVX walk be built without -mavx, it's only called when supported
+#define BVH_TARGET_AVX __attribute__((target("avx")))
+#else
+#define BVH_TARGET_AVX
+#endif
+#endif
+
+#define BVH_MAX_LEAF_TRIS		4
+#define BVH_MAX_DEPTH			60
+#define BVH_STACK_SIZE			64
+#define BVH_SAH_BINS			16
+#define BVH_EPSILON				0.01f		// segments stop this short of both ends
+
+namespace GBSPTools {
+	// 32 bytes, Count == 0 means an interior node whose children are First and First + 1
+	typedef struct {
+		geFloat		Mins[3];
+		int32		First;
+		geFloat		Maxs[3];
+		int32		Count;
+	} BvhNode;
+
+	typedef struct {
+		geFloat		V0[3];
+		geFloat		E1[3];
+		geFloat		E2[3];
+	} BvhTriangle;
+
+#ifdef BVH_SSE
+	// SIMD lanes used by the SSE packet traversal
+	struct BvhLanes4 {
+		enum { Width = 4 };
+		typedef __m128 F;
+		static F Set1(float x) { return _mm_set1_ps(x); }
+		static F Load(const float* p) { return _mm_load_ps(p); }
+		static F Add(F a, F b) { return _mm_add_ps(a, b); }
+		static F Sub(F a, F b) { return _mm_sub_ps(a, b); }
+		static F Mul(F a, F b) { return _mm_mul_ps(a, b); }
+		static F Div(F a, F b) { return _mm_div_ps(a, b); }
+		static F Min(F a, F b) { return _mm_min_ps(a, b); }
+		static F Max(F a, F b) { return _mm_max_ps(a, b); }
+		static F Lt(F a, F b) { return _mm_cmplt_ps(a, b); }
+		static F Le(F a, F b) { return _mm_cmple_ps(a, b); }
+		static F And(F a, F b) { return _mm_and_ps(a, b); }
+		static F Or(F a, F b) { return _mm_or_ps(a, b); }
+		static F AndNot(F a, F b) { return _mm_andnot_ps(b, a); }		// a & ~b
+		static F Abs(F a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+		static int Mask(F a) { return _mm_movemask_ps(a); }
+	};
+#endif
+
+	class Bvh {
+	public:
+		Bvh() {}
+		Bvh(const Bvh&) = delete;
+		Bvh& operator=(const Bvh&) = delete;
+
+		const std::string& GetError() const { return error; }
+		int32 GetNumNodes() const { return numNodes; }
+		int32 GetNumTriangles() const { return (int32)triangles.size(); }
+
+		static const char* GetPacketName() {
+#if defined(BVH_AVX)
+			if (HasAvx()) {
+				return "avx";
+			}
+#endif
+#if defined(BVH_SSE)
+			return "sse";
+#else
+			return "scalar";
+#endif
+		}
+
+		//========================================================================================
+		//	Build()
+		//	Builds the hierarchy over the faces of a model, fanned into triangles.
+		//	Translucent faces let light through and are left out.
+		//========================================================================================
+		bool Build(const BspFile& bsp, int32 model = 0) {
+			Span<const GFX_Model> models = bsp.GetChunkData<GFX_Model>(GBSP_CHUNK_MODELS);
+			Span<const GFX_Face> faces = bsp.GetChunkData<GFX_Face>(GBSP_CHUNK_FACES);
+			Span<const GFX_TexInfo> texInfos = bsp.GetChunkData<GFX_TexInfo>(GBSP_CHUNK_TEXINFO);
+			Span<const int32> vertIndex = bsp.GetChunkData<int32>(GBSP_CHUNK_VERT_INDEX);
+			Span<const geVec3d> verts = bsp.GetChunkData<geVec3d>(GBSP_CHUNK_VERTS);
+			if (model < 0 || model >= models.size()) {
+				error = "missing model " + std::to_string(model);
+				return false;
+			}
+
+			std::vector<BvhTriangle> tris;
+			const GFX_Model& m = models[model];
+			for (int32 f = m.FirstFace; f < m.FirstFace + m.NumFaces; f++) {
+				if (f < 0 || f >= faces.size()) {
+					error = "model " + std::to_string(model) + " has a bad face range";
+					return false;
+				}
+				const GFX_Face& face = faces[f];
+				if (face.TexInfo >= 0 && face.TexInfo < texInfos.size() && (texInfos[face.TexInfo].Flags & TEXINFO_TRANS)) {
+					continue;
+				}
+				if (face.FirstVert < 0 || face.NumVerts < 0 || face.FirstVert + face.NumVerts > vertIndex.size()) {
+					error = "face " + std::to_string(f) + " is out of range";
+					return false;
+				}
+				for (int32 v = 2; v < face.NumVerts; v++) {
+					int32 i0 = vertIndex[face.FirstVert], i1 = vertIndex[face.FirstVert + v - 1], i2 = vertIndex[face.FirstVert + v];
+					if (i0 < 0 || i1 < 0 || i2 < 0 || i0 >= verts.size() || i1 >= verts.size() || i2 >= verts.size()) {
+						error = "face " + std::to_string(f) + " has a bad vertex";
+						return false;
+					}
+					tris.push_back(MakeTriangle(verts[i0], verts[i1], verts[i2]));
+				}
+			}
+			return Build(tris);
+		}
+
+		bool Build(const std::vector<BvhTriangle>& tris) {
+			std::vector<BuildItem> items(tris.size());
+			std::vector<int32> order(tris.size());
+			for (size_t i = 0; i < tris.size(); i++) {
+				const BvhTriangle& t = tris[i];
+				BuildItem& item = items[i];
+				for (int axis = 0; axis < 3; axis++) {
+					geFloat a = t.V0[axis], b = a + t.E1[axis], c = a + t.E2[axis];
+					item.Mins[axis] = std::min(a, std::min(b, c));
+					item.Maxs[axis] = std::max(a, std::max(b, c));
+					item.Center[axis] = (item.Mins[axis] + item.Maxs[axis]) * 0.5f;
+				}
+				order[i] = (int32)i;
+			}
+
+			std::vector<BvhNode> built(1);
+			if (!tris.empty()) {
+				BuildNode(built, 0, items, order, 0, (int32)tris.size(), 0);
+			}
+			else {
+				// a single empty leaf that nothing can hit
+				for (int axis = 0; axis < 3; axis++) {
+					built[0].Mins[axis] = 1.0f;
+					built[0].Maxs[axis] = -1.0f;
+				}
+			}
+
+			if (!nodes.Resize(built.size())) {
+				error = "out of memory";
+				return false;
+			}
+			memcpy(nodes.GetData(), built.data(), built.size() * sizeof(BvhNode));
+			numNodes = (int32)built.size();
+
+			// leafs reference runs of triangles, store them in leaf order
+			triangles.resize(tris.size());
+			for (size_t i = 0; i < order.size(); i++) {
+				triangles[i] = tris[order[i]];
+			}
+			return true;
+		}
+
+		//========================================================================================
+		//	Occluded()
+		//	True when a triangle lies on the segment start-end
+		//========================================================================================
+		bool Occluded(const geVec3d& start, const geVec3d& end) const {
+			geVec3d dir;
+			geVec3d_Subtract(&end, &start, &dir);
+			geFloat maxT = geVec3d_Normalize(&dir) - BVH_EPSILON;
+			if (maxT <= BVH_EPSILON) {
+				return false;
+			}
+			geFloat org[3] = { start.X, start.Y, start.Z };
+			geFloat d[3] = { dir.X, dir.Y, dir.Z };
+			geFloat inv[3];
+			for (int axis = 0; axis < 3; axis++) {
+				d[axis] = SafeDir(d[axis]);
+				inv[axis] = 1.0f / d[axis];
+			}
+
+			int32 stack[BVH_STACK_SIZE];
+			int sp = 0;
+			stack[sp++] = 0;
+			while (sp) {
+				const BvhNode& node = nodes[stack[--sp]];
+				geFloat tnear = BVH_EPSILON, tfar = maxT;
+				for (int axis = 0; axis < 3; axis++) {
+					geFloat t0 = (node.Mins[axis] - org[axis]) * inv[axis];
+					geFloat t1 = (node.Maxs[axis] - org[axis]) * inv[axis];
+					tnear = std::max(tnear, std::min(t0, t1));
+					tfar = std::min(tfar, std::max(t0, t1));
+				}
+				if (tnear > tfar) {
+					continue;
+				}
+				if (node.Count == 0) {
+					stack[sp++] = node.First;
+					stack[sp++] = node.First + 1;
+					continue;
+				}
+				for (int32 i = node.First; i < node.First + node.Count; i++) {
+					if (IntersectTriangle(triangles[i], org, d, maxT)) {
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+
+		//========================================================================================
+		//	Occluded4() / Occluded8()
+		//	Occluded() for up to 4 / 8 segments at once, bit i of the result is set when
+		//	segment i is blocked. Without the matching instruction set, in the build or in
+		//	the processor, the packet is split.
+		//========================================================================================
+		uint32 Occluded4(const geVec3d* starts, const geVec3d* ends, int count) const {
+#ifdef BVH_SSE
+			return OccludedPacket<BvhLanes4>(starts, ends, count);
+#else
+			return OccludedSerial(starts, ends, count);
+#endif
+		}
+
+		uint32 Occluded8(const geVec3d* starts, const geVec3d* ends, int count) const {
+#if defined(BVH_AVX)
+			if (HasAvx()) {
+				return OccludedAvx(starts, ends, count);
+			}
+#endif
+#if defined(BVH_SSE)
+			uint32 mask = OccludedPacket<BvhLanes4>(starts, ends, std::min(count, 4));
+			if (count > 4) {
+				mask |= OccludedPacket<BvhLanes4>(starts + 4, ends + 4, count - 4) << 4;
+			}
+			return mask;
+#else
+			return OccludedSerial(starts, ends, count);
+#endif
+		}
+
+		uint32 OccludedSerial(const geVec3d* starts, const geVec3d* ends, int count) const {
+			uint32 mask = 0;
+			for (int i = 0; i < count; i++) {
+				if (Occluded(starts[i], ends[i])) {
+					mask |= 1u << i;
+				}
+			}
+			return mask;
+		}
+
+	private:
+		typedef struct {
+			geFloat		Mins[3];
+			geFloat		Maxs[3];
+			geFloat		Center[3];
+		} BuildItem;
+
+		typedef struct {
+			geFloat		Mins[3];
+			geFloat		Maxs[3];
+			int32		Count;
+		} BuildBin;
+
+		AlignedArray<BvhNode, 64> nodes;
+		int32 numNodes = 0;
+		std::vector<BvhTriangle> triangles;
+		std::string error;
+
+#ifdef BVH_AVX
+		static bool HasAvx() {
+			static const bool avx = CpuHasAvx();
+			return avx;
+		}
+#endif
+
+		static BvhTriangle MakeTriangle(const geVec3d& a, const geVec3d& b, const geVec3d& c) {
+			BvhTriangle t;
+			t.V0[0] = a.X; t.V0[1] = a.Y; t.V0[2] = a.Z;
+			t.E1[0] = b.X - a.X; t.E1[1] = b.Y - a.Y; t.E1[2] = b.Z - a.Z;
+			t.E2[0] = c.X - a.X; t.E2[1] = c.Y - a.Y; t.E2[2] = c.Z - a.Z;
+			return t;
+		}
+
+		// keeps 1 / dir finite so empty slabs never turn into NaNs
+		static geFloat SafeDir(geFloat d) {
+			const geFloat tiny = 1e-8f;
+			if (fabsf(d) < tiny) {
+				return d < 0.0f ? -tiny : tiny;
+			}
+			return d;
+		}
+
+		static geFloat HalfArea(const geFloat* mins, const geFloat* maxs) {
+			geFloat dx = maxs[0] - mins[0], dy = maxs[1] - mins[1], dz = maxs[2] - mins[2];
+			return dx * dy + dy * dz + dz * dx;
+		}
+
+		static void Grow(geFloat* mins, geFloat* maxs, const geFloat* otherMins, const geFloat* otherMaxs) {
+			for (int axis = 0; axis < 3; axis++) {
+				mins[axis] = std::min(mins[axis], otherMins[axis]);
+				maxs[axis] = std::max(maxs[axis], otherMaxs[axis]);
+			}
+		}
+
+		static void ClearBounds(geFloat* mins, geFloat* maxs) {
+			for (int axis = 0; axis < 3; axis++) {
+				mins[axis] = 1e30f;
+				maxs[axis] = -1e30f;
+			}
+		}
+
+		//========================================================================================
+		//	BuildNode()
+		//	Fills node with the triangles order[first, first + count), splitting them at the
+		//	cheapest of BVH_SAH_BINS planes per axis when that beats keeping them in a leaf
+		//========================================================================================
+		static void BuildNode(std::vector<BvhNode>& built, int32 nodeIndex, const std::vector<BuildItem>& items, std::vector<int32>& order, int32 first, int32 count, int depth) {
+			geFloat mins[3], maxs[3], centerMins[3], centerMaxs[3];
+			ClearBounds(mins, maxs);
+			ClearBounds(centerMins, centerMaxs);
+			for (int32 i = first; i < first + count; i++) {
+				const BuildItem& item = items[order[i]];
+				Grow(mins, maxs, item.Mins, item.Maxs);
+				Grow(centerMins, centerMaxs, item.Center, item.Center);
+			}
+
+			BvhNode& node = built[nodeIndex];
+			memcpy(node.Mins, mins, sizeof(mins));
+			memcpy(node.Maxs, maxs, sizeof(maxs));
+			node.First = first;
+			node.Count = count;
+			if (count <= BVH_MAX_LEAF_TRIS || depth >= BVH_MAX_DEPTH) {
+				return;
+			}
+
+			int bestAxis = -1;
+			int bestSplit = 0;
+			geFloat bestCost = HalfArea(mins, maxs) * count;
+			for (int axis = 0; axis < 3; axis++) {
+				geFloat extent = centerMaxs[axis] - centerMins[axis];
+				if (extent <= 0.0f) {
+					continue;
+				}
+				BuildBin bins[BVH_SAH_BINS];
+				for (int b = 0; b < BVH_SAH_BINS; b++) {
+					ClearBounds(bins[b].Mins, bins[b].Maxs);
+					bins[b].Count = 0;
+				}
+				geFloat scale = BVH_SAH_BINS / extent;
+				for (int32 i = first; i < first + count; i++) {
+					const BuildItem& item = items[order[i]];
+					int b = std::min(BVH_SAH_BINS - 1, (int)((item.Center[axis] - centerMins[axis]) * scale));
+					Grow(bins[b].Mins, bins[b].Maxs, item.Mins, item.Maxs);
+					bins[b].Count++;
+				}
+
+				// sweep from the right to get the cost of every right side, then from the left
+				geFloat rightArea[BVH_SAH_BINS];
+				int32 rightCount[BVH_SAH_BINS];
+				geFloat boxMins[3], boxMaxs[3];
+				ClearBounds(boxMins, boxMaxs);
+				int32 n = 0;
+				for (int b = BVH_SAH_BINS - 1; b > 0; b--) {
+					Grow(boxMins, boxMaxs, bins[b].Mins, bins[b].Maxs);
+					n += bins[b].Count;
+					rightArea[b] = n ? HalfArea(boxMins, boxMaxs) : 0.0f;
+					rightCount[b] = n;
+				}
+				ClearBounds(boxMins, boxMaxs);
+				n = 0;
+				for (int b = 0; b < BVH_SAH_BINS - 1; b++) {
+					Grow(boxMins, boxMaxs, bins[b].Mins, bins[b].Maxs);
+					n += bins[b].Count;
+					if (n == 0 || rightCount[b + 1] == 0) {
+						continue;
+					}
+					geFloat cost = HalfArea(boxMins, boxMaxs) * n + rightArea[b + 1] * rightCount[b + 1];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = b + 1;
+					}
+				}
+			}
+
+			int32 mid;
+			if (bestAxis >= 0) {
+				geFloat scale = BVH_SAH_BINS / (centerMaxs[bestAxis] - centerMins[bestAxis]);
+				geFloat base = centerMins[bestAxis];
+				mid = (int32)(std::partition(order.begin() + first, order.begin() + first + count, [&](int32 index) {
+					return std::min(BVH_SAH_BINS - 1, (int)((items[index].Center[bestAxis] - base) * scale)) < bestSplit;
+				}) - order.begin());
+			}
+			else if (count > BVH_MAX_LEAF_TRIS * 4) {
+				// no split pays off but the leaf would be huge, halve it along the longest axis
+				int axis = 0;
+				for (int a = 1; a < 3; a++) {
+					if (maxs[a] - mins[a] > maxs[axis] - mins[axis]) {
+						axis = a;
+					}
+				}
+				mid = first + count / 2;
+				std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + first + count, [&](int32 a, int32 b) {
+					return items[a].Center[axis] < items[b].Center[axis];
+				});
+			}
+			else {
+				return;
+			}
+
+			int32 children = (int32)built.size();
+			built.resize(built.size() + 2);
+			built[nodeIndex].First = children;
+			built[nodeIndex].Count = 0;
+			BuildNode(built, children, items, order, first, mid - first, depth + 1);
+			BuildNode(built, children + 1, items, order, mid, first + count - mid, depth + 1);
+		}
+
+		// Moller-Trumbore, any hit with BVH_EPSILON < t < maxT
+		static bool IntersectTriangle(const BvhTriangle& tri, const geFloat* org, const geFloat* dir, geFloat maxT) {
+			geFloat p[3] = { dir[1] * tri.E2[2] - dir[2] * tri.E2[1], dir[2] * tri.E2[0] - dir[0] * tri.E2[2], dir[0] * tri.E2[1] - dir[1] * tri.E2[0] };
+			geFloat det = tri.E1[0] * p[0] + tri.E1[1] * p[1] + tri.E1[2] * p[2];
+			if (fabsf(det) < 1e-8f) {
+				return false;
+			}
+			geFloat invDet = 1.0f / det;
+			geFloat s[3] = { org[0] - tri.V0[0], org[1] - tri.V0[1], org[2] - tri.V0[2] };
+			geFloat u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+			if (u < 0.0f || u > 1.0f) {
+				return false;
+			}
+			geFloat q[3] = { s[1] * tri.E1[2] - s[2] * tri.E1[1], s[2] * tri.E1[0] - s[0] * tri.E1[2], s[0] * tri.E1[1] - s[1] * tri.E1[0] };
+			geFloat v = (dir[0] * q[0] + dir[1] * q[1] + dir[2] * q[2]) * invDet;
+			if (v < 0.0f || u + v > 1.0f) {
+				return false;
+			}
+			geFloat t = (tri.E2[0] * q[0] + tri.E2[1] * q[1] + tri.E2[2] * q[2]) * invDet;
+			return t > BVH_EPSILON && t < maxT;
+		}
+
+		// SoA copy of a packet of W segments, unused lanes get a negative length so they never hit
+		template <int W>
+		static void MakePacket(const geVec3d* starts, const geVec3d* ends, int count, geFloat (&org)[3][W], geFloat (&dir)[3][W], geFloat (&inv)[3][W], geFloat (&len)[W]) {
+			for (int i = 0; i < W; i++) {
+				geVec3d o, d;
+				if (i < count) {
+					o = starts[i];
+					geVec3d_Subtract(&ends[i], &starts[i], &d);
+					len[i] = geVec3d_Normalize(&d) - BVH_EPSILON;
+				}
+				else {
+					geVec3d_Clear(&o);
+					geVec3d_Set(&d, 1.0f, 1.0f, 1.0f);
+					len[i] = -1.0f;
+				}
+				org[0][i] = o.X; org[1][i] = o.Y; org[2][i] = o.Z;
+				dir[0][i] = SafeDir(d.X); dir[1][i] = SafeDir(d.Y); dir[2][i] = SafeDir(d.Z);
+				for (int axis = 0; axis < 3; axis++) {
+					inv[axis][i] = 1.0f / dir[axis][i];
+				}
+			}
+		}
+
+		//========================================================================================
+		//	OccludedPacket()
+		//	Walks the tree with L::Width segments at once. A node is entered when any live
+		//	segment crosses its box, segments drop out as soon as they hit something.
+		//========================================================================================
+		template <typename L>
+		uint32 OccludedPacket(const geVec3d* starts, const geVec3d* ends, int count) const {
+			typedef typename L::F F;
+			const int W = L::Width;
+
+			alignas(32) geFloat org[3][W];
+			alignas(32) geFloat inv[3][W];
+			alignas(32) geFloat dir[3][W];
+			alignas(32) geFloat len[W];
+			MakePacket<W>(starts, ends, count, org, dir, inv, len);
+
+			const F ox = L::Load(org[0]), oy = L::Load(org[1]), oz = L::Load(org[2]);
+			const F dx = L::Load(dir[0]), dy = L::Load(dir[1]), dz = L::Load(dir[2]);
+			const F ix = L::Load(inv[0]), iy = L::Load(inv[1]), iz = L::Load(inv[2]);
+			const F tmin = L::Set1(BVH_EPSILON);
+			const F tmax = L::Load(len);
+			const F zero = L::Set1(0.0f);
+			const F one = L::Set1(1.0f);
+			F active = L::Lt(tmin, tmax);
+			F hits = zero;
+
+			int32 stack[BVH_STACK_SIZE];
+			int sp = 0;
+			stack[sp++] = 0;
+			while (sp) {
+				const BvhNode& node = nodes[stack[--sp]];
+
+				F tx0 = L::Mul(L::Sub(L::Set1(node.Mins[0]), ox), ix);
+				F tx1 = L::Mul(L::Sub(L::Set1(node.Maxs[0]), ox), ix);
+				F ty0 = L::Mul(L::Sub(L::Set1(node.Mins[1]), oy), iy);
+				F ty1 = L::Mul(L::Sub(L::Set1(node.Maxs[1]), oy), iy);
+				F tz0 = L::Mul(L::Sub(L::Set1(node.Mins[2]), oz), iz);
+				F tz1 = L::Mul(L::Sub(L::Set1(node.Maxs[2]), oz), iz);
+				F tnear = L::Max(L::Max(L::Min(tx0, tx1), L::Min(ty0, ty1)), L::Max(L::Min(tz0, tz1), tmin));
+				F tfar = L::Min(L::Min(L::Max(tx0, tx1), L::Max(ty0, ty1)), L::Min(L::Max(tz0, tz1), tmax));
+				if (!L::Mask(L::And(L::Le(tnear, tfar), active))) {
+					continue;
+				}
+
+				if (node.Count == 0) {
+					stack[sp++] = node.First;
+					stack[sp++] = node.First + 1;
+					continue;
+				}
+
+				for (int32 i = node.First; i < node.First + node.Count; i++) {
+					const BvhTriangle& tri = triangles[i];
+					F e1x = L::Set1(tri.E1[0]), e1y = L::Set1(tri.E1[1]), e1z = L::Set1(tri.E1[2]);
+					F e2x = L::Set1(tri.E2[0]), e2y = L::Set1(tri.E2[1]), e2z = L::Set1(tri.E2[2]);
+
+					F px = L::Sub(L::Mul(dy, e2z), L::Mul(dz, e2y));
+					F py = L::Sub(L::Mul(dz, e2x), L::Mul(dx, e2z));
+					F pz = L::Sub(L::Mul(dx, e2y), L::Mul(dy, e2x));
+					F det = L::Add(L::Add(L::Mul(e1x, px), L::Mul(e1y, py)), L::Mul(e1z, pz));
+					F valid = L::Lt(L::Set1(1e-8f), L::Abs(det));
+					F invDet = L::Div(one, det);
+
+					F sx = L::Sub(ox, L::Set1(tri.V0[0]));
+					F sy = L::Sub(oy, L::Set1(tri.V0[1]));
+					F sz = L::Sub(oz, L::Set1(tri.V0[2]));
+					F u = L::Mul(L::Add(L::Add(L::Mul(sx, px), L::Mul(sy, py)), L::Mul(sz, pz)), invDet);
+
+					F qx = L::Sub(L::Mul(sy, e1z), L::Mul(sz, e1y));
+					F qy = L::Sub(L::Mul(sz, e1x), L::Mul(sx, e1z));
+					F qz = L::Sub(L::Mul(sx, e1y), L::Mul(sy, e1x));
+					F v = L::Mul(L::Add(L::Add(L::Mul(dx, qx), L::Mul(dy, qy)), L::Mul(dz, qz)), invDet);
+					F t = L::Mul(L::Add(L::Add(L::Mul(e2x, qx), L::Mul(e2y, qy)), L::Mul(e2z, qz)), invDet);
+
+					F hit = L::And(valid, active);
+					hit = L::And(hit, L::And(L::Le(zero, u), L::Le(zero, v)));
+					hit = L::And(hit, L::Le(L::Add(u, v), one));
+					hit = L::And(hit, L::And(L::Lt(tmin, t), L::Lt(t, tmax)));
+
+					hits = L::Or(hits, hit);
+					active = L::AndNot(active, hit);
+				}
+				if (!L::Mask(active)) {
+					break;
+				}
+			}
+			return (uint32)L::Mask(hits);
+		}
+
+#ifdef BVH_AVX
+		//========================================================================================
+		//	OccludedAvx()
+		//	OccludedPacket() 8 segments at a time. Spelled out with the AVX intrinsics rather
+		//	than through lanes, so no 256 bit value crosses a function built without AVX.
+		//========================================================================================
+		BVH_TARGET_AVX uint32 OccludedAvx(const geVec3d* starts, const geVec3d* ends, int count) const {
+			alignas(32) geFloat org[3][8];
+			alignas(32) geFloat inv[3][8];
+			alignas(32) geFloat dir[3][8];
+			alignas(32) geFloat len[8];
+			MakePacket<8>(starts, ends, count, org, dir, inv, len);
+
+			const __m256 ox = _mm256_load_ps(org[0]), oy = _mm256_load_ps(org[1]), oz = _mm256_load_ps(org[2]);
+			const __m256 dx = _mm256_load_ps(dir[0]), dy = _mm256_load_ps(dir[1]), dz = _mm256_load_ps(dir[2]);
+			const __m256 ix = _mm256_load_ps(inv[0]), iy = _mm256_load_ps(inv[1]), iz = _mm256_load_ps(inv[2]);
+			const __m256 tmin = _mm256_set1_ps(BVH_EPSILON);
+			const __m256 tmax = _mm256_load_ps(len);
+			const __m256 zero = _mm256_setzero_ps();
+			const __m256 one = _mm256_set1_ps(1.0f);
+			const __m256 signBit = _mm256_set1_ps(-0.0f);
+			__m256 active = _mm256_cmp_ps(tmin, tmax, _CMP_LT_OQ);
+			__m256 hits = zero;
+
+			int32 stack[BVH_STACK_SIZE];
+			int sp = 0;
+			stack[sp++] = 0;
+			while (sp) {
+				const BvhNode& node = nodes[stack[--sp]];
+
+				__m256 tx0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.Mins[0]), ox), ix);
+				__m256 tx1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.Maxs[0]), ox), ix);
+				__m256 ty0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.Mins[1]), oy), iy);
+				__m256 ty1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.Maxs[1]), oy), iy);
+				__m256 tz0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.Mins[2]), oz), iz);
+				__m256 tz1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(node.Maxs[2]), oz), iz);
+				__m256 tnear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx0, tx1), _mm256_min_ps(ty0, ty1)), _mm256_max_ps(_mm256_min_ps(tz0, tz1), tmin));
+				__m256 tfar = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx0, tx1), _mm256_max_ps(ty0, ty1)), _mm256_min_ps(_mm256_max_ps(tz0, tz1), tmax));
+				if (!_mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(tnear, tfar, _CMP_LE_OQ), active))) {
+					continue;
+				}
+
+				if (node.Count == 0) {
+					stack[sp++] = node.First;
+					stack[sp++] = node.First + 1;
+					continue;
+				}
+
+				for (int32 i = node.First; i < node.First + node.Count; i++) {
+					const BvhTriangle& tri = triangles[i];
+					__m256 e1x = _mm256_set1_ps(tri.E1[0]), e1y = _mm256_set1_ps(tri.E1[1]), e1z = _mm256_set1_ps(tri.E1[2]);
+					__m256 e2x = _mm256_set1_ps(tri.E2[0]), e2y = _mm256_set1_ps(tri.E2[1]), e2z = _mm256_set1_ps(tri.E2[2]);
+
+					__m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+					__m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+					__m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+					__m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+					__m256 valid = _mm256_cmp_ps(_mm256_set1_ps(1e-8f), _mm256_andnot_ps(signBit, det), _CMP_LT_OQ);
+					__m256 invDet = _mm256_div_ps(one, det);
+
+					__m256 sx = _mm256_sub_ps(ox, _mm256_set1_ps(tri.V0[0]));
+					__m256 sy = _mm256_sub_ps(oy, _mm256_set1_ps(tri.V0[1]));
+					__m256 sz = _mm256_sub_ps(oz, _mm256_set1_ps(tri.V0[2]));
+					__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), invDet);
+
+					__m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+					__m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+					__m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+					__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), invDet);
+					__m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), invDet);
+
+					__m256 hit = _mm256_and_ps(valid, active);
+					hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(zero, u, _CMP_LE_OQ), _mm256_cmp_ps(zero, v, _CMP_LE_OQ)));
+					hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+					hit = _mm256_and_ps(hit, _mm256_and_ps(_mm256_cmp_ps(tmin, t, _CMP_LT_OQ), _mm256_cmp_ps(t, tmax, _CMP_LT_OQ)));
+
+					hits = _mm256_or_ps(hits, hit);
+					active = _mm256_andnot_ps(hit, active);
+				}
+				if (!_mm256_movemask_ps(active)) {
+					break;
+				}
+			}
+			return (uint32)_mm256_movemask_ps(hits);
+		}
+#endif
+	};
+};
+
+#endif // GBSPTOOLS_BVH_H
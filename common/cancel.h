@@ -0,0 +1,159 @@
+/****************************************************************************************/
+/*  cancel.h
+/*
+/*  Author: rtxa
+/*  Description: Cooperative cancellation of the compile stages, on Ctrl+C or when a
+/*  stage runs out of its time budget
+/*
+/*	A signal handler may only set a flag, so a watchdog thread notices it (or the end
+/*	of the budget) and asks the running stage to stop: GBSP_Cancel for the library, a
+/*	flag the native stages poll between work items. The stage then returns by itself
+/*	and its output is discarded like any failed stage, nothing gets killed half way
+/*	through writing a file. A second Ctrl+C kills the process as usual.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_CANCEL_H
+#define GBSPTOOLS_CANCEL_H
+
+#include <signal.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "basetype.h"
+
+#define CANCEL_POLL_INTERVAL	50			// milliseconds
+
+namespace GBSPTools {
+	// Raised while the running native stage has to stop
+	inline std::atomic<bool>& GetCancelFlag() {
+		static std::atomic<bool> flag(false);
+		return flag;
+	}
+
+	inline bool IsCancelRequested() {
+		return GetCancelFlag().load(std::memory_order_relaxed);
+	}
+
+	typedef enum {
+		CANCEL_NONE,
+		CANCEL_TIMEOUT,
+		CANCEL_INTERRUPT
+	} CancelReason;
+
+	// what asks the library to stop, GBSP_Cancel
+	typedef geBoolean CancelCallback(void);
+
+	class CancelWatchdog {
+	public:
+		CancelWatchdog() {}
+		~CancelWatchdog() { Stop(); }
+
+		CancelWatchdog(const CancelWatchdog&) = delete;
+		CancelWatchdog& operator=(const CancelWatchdog&) = delete;
+
+		// Starts watching, Ctrl+C included
+		void Start() {
+			if (running) {
+				return;
+			}
+			GetInterrupted() = 0;
+			signal(SIGINT, OnInterrupt);
+			running = true;
+			thread = std::thread([this]() { Watch(); });
+		}
+
+		void Stop() {
+			if (!running) {
+				return;
+			}
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				running = false;
+			}
+			wake.notify_one();
+			thread.join();
+			signal(SIGINT, SIG_DFL);
+		}
+
+		bool WasInterrupted() const { return GetInterrupted() != 0; }
+
+		//========================================================================================
+		//	Arm()
+		//	Watches the stage about to run, which gets seconds to finish (none when 0)
+		//	and is stopped through callback, if given, and the cancel flag
+		//========================================================================================
+		void Arm(double seconds, CancelCallback* callback) {
+			std::lock_guard<std::mutex> guard(lock);
+			armed = true;
+			budget = seconds;
+			deadline = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds > 0.0 ? seconds : 0.0));
+			cancel = callback;
+			reason = WasInterrupted() ? CANCEL_INTERRUPT : CANCEL_NONE;
+			GetCancelFlag() = reason != CANCEL_NONE;
+		}
+
+		// Ends the stage, returns why it was asked to stop if it was
+		CancelReason Disarm() {
+			std::lock_guard<std::mutex> guard(lock);
+			armed = false;
+			cancel = nullptr;
+			CancelReason result = reason;
+			reason = CANCEL_NONE;
+			GetCancelFlag() = WasInterrupted();
+			return result;
+		}
+
+		double GetBudget() const { return budget; }
+
+	private:
+		std::thread thread;
+		std::mutex lock;
+		std::condition_variable wake;
+		bool running = false;
+		bool armed = false;
+		double budget = 0.0;
+		std::chrono::steady_clock::time_point deadline;
+		CancelCallback* cancel = nullptr;
+		CancelReason reason = CANCEL_NONE;
+
+		static volatile sig_atomic_t& GetInterrupted() {
+			static volatile sig_atomic_t interrupted = 0;
+			return interrupted;
+		}
+
+		// the default handler comes back, so a second Ctrl+C kills the process
+		static void OnInterrupt(int) {
+			GetInterrupted() = 1;
+			signal(SIGINT, SIG_DFL);
+		}
+
+		void Watch() {
+			std::unique_lock<std::mutex> guard(lock);
+			while (running) {
+				wake.wait_for(guard, std::chrono::milliseconds(CANCEL_POLL_INTERVAL));
+				if (!armed || reason != CANCEL_NONE) {
+					continue;
+				}
+				if (WasInterrupted()) {
+					reason = CANCEL_INTERRUPT;
+				}
+				else if (budget > 0.0 && std::chrono::steady_clock::now() >= deadline) {
+					reason = CANCEL_TIMEOUT;
+				}
+				else {
+					continue;
+				}
+
+				GetCancelFlag() = true;
+				if (cancel != nullptr) {
+					cancel();
+				}
+			}
+		}
+	};
+};
+
+#endif // GBSPTOOLS_CANCEL_H
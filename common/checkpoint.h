@@ -0,0 +1,234 @@
+/****************************************************************************************/
+/*  checkpoint.h
+/*
+/*  Author: rtxa
+/*  Description: Progress of a long native stage saved next to the .bsp now and then,
+/*  so a crash or a reboot doesn't throw hours of full vis or radiosity away
+/*
+/*	A checkpoint belongs to one input: the hash of the .bsp chunks the stage started from and
+/*	of the settings that change its results. Resuming only takes a checkpoint of the
+/*	same stage and input, anything else starts over. Like the vis cache, the file is
+/*	replaced through a temporary one, so a crash while saving keeps the previous one.
+/*
+/*	File layout: CheckpointHeader, then Size bytes only the stage knows how to read.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_CHECKPOINT_H
+#define GBSPTOOLS_CHECKPOINT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "basetype.h"
+#include "bspfile.h"
+#include "hash.h"
+#include "mappedfile.h"
+#include "utils.h"
+
+#define CHECKPOINT_TAG					"GCKP"
+#define CHECKPOINT_VERSION				1
+#define CHECKPOINT_DEFAULT_INTERVAL		300			// seconds
+#define VIS_CHECKPOINT_EXTENSION		".vischeckpoint"
+#define LIGHT_CHECKPOINT_EXTENSION		".lightcheckpoint"
+
+namespace GBSPTools {
+	typedef struct {
+		char		Tag[4];
+		int32		Version;
+		char		Stage[8];				// "gvis" or "glight"
+		char		Input[32];				// ContentHash of the input, hex digits
+		long long	Size;
+	} CheckpointHeader;
+
+	typedef struct {
+		std::string	Path;					// empty when off
+		double		Interval;				// seconds between saves
+		bool		Resume;					// go on from the checkpoint at Path
+	} CheckpointParms;
+
+	// Stage state in the checkpoint, values are written as they are in memory
+	class CheckpointWriter {
+	public:
+		const std::vector<uint8>& GetData() const { return data; }
+
+		template <typename T>
+		void Write(const T* values, size_t count) {
+			const uint8* bytes = (const uint8*)values;
+			data.insert(data.end(), bytes, bytes + count * sizeof(T));
+		}
+
+		template <typename T>
+		void WriteValue(const T& value) {
+			Write(&value, 1);
+		}
+
+	private:
+		std::vector<uint8> data;
+	};
+
+	// Reads back what a CheckpointWriter wrote, false past the end
+	class CheckpointReader {
+	public:
+		explicit CheckpointReader(const std::vector<uint8>& data) : data(data) {}
+
+		template <typename T>
+		bool Read(T* values, size_t count) {
+			if ((data.size() - offset) / sizeof(T) < count) {
+				return false;
+			}
+			memcpy(values, data.data() + offset, count * sizeof(T));
+			offset += count * sizeof(T);
+			return true;
+		}
+
+		template <typename T>
+		bool ReadValue(T& value) {
+			return Read(&value, 1);
+		}
+
+		bool IsAtEnd() const { return offset == data.size(); }
+
+	private:
+		const std::vector<uint8>& data;
+		size_t offset = 0;
+	};
+
+	class Checkpoint {
+	public:
+		Checkpoint(const CheckpointParms& parms, const char* stage, const std::string& input) : parms(parms), stage(stage), input(input), origin(std::chrono::steady_clock::now()) {
+			next = parms.Interval;
+		}
+
+		Checkpoint(const Checkpoint&) = delete;
+		Checkpoint& operator=(const Checkpoint&) = delete;
+
+		bool IsEnabled() const { return !parms.Path.empty(); }
+		const std::string& GetPath() const { return parms.Path; }
+		const std::string& GetError() const { return error; }
+
+		// What the checkpoint being resumed holds, empty when starting over
+		const std::vector<uint8>& GetResumeData() const { return resume; }
+
+		//========================================================================================
+		//	Load()
+		//	Reads the checkpoint to resume from, when asked to. A missing file starts over,
+		//	false when the file is bad or belongs to another input.
+		//========================================================================================
+		bool Load() {
+			resume.clear();
+			if (!IsEnabled() || !parms.Resume) {
+				return true;
+			}
+			MappedFile file;
+			if (!file.Open(parms.Path)) {
+				return true;
+			}
+
+			CheckpointHeader header;
+			if (file.GetSize() < sizeof(header)) {
+				return Fail("truncated header in " + parms.Path);
+			}
+			memcpy(&header, file.GetData(), sizeof(header));
+			if (memcmp(header.Tag, CHECKPOINT_TAG, 4) != 0 || header.Version != CHECKPOINT_VERSION) {
+				return Fail(parms.Path + " is not a checkpoint of this version");
+			}
+			if (strncmp(header.Stage, stage.c_str(), sizeof(header.Stage)) != 0 || input.compare(0, std::string::npos, header.Input, sizeof(header.Input)) != 0) {
+				return Fail(parms.Path + " was saved from another .bsp or other settings");
+			}
+			if (header.Size < 0 || (unsigned long long)header.Size != file.GetSize() - sizeof(header)) {
+				return Fail("truncated data in " + parms.Path);
+			}
+
+			resume.assign(file.GetData() + sizeof(header), file.GetData() + file.GetSize());
+			return true;
+		}
+
+		// True for the one thread that gets to save, once Interval seconds went by
+		bool Claim() {
+			if (!IsEnabled() || parms.Interval <= 0.0 || Now() < next.load()) {
+				return false;
+			}
+			bool expected = false;
+			return busy.compare_exchange_strong(expected, true);
+		}
+
+		//========================================================================================
+		//	Save()
+		//	Replaces the checkpoint with the state in writer, and waits Interval seconds
+		//	before the next Claim()
+		//========================================================================================
+		bool Save(const CheckpointWriter& writer) {
+			const std::vector<uint8>& data = writer.GetData();
+			const std::string tempPath = parms.Path + ".tmp";
+			bool ok = false;
+			FILE* fp = fopen(tempPath.c_str(), "wb");
+			if (fp != nullptr) {
+				CheckpointHeader header;
+				memset(&header, 0, sizeof(header));
+				memcpy(header.Tag, CHECKPOINT_TAG, 4);
+				header.Version = CHECKPOINT_VERSION;
+				memcpy(header.Stage, stage.c_str(), stage.size() < sizeof(header.Stage) ? stage.size() : sizeof(header.Stage));
+				memcpy(header.Input, input.c_str(), input.size() < sizeof(header.Input) ? input.size() : sizeof(header.Input));
+				header.Size = (long long)data.size();
+				ok = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(data.data(), 1, data.size(), fp) == data.size();
+				ok = fclose(fp) == 0 && ok;
+			}
+			if (ok) {
+				ok = CommitFile(tempPath, parms.Path);
+			}
+			if (!ok) {
+				remove(tempPath.c_str());
+				error = "unable to write " + parms.Path;
+			}
+
+			next = Now() + parms.Interval;
+			busy = false;
+			return ok;
+		}
+
+		// Once the stage is done there's nothing to resume
+		void Remove() {
+			if (IsEnabled()) {
+				remove(parms.Path.c_str());
+			}
+		}
+
+	private:
+		CheckpointParms parms;
+		std::string stage;
+		std::string input;
+		std::chrono::steady_clock::time_point origin;
+		std::atomic<double> next{ 0.0 };
+		std::atomic<bool> busy{ false };
+		std::vector<uint8> resume;
+		std::string error;
+
+		double Now() const {
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - origin).count();
+		}
+
+		bool Fail(const std::string& message) {
+			resume.clear();
+			error = message;
+			return false;
+		}
+	};
+
+	// Adds the chunks of bsp to the input of a checkpoint. The header is left out, its
+	// BSPTime changes on every compile even when the rest of the .bsp doesn't.
+	inline void AddCheckpointInput(ContentHash& input, const BspFile& bsp) {
+		for (const BspFile::Chunk& chunk : bsp.GetChunks()) {
+			if (chunk.Header.Type == GBSP_CHUNK_HEADER) {
+				continue;
+			}
+			input.AddValue(chunk.Header);
+			input.Add(chunk.Data, (size_t)chunk.Header.Size * chunk.Header.Elements);
+		}
+	}
+};
+
+#endif // GBSPTOOLS_CHECKPOINT_H
@@ -0,0 +1,142 @@
+/****************************************************************************************/
+/*  entities.h
+/*
+/*  Author: rtxa
+/*  Description: Parser for the entity text stored in the entdata chunk of a .BSP
+/*
+/*	{
+/*	"classname" "light"
+/*	"origin" "0 64 0"
+/*	}
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_ENTITIES_H
+#define GBSPTOOLS_ENTITIES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "basetype.h"
+#include "vec3d.h"
+
+namespace GBSPTools {
+	class Entity {
+	public:
+		std::vector<std::pair<std::string, std::string>> Keys;
+
+		// Value of key, or an empty string when missing
+		const std::string& ValueForKey(const char* key) const {
+			static const std::string empty;
+			for (const auto& pair : Keys) {
+				if (pair.first == key) {
+					return pair.second;
+				}
+			}
+			return empty;
+		}
+
+		bool HasKey(const char* key) const {
+			for (const auto& pair : Keys) {
+				if (pair.first == key) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		geFloat GetFloat(const char* key, geFloat defaultValue = 0.0f) const {
+			const std::string& value = ValueForKey(key);
+			return value.empty() ? defaultValue : (geFloat)atof(value.c_str());
+		}
+
+		geVec3d GetVector(const char* key, const geVec3d& defaultValue) const {
+			const std::string& value = ValueForKey(key);
+			geVec3d v = defaultValue;
+			if (!value.empty()) {
+				sscanf(value.c_str(), "%f %f %f", &v.X, &v.Y, &v.Z);
+			}
+			return v;
+		}
+
+		bool IsClass(const char* classname) const {
+			return ValueForKey("classname") == classname;
+		}
+	};
+
+	//========================================================================================
+	//	ParseEntities()
+	//	Parses the entity text, returns false (keeping what was read so far) on bad syntax
+	//========================================================================================
+	inline bool ParseEntities(const char* text, size_t length, std::vector<Entity>& entities) {
+		size_t pos = 0;
+
+		auto skipSpace = [&]() {
+			while (pos < length && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\r' || text[pos] == '\n' || text[pos] == '\0')) {
+				pos++;
+			}
+		};
+
+		auto readQuoted = [&](std::string& out) -> bool {
+			skipSpace();
+			if (pos >= length || text[pos] != '"') {
+				return false;
+			}
+			size_t start = ++pos;
+			while (pos < length && text[pos] != '"') {
+				pos++;
+			}
+			if (pos >= length) {
+				return false;
+			}
+			out.assign(text + start, pos - start);
+			pos++;
+			return true;
+		};
+
+		for (;;) {
+			skipSpace();
+			if (pos >= length) {
+				return true;
+			}
+			if (text[pos] != '{') {
+				return false;
+			}
+			pos++;
+
+			Entity entity;
+			for (;;) {
+				skipSpace();
+				if (pos >= length) {
+					return false;
+				}
+				if (text[pos] == '}') {
+					pos++;
+					break;
+				}
+				std::pair<std::string, std::string> pair;
+				if (!readQuoted(pair.first) || !readQuoted(pair.second)) {
+					return false;
+				}
+				entity.Keys.push_back(std::move(pair));
+			}
+			entities.push_back(std::move(entity));
+		}
+	}
+
+	inline std::string UnparseEntities(const std::vector<Entity>& entities) {
+		std::string text;
+		for (const Entity& entity : entities) {
+			text += "{\n";
+			for (const auto& pair : entity.Keys) {
+				text += "\"" + pair.first + "\" \"" + pair.second + "\"\n";
+			}
+			text += "}\n";
+		}
+		return text;
+	}
+};
+
+#endif // GBSPTOOLS_ENTITIES_H
@@ -0,0 +1,88 @@
+/****************************************************************************************/
+/*  entupdate.h
+/*
+/*  Author: rtxa
+/*  Description: Entity update (-onlyents), puts the entities of the .MAP into the
+/*  entdata chunk of a compiled .BSP
+/*
+/*	Only that chunk changes, so BspFile::Update() writes it back in place when its
+/*	size didn't change. The models stay as they are: the .map has to have the brush
+/*	entities the .bsp was compiled with.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_ENTUPDATE_H
+#define GBSPTOOLS_ENTUPDATE_H
+
+#include <stdio.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "bspfile.h"
+#include "entities.h"
+#include "mapfile.h"
+
+namespace GBSPTools {
+	// The keys of every entity of map, as the entdata chunk holds them
+	inline std::string MapEntityData(const MapFile& map) {
+		std::vector<Entity> entities(map.Entities.size());
+		for (size_t e = 0; e < entities.size(); e++) {
+			const MapEntity& ent = map.Entities[e];
+			for (int32 k = ent.FirstKey; k < ent.FirstKey + ent.NumKeys; k++) {
+				entities[e].Keys.push_back(std::make_pair(map.GetString(map.Keys[k].Key), map.GetString(map.Keys[k].Value)));
+			}
+		}
+		return UnparseEntities(entities);
+	}
+
+	//========================================================================================
+	//	UpdateEntities()
+	//	Replaces the entities of bsp with the ones of the .map at mapPath. The .map has to
+	//	have the brush entities bsp was compiled with, their models are kept.
+	//========================================================================================
+	inline bool UpdateEntities(const std::string& mapPath, BspFile& bsp, int numThreads) {
+		MapFile map;
+		if (!map.Load(mapPath, numThreads)) {
+			printf("Error: %s\n", map.GetError().c_str());
+			return false;
+		}
+
+		int32 numModels = 0;
+		for (int32 e = 0; e < (int32)map.Entities.size(); e++) {
+			numModels += e == 0 || map.Entities[e].NumBrushes ? 1 : 0;
+		}
+		const int32 bspModels = (int32)bsp.GetChunkData<GFX_Model>(GBSP_CHUNK_MODELS).size();
+		if (numModels != bspModels) {
+			printf("Error: %s has %d model(s) and the .bsp %d, compile it again instead\n", mapPath.c_str(), numModels, bspModels);
+			return false;
+		}
+
+		std::string entData = MapEntityData(map);
+		bsp.SetChunkData(GBSP_CHUNK_ENTDATA, entData.c_str(), (int32)entData.size() + 1);
+		printf("Updated %d entities\n", (int32)map.Entities.size());
+		return true;
+	}
+
+	//========================================================================================
+	//	UpdateEntitiesFile()
+	//	Replaces the entities of the .bsp at bspPath with the ones of the .map at mapPath,
+	//	writing back only that chunk when it can
+	//========================================================================================
+	inline bool UpdateEntitiesFile(const std::string& mapPath, const std::string& bspPath, int numThreads) {
+		BspFile bsp;
+		if (!bsp.Open(bspPath)) {
+			printf("Error: %s\n", bsp.GetError().c_str());
+			return false;
+		}
+		if (!UpdateEntities(mapPath, bsp, numThreads)) {
+			return false;
+		}
+		if (!bsp.Update()) {
+			printf("Error: %s\n", bsp.GetError().c_str());
+			return false;
+		}
+		return true;
+	}
+};
+
+#endif // GBSPTOOLS_ENTUPDATE_H
@@ -22,11 +22,13 @@
 #ifndef GBSPLIB_H
 #define GBSPLIB_H
 
-#include <Windows.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
-#include "MathLib.h"
+#include "mathlib.h"
 
-#include "Vec3d.h"
+#include "vec3d.h"
 
 #define GBSP_VERSION_MAJOR	6
 #define GBSP_VERSION_MINOR	0
@@ -36,8 +38,13 @@
 //====================================================================================
 //	Main driver interfaces
 //====================================================================================
+#ifdef _WIN32
 #define DllImport	extern "C" __declspec( dllimport )
 #define DllExport	extern "C" __declspec( dllexport )
+#else
+#define DllImport	extern "C"
+#define DllExport	extern "C" __attribute__((visibility("default")))
+#endif
 
 typedef void ERROR_CB(char *String, ...);
 typedef void PRINTF_CB(char *String, ...);
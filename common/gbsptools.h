@@ -9,7 +9,14 @@
 #ifndef GBSPTOOLS_H
 #define GBSPTOOLS_H
 
+#include <stdarg.h>
 #include <stdio.h>
+#include <string>
+#include <vector>
+#include "platform.h"
+#include "gbsplib.h"
+#include "asynclog.h"
+#include "progress.h"
 
 #define GBSPTOOLS_VERSION 0.91
 #define GBSPTOOLS_AUTHOR "rtxa"
@@ -24,51 +31,209 @@ typedef enum {
 	COMPILER_ERROR_BSPFAIL,			// unable to compile the BSP
 	COMPILER_ERROR_BSPSAVE,			// unable to save the compiled BSP
 	// Errors returned by ParseCmdArgs
-	COMPILER_ERROR_BADARG
+	COMPILER_ERROR_BADARG,
+	// Stages stopped before the end
+	COMPILER_ERROR_CANCEL,			// interrupted with Ctrl+C
+	COMPILER_ERROR_TIMEOUT			// ran out of its time budget
 } CompilerErrorEnum;
 
-static void Compiler_PrintfCallback(char *format, ...) {
+// Receives what the library prints as progress events, when set
+static GBSPTools::ProgressReporter* Compiler_Progress = nullptr;
+
+// The tools know where the stages begin and end, the library output doesn't say
+static inline void Compiler_BeginStage(const char* stage) {
+	if (Compiler_Progress != nullptr) {
+		Compiler_Progress->BeginStage(stage);
+	}
+}
+
+static inline void Compiler_EndStage(int result) {
+	if (Compiler_Progress != nullptr) {
+		Compiler_Progress->EndStage(result);
+	}
+}
+
+// Buffers what the library prints and writes it from a background thread, when set
+static GBSPTools::AsyncLog* Compiler_Log = nullptr;
+
+// Has to be called before the tools print anything themselves after a library call
+static inline void Compiler_FlushLog() {
+	if (Compiler_Log != nullptr) {
+		Compiler_Log->Flush();
+	}
+}
+
+// Formats into stackText, or on the heap when the text doesn't fit there, and returns
+// the one used with length set to the size of the text
+static inline const char* Compiler_FormatText(char* stackText, size_t stackSize, std::vector<char>& heapText, int& length, const char* format, va_list argptr) {
+	va_list copy;
+	va_copy(copy, argptr);
+	length = vsnprintf(stackText, stackSize, format, argptr);
+	if (length < 0) {
+		stackText[0] = '\0';
+		length = 0;
+	}
+	else if (length >= (int)stackSize) {
+		heapText.resize((size_t)length + 1);
+		vsnprintf(heapText.data(), heapText.size(), format, copy);
+		va_end(copy);
+		return heapText.data();
+	}
+	va_end(copy);
+	return stackText;
+}
+
+static inline void Compiler_PrintfCallback(char *format, ...) {
 	va_list argptr;
 	va_start(argptr, format);
-	vprintf_s(format, argptr);
+	if (Compiler_Progress == nullptr && Compiler_Log == nullptr) {
+		vprintf(format, argptr);
+		va_end(argptr);
+		return;
+	}
+
+	// formatted once for both, on the stack unless it's a long one
+	char stackText[ASYNCLOG_MAX_MESSAGE];
+	std::vector<char> heapText;
+	int length;
+	const char* text = Compiler_FormatText(stackText, sizeof(stackText), heapText, length, format, argptr);
 	va_end(argptr);
+	if (Compiler_Progress != nullptr) {
+		Compiler_Progress->Feed(text);
+	}
+	if (Compiler_Log != nullptr) {
+		Compiler_Log->Write(text, (size_t)length, false);
+	}
+	else {
+		fputs(text, stdout);
+	}
 }
 
-static void Compiler_ErrorfCallback(char *format, ...) {
+// errors are never dropped, and are on the console before the library goes on
+static inline void Compiler_ErrorfCallback(char *format, ...) {
 	va_list argptr;
 	va_start(argptr, format);
-	vfprintf_s(stdout, format, argptr);
-	va_end(argptr);	
+	if (Compiler_Progress == nullptr && Compiler_Log == nullptr) {
+		vfprintf(stdout, format, argptr);
+		va_end(argptr);
+		return;
+	}
+
+	char stackText[ASYNCLOG_MAX_MESSAGE];
+	std::vector<char> heapText;
+	int length;
+	const char* text = Compiler_FormatText(stackText, sizeof(stackText), heapText, length, format, argptr);
+	va_end(argptr);
+	if (Compiler_Progress != nullptr) {
+		Compiler_Progress->Error(text);
+	}
+	if (Compiler_Log != nullptr) {
+		Compiler_Log->Write(text, (size_t)length, true);
+		Compiler_Log->Flush();
+	}
+	else {
+		fputs(text, stdout);
+	}
+}
+
+//========================================================================================
+//	Compiler_GetLibrarySearchPaths()
+//	Builds the list of places where the compiler library is looked for, in order:
+//	the -lib option, the GBSPLIB_PATH environment variable and the system search
+//	Each entry can be the library itself or a directory containing it
+//========================================================================================
+std::vector<std::string> Compiler_GetLibrarySearchPaths(const char* libPath) {
+	std::vector<std::string> entries;
+	std::vector<std::string> paths;
+
+	if (libPath != nullptr && libPath[0]) {
+		entries.push_back(libPath);
+	}
+
+	const char* envPath = getenv("GBSPLIB_PATH");
+	if (envPath != nullptr) {
+#ifdef _WIN32
+		const char listSeparator = ';';
+#else
+		const char listSeparator = ':';
+#endif
+		std::string list(envPath);
+		std::string::size_type start = 0;
+		while (start <= list.size()) {
+			std::string::size_type end = list.find(listSeparator, start);
+			if (end == std::string::npos) {
+				end = list.size();
+			}
+			if (end > start) {
+				entries.push_back(list.substr(start, end - start));
+			}
+			start = end + 1;
+		}
+	}
+
+	for (const std::string& entry : entries) {
+		paths.push_back(entry);
+		std::string dirPath(entry);
+		if (dirPath.back() != '/' && dirPath.back() != '\\') {
+			dirPath.push_back('/');
+		}
+		paths.push_back(dirPath + COMPILER_LIB_NAME);
+	}
+
+#ifndef _WIN32
+	// dlopen() doesn't look into the working directory like LoadLibrary() does
+	paths.push_back(std::string("./") + COMPILER_LIB_NAME);
+#endif
+	paths.push_back(COMPILER_LIB_NAME);
+
+	return paths;
 }
 
-CompilerErrorEnum Compiler_LoadCompilerDLL(GBSP_FuncHook* &pFHook, HINSTANCE& pHandle, ERROR_CB ErrorCallbackFcn, PRINTF_CB PrintfCallbackFcn) {
-	// load compiler dll
-	GBSP_Hook compHook;
+//========================================================================================
+//	Compiler_LoadCompilerLib()
+//	Loads the compiler library (gbsplib.dll or libgbsplib.so) and gets its function hooks
+//========================================================================================
+CompilerErrorEnum Compiler_LoadCompilerLib(GBSP_FuncHook* &pFHook, CompilerLibHandle& pHandle, ERROR_CB ErrorCallbackFcn, PRINTF_CB PrintfCallbackFcn, const char* libPath = nullptr) {
+	// the library keeps a pointer to the hook, it must outlive this call
+	static GBSP_Hook compHook;
 
 	compHook.Error = ErrorCallbackFcn;
 	compHook.Printf = PrintfCallbackFcn;
 
-	pHandle = LoadLibrary("gbsplib.dll");
+	pHandle = nullptr;
+	std::string loadError;
+	for (const std::string& path : Compiler_GetLibrarySearchPaths(libPath)) {
+		pHandle = GBSPTools::OpenLibrary(path);
+		if (pHandle != nullptr) {
+			break;
+		}
+		loadError = GBSPTools::GetLibraryError();
+	}
+
 	if (pHandle == nullptr) {
-		fprintf(stdout, "Compile Failed: Unable to load GBSPLib.Dll!\n");
+		fprintf(stdout, "Compile Failed: Unable to load %s! (%s)\n", COMPILER_LIB_NAME, loadError.c_str());
 		return COMPILER_ERROR_NODLL;
 	}
 
-	GBSP_INIT* pCompInit = (GBSP_INIT*)GetProcAddress(pHandle, "GBSP_Init");
+	GBSP_INIT* pCompInit = (GBSP_INIT*)GBSPTools::GetLibrarySymbol(pHandle, "GBSP_Init");
 	if (pCompInit == nullptr) {
-		fprintf(stdout, "Compile Failed: Couldn't initialize GBSP_Init, GBSPLib.Dll.\n");
-		FreeLibrary(pHandle);
+		fprintf(stdout, "Compile Failed: Couldn't initialize GBSP_Init, %s.\n", COMPILER_LIB_NAME);
+		GBSPTools::CloseLibrary(pHandle);
 		return COMPILER_ERROR_MISSINGFUNC;
 	}
 
 	pFHook = pCompInit(&compHook);
 	if (pFHook == nullptr) {
-		fprintf(stdout, "Compile Failed: GBSP_Init returned NULL Hook!, GBSPLib.Dll.\n");
-		FreeLibrary(pHandle);
+		fprintf(stdout, "Compile Failed: GBSP_Init returned NULL Hook!, %s.\n", COMPILER_LIB_NAME);
+		GBSPTools::CloseLibrary(pHandle);
 		return COMPILER_ERROR_MISSINGFUNC;
 	}
 
 	return COMPILER_ERROR_NONE;
 }
 
+void Compiler_FreeCompilerLib(CompilerLibHandle handle) {
+	GBSPTools::CloseLibrary(handle);
+}
+
 #endif // GBSPTOOLS_H
\ No newline at end of file
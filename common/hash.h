@@ -0,0 +1,91 @@
+/****************************************************************************************/
+/*  hash.h
+/*
+/*  Author: rtxa
+/*  Description: Fast non cryptographic hashing, to tell data apart between runs
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_HASH_H
+#define GBSPTOOLS_HASH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "mappedfile.h"
+
+namespace GBSPTools {
+	// splitmix64 finalizer, spreads every input bit over the whole hash
+	inline uint64_t HashMix(uint64_t x) {
+		x ^= x >> 30;
+		x *= 0xbf58476d1ce4e5b9ull;
+		x ^= x >> 27;
+		x *= 0x94d049bb133111ebull;
+		x ^= x >> 31;
+		return x;
+	}
+
+	//========================================================================================
+	//	ContentHash
+	//	128 bit hash of everything added to it, as two independent 64 bit lanes fed a
+	//	word at a time. Good enough to name files by their contents, not against tampering.
+	//========================================================================================
+	class ContentHash {
+	public:
+		void Add(const void* data, size_t size) {
+			const uint8* bytes = (const uint8*)data;
+			length += size;
+			for (; size >= 8; bytes += 8, size -= 8) {
+				uint64_t word;
+				memcpy(&word, bytes, 8);
+				AddWord(word);
+			}
+			if (size) {
+				uint64_t word = 0;
+				memcpy(&word, bytes, size);
+				AddWord(word ^ ((uint64_t)size << 56));
+			}
+		}
+
+		template <typename T>
+		void AddValue(const T& value) {
+			Add(&value, sizeof(T));
+		}
+
+		// the terminator keeps "ab" + "c" apart from "a" + "bc"
+		void AddString(const std::string& text) {
+			Add(text.c_str(), text.size() + 1);
+		}
+
+		// false when the file can't be read
+		bool AddFile(const std::string& path) {
+			MappedFile file;
+			if (!file.Open(path)) {
+				return false;
+			}
+			AddValue((uint64_t)file.GetSize());
+			Add(file.GetData(), file.GetSize());
+			return true;
+		}
+
+		// 32 hex digits
+		std::string ToString() const {
+			char text[33];
+			snprintf(text, sizeof(text), "%016llx%016llx", (unsigned long long)HashMix(a ^ length), (unsigned long long)HashMix(b + length));
+			return std::string(text);
+		}
+
+	private:
+		uint64_t a = 0x243f6a8885a308d3ull;
+		uint64_t b = 0x13198a2e03707344ull;
+		uint64_t length = 0;
+
+		void AddWord(uint64_t word) {
+			a = HashMix(a ^ word);
+			b = HashMix(b + word * 0x9e3779b97f4a7c15ull);
+		}
+	};
+};
+
+#endif // GBSPTOOLS_HASH_H
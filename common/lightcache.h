@@ -0,0 +1,165 @@
+/****************************************************************************************/
+/*  lightcache.h
+/*
+/*  Author: rtxa
+/*  Description: The lights a .bsp was lit with, kept next to it between runs
+/*
+/*	A face's lighting only depends on the geometry, the light settings and the lights
+/*	that can reach it. The cache keeps a hash of the first two, a hash of the lighting
+/*	chunks the run wrote and every light it used, so after an entity update the next
+/*	run knows which faces still see the very same lights and can keep their lighting
+/*	from the .bsp as it is.
+/*
+/*	File layout: LightCacheHeader, then NumLights LightSource.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_LIGHTCACHE_H
+#define GBSPTOOLS_LIGHTCACHE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "basetype.h"
+#include "mappedfile.h"
+#include "utils.h"
+#include "vec3d.h"
+
+#define LIGHTCACHE_TAG			"GLCH"
+#define LIGHTCACHE_VERSION		1
+#define LIGHTCACHE_EXTENSION	".lightcache"
+#define LIGHTCACHE_HASH_SIZE	32			// hex digits of a ContentHash
+
+namespace GBSPTools {
+	enum LightType {
+		LIGHT_POINT,
+		LIGHT_SPOT,
+		LIGHT_SURFACE
+	};
+
+	typedef struct {
+		LightType	Type;
+		geVec3d		Origin;
+		geVec3d		Color;					// 0-1 per channel
+		geFloat		Intensity;
+		geVec3d		Normal;					// spot direction or emitting face normal
+		geFloat		Cone;					// cos of half the spot arc
+		geFloat		Area;					// surface area the sample stands for
+		int32		Style;
+		int32		Face;					// emitting face, -1 for entities
+	} LightSource;
+
+	typedef struct {
+		char		Tag[4];
+		int32		Version;
+		char		Geometry[LIGHTCACHE_HASH_SIZE];		// everything but the entities and the lighting, and the settings
+		char		Lighting[LIGHTCACHE_HASH_SIZE];		// faces, lightdata and rgb verts chunks as written
+		int32		NumLights;
+	} LightCacheHeader;
+
+	class LightCache {
+	public:
+		const std::string& GetError() const { return error; }
+		bool IsEmpty() const { return geometry.empty(); }
+		const std::string& GetGeometry() const { return geometry; }
+		const std::string& GetLighting() const { return lighting; }
+		const std::vector<LightSource>& GetLights() const { return lights; }
+
+		void Clear() {
+			geometry.clear();
+			lighting.clear();
+			lights.clear();
+		}
+
+		void Set(const std::string& geometryHash, const std::string& lightingHash, const std::vector<LightSource>& used) {
+			geometry = geometryHash;
+			lighting = lightingHash;
+			lights = used;
+		}
+
+		//========================================================================================
+		//	Load()
+		//	Replaces the contents with the cache at path. A missing file is an empty cache.
+		//========================================================================================
+		bool Load(const std::string& path) {
+			Clear();
+			MappedFile file;
+			if (!file.Open(path)) {
+				return true;
+			}
+
+			const uint8* data = file.GetData();
+			const size_t size = file.GetSize();
+			LightCacheHeader header;
+			if (size < sizeof(header)) {
+				return Fail("truncated header in " + path);
+			}
+			memcpy(&header, data, sizeof(header));
+			if (memcmp(header.Tag, LIGHTCACHE_TAG, 4) != 0 || header.Version != LIGHTCACHE_VERSION || header.NumLights < 0) {
+				return Fail(path + " is not a light cache of this version");
+			}
+			if ((size - sizeof(header)) / sizeof(LightSource) < (size_t)header.NumLights) {
+				return Fail("truncated lights in " + path);
+			}
+
+			lights.resize(header.NumLights);
+			memcpy(lights.data(), data + sizeof(header), header.NumLights * sizeof(LightSource));
+			geometry.assign(header.Geometry, LIGHTCACHE_HASH_SIZE);
+			lighting.assign(header.Lighting, LIGHTCACHE_HASH_SIZE);
+			return true;
+		}
+
+		//========================================================================================
+		//	Save()
+		//	Writes the cache to a temporary file that then replaces path, so an interrupted
+		//	run never leaves half a cache behind
+		//========================================================================================
+		bool Save(const std::string& path) {
+			if (geometry.size() != LIGHTCACHE_HASH_SIZE || lighting.size() != LIGHTCACHE_HASH_SIZE) {
+				error = "nothing to save to " + path;
+				return false;
+			}
+
+			const std::string tempPath = path + ".tmp";
+			FILE* fp = fopen(tempPath.c_str(), "wb");
+			if (fp == nullptr) {
+				error = "unable to write " + tempPath;
+				return false;
+			}
+
+			LightCacheHeader header;
+			memcpy(header.Tag, LIGHTCACHE_TAG, 4);
+			header.Version = LIGHTCACHE_VERSION;
+			memcpy(header.Geometry, geometry.data(), LIGHTCACHE_HASH_SIZE);
+			memcpy(header.Lighting, lighting.data(), LIGHTCACHE_HASH_SIZE);
+			header.NumLights = (int32)lights.size();
+			bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+			ok = ok && fwrite(lights.data(), sizeof(LightSource), lights.size(), fp) == lights.size();
+			ok = fclose(fp) == 0 && ok;
+
+			if (ok) {
+				ok = CommitFile(tempPath, path);
+			}
+			if (!ok) {
+				remove(tempPath.c_str());
+				error = "unable to write " + path;
+			}
+			return ok;
+		}
+
+	private:
+		std::string geometry;
+		std::string lighting;
+		std::vector<LightSource> lights;
+		std::string error;
+
+		bool Fail(const std::string& message) {
+			Clear();
+			error = message;
+			return false;
+		}
+	};
+};
+
+#endif // GBSPTOOLS_LIGHTCACHE_H
@@ -0,0 +1,423 @@
+/****************************************************************************************/
+/*  mapfile.h
+/*
+/*  Author: rtxa
+/*  Description: Native reader for the G3D binary .MAP file format
+/*
+/*	The file is memory mapped and decoded into a few flat arrays (entities, keys,
+/*	brushes, faces, points and textures) that index into each other, so loading a map
+/*	costs a handful of allocations no matter how big it is. Strings point back into
+/*	the mapping. Brushes are independent of each other, once a quick scan found
+/*	where each one starts they are decoded in parallel.
+/*
+/*	Layout (little endian):
+/*		int32	Version
+/*		char	Tag[5]					"GBSP\0"
+/*		int32	NumEntities
+/*		Entity	Entities[NumEntities]
+/*
+/*	Entity:
+/*		int32	NumBrushes
+/*		Brush	Brushes[NumBrushes]
+/*		int32	NumKeys
+/*		{ int32 Length; char Text[Length]; } Key, Value	(x NumKeys)
+/*
+/*	Brush:
+/*		int32	NumFaces
+/*		uint32	Contents
+/*		Face	Faces[NumFaces]
+/*
+/*	Face:
+/*		int32	NumPoints
+/*		uint32	Flags
+/*		float	LightIntensity, MipMapBias, Translucency, Reflectivity
+/*		geVec3d	Points[NumPoints]
+/*		char	TexName[32]
+/*		geVec3d	TexVecs[2]
+/*		float	TexShift[2]
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_MAPFILE_H
+#define GBSPTOOLS_MAPFILE_H
+
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "basetype.h"
+#include "vec3d.h"
+#include "mappedfile.h"
+#include "threads.h"
+
+#define MAP_TAG				"GBSP"
+#define MAP_TEXNAME_SIZE	32
+#define MAP_MAX_FACE_POINTS	64
+
+namespace GBSPTools {
+	// Text stored inside the mapped file
+	typedef struct {
+		size_t		Offset;
+		uint32		Length;
+	} MapString;
+
+	typedef struct {
+		MapString	Key;
+		MapString	Value;
+	} MapKey;
+
+	typedef struct {
+		int32		FirstBrush;
+		int32		NumBrushes;
+		int32		FirstKey;
+		int32		NumKeys;
+	} MapEntity;
+
+	typedef struct {
+		int32		FirstFace;
+		int32		NumFaces;
+		uint32		Contents;
+		int32		Entity;
+	} MapBrush;
+
+	typedef struct {
+		int32		FirstPoint;
+		int32		NumPoints;
+		uint32		Flags;
+		geFloat		LightIntensity;
+		geFloat		MipMapBias;
+		geFloat		Translucency;
+		geFloat		Reflectivity;
+		geVec3d		TexVecs[2];
+		geFloat		TexShift[2];
+		int32		Texture;			// index into MapFile::Textures
+	} MapFace;
+
+	typedef struct {
+		MapString	Name;
+	} MapTexture;
+
+	//========================================================================================
+	//	MapReader
+	//	Bounds checked cursor over the mapped bytes, reads never fault on a truncated file,
+	//	they flag the reader as failed instead
+	//========================================================================================
+	class MapReader {
+	public:
+		MapReader(const uint8* data, size_t size, size_t pos = 0) : data(data), size(size), pos(pos) {}
+
+		int32 ReadInt32() {
+			int32 value = 0;
+			Read(&value, sizeof(value));
+			return value;
+		}
+
+		geFloat ReadFloat() {
+			geFloat value = 0.0f;
+			Read(&value, sizeof(value));
+			return value;
+		}
+
+		void ReadVec3d(geVec3d* v) {
+			Read(v, sizeof(geVec3d));
+		}
+
+		bool Skip(size_t bytes) {
+			if (!ok || bytes > size - pos) {
+				ok = false;
+				return false;
+			}
+			pos += bytes;
+			return true;
+		}
+
+		bool Read(void* dest, size_t bytes) {
+			if (!ok || bytes > size - pos) {
+				ok = false;
+				return false;
+			}
+			memcpy(dest, data + pos, bytes);
+			pos += bytes;
+			return true;
+		}
+
+		size_t GetPos() const { return pos; }
+		size_t GetRemaining() const { return size - pos; }
+		bool IsOk() const { return ok; }
+
+	private:
+		const uint8* data;
+		size_t size;
+		size_t pos;
+		bool ok = true;
+	};
+
+	class MapFile {
+	public:
+		// Flags + 4 floats + texture name + texture vectors + shift, the points come apart
+		static const size_t FaceFixedSize = sizeof(uint32) + 4 * sizeof(geFloat) + MAP_TEXNAME_SIZE + 2 * sizeof(geVec3d) + 2 * sizeof(geFloat);
+
+		int32						Version = 0;
+		std::vector<MapEntity>		Entities;
+		std::vector<MapKey>			Keys;
+		std::vector<MapBrush>		Brushes;
+		std::vector<MapFace>		Faces;
+		std::vector<geVec3d>		Points;
+		std::vector<MapTexture>		Textures;
+
+		//========================================================================================
+		//	Load()
+		//	Maps and decodes the whole file, numThreads <= 0 uses every core
+		//========================================================================================
+		bool Load(const std::string& path, int numThreads = 0) {
+			Clear();
+
+			if (!file.Open(path)) {
+				error = "unable to open " + path;
+				return false;
+			}
+
+			MapReader reader(file.GetData(), file.GetSize());
+			char tag[5];
+			Version = reader.ReadInt32();
+			reader.Read(tag, sizeof(tag));
+			if (!reader.IsOk() || memcmp(tag, MAP_TAG, sizeof(tag)) != 0) {
+				error = path + " is not a G3D binary .map file";
+				return false;
+			}
+
+			std::vector<BrushBlock> blocks;
+			if (!ScanEntities(reader, blocks)) {
+				return false;
+			}
+
+			// every array gets its final size up front, decoding only fills them in
+			Brushes.resize(blocks.size());
+			Faces.resize(numScannedFaces);
+			Points.resize(numScannedPoints);
+			textureNames.resize(numScannedFaces);
+
+			ParallelFor((int)blocks.size(), numThreads, [&](int i) {
+				DecodeBrush(blocks[i], &Brushes[i]);
+			});
+
+			IndexTextures();
+			return true;
+		}
+
+		void Clear() {
+			Version = 0;
+			Entities.clear();
+			Keys.clear();
+			Brushes.clear();
+			Faces.clear();
+			Points.clear();
+			Textures.clear();
+			numScannedFaces = 0;
+			numScannedPoints = 0;
+			error.clear();
+			file.Close();
+		}
+
+		const std::string& GetError() const { return error; }
+
+		const char* GetStringData(const MapString& str) const {
+			return (const char*)file.GetData() + str.Offset;
+		}
+
+		std::string GetString(const MapString& str) const {
+			return std::string(GetStringData(str), str.Length);
+		}
+
+		bool StringEquals(const MapString& str, const char* text) const {
+			size_t length = strlen(text);
+			return length == str.Length && !memcmp(GetStringData(str), text, length);
+		}
+
+		// Value of key in entity, or an empty string if the entity doesn't have it
+		std::string ValueForKey(int32 entity, const char* key) const {
+			const MapEntity& ent = Entities[entity];
+			for (int32 i = ent.FirstKey; i < ent.FirstKey + ent.NumKeys; i++) {
+				if (StringEquals(Keys[i].Key, key)) {
+					return GetString(Keys[i].Value);
+				}
+			}
+			return std::string();
+		}
+
+		// Size of the mapped file in bytes
+		size_t GetFileSize() const { return file.GetSize(); }
+
+	private:
+		// Where a brush lives in the file and where its decoded data goes
+		typedef struct {
+			size_t		Offset;
+			int32		Entity;
+			int32		FirstFace;
+			int32		FirstPoint;
+		} BrushBlock;
+
+		MappedFile file;
+		std::string error;
+		int32 numScannedFaces = 0;
+		int32 numScannedPoints = 0;
+		std::vector<size_t> textureNames;		// file offset of the texture name of each face, until indexed
+
+		//========================================================================================
+		//	ScanEntities()
+		//	Walks the file once reading only the counts, to find where every brush starts
+		//	and how many faces and points precede it. Keys are small, they are read here.
+		//========================================================================================
+		bool ScanEntities(MapReader& reader, std::vector<BrushBlock>& blocks) {
+			int32 numEntities = reader.ReadInt32();
+			if (!reader.IsOk() || numEntities < 0 || (size_t)numEntities > reader.GetRemaining() / (2 * sizeof(int32))) {
+				error = "bad entity count";
+				return false;
+			}
+			Entities.resize(numEntities);
+
+			for (int32 e = 0; e < numEntities; e++) {
+				MapEntity& ent = Entities[e];
+				ent.FirstBrush = (int32)blocks.size();
+				ent.NumBrushes = reader.ReadInt32();
+				if (!reader.IsOk() || ent.NumBrushes < 0 || (size_t)ent.NumBrushes > reader.GetRemaining() / (2 * sizeof(int32))) {
+					error = "bad brush count in entity " + std::to_string(e);
+					return false;
+				}
+
+				for (int32 b = 0; b < ent.NumBrushes; b++) {
+					BrushBlock block;
+					block.Offset = reader.GetPos();
+					block.Entity = e;
+					block.FirstFace = numScannedFaces;
+					block.FirstPoint = numScannedPoints;
+
+					int32 numFaces = reader.ReadInt32();
+					reader.Skip(sizeof(uint32));
+					if (!reader.IsOk() || numFaces < 0 || (size_t)numFaces > reader.GetRemaining() / (sizeof(int32) + FaceFixedSize)) {
+						error = "bad face count in brush " + std::to_string(blocks.size());
+						return false;
+					}
+
+					for (int32 f = 0; f < numFaces; f++) {
+						int32 numPoints = reader.ReadInt32();
+						if (!reader.IsOk() || numPoints < 0 || numPoints > MAP_MAX_FACE_POINTS) {
+							error = "bad point count in brush " + std::to_string(blocks.size());
+							return false;
+						}
+						if (!reader.Skip(FaceFixedSize + numPoints * sizeof(geVec3d))) {
+							error = "unexpected end of file";
+							return false;
+						}
+						numScannedPoints += numPoints;
+					}
+
+					numScannedFaces += numFaces;
+					blocks.push_back(block);
+				}
+
+				ent.FirstKey = (int32)Keys.size();
+				ent.NumKeys = reader.ReadInt32();
+				if (!reader.IsOk() || ent.NumKeys < 0 || (size_t)ent.NumKeys > reader.GetRemaining() / (2 * sizeof(int32))) {
+					error = "bad key count in entity " + std::to_string(e);
+					return false;
+				}
+
+				for (int32 k = 0; k < ent.NumKeys; k++) {
+					MapKey key;
+					if (!ReadString(reader, &key.Key) || !ReadString(reader, &key.Value)) {
+						error = "bad key in entity " + std::to_string(e);
+						return false;
+					}
+					Keys.push_back(key);
+				}
+			}
+
+			return true;
+		}
+
+		bool ReadString(MapReader& reader, MapString* str) {
+			int32 length = reader.ReadInt32();
+			if (!reader.IsOk() || length < 0) {
+				return false;
+			}
+			str->Offset = reader.GetPos();
+			if (!reader.Skip(length)) {
+				return false;
+			}
+			// the stored length may include the terminator
+			const char* text = (const char*)file.GetData() + str->Offset;
+			str->Length = (uint32)strnlen(text, length);
+			return true;
+		}
+
+		//========================================================================================
+		//	DecodeBrush()
+		//	Decodes one brush into its preassigned slots, safe to run concurrently since
+		//	the scan already validated the block and each block writes its own ranges
+		//========================================================================================
+		void DecodeBrush(const BrushBlock& block, MapBrush* brush) {
+			MapReader reader(file.GetData(), file.GetSize(), block.Offset);
+
+			brush->FirstFace = block.FirstFace;
+			brush->NumFaces = reader.ReadInt32();
+			brush->Contents = (uint32)reader.ReadInt32();
+			brush->Entity = block.Entity;
+
+			int32 firstPoint = block.FirstPoint;
+			for (int32 f = 0; f < brush->NumFaces; f++) {
+				MapFace& face = Faces[block.FirstFace + f];
+				face.FirstPoint = firstPoint;
+				face.NumPoints = reader.ReadInt32();
+				face.Flags = (uint32)reader.ReadInt32();
+				face.LightIntensity = reader.ReadFloat();
+				face.MipMapBias = reader.ReadFloat();
+				face.Translucency = reader.ReadFloat();
+				face.Reflectivity = reader.ReadFloat();
+				reader.Read(&Points[firstPoint], face.NumPoints * sizeof(geVec3d));
+
+				// texture names are resolved to indices once every brush is decoded
+				textureNames[block.FirstFace + f] = reader.GetPos();
+				reader.Skip(MAP_TEXNAME_SIZE);
+
+				reader.ReadVec3d(&face.TexVecs[0]);
+				reader.ReadVec3d(&face.TexVecs[1]);
+				face.TexShift[0] = reader.ReadFloat();
+				face.TexShift[1] = reader.ReadFloat();
+
+				firstPoint += face.NumPoints;
+			}
+		}
+
+		//========================================================================================
+		//	IndexTextures()
+		//	Turns the texture name offsets left by DecodeBrush() into indices into Textures
+		//========================================================================================
+		void IndexTextures() {
+			std::unordered_map<std::string, int32> indices;
+			std::string nameBuffer;
+			nameBuffer.reserve(MAP_TEXNAME_SIZE);
+
+			for (size_t i = 0; i < Faces.size(); i++) {
+				MapFace& face = Faces[i];
+				MapString name;
+				name.Offset = textureNames[i];
+				name.Length = (uint32)strnlen(GetStringData(name), MAP_TEXNAME_SIZE);
+				nameBuffer.assign(GetStringData(name), name.Length);
+
+				auto it = indices.find(nameBuffer);
+				if (it == indices.end()) {
+					MapTexture texture;
+					texture.Name = name;
+					it = indices.emplace(nameBuffer, (int32)Textures.size()).first;
+					Textures.push_back(texture);
+				}
+				face.Texture = it->second;
+			}
+			textureNames.clear();
+			textureNames.shrink_to_fit();
+		}
+	};
+};
+
+#endif // GBSPTOOLS_MAPFILE_H
@@ -0,0 +1,122 @@
+/****************************************************************************************/
+/*  mappedfile.h
+/*
+/*  Author: rtxa
+/*  Description: Read only memory mapping of a whole file
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_MAPPEDFILE_H
+#define GBSPTOOLS_MAPPEDFILE_H
+
+#include <string>
+#include "platform.h"
+#include "basetype.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace GBSPTools {
+	class MappedFile {
+	public:
+		MappedFile() {}
+		~MappedFile() { Close(); }
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		bool Open(const std::string& path) {
+			Close();
+#ifdef _WIN32
+			// others may write while mapped, BspFile updates chunks in place that way
+			file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (file == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize)) {
+				Close();
+				return false;
+			}
+			size = (size_t)fileSize.QuadPart;
+			if (size == 0) {
+				return true;
+			}
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping == NULL) {
+				Close();
+				return false;
+			}
+			data = (const uint8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+			fd = open(path.c_str(), O_RDONLY);
+			if (fd < 0) {
+				return false;
+			}
+			struct stat st;
+			if (fstat(fd, &st) != 0) {
+				Close();
+				return false;
+			}
+			size = (size_t)st.st_size;
+			if (size == 0) {
+				return true;
+			}
+			void* view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			data = (view == MAP_FAILED) ? nullptr : (const uint8*)view;
+			if (data != nullptr) {
+				madvise(view, size, MADV_WILLNEED);
+			}
+#endif
+			if (data == nullptr) {
+				Close();
+				return false;
+			}
+			return true;
+		}
+
+		void Close() {
+#ifdef _WIN32
+			if (data != nullptr) {
+				UnmapViewOfFile(data);
+			}
+			if (mapping != NULL) {
+				CloseHandle(mapping);
+			}
+			if (file != INVALID_HANDLE_VALUE) {
+				CloseHandle(file);
+			}
+			mapping = NULL;
+			file = INVALID_HANDLE_VALUE;
+#else
+			if (data != nullptr) {
+				munmap((void*)data, size);
+			}
+			if (fd >= 0) {
+				close(fd);
+			}
+			fd = -1;
+#endif
+			data = nullptr;
+			size = 0;
+		}
+
+		const uint8* GetData() const { return data; }
+		size_t GetSize() const { return size; }
+
+	private:
+		const uint8* data = nullptr;
+		size_t size = 0;
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = NULL;
+#else
+		int fd = -1;
+#endif
+	};
+};
+
+#endif // GBSPTOOLS_MAPPEDFILE_H
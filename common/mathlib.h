@@ -22,7 +22,7 @@
 #ifndef MATHLIB_H
 #define MATHLIB_H
 
-#include "Vec3d.h"
+#include "vec3d.h"
 
 //#define	ON_EPSILON			(geFloat)0.05
 #define		ON_EPSILON			(geFloat)0.1
@@ -53,4 +53,96 @@ geFloat		ColorClamp(geVec3d *C1, geFloat Clamp, geVec3d *C2);
 
 int32		geVec3d_PlaneType(geVec3d *V1);
 
+//========================================================================================
+//	Defined here for the same reason as the geVec3d_ functions in vec3d.h
+//========================================================================================
+geVec3d		VecOrigin = { 0.0f, 0.0f, 0.0f };
+
+void ClearBounds(geVec3d *Mins, geVec3d *Maxs)
+{
+	geVec3d_Set(Mins, MIN_MAX_BOUNDS, MIN_MAX_BOUNDS, MIN_MAX_BOUNDS);
+	geVec3d_Set(Maxs, -MIN_MAX_BOUNDS, -MIN_MAX_BOUNDS, -MIN_MAX_BOUNDS);
+}
+
+void AddPointToBounds(geVec3d *v, geVec3d *Mins, geVec3d *Maxs)
+{
+	int32		i;
+	geFloat		Val;
+
+	for (i = 0; i < 3; i++)
+	{
+		Val = VectorToSUB(*v, i);
+
+		if (Val < VectorToSUB(*Mins, i))
+			VectorToSUB(*Mins, i) = Val;
+		if (Val > VectorToSUB(*Maxs, i))
+			VectorToSUB(*Maxs, i) = Val;
+	}
+}
+
+// C2 is C1 scaled so its largest channel is 1, returns that channel (C1 as is when it's 0)
+geFloat ColorNormalize(geVec3d *C1, geVec3d *C2)
+{
+	geFloat		Max;
+
+	Max = C1->X;
+	if (C1->Y > Max)
+		Max = C1->Y;
+	if (C1->Z > Max)
+		Max = C1->Z;
+
+	if (Max == 0.0f)
+	{
+		*C2 = *C1;
+		return 0.0f;
+	}
+
+	geVec3d_Scale(C1, 1.0f / Max, C2);
+
+	return Max;
+}
+
+// C2 is C1 with negative channels at 0 and, when the largest goes over Clamp, scaled
+// down so it's Clamp and the hue stays. Returns the largest channel before clamping.
+geFloat ColorClamp(geVec3d *C1, geFloat Clamp, geVec3d *C2)
+{
+	geVec3d		C3;
+	geFloat		Max;
+
+	C3.X = C1->X > 0.0f ? C1->X : 0.0f;
+	C3.Y = C1->Y > 0.0f ? C1->Y : 0.0f;
+	C3.Z = C1->Z > 0.0f ? C1->Z : 0.0f;
+
+	Max = C3.X > C3.Y ? C3.X : C3.Y;
+	Max = Max > C3.Z ? Max : C3.Z;
+
+	geVec3d_Scale(&C3, Max > Clamp ? Clamp / Max : 1.0f, C2);
+
+	return Max;
+}
+
+// PLANE_X, _Y or _Z for an axial normal, else the PLANE_ANY of the axis it's closest to
+int32 geVec3d_PlaneType(geVec3d *V1)
+{
+	geFloat		X, Y, Z;
+
+	X = fabsf(V1->X);
+	Y = fabsf(V1->Y);
+	Z = fabsf(V1->Z);
+
+	if (X == 1.0f)
+		return PLANE_X;
+	else if (Y == 1.0f)
+		return PLANE_Y;
+	else if (Z == 1.0f)
+		return PLANE_Z;
+
+	if (X >= Y && X >= Z)
+		return PLANE_ANYX;
+	if (Y >= X && Y >= Z)
+		return PLANE_ANYY;
+
+	return PLANE_ANYZ;
+}
+
 #endif
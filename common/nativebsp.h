@@ -0,0 +1,1401 @@
+/****************************************************************************************/
+/*  nativebsp.h
+/*
+/*  Author: rtxa
+/*  Description: Native BSP compiler, builds the node trees of the world and the brush
+/*  entities from the .MAP brushes and writes the chunks the later stages read
+/*
+/*	Every brush becomes a convex polyhedron cut out of its face planes, then the brushes
+/*	are carved against each other (CSG) so no two of them overlap: where they do, the one
+/*	with the stronger contents keeps the space, the later one on a tie. Each brush only
+/*	depends on the original ones, so they are carved in parallel.
+/*
+/*	The tree splits the brushes by one of their own faces at a time, picked with the
+/*	usual heuristics (faces others lie on, few brushes split, balanced sides, axial
+/*	planes), until every leaf is either completely inside a brush or out of all of
+/*	them. Detail brushes only split once the structural ones are done, and the leafs
+/*	below such a split share a cluster. Once a node holds enough brushes its front
+/*	subtree is built on another thread while the current one goes on with the back;
+/*	the tree is numbered afterwards, depth first, so the output doesn't depend on how
+/*	many threads built it.
+/*
+/*	The empty leafs reached from outside of the map are filled, unless an entity sits
+/*	in them (the map leaks), and the faces are the parts of the brush faces that face
+/*	an empty leaf. Lighting and visibility are left to glight and gvis.
+/*
+/*	Every entity with brushes gets a model of its own after the world, in entity order,
+/*	built the same way but with no portals: nothing is filled and its leafs have no
+/*	clusters.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_NATIVEBSP_H
+#define GBSPTOOLS_NATIVEBSP_H
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "arena.h"
+#include "bspfile.h"
+#include "cancel.h"
+#include "entupdate.h"
+#include "gbsplib.h"
+#include "hash.h"
+#include "mapfile.h"
+#include "planepool.h"
+#include "threads.h"
+#include "vecbatch.h"
+#include "winding.h"
+
+#define NATIVEBSP_PARALLEL_BRUSHES		128			// smallest node split up front to be built on the threads
+#define NATIVEBSP_SUBTREES_PER_THREAD	4			// subtrees handed out per thread
+#define NATIVEBSP_WORLD_MARGIN			16.0f		// space between the brushes and the outside
+#define NATIVEBSP_DIST_EPSILON			0.01f
+#define NATIVEBSP_MIN_VOLUME			1.0f		// smaller brush pieces are dropped
+#define NATIVEBSP_SIDE_OUTSIDE			-2			// TexInfo of the sides of the world box
+
+namespace GBSPTools {
+	typedef struct {
+		int32		Brushes;			// from the .map
+		int32		SkippedBrushes;		// hints and bad brushes
+		int32		Models;				// the world and the brush entities
+		int32		Fragments;			// left after CSG
+		int32		Planes;
+		int32		Nodes;
+		int32		Leafs;
+		int32		OutsideLeafs;		// filled
+		int32		Clusters;
+		int32		Portals;
+		int32		Faces;
+		int32		Verts;
+		int32		ParallelSubtrees;	// handed out to the threads
+		long long	ArenaPeak;			// bytes the brush sides took at most
+	} BspStats;
+
+	class NativeBsp {
+	public:
+		NativeBsp(const BspParms& parms, int numThreads) : parms(parms), numThreads(ResolveNumThreads(numThreads)) {
+			memset(&stats, 0, sizeof(stats));
+		}
+
+		const std::string& GetError() const { return error; }
+		const BspStats& GetStats() const { return stats; }
+		bool WasCanceled() const { return canceled; }
+
+		//========================================================================================
+		//	Compile()
+		//	Builds the world and the brush entities of map and writes their chunks into bsp
+		//========================================================================================
+		bool Compile(const MapFile& map, BspFile& bsp) {
+			ArenaScope scope(arena);
+			if (map.Entities.empty()) {
+				error = "the map has no entities";
+				return false;
+			}
+			stats.Brushes = (int32)map.Brushes.size();
+
+			for (int32 e = 0; e < (int32)map.Entities.size(); e++) {
+				if (e > 0 && !map.Entities[e].NumBrushes) {
+					continue;
+				}
+				if (!CompileModel(map, e)) {
+					return false;
+				}
+			}
+
+			WriteChunks(map, bsp);
+			return true;
+		}
+
+	private:
+		typedef struct {
+			int32		PlaneNum;
+			int32		PlaneSide;			// 1 when facing the other way than the plane
+			int32		TexInfo;			// -1 for sides made by a split
+			bool		Visible;			// came from a map face that gets drawn
+			bool		Tested;				// already split by on the way down the tree
+			Winding		W;
+		} BspSide;
+
+		typedef struct {
+			std::vector<BspSide, ArenaAllocator<BspSide>> Sides;
+			uint32		Contents;
+			geVec3d		Mins;
+			geVec3d		Maxs;
+		} BspBrush;
+
+		struct BspNode {
+			int32		PlaneNum = -1;		// -1 for leafs
+			bool		Detail = false;		// splits detail brushes only
+			uint32		Contents = 0;
+			bool		Outside = false;
+			int32		Index = 0;			// node or leaf number in the output
+			int32		Cluster = -1;
+			BspBrush	Volume = BspBrush();	// the convex space of the node, no sides when it has none
+			std::vector<GFX_LeafSide> Sides;	// planes of the volume of a leaf, kept by ReleaseVolumes()
+			bool		TouchesWorld = false;	// leaf with a side on the world box
+			std::unique_ptr<BspNode> Children[2];
+			std::vector<BspNode*> Neighbors;	// leafs across the portals
+			std::vector<int32> Faces;		// faces on the node, or in front of the leaf
+		};
+
+		// A piece of a brush face that ended up in front of an empty leaf
+		typedef struct {
+			Winding		W;
+			int32		PlaneNum;
+			int32		PlaneSide;
+			int32		TexInfo;
+			BspNode*	Node;
+			BspNode*	Leaf;
+		} FacePiece;
+
+		BspParms parms;
+		int numThreads;
+		std::string error;
+		BspStats stats;
+		bool canceled = false;
+
+		// the brush sides come from here, declared first to outlive every brush
+		Arena arena;
+		Arena treeArena;						// those of the tree building
+		PlanePool planes;
+		std::vector<GFX_TexInfo> texInfos;
+		std::unordered_multimap<uint64_t, int32> texInfoKeys;		// TexInfoKey() to its index in texInfos
+		std::vector<BspBrush> brushes;			// from the map
+		std::vector<BspBrush> fragments;		// after CSG
+		std::unique_ptr<BspNode> root;
+		int32 parallelSubtrees = 0;
+		long long treePeak = 0;					// of treeArena over all the models
+		geVec3d modelMins;						// of the brushes of the model being built
+		geVec3d modelMaxs;
+		std::vector<FacePiece> faces;
+
+		// the output of the models built so far
+		std::vector<GFX_Model> models;
+		std::vector<GFX_Node> gfxNodes;
+		std::vector<GFX_BNode> gfxBNodes;
+		std::vector<GFX_Leaf> gfxLeafs;
+		std::vector<int32> leafFaces;
+		std::vector<GFX_LeafSide> leafSides;
+		std::vector<GFX_Face> gfxFaces;
+		std::vector<int32> vertIndex;
+		std::vector<geVec3d> verts;
+		std::unordered_map<std::string, int32> vertLookup;
+
+		bool Cancel() {
+			canceled = true;
+			error = "canceled";
+			return false;
+		}
+
+		//========================================================================================
+		//	CompileModel()
+		//	Builds the tree of the brushes of entity and adds its model to the output,
+		//	the world first
+		//========================================================================================
+		bool CompileModel(const MapFile& map, int32 entity) {
+			const bool world = entity == 0;
+			if (!LoadBrushes(map, entity)) {
+				return false;
+			}
+
+			CarveBrushes();
+			if (IsCancelRequested()) {
+				return Cancel();
+			}
+
+			// the tree takes its brushes and node volumes from an arena of its own, given back
+			// whole once the portals are made and only the leaf planes are left to use
+			{
+				ArenaScope treeScope(treeArena);
+				// every plane a node may use exists before the tree is built on several threads
+				root.reset(new BspNode());
+				MakeWorldVolume(root->Volume);
+				BuildTree(root.get(), CopyBrushes(fragments));
+				if (IsCancelRequested()) {
+					return Cancel();
+				}
+				if (world) {
+					MakePortals(root.get());
+				}
+				ReleaseVolumes(root.get());
+			}
+			treePeak = std::max(treePeak, treeArena.GetStats().PeakReserved);
+			treeArena.Reset();
+
+			if (world) {
+				FillOutside(map);
+			}
+			MakeFaces();
+			if (IsCancelRequested()) {
+				return Cancel();
+			}
+
+			WriteModel(map, entity);
+			brushes.clear();
+			fragments.clear();
+			faces.clear();
+			root.reset();
+			return true;
+		}
+
+		// The pair number of the plane and the side normal faces, as GFX faces and leaf sides want them
+		int32 FindPlane(const geVec3d& normal, geFloat dist, int32* side) {
+			int32 num = planes.Find(normal, dist);
+			*side = num & 1;
+			return num >> 1;
+		}
+
+		static int32 SideNum(const BspSide& side) {
+			return side.PlaneNum << 1 | side.PlaneSide;
+		}
+
+		// Keeps the part of w inside of the side
+		bool ClipInside(Winding& w, const BspSide& side) const {
+			int32 num = PlanePool::Flip(SideNum(side));
+			return w.Clip(planes.GetNormal(num), planes.GetDist(num));
+		}
+
+		// Hash of the bytes of texInfo, which is zeroed first so the padding compares too
+		static uint64_t TexInfoKey(const GFX_TexInfo& texInfo) {
+			const uint8* bytes = (const uint8*)&texInfo;
+			uint64_t key = sizeof(texInfo);
+			for (size_t i = 0; i < sizeof(texInfo); i += 8) {
+				uint64_t word = 0;
+				memcpy(&word, bytes + i, sizeof(texInfo) - i < 8 ? sizeof(texInfo) - i : 8);
+				key = HashMix(key ^ word);
+			}
+			return key;
+		}
+
+		int32 FindTexInfo(const MapFace& face) {
+			GFX_TexInfo texInfo;
+			memset(&texInfo, 0, sizeof(texInfo));
+			texInfo.Vecs[0] = face.TexVecs[0];
+			texInfo.Vecs[1] = face.TexVecs[1];
+			texInfo.Shift[0] = face.TexShift[0];
+			texInfo.Shift[1] = face.TexShift[1];
+			// the first face flags of the editor are the texinfo ones
+			texInfo.Flags = face.Flags & (TEXINFO_MIRROR | TEXINFO_FULLBRIGHT | TEXINFO_SKY | TEXINFO_LIGHT);
+			if (face.Translucency < 255.0f) {
+				texInfo.Flags |= TEXINFO_TRANS;
+			}
+			texInfo.FaceLight = (int32)face.LightIntensity;
+			texInfo.ReflectiveScale = face.Reflectivity;
+			texInfo.Alpha = face.Translucency;
+			texInfo.MipMapBias = face.MipMapBias;
+			texInfo.Texture = face.Texture;
+
+			const uint64_t key = TexInfoKey(texInfo);
+			auto range = texInfoKeys.equal_range(key);
+			for (auto it = range.first; it != range.second; ++it) {
+				if (!memcmp(&texInfos[it->second], &texInfo, sizeof(texInfo))) {
+					return it->second;
+				}
+			}
+			texInfos.push_back(texInfo);
+			texInfoKeys.emplace(key, (int32)texInfos.size() - 1);
+			return (int32)texInfos.size() - 1;
+		}
+
+		static uint32 BrushContents(uint32 contents) {
+			contents &= BSP_CONTENTS_SOLID2 | BSP_CONTENTS_WINDOW2 | BSP_CONTENTS_EMPTY2 | BSP_CONTENTS_TRANSLUCENT2 | BSP_CONTENTS_WAVY2
+				| BSP_CONTENTS_DETAIL2 | BSP_CONTENTS_CLIP2 | BSP_CONTENTS_HINT2 | BSP_CONTENTS_AREA2;
+			if (contents & BSP_CONTENTS_CLIP2) {
+				return BSP_CONTENTS_CLIP2;
+			}
+			if (!(contents & (BSP_CONTENTS_SOLID2 | BSP_CONTENTS_WINDOW2 | BSP_CONTENTS_EMPTY2))) {
+				contents |= BSP_CONTENTS_SOLID2;
+			}
+			return contents;
+		}
+
+		// which brush keeps the space where two overlap
+		static int ContentsRank(uint32 contents) {
+			if (contents & BSP_CONTENTS_SOLID2) {
+				return 3;
+			}
+			return (contents & BSP_CONTENTS_WINDOW2) ? 2 : 1;
+		}
+
+		//========================================================================================
+		//	LoadBrushes()
+		//	Makes the brushes of entity convex polyhedra, a side for each face plane
+		//========================================================================================
+		bool LoadBrushes(const MapFile& map, int32 entity) {
+			const MapEntity& ent = map.Entities[entity];
+			for (int32 b = ent.FirstBrush; b < ent.FirstBrush + ent.NumBrushes; b++) {
+				const MapBrush& mapBrush = map.Brushes[b];
+				BspBrush brush;
+				brush.Contents = BrushContents(mapBrush.Contents);
+				if (brush.Contents & (BSP_CONTENTS_HINT2 | BSP_CONTENTS_AREA2)) {
+					stats.SkippedBrushes++;
+					continue;
+				}
+
+				geVec3d center;
+				geVec3d_Clear(&center);
+				int32 numPoints = 0;
+				for (int32 f = mapBrush.FirstFace; f < mapBrush.FirstFace + mapBrush.NumFaces; f++) {
+					const MapFace& face = map.Faces[f];
+					for (int32 p = face.FirstPoint; p < face.FirstPoint + face.NumPoints; p++) {
+						geVec3d_Add(&center, &map.Points[p], &center);
+						numPoints++;
+					}
+				}
+				if (!numPoints) {
+					stats.SkippedBrushes++;
+					continue;
+				}
+				geVec3d_Scale(&center, 1.0f / numPoints, &center);
+
+				for (int32 f = mapBrush.FirstFace; f < mapBrush.FirstFace + mapBrush.NumFaces; f++) {
+					const MapFace& face = map.Faces[f];
+					if (face.NumPoints < 3) {
+						continue;
+					}
+
+					// Newell's normal holds up on slightly uneven faces
+					geVec3d normal, faceCenter;
+					geVec3d_Clear(&normal);
+					geVec3d_Clear(&faceCenter);
+					for (int32 p = 0; p < face.NumPoints; p++) {
+						const geVec3d& a = map.Points[face.FirstPoint + p];
+						const geVec3d& c = map.Points[face.FirstPoint + (p + 1) % face.NumPoints];
+						normal.X += (a.Y - c.Y) * (a.Z + c.Z);
+						normal.Y += (a.Z - c.Z) * (a.X + c.X);
+						normal.Z += (a.X - c.X) * (a.Y + c.Y);
+						geVec3d_Add(&faceCenter, &a, &faceCenter);
+					}
+					if (geVec3d_Normalize(&normal) == 0.0f) {
+						continue;
+					}
+					geVec3d_Scale(&faceCenter, 1.0f / face.NumPoints, &faceCenter);
+					geFloat dist = geVec3d_DotProduct(&faceCenter, &normal);
+
+					// whatever order the editor wrote the points in, sides face out of the brush
+					if (geVec3d_DotProduct(&center, &normal) - dist > 0.0f) {
+						geVec3d_Inverse(&normal);
+						dist = -dist;
+					}
+
+					BspSide side;
+					side.PlaneNum = FindPlane(normal, dist, &side.PlaneSide);
+					side.TexInfo = FindTexInfo(face);
+					side.Visible = !(brush.Contents & BSP_CONTENTS_CLIP2);
+					side.Tested = false;
+
+					bool duplicate = false;
+					for (const BspSide& other : brush.Sides) {
+						duplicate |= other.PlaneNum == side.PlaneNum && other.PlaneSide == side.PlaneSide;
+					}
+					if (!duplicate) {
+						brush.Sides.push_back(side);
+					}
+				}
+
+				if (!MakeBrushWindings(brush) || BrushVolume(brush) < NATIVEBSP_MIN_VOLUME) {
+					stats.SkippedBrushes++;
+					continue;
+				}
+				brushes.push_back(std::move(brush));
+			}
+
+			if (brushes.empty()) {
+				if (entity == 0) {
+					error = "the world has no brushes";
+				}
+				else {
+					error = "entity " + std::to_string(entity) + " (" + map.ValueForKey(entity, "classname") + ") has no usable brushes";
+				}
+				return false;
+			}
+
+			modelMins = brushes[0].Mins;
+			modelMaxs = brushes[0].Maxs;
+			for (const BspBrush& brush : brushes) {
+				AddBounds(modelMins, modelMaxs, brush.Mins, brush.Maxs);
+			}
+			return true;
+		}
+
+		static void AddBounds(geVec3d& mins, geVec3d& maxs, const geVec3d& otherMins, const geVec3d& otherMaxs) {
+			geVec3d_Set(&mins, std::min(mins.X, otherMins.X), std::min(mins.Y, otherMins.Y), std::min(mins.Z, otherMins.Z));
+			geVec3d_Set(&maxs, std::max(maxs.X, otherMaxs.X), std::max(maxs.Y, otherMaxs.Y), std::max(maxs.Z, otherMaxs.Z));
+		}
+
+		// The points of every side winding, in a buffer of the calling thread that the next
+		// call reuses
+		static VecSoA& GatherPoints(const BspBrush& brush) {
+			static thread_local VecSoA points;
+			points.clear();
+			for (const BspSide& side : brush.Sides) {
+				points.Append(side.W.Points.data(), side.W.size());
+			}
+			return points;
+		}
+
+		// Bounds of the side windings, false when fewer than 4 sides are left
+		static bool BoundBrush(BspBrush& brush) {
+			geVec3d_Set(&brush.Mins, MIN_MAX_BOUNDS2, MIN_MAX_BOUNDS2, MIN_MAX_BOUNDS2);
+			geVec3d_Set(&brush.Maxs, -MIN_MAX_BOUNDS2, -MIN_MAX_BOUNDS2, -MIN_MAX_BOUNDS2);
+			VecSoA& points = GatherPoints(brush);
+			int32 numSides = 0;
+			for (const BspSide& side : brush.Sides) {
+				numSides += side.W.empty() ? 0 : 1;
+			}
+			GetVecKernels().Bounds(points.X(), points.Y(), points.Z(), points.size(), brush.Mins, brush.Maxs);
+			return numSides >= 4;
+		}
+
+		// Every side winding is its plane clipped by all the other sides
+		bool MakeBrushWindings(BspBrush& brush) const {
+			for (BspSide& side : brush.Sides) {
+				side.W = Winding::ForPlane(planes.GetNormal(SideNum(side)), planes.GetDist(SideNum(side)));
+				for (const BspSide& other : brush.Sides) {
+					if (&other == &side) {
+						continue;
+					}
+					if (!ClipInside(side.W, other)) {
+						break;
+					}
+				}
+			}
+			return BoundBrush(brush);
+		}
+
+		static geFloat BrushVolume(const BspBrush& brush) {
+			const geVec3d* corner = nullptr;
+			for (const BspSide& side : brush.Sides) {
+				if (!side.W.empty()) {
+					corner = &side.W.Points[0];
+					break;
+				}
+			}
+			if (corner == nullptr) {
+				return 0.0f;
+			}
+			// pyramids from one corner to every side
+			geFloat volume = 0.0f;
+			for (const BspSide& side : brush.Sides) {
+				if (side.W.size() < 3) {
+					continue;
+				}
+				geVec3d a, b, normal;
+				geVec3d_Subtract(&side.W.Points[1], &side.W.Points[0], &a);
+				geVec3d_Subtract(&side.W.Points[2], &side.W.Points[0], &b);
+				geVec3d_CrossProduct(&a, &b, &normal);
+				geVec3d_Normalize(&normal);
+				geVec3d_Subtract(&side.W.Points[0], corner, &a);
+				volume += fabsf(geVec3d_DotProduct(&a, &normal)) * side.W.Area();
+			}
+			return volume / 3.0f;
+		}
+
+		//========================================================================================
+		//	SplitBrush()
+		//	Cuts the brush by the plane, the pieces get a new side along the cut. A brush on
+		//	one side only goes there whole, a piece too thin to matter is dropped.
+		//========================================================================================
+		void SplitBrush(const BspBrush& brush, int32 planeNum, BspBrush& front, BspBrush& back, bool& hasFront, bool& hasBack) const {
+			const geVec3d normal = planes.GetNormal(planeNum << 1);
+			const geFloat dist = planes.GetDist(planeNum << 1);
+			hasFront = false;
+			hasBack = false;
+
+			geFloat frontDist = 0.0f, backDist = 0.0f;
+			VecSoA& points = GatherPoints(brush);
+			GetVecKernels().PlaneRange(points.X(), points.Y(), points.Z(), points.size(), normal, dist, backDist, frontDist);
+			if (frontDist < ON_EPSILON) {
+				back = brush;
+				hasBack = true;
+				return;
+			}
+			if (backDist > -ON_EPSILON) {
+				front = brush;
+				hasFront = true;
+				return;
+			}
+
+			// the cut is the plane inside of the brush
+			Winding mid = Winding::ForPlane(normal, dist);
+			for (const BspSide& side : brush.Sides) {
+				if (!ClipInside(mid, side)) {
+					break;
+				}
+			}
+			if (mid.size() < 3) {
+				if (frontDist > -backDist) {
+					front = brush;
+					hasFront = true;
+				}
+				else {
+					back = brush;
+					hasBack = true;
+				}
+				return;
+			}
+
+			BspBrush* pieces[2] = { &front, &back };
+			for (int i = 0; i < 2; i++) {
+				pieces[i]->Sides.clear();
+				pieces[i]->Contents = brush.Contents;
+			}
+			for (const BspSide& side : brush.Sides) {
+				if (side.W.empty()) {
+					continue;
+				}
+				Winding w[2];
+				side.W.Split(normal, dist, w[0], w[1]);
+				for (int i = 0; i < 2; i++) {
+					if (w[i].size() >= 3) {
+						BspSide piece = side;
+						piece.W = std::move(w[i]);
+						pieces[i]->Sides.push_back(std::move(piece));
+					}
+				}
+			}
+			for (int i = 0; i < 2; i++) {
+				BspSide cut;
+				cut.PlaneNum = planeNum;
+				cut.PlaneSide = i == 0 ? 1 : 0;
+				cut.TexInfo = -1;
+				cut.Visible = false;
+				cut.Tested = true;
+				cut.W = mid;
+				pieces[i]->Sides.push_back(std::move(cut));
+			}
+
+			hasFront = BoundBrush(front) && BrushVolume(front) >= NATIVEBSP_MIN_VOLUME;
+			hasBack = BoundBrush(back) && BrushVolume(back) >= NATIVEBSP_MIN_VOLUME;
+		}
+
+		static bool BoundsOverlap(const BspBrush& a, const BspBrush& b) {
+			return a.Mins.X < b.Maxs.X - ON_EPSILON && a.Maxs.X > b.Mins.X + ON_EPSILON
+				&& a.Mins.Y < b.Maxs.Y - ON_EPSILON && a.Maxs.Y > b.Mins.Y + ON_EPSILON
+				&& a.Mins.Z < b.Maxs.Z - ON_EPSILON && a.Maxs.Z > b.Mins.Z + ON_EPSILON;
+		}
+
+		//========================================================================================
+		//	SubtractBrush()
+		//	The pieces of a outside of b: a is split by every side of b in turn, the front
+		//	pieces are outside and the last back piece is inside. When nothing ends up
+		//	inside, a is left whole.
+		//========================================================================================
+		void SubtractBrush(const BspBrush& a, const BspBrush& b, std::vector<BspBrush>& out) const {
+			std::vector<BspBrush> outside;
+			BspBrush inside = a;
+			for (const BspSide& side : b.Sides) {
+				// the sides of b face out, its planes need to
+				BspBrush front, back;
+				bool hasFront, hasBack;
+				SplitBrush(inside, side.PlaneNum, front, back, hasFront, hasBack);
+				BspBrush& out0 = side.PlaneSide ? back : front;
+				BspBrush& in0 = side.PlaneSide ? front : back;
+				bool hasOut = side.PlaneSide ? hasBack : hasFront;
+				bool hasIn = side.PlaneSide ? hasFront : hasBack;
+				if (hasOut) {
+					outside.push_back(std::move(out0));
+				}
+				if (!hasIn) {
+					out.push_back(a);
+					return;
+				}
+				inside = std::move(in0);
+			}
+			for (BspBrush& piece : outside) {
+				out.push_back(std::move(piece));
+			}
+		}
+
+		//========================================================================================
+		//	CarveBrushes()
+		//	Removes the space every brush shares with the brushes that win over it
+		//========================================================================================
+		void CarveBrushes() {
+			const int32 count = (int32)brushes.size();
+			std::vector<std::vector<BspBrush>> carved(count);
+
+			ParallelFor(count, numThreads, [&](int i) {
+				ArenaScope scope(arena);
+				std::vector<BspBrush> pieces(1, brushes[i]);
+				const int rank = ContentsRank(brushes[i].Contents);
+				for (int32 j = 0; j < count && !pieces.empty(); j++) {
+					const BspBrush& other = brushes[j];
+					int otherRank = ContentsRank(other.Contents);
+					if (j == i || otherRank < rank || (otherRank == rank && j < i) || !BoundsOverlap(brushes[i], other)) {
+						continue;
+					}
+					if (IsCancelRequested()) {
+						return;
+					}
+					std::vector<BspBrush> left;
+					for (const BspBrush& piece : pieces) {
+						if (BoundsOverlap(piece, other)) {
+							SubtractBrush(piece, other, left);
+						}
+						else {
+							left.push_back(piece);
+						}
+					}
+					pieces.swap(left);
+				}
+				carved[i].swap(pieces);
+			});
+
+			for (std::vector<BspBrush>& pieces : carved) {
+				for (BspBrush& piece : pieces) {
+					fragments.push_back(std::move(piece));
+				}
+			}
+			stats.Fragments += (int32)fragments.size();
+		}
+
+		// Copies of brushes with their sides in the current arena
+		static std::vector<BspBrush> CopyBrushes(const std::vector<BspBrush>& brushes) {
+			std::vector<BspBrush> copies(brushes.size());
+			for (size_t i = 0; i < brushes.size(); i++) {
+				copies[i].Sides.assign(brushes[i].Sides.begin(), brushes[i].Sides.end());
+				copies[i].Contents = brushes[i].Contents;
+				copies[i].Mins = brushes[i].Mins;
+				copies[i].Maxs = brushes[i].Maxs;
+			}
+			return copies;
+		}
+
+		// A box around the whole model, its sides mark the leafs that touch the outside
+		void MakeWorldVolume(BspBrush& volume) {
+			volume.Contents = 0;
+			volume.Sides.clear();
+			for (int axis = 0; axis < 3; axis++) {
+				for (int dir = 0; dir < 2; dir++) {
+					geVec3d normal;
+					geVec3d_Clear(&normal);
+					VectorToSUB(normal, axis) = dir ? -1.0f : 1.0f;
+					geFloat dist = dir ? -(VectorToSUB(modelMins, axis) - NATIVEBSP_WORLD_MARGIN) : VectorToSUB(modelMaxs, axis) + NATIVEBSP_WORLD_MARGIN;
+
+					BspSide side;
+					side.PlaneNum = FindPlane(normal, dist, &side.PlaneSide);
+					side.TexInfo = NATIVEBSP_SIDE_OUTSIDE;
+					side.Visible = false;
+					side.Tested = true;
+					volume.Sides.push_back(side);
+				}
+			}
+			MakeBrushWindings(volume);
+		}
+
+		//========================================================================================
+		//	BrushOnPlaneSide()
+		//	SIDE_FRONT, SIDE_BACK or SIDE_CROSS, with facing set when one of the sides of
+		//	the brush lies on the plane. The bounds decide most brushes without the windings.
+		//========================================================================================
+		int BrushOnPlaneSide(const BspBrush& brush, int32 planeNum, bool& facing) const {
+			facing = false;
+			for (const BspSide& side : brush.Sides) {
+				if (side.PlaneNum == planeNum) {
+					facing = true;
+					return side.PlaneSide ? SIDE_FRONT : SIDE_BACK;
+				}
+			}
+
+			const int32 num = planeNum << 1;
+			const geVec3d normal = planes.GetNormal(num);
+			geVec3d nearCorner, farCorner;
+			for (int axis = 0; axis < 3; axis++) {
+				bool positive = VectorToSUB(normal, axis) >= 0.0f;
+				VectorToSUB(nearCorner, axis) = positive ? VectorToSUB(brush.Mins, axis) : VectorToSUB(brush.Maxs, axis);
+				VectorToSUB(farCorner, axis) = positive ? VectorToSUB(brush.Maxs, axis) : VectorToSUB(brush.Mins, axis);
+			}
+			if (planes.Distance(num, farCorner) < ON_EPSILON) {
+				return SIDE_BACK;
+			}
+			if (planes.Distance(num, nearCorner) > -ON_EPSILON) {
+				return SIDE_FRONT;
+			}
+			if (planes.GetType(num) < 3) {
+				return SIDE_CROSS;
+			}
+
+			bool front = false, back = false;
+			for (const BspSide& side : brush.Sides) {
+				for (const geVec3d& p : side.W.Points) {
+					geFloat d = planes.Distance(num, p);
+					front |= d >= ON_EPSILON;
+					back |= d <= -ON_EPSILON;
+				}
+			}
+			if (front && back) {
+				return SIDE_CROSS;
+			}
+			return front ? SIDE_FRONT : SIDE_BACK;
+		}
+
+		//========================================================================================
+		//	SelectSplit()
+		//	Picks the plane of an untested brush side that splits the brushes best: the
+		//	visible faces of structural brushes first, then their other sides, then the
+		//	detail brushes. False when every side was tested, the node is a leaf.
+		//========================================================================================
+		bool SelectSplit(const std::vector<BspBrush>& list, int32& bestPlane, bool& detail) const {
+			std::unordered_set<int32> checked;
+			for (int pass = 0; pass < 3; pass++) {
+				int bestValue = INT_MIN;
+				bestPlane = -1;
+				for (const BspBrush& brush : list) {
+					bool isDetail = (brush.Contents & BSP_CONTENTS_DETAIL2) != 0;
+					if (isDetail != (pass == 2)) {
+						continue;
+					}
+					for (const BspSide& side : brush.Sides) {
+						if (side.Tested || (pass == 0 && !side.Visible) || !checked.insert(side.PlaneNum).second) {
+							continue;
+						}
+
+						int front = 0, back = 0, splits = 0, facing = 0;
+						for (const BspBrush& other : list) {
+							bool onPlane;
+							int s = BrushOnPlaneSide(other, side.PlaneNum, onPlane);
+							facing += onPlane;
+							splits += s == SIDE_CROSS;
+							front += s == SIDE_FRONT;
+							back += s == SIDE_BACK;
+						}
+						int value = 5 * facing - 5 * splits - abs(front - back);
+						if (planes.GetType(side.PlaneNum << 1) < 3) {
+							value += 5;
+						}
+						if (value > bestValue) {
+							bestValue = value;
+							bestPlane = side.PlaneNum;
+						}
+					}
+				}
+				if (bestPlane >= 0) {
+					detail = pass == 2;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		//========================================================================================
+		//	SplitNode()
+		//	Picks the split of node and cuts its brushes and volume with it. False when the
+		//	brushes fill or miss the whole node, which is then a leaf.
+		//========================================================================================
+		bool SplitNode(BspNode* node, std::vector<BspBrush>&& list, std::vector<BspBrush> (&lists)[2]) {
+			int32 planeNum;
+			bool detail = false;
+			if (IsCancelRequested() || !SelectSplit(list, planeNum, detail)) {
+				// every side was split by, so the brushes left cover the whole leaf
+				node->Contents = 0;
+				for (const BspBrush& brush : list) {
+					node->Contents |= brush.Contents;
+				}
+				if (!node->Contents) {
+					node->Contents = BSP_CONTENTS_EMPTY2;
+				}
+				return false;
+			}
+
+			node->PlaneNum = planeNum;
+			node->Detail = detail;
+			for (const BspBrush& brush : list) {
+				BspBrush pieces[2];
+				bool has[2];
+				SplitBrush(brush, planeNum, pieces[0], pieces[1], has[0], has[1]);
+				for (int i = 0; i < 2; i++) {
+					if (!has[i]) {
+						continue;
+					}
+					for (BspSide& side : pieces[i].Sides) {
+						side.Tested |= side.PlaneNum == planeNum;
+					}
+					lists[i].push_back(std::move(pieces[i]));
+				}
+			}
+			list.clear();
+			list.shrink_to_fit();
+
+			for (int i = 0; i < 2; i++) {
+				node->Children[i].reset(new BspNode());
+			}
+			BspBrush volumes[2];
+			bool hasVolume[2];
+			SplitBrush(node->Volume, planeNum, volumes[0], volumes[1], hasVolume[0], hasVolume[1]);
+			for (int i = 0; i < 2; i++) {
+				if (hasVolume[i]) {
+					node->Children[i]->Volume = std::move(volumes[i]);
+				}
+			}
+			return true;
+		}
+
+		void BuildSubtree(BspNode* node, std::vector<BspBrush>&& list) {
+			std::vector<BspBrush> lists[2];
+			if (SplitNode(node, std::move(list), lists)) {
+				BuildSubtree(node->Children[0].get(), std::move(lists[0]));
+				BuildSubtree(node->Children[1].get(), std::move(lists[1]));
+			}
+		}
+
+		//========================================================================================
+		//	BuildTree()
+		//	Splits the biggest node left on this thread until there are a few subtrees per
+		//	thread or they're all small, then builds them on the threads biggest first
+		//========================================================================================
+		void BuildTree(BspNode* node, std::vector<BspBrush>&& list) {
+			typedef struct {
+				BspNode*	Node;
+				std::vector<BspBrush> List;
+			} Subtree;
+
+			std::vector<Subtree> subtrees;
+			subtrees.push_back(Subtree{ node, std::move(list) });
+			const size_t wanted = numThreads > 1 ? (size_t)numThreads * NATIVEBSP_SUBTREES_PER_THREAD : 1;
+			while (subtrees.size() < wanted) {
+				size_t biggest = 0;
+				for (size_t i = 1; i < subtrees.size(); i++) {
+					if (subtrees[i].List.size() > subtrees[biggest].List.size()) {
+						biggest = i;
+					}
+				}
+				if (subtrees[biggest].List.size() < NATIVEBSP_PARALLEL_BRUSHES) {
+					break;
+				}
+
+				Subtree top = std::move(subtrees[biggest]);
+				subtrees[biggest] = std::move(subtrees.back());
+				subtrees.pop_back();
+				std::vector<BspBrush> lists[2];
+				if (SplitNode(top.Node, std::move(top.List), lists)) {
+					for (int i = 0; i < 2; i++) {
+						subtrees.push_back(Subtree{ top.Node->Children[i].get(), std::move(lists[i]) });
+					}
+				}
+			}
+
+			std::vector<int> order(subtrees.size());
+			for (size_t i = 0; i < order.size(); i++) {
+				order[i] = (int)i;
+			}
+			std::sort(order.begin(), order.end(), [&](int a, int b) {
+				return subtrees[a].List.size() > subtrees[b].List.size();
+			});
+			parallelSubtrees += subtrees.size() > 1 ? (int32)subtrees.size() : 0;
+			WorkStealingFor((int)subtrees.size(), numThreads, [&](int i) {
+				ArenaScope scope(treeArena);
+				BuildSubtree(subtrees[i].Node, std::move(subtrees[i].List));
+			}, &order);
+		}
+
+		static bool IsSolid(const BspNode* leaf) {
+			return (leaf->Contents & BSP_CONTENTS_SOLID2) != 0 || leaf->Outside;
+		}
+
+		//========================================================================================
+		//	MakePortals()
+		//	The node plane inside of the node volume is cut down both subtrees, each piece
+		//	left joins the two leafs on its sides
+		//========================================================================================
+		void MakePortals(BspNode* node) {
+			if (node->PlaneNum < 0) {
+				return;
+			}
+			if (node->Volume.Sides.empty()) {
+				MakePortals(node->Children[0].get());
+				MakePortals(node->Children[1].get());
+				return;
+			}
+			const int32 num = node->PlaneNum << 1;
+			Winding w = Winding::ForPlane(planes.GetNormal(num), planes.GetDist(num));
+			for (const BspSide& side : node->Volume.Sides) {
+				if (!ClipInside(w, side)) {
+					break;
+				}
+			}
+			if (w.size() >= 3) {
+				FilterPortal(w, node->Children[0].get(), nullptr, node->Children[1].get());
+			}
+			MakePortals(node->Children[0].get());
+			MakePortals(node->Children[1].get());
+		}
+
+		// Drops the node volumes, the leafs keep the planes of theirs and whether it
+		// touches the world box
+		void ReleaseVolumes(BspNode* node) {
+			if (node->PlaneNum < 0) {
+				for (const BspSide& side : node->Volume.Sides) {
+					if (side.W.empty()) {
+						continue;
+					}
+					if (side.TexInfo == NATIVEBSP_SIDE_OUTSIDE) {
+						node->TouchesWorld = true;
+					}
+					else {
+						GFX_LeafSide leafSide = { side.PlaneNum, side.PlaneSide };
+						node->Sides.push_back(leafSide);
+					}
+				}
+			}
+			else {
+				ReleaseVolumes(node->Children[0].get());
+				ReleaseVolumes(node->Children[1].get());
+			}
+			decltype(node->Volume.Sides)().swap(node->Volume.Sides);
+		}
+
+		// Finds the front leaf of the portal pieces first, then the back one
+		void FilterPortal(const Winding& w, BspNode* node, BspNode* frontLeaf, BspNode* backRoot) {
+			if (node->PlaneNum < 0) {
+				if (frontLeaf == nullptr) {
+					FilterPortal(w, backRoot, node, nullptr);
+					return;
+				}
+				frontLeaf->Neighbors.push_back(node);
+				node->Neighbors.push_back(frontLeaf);
+				stats.Portals++;
+				return;
+			}
+			const int32 num = node->PlaneNum << 1;
+			Winding pieces[2];
+			w.Split(planes.GetNormal(num), planes.GetDist(num), pieces[0], pieces[1]);
+			for (int i = 0; i < 2; i++) {
+				if (pieces[i].size() >= 3) {
+					FilterPortal(pieces[i], node->Children[i].get(), frontLeaf, backRoot);
+				}
+			}
+		}
+
+		BspNode* FindLeaf(const geVec3d& p) const {
+			BspNode* node = root.get();
+			while (node->PlaneNum >= 0) {
+				node = node->Children[planes.Distance(node->PlaneNum << 1, p) < 0.0f ? 1 : 0].get();
+			}
+			return node;
+		}
+
+		static void CollectLeafs(BspNode* node, std::vector<BspNode*>& leafs) {
+			if (node->PlaneNum < 0) {
+				leafs.push_back(node);
+				return;
+			}
+			CollectLeafs(node->Children[0].get(), leafs);
+			CollectLeafs(node->Children[1].get(), leafs);
+		}
+
+		//========================================================================================
+		//	FillOutside()
+		//	Floods the empty leafs from the world box through the portals and makes them
+		//	solid, unless an entity is out there too: then the map leaks and stays as is
+		//========================================================================================
+		void FillOutside(const MapFile& map) {
+			std::vector<BspNode*> leafs;
+			CollectLeafs(root.get(), leafs);
+
+			std::vector<BspNode*> stack;
+			for (BspNode* leaf : leafs) {
+				if (IsSolid(leaf)) {
+					continue;
+				}
+				if (leaf->TouchesWorld) {
+					leaf->Outside = true;
+					stack.push_back(leaf);
+				}
+			}
+			while (!stack.empty()) {
+				BspNode* leaf = stack.back();
+				stack.pop_back();
+				for (BspNode* other : leaf->Neighbors) {
+					if (!IsSolid(other)) {
+						other->Outside = true;
+						stack.push_back(other);
+					}
+				}
+			}
+
+			bool inside = false;
+			for (int32 e = 1; e < (int32)map.Entities.size(); e++) {
+				std::string origin = map.ValueForKey(e, "origin");
+				geVec3d p;
+				if (origin.empty() || sscanf(origin.c_str(), "%f %f %f", &p.X, &p.Y, &p.Z) != 3) {
+					continue;
+				}
+				if (FindLeaf(p)->Outside) {
+					printf("Warning: The map leaks, %s at %.0f %.0f %.0f sees the outside. It won't be filled.\n",
+						map.ValueForKey(e, "classname").c_str(), p.X, p.Y, p.Z);
+					ClearOutside(leafs);
+					return;
+				}
+				inside = true;
+			}
+			if (!inside) {
+				printf("Warning: No entity inside of the map, the outside won't be filled.\n");
+				ClearOutside(leafs);
+				return;
+			}
+
+			for (BspNode* leaf : leafs) {
+				if (leaf->Outside) {
+					leaf->Contents = BSP_CONTENTS_SOLID2;
+					stats.OutsideLeafs++;
+				}
+			}
+		}
+
+		static void ClearOutside(std::vector<BspNode*>& leafs) {
+			for (BspNode* leaf : leafs) {
+				leaf->Outside = false;
+			}
+		}
+
+		//========================================================================================
+		//	FilterFace()
+		//	Cuts a brush face down the tree, the pieces in front of empty leafs are kept.
+		//	The node on the plane of the face owns it, or the last one on the way.
+		//========================================================================================
+		void FilterFace(const Winding& w, BspNode* node, const BspSide& side, BspNode* owner, std::vector<FacePiece>& out) const {
+			while (node->PlaneNum >= 0) {
+				if (node->PlaneNum == side.PlaneNum) {
+					owner = node;
+					node = node->Children[side.PlaneSide].get();
+					continue;
+				}
+				owner = owner != nullptr && owner->PlaneNum == side.PlaneNum ? owner : node;
+
+				const geVec3d normal = planes.GetNormal(node->PlaneNum << 1);
+				const geFloat dist = planes.GetDist(node->PlaneNum << 1);
+				int s = w.Side(normal, dist);
+				if (s == SIDE_CROSS) {
+					Winding pieces[2];
+					w.Split(normal, dist, pieces[0], pieces[1]);
+					for (int i = 0; i < 2; i++) {
+						if (pieces[i].size() >= 3) {
+							FilterFace(pieces[i], node->Children[i].get(), side, owner, out);
+						}
+					}
+					return;
+				}
+				node = node->Children[s == SIDE_BACK ? 1 : 0].get();
+			}
+
+			if (IsSolid(node) || owner == nullptr) {
+				return;
+			}
+			FacePiece piece;
+			piece.W = w;
+			piece.PlaneNum = side.PlaneNum;
+			piece.PlaneSide = side.PlaneSide;
+			piece.TexInfo = side.TexInfo;
+			piece.Node = owner;
+			piece.Leaf = node;
+			out.push_back(std::move(piece));
+		}
+
+		void MakeFaces() {
+			std::vector<std::vector<FacePiece>> pieces(fragments.size());
+			ParallelFor((int)fragments.size(), numThreads, [&](int i) {
+				for (const BspSide& side : fragments[i].Sides) {
+					if (side.Visible && side.W.size() >= 3) {
+						FilterFace(side.W, root.get(), side, nullptr, pieces[i]);
+					}
+				}
+			});
+			for (std::vector<FacePiece>& list : pieces) {
+				for (FacePiece& piece : list) {
+					faces.push_back(std::move(piece));
+				}
+			}
+		}
+
+		// Depth first numbering after the models written so far, the leafs of the world get
+		// their clusters on the way
+		void NumberTree(BspNode* node, int32& numNodes, std::vector<BspNode*>& leafs, int32* sharedCluster) {
+			if (node->PlaneNum < 0) {
+				node->Index = (int32)(gfxLeafs.size() + leafs.size());
+				leafs.push_back(node);
+				if (IsSolid(node) || !models.empty()) {
+					node->Cluster = -1;
+					return;
+				}
+				int32 cluster = -1;
+				int32& slot = sharedCluster != nullptr ? *sharedCluster : cluster;
+				if (slot < 0) {
+					slot = stats.Clusters++;
+				}
+				node->Cluster = slot;
+				return;
+			}
+
+			node->Index = numNodes++;
+			int32 detailCluster = -1;
+			if (sharedCluster == nullptr && node->Detail) {
+				sharedCluster = &detailCluster;
+			}
+			NumberTree(node->Children[0].get(), numNodes, leafs, sharedCluster);
+			NumberTree(node->Children[1].get(), numNodes, leafs, sharedCluster);
+		}
+
+		void WriteNodes(const BspNode* node) {
+			if (node->PlaneNum < 0) {
+				return;
+			}
+			GFX_Node& out = gfxNodes[node->Index];
+			GFX_BNode& bout = gfxBNodes[node->Index];
+			out.PlaneNum = node->PlaneNum;
+			bout.PlaneNum = node->PlaneNum;
+			out.Mins = node->Volume.Mins;
+			out.Maxs = node->Volume.Maxs;
+			for (int i = 0; i < 2; i++) {
+				const BspNode* child = node->Children[i].get();
+				out.Children[i] = child->PlaneNum < 0 ? -(child->Index + 1) : child->Index;
+				bout.Children[i] = out.Children[i];
+				WriteNodes(child);
+			}
+		}
+
+		//========================================================================================
+		//	WriteModel()
+		//	Numbers the tree and the faces of the model of entity after the ones written
+		//	so far and adds them to the output
+		//========================================================================================
+		void WriteModel(const MapFile& map, int32 entity) {
+			const int32 firstNode = (int32)gfxNodes.size();
+			const int32 firstLeaf = (int32)gfxLeafs.size();
+			const int32 firstFace = (int32)gfxFaces.size();
+			int32 numNodes = firstNode;
+			std::vector<BspNode*> leafs;
+			NumberTree(root.get(), numNodes, leafs, nullptr);
+
+			// the faces of a node are next to each other
+			std::stable_sort(faces.begin(), faces.end(), [](const FacePiece& a, const FacePiece& b) {
+				return a.Node->Index < b.Node->Index;
+			});
+
+			gfxFaces.resize(firstFace + faces.size());
+			gfxNodes.resize(numNodes);
+			gfxBNodes.resize(numNodes);
+			for (int32 i = firstNode; i < numNodes; i++) {
+				gfxNodes[i].FirstFace = 0;
+				gfxNodes[i].NumFaces = 0;
+			}
+
+			for (int32 i = 0; i < (int32)faces.size(); i++) {
+				const FacePiece& piece = faces[i];
+				GFX_Face& face = gfxFaces[firstFace + i];
+				memset(&face, 0, sizeof(face));
+				face.FirstVert = (int32)vertIndex.size();
+				face.NumVerts = piece.W.size();
+				face.PlaneNum = piece.PlaneNum;
+				face.PlaneSide = piece.PlaneSide;
+				face.TexInfo = piece.TexInfo;
+				face.LightOfs = -1;
+				memset(face.LTypes, 255, sizeof(face.LTypes));
+
+				for (const geVec3d& point : piece.W.Points) {
+					geVec3d p = point;
+					for (int axis = 0; axis < 3; axis++) {
+						geFloat& v = (&p.X)[axis];
+						if (fabsf(v - floorf(v + 0.5f)) < NATIVEBSP_DIST_EPSILON) {
+							v = floorf(v + 0.5f);
+						}
+					}
+					std::string key((const char*)&p, sizeof(p));
+					auto found = vertLookup.emplace(key, (int32)verts.size());
+					if (found.second) {
+						verts.push_back(p);
+					}
+					vertIndex.push_back(found.first->second);
+				}
+
+				GFX_Node& node = gfxNodes[piece.Node->Index];
+				if (!node.NumFaces) {
+					node.FirstFace = firstFace + i;
+				}
+				node.NumFaces++;
+				piece.Leaf->Faces.push_back(firstFace + i);
+			}
+			WriteNodes(root.get());
+
+			gfxLeafs.resize(firstLeaf + leafs.size());
+			for (int32 i = 0; i < (int32)leafs.size(); i++) {
+				const BspNode* leaf = leafs[i];
+				GFX_Leaf& out = gfxLeafs[firstLeaf + i];
+				memset(&out, 0, sizeof(out));
+				out.Contents = (int32)leaf->Contents;
+				out.Mins = leaf->Volume.Mins;
+				out.Maxs = leaf->Volume.Maxs;
+				out.FirstFace = (int32)leafFaces.size();
+				out.NumFaces = (int32)leaf->Faces.size();
+				leafFaces.insert(leafFaces.end(), leaf->Faces.begin(), leaf->Faces.end());
+				out.Cluster = leaf->Cluster;
+				out.Area = IsSolid(leaf) ? 0 : 1;
+
+				// solid leafs keep their sides for collision
+				out.FirstSide = (int32)leafSides.size();
+				if (IsSolid(leaf)) {
+					leafSides.insert(leafSides.end(), leaf->Sides.begin(), leaf->Sides.end());
+				}
+				out.NumSides = (int32)leafSides.size() - out.FirstSide;
+			}
+
+			GFX_Model model;
+			memset(&model, 0, sizeof(model));
+			model.RootNode[0] = root->PlaneNum < 0 ? -(root->Index + 1) : root->Index;
+			model.RootNode[1] = model.RootNode[0];
+			model.Mins = modelMins;
+			model.Maxs = modelMaxs;
+			std::string origin = map.ValueForKey(entity, "origin");
+			if (entity == 0 || origin.empty() || sscanf(origin.c_str(), "%f %f %f", &model.Origin.X, &model.Origin.Y, &model.Origin.Z) != 3) {
+				geVec3d_Clear(&model.Origin);
+			}
+			model.FirstFace = firstFace;
+			model.NumFaces = (int32)faces.size();
+			model.FirstLeaf = firstLeaf;
+			model.NumLeafs = (int32)leafs.size();
+			model.NumClusters = models.empty() ? stats.Clusters : 0;
+			models.push_back(model);
+		}
+
+		//========================================================================================
+		//	WriteChunks()
+		//	Stores the models and everything else the later stages need
+		//========================================================================================
+		void WriteChunks(const MapFile& map, BspFile& bsp) {
+			std::vector<GFX_Cluster> clusters(stats.Clusters);
+			for (GFX_Cluster& cluster : clusters) {
+				cluster.VisOfs = -1;
+			}
+			std::vector<GFX_Area> areas(2);
+			memset(areas.data(), 0, areas.size() * sizeof(GFX_Area));
+
+			std::vector<GFX_Texture> textures(map.Textures.size());
+			for (size_t i = 0; i < textures.size(); i++) {
+				memset(&textures[i], 0, sizeof(GFX_Texture));
+				std::string name = map.GetString(map.Textures[i].Name);
+				memcpy(textures[i].Name, name.c_str(), std::min(name.size(), sizeof(textures[i].Name) - 1));
+			}
+
+			std::string entData = MapEntityData(map);
+
+			GBSP_Header header;
+			memset(&header, 0, sizeof(header));
+			memcpy(header.TAG, GBSP_TAG, 4);
+			header.Version = GBSP_VERSION;
+
+			bsp.SetChunkData(GBSP_CHUNK_HEADER, &header, 1);
+			bsp.SetChunkData(GBSP_CHUNK_MODELS, models);
+			bsp.SetChunkData(GBSP_CHUNK_NODES, gfxNodes);
+			bsp.SetChunkData(GBSP_CHUNK_BNODES, gfxBNodes);
+			bsp.SetChunkData(GBSP_CHUNK_LEAFS, gfxLeafs);
+			bsp.SetChunkData(GBSP_CHUNK_CLUSTERS, clusters);
+			bsp.SetChunkData(GBSP_CHUNK_AREAS, areas);
+			bsp.SetChunkData(GBSP_CHUNK_AREA_PORTALS, (const GFX_AreaPortal*)nullptr, 0);
+			bsp.SetChunkData(GBSP_CHUNK_LEAF_SIDES, leafSides);
+			bsp.SetChunkData(GBSP_CHUNK_PORTALS, (const GFX_Portal*)nullptr, 0);
+			bsp.SetChunkData(GBSP_CHUNK_PLANES, planes.ToGFXPlanes());
+			bsp.SetChunkData(GBSP_CHUNK_FACES, gfxFaces);
+			bsp.SetChunkData(GBSP_CHUNK_LEAF_FACES, leafFaces);
+			bsp.SetChunkData(GBSP_CHUNK_VERT_INDEX, vertIndex);
+			bsp.SetChunkData(GBSP_CHUNK_VERTS, verts);
+			bsp.SetChunkData(GBSP_CHUNK_RGB_VERTS, std::vector<geVec3d>(vertIndex.size(), VecOrigin));
+			bsp.SetChunkData(GBSP_CHUNK_ENTDATA, entData.c_str(), (int32)entData.size() + 1);
+			bsp.SetChunkData(GBSP_CHUNK_TEXINFO, texInfos);
+			bsp.SetChunkData(GBSP_CHUNK_TEXTURES, textures);
+			bsp.SetChunkData(GBSP_CHUNK_TEXDATA, (const uint8*)nullptr, 0);
+			bsp.SetChunkData(GBSP_CHUNK_LIGHTDATA, (const uint8*)nullptr, 0);
+			bsp.SetChunkData(GBSP_CHUNK_VISDATA, (const uint8*)nullptr, 0);
+			bsp.SetChunkData(GBSP_CHUNK_SKYDATA, (const uint8*)nullptr, 0);
+			bsp.SetChunkData(GBSP_CHUNK_PALETTES, (const uint8*)nullptr, 0);
+			bsp.SetChunkData(GBSP_CHUNK_MOTIONS, (const uint8*)nullptr, 0);
+
+			stats.Models = (int32)models.size();
+			stats.Planes = planes.size() / 2;
+			stats.Nodes = (int32)gfxNodes.size();
+			stats.Leafs = (int32)gfxLeafs.size();
+			stats.Faces = (int32)gfxFaces.size();
+			stats.Verts = (int32)verts.size();
+			stats.ParallelSubtrees = parallelSubtrees;
+			stats.ArenaPeak = treePeak + arena.GetStats().PeakReserved;
+		}
+	};
+
+	//========================================================================================
+	//	CreateBsp()
+	//	Reads the .map at mapPath and compiles it natively into bsp, in memory
+	//========================================================================================
+	inline bool CreateBsp(const std::string& mapPath, BspFile& bsp, const BspParms& parms, int numThreads) {
+		auto start = std::chrono::steady_clock::now();
+
+		MapFile map;
+		if (!map.Load(mapPath, numThreads)) {
+			printf("Error: %s\n", map.GetError().c_str());
+			return false;
+		}
+		if (parms.EntityVerbose) {
+			for (int32 e = 0; e < (int32)map.Entities.size(); e++) {
+				printf("Entity %4d: %-24s %d brush(es)\n", e, map.ValueForKey(e, "classname").c_str(), map.Entities[e].NumBrushes);
+			}
+		}
+
+		NativeBsp compiler(parms, numThreads);
+		printf("Native bsp: %d thread(s)\n", ResolveNumThreads(numThreads));
+		bsp.Close();
+		if (!compiler.Compile(map, bsp)) {
+			printf("Error: Unable to compile %s: %s\n", mapPath.c_str(), compiler.GetError().c_str());
+			return false;
+		}
+
+		const BspStats& stats = compiler.GetStats();
+		if (stats.SkippedBrushes) {
+			printf("Warning: %d hint or bad brush(es) were left out\n", stats.SkippedBrushes);
+		}
+		if (parms.Verbose) {
+			printf("Num brushes          : %d\n", stats.Brushes);
+			printf("Num models           : %d\n", stats.Models);
+			printf("Num CSG fragments    : %d\n", stats.Fragments);
+			printf("Num planes           : %d\n", stats.Planes);
+			printf("Num nodes            : %d\n", stats.Nodes);
+			printf("Num leafs            : %d\n", stats.Leafs);
+			printf("Num outside leafs    : %d\n", stats.OutsideLeafs);
+			printf("Num clusters         : %d\n", stats.Clusters);
+			printf("Num portals          : %d\n", stats.Portals);
+			printf("Num faces            : %d\n", stats.Faces);
+			printf("Num verts            : %d\n", stats.Verts);
+			printf("Parallel subtrees    : %d\n", stats.ParallelSubtrees);
+			printf("Brush side memory    : %.1f MB at most\n", stats.ArenaPeak / (1024.0 * 1024.0));
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("Native bsp finished in %.2f seconds\n", seconds);
+		return true;
+	}
+
+	//========================================================================================
+	//	CreateBspFile()
+	//	Reads the .map at mapPath, compiles it natively and writes bspPath
+	//========================================================================================
+	inline bool CreateBspFile(const std::string& mapPath, const std::string& bspPath, const BspParms& parms, int numThreads) {
+		BspFile bsp;
+		if (!CreateBsp(mapPath, bsp, parms, numThreads)) {
+			return false;
+		}
+		if (!bsp.Save(bspPath)) {
+			printf("Error: %s\n", bsp.GetError().c_str());
+			return false;
+		}
+		return true;
+	}
+};
+
+#endif // GBSPTOOLS_NATIVEBSP_H
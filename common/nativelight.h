@@ -0,0 +1,1502 @@
+/****************************************************************************************/
+/*  nativelight.h
+/*
+/*  Author: rtxa
+/*  Description: Native direct lighting of a .BSP, spread across all the cores
+/*
+/*	Follows what GBSPLib does for direct light so the results can replace each other:
+/*	lightmaps are sampled every LGRID_SIZE units along the normalized texture vectors,
+/*	each lit face stores a one byte RGB flag followed by an RGB map per light style
+/*	in the lightdata chunk, and gouraud/flat faces get vertex colors instead.
+/*
+/*	Light sources:
+/*	- "light" entities: "light" intensity (300), "color" r g b (255 255 255), "style"
+/*	- "spotlight" entities: same keys plus "angles" for the direction and "arc" in degrees
+/*	- faces with TEXINFO_LIGHT emit their FaceLight from sample points over the face
+/*
+/*	Shadows come from the faces of the world model (see bvh.h), not from its leafs.
+/*
+/*	ExtraSamples averages five samples in every luxel. The Adaptive sampler instead
+/*	takes the center of every luxel first and only supersamples the luxels that differ
+/*	from their neighbours by more than Contrast (shadow edges), on the largest grid
+/*	around the center that fits in MaxSamples (5, 9, 17... 65). With MaxSamples 5
+/*	those luxels come out exactly as with ExtraSamples.
+/*
+/*	With Radiosity, faces are split into patches every PatchSize units (twice that with
+/*	FastPatch) that bounce the direct light around (see radiosity.h). Patches split into
+/*	four, down to MinPatchSize, where the direct light across them changes a lot, which
+/*	puts small patches on shadow edges and next to lights only. The reflectivity
+/*	of a patch is the average color of its texture times both ReflectiveScales. The
+/*	bounce light of the patches is blended into the base style of their face.
+/*	Given a Checkpoint the radiosity saves its progress there (see radiosity.h).
+/*
+/*	Given a LightCache of the last run (direct light only), faces that are reached by
+/*	exactly the same lights as then, in the same order, keep their lighting from the
+/*	.bsp: moving a light only relights the faces within its range, before and after.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_NATIVELIGHT_H
+#define GBSPTOOLS_NATIVELIGHT_H
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "gbsplib.h"
+#include "mathlib.h"
+#include "arena.h"
+#include "bspfile.h"
+#include "bvh.h"
+#include "cancel.h"
+#include "checkpoint.h"
+#include "entities.h"
+#include "hash.h"
+#include "lightcache.h"
+#include "radiosity.h"
+#include "threads.h"
+#include "vecbatch.h"
+
+#define LGRID_SIZE					16.0f
+#define LIGHT_DEFAULT_INTENSITY		300.0f
+#define LIGHT_SURFACE_SPACING		32.0f		// distance between surface light samples
+#define LIGHT_SURFACE_MIN_DIST		16.0f		// keeps 1/d^2 from blowing up next to the emitter
+#define LIGHT_SAMPLE_EPSILON		0.5f		// samples are lifted this much off the face
+#define LIGHT_MAX_LUXELS			(256 * 256)
+#define LIGHT_RAY_PACKET			8			// shadow rays traced together, see Bvh::Occluded8()
+#define LIGHT_DEG_TO_RAD			(3.14159265f / 180.0f)
+#define LIGHT_DEFAULT_REFLECTIVITY	0.5f		// for faces whose texture can't be read
+#define LIGHT_DEFAULT_CONTRAST		0.05f		// of the adaptive sampler
+#define LIGHT_DEFAULT_MAX_SAMPLES	5
+#define LIGHT_MAX_SAMPLE_GRID		8			// supersampled luxels take 8 x 8 samples and the center at most
+#define LIGHT_CONTRAST_FLOOR		16.0f		// keeps dim luxels from looking contrasted
+#define RADIOSITY_SUBDIVIDE_CONTRAST	0.25f		// patches split when the direct light across them changes more than this
+#define RADIOSITY_CONTRAST_FLOOR	16.0f		// keeps dim areas from looking contrasted
+
+namespace GBSPTools {
+	typedef struct {
+		geBoolean	Adaptive;				// supersample the contrasted luxels only, instead of ExtraSamples
+		geFloat		Contrast;				// luxels this far off their neighbours are supersampled
+		int32		MaxSamples;				// per supersampled luxel, the center one included
+	} SampleParms;
+
+	typedef struct {
+		int32		Lights;
+		int32		LitFaces;
+		int32		VertexFaces;
+		int32		Luxels;
+		int32		DroppedStyles;			// faces touched by more than MAX_LTYPE_INDEX styles
+		long long	Rays;
+		int32		Patches;
+		int32		PatchSplits;
+		bool		PatchBudgetHit;			// the memory budget stopped the subdivision
+		int32		Shots;
+		int32		ResumedShots;			// taken from the checkpoint
+		geFloat		Unshot;					// radiosity power left unshot, as a fraction
+		long long	BounceRays;
+		long long	ArenaPeak;				// bytes the luxel colors took at most
+		int32		KeptFaces;				// lighting kept from the .bsp, see LightCache
+		int32		SupersampledLuxels;		// by the adaptive sampler
+	} LightStats;
+
+	class NativeLight {
+	public:
+		NativeLight(const LightParms& parms, const RadiosityParms& radiosity, const SampleParms& sampling, int numThreads) : parms(parms), radiosity(radiosity), sampling(sampling), numThreads(numThreads) {
+			memset(&stats, 0, sizeof(stats));
+		}
+
+		const std::string& GetError() const { return error; }
+		const LightStats& GetStats() const { return stats; }
+		const std::vector<LightSource>& GetLights() const { return lights; }
+		// Why the cache given to Light() couldn't be used, empty when it could or was empty
+		const std::string& GetCacheMiss() const { return cacheMiss; }
+
+		//========================================================================================
+		//	Light()
+		//	Relights every face of bsp, replacing its lightdata, faces and rgb verts chunks.
+		//	Nothing is written to disk, the caller saves or updates the file. With a cache
+		//	(no radiosity), the faces it shows unchanged keep their lighting and the cache
+		//	is updated to this run.
+		//========================================================================================
+		bool Light(BspFile& bsp, LightCache* cache = nullptr, Checkpoint* checkpoint = nullptr) {
+			if (!LoadGeometry(bsp) || !LoadLights(bsp)) {
+				return false;
+			}
+			if (parms.Radiosity) {
+				cache = nullptr;		// the bounces carry every light to every face
+				SolveRadiosity(bsp, checkpoint);
+			}
+			if (IsCancelRequested()) {
+				error = "canceled during radiosity";
+				return false;
+			}
+
+			std::vector<FaceResult> results(faces.size());
+			std::vector<uint8> kept(faces.size(), 0);
+			std::string geometryHash;
+			if (cache != nullptr) {
+				geometryHash = HashGeometry(bsp);
+				KeepLighting(bsp, *cache, geometryHash, results, kept);
+			}
+			std::atomic<long long> rays(0);
+
+			// expensive faces (big lightmaps) first so they don't end up last on one thread
+			std::vector<int> order(faces.size());
+			for (int32 i = 0; i < faces.size(); i++) {
+				order[i] = i;
+			}
+			std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+				return (long long)faces[a].LWidth * faces[a].LHeight > (long long)faces[b].LWidth * faces[b].LHeight;
+			});
+
+			std::atomic<int32> lit(0);
+			WorkStealingFor(faces.size(), numThreads, [&](int face) {
+				if (IsCancelRequested() || kept[face]) {
+					return;
+				}
+				long long faceRays = 0;
+				LightFace(face, results[face], faceRays);
+				rays += faceRays;
+				lit++;
+			}, &order);
+
+			stats.Rays = rays;
+			stats.ArenaPeak = arena.GetStats().PeakReserved;
+			if (IsCancelRequested()) {
+				error = "canceled with " + std::to_string(lit) + " of " + std::to_string(faces.size() - stats.KeptFaces) + " faces lit";
+				return false;
+			}
+			if (!WriteResults(bsp, results)) {
+				return false;
+			}
+			if (cache != nullptr) {
+				cache->Set(geometryHash, lightingHash, lights);
+			}
+			return true;
+		}
+
+	private:
+		typedef struct {
+			geVec3d		Normal;
+			geFloat		Dist;
+			geVec3d		Vecs[2];				// normalized texture vectors
+			geVec3d		Centroid;
+			geVec3d		Mins;
+			geVec3d		Maxs;
+			int32		LMins[2];
+			int32		LWidth;
+			int32		LHeight;
+			bool		Lightmapped;
+			bool		VertexLit;
+			geFloat		Winding;				// 1 when the verts go counter clockwise seen from the front, -1 otherwise
+			int32		FirstPatch;
+			int32		NumPatches;
+			geVec3d		PatchAxes[2];			// in plane axes of the patch grid, the first along the first edge
+		} FaceInfo;
+
+		typedef struct {
+			int32		Face;
+			geFloat		U;						// center, in the patch frame of the face
+			geFloat		V;
+			geFloat		Size;
+			geVec3d		Direct;
+			geFloat		Contrast;				// worth splitting above RADIOSITY_SUBDIVIDE_CONTRAST
+			bool		Evaluated;
+		} PatchCell;
+
+		typedef struct {
+			std::vector<uint8> Data;			// RGB maps, one per style
+			uint8		Styles[MAX_LTYPE_INDEX];
+			int32		NumStyles;
+			std::vector<geVec3d> VertColors;
+			int32		Luxels;
+			int32		Supersampled;			// luxels the adaptive sampler refined
+			bool		DroppedStyles;
+		} FaceResult;
+
+		LightParms parms;
+		RadiosityParms radiosity;
+		SampleParms sampling;
+		int numThreads;
+		std::string error;
+		std::string cacheMiss;
+		std::string lightingHash;		// of the chunks WriteResults() made
+		LightStats stats;
+		mutable Arena arena;			// the luxel colors of the faces being lit, on every thread
+
+		Bvh bvh;
+		Span<const GFX_Face> faces;
+		Span<const GFX_Plane> planes;
+		Span<const GFX_TexInfo> texInfos;
+		Span<const int32> vertIndex;
+		Span<const geVec3d> verts;
+		std::vector<FaceInfo> faceInfos;
+		std::vector<LightSource> lights;
+		VecSoA lightOrigins;			// of the lights, for FindCandidates()
+		std::vector<RadiosityPatch> patches;
+
+		geVec3d FaceVert(const GFX_Face& face, int32 i) const {
+			return verts[vertIndex[face.FirstVert + i]];
+		}
+
+		bool LoadGeometry(const BspFile& bsp) {
+			faces = bsp.GetChunkData<GFX_Face>(GBSP_CHUNK_FACES);
+			planes = bsp.GetChunkData<GFX_Plane>(GBSP_CHUNK_PLANES);
+			texInfos = bsp.GetChunkData<GFX_TexInfo>(GBSP_CHUNK_TEXINFO);
+			vertIndex = bsp.GetChunkData<int32>(GBSP_CHUNK_VERT_INDEX);
+			verts = bsp.GetChunkData<geVec3d>(GBSP_CHUNK_VERTS);
+
+			if (!bvh.Build(bsp)) {
+				error = bvh.GetError();
+				return false;
+			}
+			if (faces.empty() || texInfos.empty() || vertIndex.empty() || verts.empty()) {
+				error = "missing or bad face, texinfo or vertex chunks";
+				return false;
+			}
+
+			faceInfos.resize(faces.size());
+			for (int32 i = 0; i < faces.size(); i++) {
+				const GFX_Face& face = faces[i];
+				FaceInfo& info = faceInfos[i];
+				memset(&info, 0, sizeof(info));
+
+				if (face.NumVerts < 3 || face.FirstVert < 0 || face.FirstVert + face.NumVerts > vertIndex.size()
+					|| face.PlaneNum < 0 || face.PlaneNum >= planes.size() || face.TexInfo < 0 || face.TexInfo >= texInfos.size()) {
+					error = "face " + std::to_string(i) + " is out of range";
+					return false;
+				}
+				for (int32 v = 0; v < face.NumVerts; v++) {
+					int32 index = vertIndex[face.FirstVert + v];
+					if (index < 0 || index >= verts.size()) {
+						error = "face " + std::to_string(i) + " has a bad vertex";
+						return false;
+					}
+				}
+
+				const GFX_Plane& plane = planes[face.PlaneNum];
+				info.Normal = plane.Normal;
+				info.Dist = plane.Dist;
+				if (face.PlaneSide) {
+					geVec3d_Inverse(&info.Normal);
+					info.Dist = -plane.Dist;
+				}
+
+				const GFX_TexInfo& tex = texInfos[face.TexInfo];
+				info.Lightmapped = !(tex.Flags & (TEXINFO_NO_LIGHTMAP | TEXINFO_SKY | TEXINFO_FULLBRIGHT | TEXINFO_GOURAUD | TEXINFO_FLAT));
+				info.VertexLit = (tex.Flags & (TEXINFO_GOURAUD | TEXINFO_FLAT)) && !(tex.Flags & (TEXINFO_SKY | TEXINFO_FULLBRIGHT));
+
+				ClearBounds(&info.Mins, &info.Maxs);
+				geVec3d_Clear(&info.Centroid);
+				for (int32 v = 0; v < face.NumVerts; v++) {
+					geVec3d p = FaceVert(face, v);
+					geVec3d_Add(&info.Centroid, &p, &info.Centroid);
+					AddPointToBounds(&p, &info.Mins, &info.Maxs);
+				}
+				geVec3d_Scale(&info.Centroid, 1.0f / face.NumVerts, &info.Centroid);
+				info.Winding = SignedArea(face, info) < 0.0f ? -1.0f : 1.0f;
+
+				for (int axis = 0; axis < 2; axis++) {
+					info.Vecs[axis] = tex.Vecs[axis];
+					if (geVec3d_Normalize(&info.Vecs[axis]) == 0.0f) {
+						info.Lightmapped = false;
+					}
+				}
+
+				// lightmap extents in LGRID_SIZE units along the texture vectors
+				geFloat mins[2] = { MIN_MAX_BOUNDS, MIN_MAX_BOUNDS };
+				geFloat maxs[2] = { -MIN_MAX_BOUNDS, -MIN_MAX_BOUNDS };
+				for (int32 v = 0; v < face.NumVerts; v++) {
+					geVec3d p = FaceVert(face, v);
+					for (int axis = 0; axis < 2; axis++) {
+						geFloat d = geVec3d_DotProduct(&p, &info.Vecs[axis]);
+						mins[axis] = d < mins[axis] ? d : mins[axis];
+						maxs[axis] = d > maxs[axis] ? d : maxs[axis];
+					}
+				}
+				for (int axis = 0; axis < 2; axis++) {
+					info.LMins[axis] = (int32)floorf(mins[axis] / LGRID_SIZE);
+				}
+				info.LWidth = (int32)ceilf(maxs[0] / LGRID_SIZE) - info.LMins[0] + 1;
+				info.LHeight = (int32)ceilf(maxs[1] / LGRID_SIZE) - info.LMins[1] + 1;
+				if (info.Lightmapped && (info.LWidth <= 0 || info.LHeight <= 0 || info.LWidth * info.LHeight > LIGHT_MAX_LUXELS)) {
+					error = "face " + std::to_string(i) + " has a bad lightmap size";
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// Direction the "angles" key (pitch yaw roll, degrees) points at: -Z rotated by X, Y then Z
+		static geVec3d AnglesToDirection(const geVec3d& angles) {
+			const geFloat toRad = LIGHT_DEG_TO_RAD;
+			geFloat sx = sinf(angles.X * toRad), cx = cosf(angles.X * toRad);
+			geFloat sy = sinf(angles.Y * toRad), cy = cosf(angles.Y * toRad);
+			geFloat sz = sinf(angles.Z * toRad), cz = cosf(angles.Z * toRad);
+			geVec3d d;
+			geVec3d_Set(&d, 0.0f, sx, -cx);
+			geVec3d_Set(&d, d.X * cy + d.Z * sy, d.Y, -d.X * sy + d.Z * cy);
+			geVec3d_Set(&d, d.X * cz - d.Y * sz, d.X * sz + d.Y * cz, d.Z);
+			return d;
+		}
+
+		bool LoadLights(const BspFile& bsp) {
+			Span<const char> entData = bsp.GetChunkData<char>(GBSP_CHUNK_ENTDATA);
+			std::vector<Entity> entities;
+			if (!ParseEntities(entData.GetData(), entData.size(), entities)) {
+				error = "bad entity data";
+				return false;
+			}
+
+			const geVec3d white = { 255.0f, 255.0f, 255.0f };
+			const geVec3d zero = VecOrigin;
+
+			for (const Entity& entity : entities) {
+				bool isSpot = entity.IsClass("spotlight");
+				if (!isSpot && !entity.IsClass("light")) {
+					continue;
+				}
+
+				LightSource light;
+				memset(&light, 0, sizeof(light));
+				light.Type = isSpot ? LIGHT_SPOT : LIGHT_POINT;
+				light.Origin = entity.GetVector("origin", zero);
+				light.Color = entity.GetVector("color", white);
+				geVec3d_Scale(&light.Color, 1.0f / 255.0f, &light.Color);
+				light.Intensity = entity.GetFloat("light", LIGHT_DEFAULT_INTENSITY);
+				light.Style = (int32)entity.GetFloat("style", 0.0f);
+				light.Face = -1;
+				if (isSpot) {
+					light.Normal = AnglesToDirection(entity.GetVector("angles", zero));
+					light.Cone = cosf(entity.GetFloat("arc", 45.0f) * 0.5f * LIGHT_DEG_TO_RAD);
+				}
+				if (light.Intensity > 0.0f && light.Style >= 0 && light.Style < 255) {
+					lights.push_back(light);
+				}
+			}
+
+			// surface lights, sampled on a grid over the emitting faces
+			for (int32 i = 0; i < faces.size(); i++) {
+				const GFX_Face& face = faces[i];
+				const GFX_TexInfo& tex = texInfos[face.TexInfo];
+				if (!(tex.Flags & TEXINFO_LIGHT) || tex.FaceLight <= 0) {
+					continue;
+				}
+				const FaceInfo& info = faceInfos[i];
+
+				std::vector<geVec3d> points;
+				geFloat area = FaceArea(face, info);
+				SampleSurface(face, info, LIGHT_SURFACE_SPACING, points);
+				if (points.empty()) {
+					points.push_back(info.Centroid);
+				}
+
+				for (const geVec3d& p : points) {
+					LightSource light;
+					memset(&light, 0, sizeof(light));
+					light.Type = LIGHT_SURFACE;
+					geVec3d_AddScaled(&p, &info.Normal, 1.0f, &light.Origin);
+					geVec3d_Set(&light.Color, 1.0f, 1.0f, 1.0f);
+					light.Intensity = (geFloat)tex.FaceLight;
+					light.Normal = info.Normal;
+					light.Area = area / points.size();
+					light.Face = i;
+					lights.push_back(light);
+				}
+			}
+
+			lightOrigins.clear();
+			for (const LightSource& light : lights) {
+				lightOrigins.Append(&light.Origin, 1);
+			}
+			stats.Lights = (int32)lights.size();
+			return true;
+		}
+
+		geFloat SignedArea(const GFX_Face& face, const FaceInfo& info) const {
+			geVec3d p0 = FaceVert(face, 0);
+			geFloat area = 0.0f;
+			for (int32 v = 2; v < face.NumVerts; v++) {
+				geVec3d a = FaceVert(face, v - 1), b = FaceVert(face, v), cross;
+				geVec3d_Subtract(&a, &p0, &a);
+				geVec3d_Subtract(&b, &p0, &b);
+				geVec3d_CrossProduct(&a, &b, &cross);
+				area += geVec3d_DotProduct(&cross, &info.Normal) * 0.5f;
+			}
+			return area;
+		}
+
+		geFloat FaceArea(const GFX_Face& face, const FaceInfo& info) const {
+			return SignedArea(face, info) * info.Winding;
+		}
+
+		bool PointInFace(const GFX_Face& face, const FaceInfo& info, const geVec3d& p) const {
+			for (int32 v = 0; v < face.NumVerts; v++) {
+				geVec3d a = FaceVert(face, v);
+				geVec3d b = FaceVert(face, (v + 1) % face.NumVerts);
+				geVec3d edge, edgeNormal, toPoint;
+				geVec3d_Subtract(&b, &a, &edge);
+				geVec3d_CrossProduct(&edge, &info.Normal, &edgeNormal);
+				geVec3d_Subtract(&p, &a, &toPoint);
+				if (geVec3d_DotProduct(&toPoint, &edgeNormal) * info.Winding > 0.01f) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// Points spacing units apart over the face, on a grid aligned with its first edge
+		void SampleSurface(const GFX_Face& face, const FaceInfo& info, geFloat spacing, std::vector<geVec3d>& points) const {
+			geVec3d u = FaceVert(face, 1), v = FaceVert(face, 0);
+			geVec3d_Subtract(&u, &v, &u);
+			if (geVec3d_Normalize(&u) == 0.0f) {
+				return;
+			}
+			geVec3d_CrossProduct(&info.Normal, &u, &v);
+			geFloat umin = MIN_MAX_BOUNDS, umax = -MIN_MAX_BOUNDS, vmin = MIN_MAX_BOUNDS, vmax = -MIN_MAX_BOUNDS;
+			for (int32 i = 0; i < face.NumVerts; i++) {
+				geVec3d p = FaceVert(face, i);
+				geVec3d_Subtract(&p, &info.Centroid, &p);
+				geFloat du = geVec3d_DotProduct(&p, &u), dv = geVec3d_DotProduct(&p, &v);
+				umin = du < umin ? du : umin;
+				umax = du > umax ? du : umax;
+				vmin = dv < vmin ? dv : vmin;
+				vmax = dv > vmax ? dv : vmax;
+			}
+			for (geFloat du = umin + spacing * 0.5f; du < umax; du += spacing) {
+				for (geFloat dv = vmin + spacing * 0.5f; dv < vmax; dv += spacing) {
+					geVec3d p;
+					geVec3d_AddScaled(&info.Centroid, &u, du, &p);
+					geVec3d_AddScaled(&p, &v, dv, &p);
+					if (PointInFace(face, info, p)) {
+						points.push_back(p);
+					}
+				}
+			}
+		}
+
+		// Average color of every texinfo's texture times its and the global ReflectiveScale
+		void LoadReflectivity(const BspFile& bsp, std::vector<geVec3d>& reflectivity) const {
+			Span<const GFX_Texture> textures = bsp.GetChunkData<GFX_Texture>(GBSP_CHUNK_TEXTURES);
+			Span<const uint8> texData = bsp.GetChunkData<uint8>(GBSP_CHUNK_TEXDATA);
+			Span<const GFX_Palette> palettes = bsp.GetChunkData<GFX_Palette>(GBSP_CHUNK_PALETTES);
+
+			std::vector<geVec3d> average(textures.size());
+			for (int32 i = 0; i < textures.size(); i++) {
+				const GFX_Texture& texture = textures[i];
+				long long size = (long long)texture.Width * texture.Height;
+				geVec3d_Set(&average[i], LIGHT_DEFAULT_REFLECTIVITY, LIGHT_DEFAULT_REFLECTIVITY, LIGHT_DEFAULT_REFLECTIVITY);
+				if (size <= 0 || texture.Offset < 0 || texture.Offset + size > texData.size() || texture.PaletteIndex < 0 || texture.PaletteIndex >= palettes.size()) {
+					continue;
+				}
+				const GFX_Palette& palette = palettes[texture.PaletteIndex];
+				const uint8* pixels = texData.GetData() + texture.Offset;
+				double sum[3] = { 0.0, 0.0, 0.0 };
+				for (long long p = 0; p < size; p++) {
+					for (int c = 0; c < 3; c++) {
+						sum[c] += palette.RGB[pixels[p]][c];
+					}
+				}
+				geVec3d_Set(&average[i], (geFloat)(sum[0] / size / 255.0), (geFloat)(sum[1] / size / 255.0), (geFloat)(sum[2] / size / 255.0));
+			}
+
+			reflectivity.resize(texInfos.size());
+			for (int32 i = 0; i < texInfos.size(); i++) {
+				const GFX_TexInfo& tex = texInfos[i];
+				geVec3d color;
+				geVec3d_Set(&color, LIGHT_DEFAULT_REFLECTIVITY, LIGHT_DEFAULT_REFLECTIVITY, LIGHT_DEFAULT_REFLECTIVITY);
+				if (tex.Texture >= 0 && tex.Texture < (int32)average.size()) {
+					color = average[tex.Texture];
+				}
+				geVec3d_Scale(&color, tex.ReflectiveScale * parms.ReflectiveScale, &reflectivity[i]);
+			}
+		}
+
+		// World position of (u, v) in the patch frame of a face
+		geVec3d PatchPoint(const FaceInfo& info, geFloat u, geFloat v) const {
+			geVec3d p;
+			geVec3d_AddScaled(&info.Centroid, &info.PatchAxes[0], u, &p);
+			geVec3d_AddScaled(&p, &info.PatchAxes[1], v, &p);
+			return p;
+		}
+
+		// Base style direct light at p, for the patches
+		geVec3d DirectLight(const geVec3d& p, const FaceInfo& info, int32 faceNum, const std::vector<int32>& candidates, long long& rays) const {
+			static const std::vector<int32> baseSlot = []() {
+				std::vector<int32> slots(256, -1);
+				slots[0] = 0;
+				return slots;
+			}();
+			geVec3d colors[MAX_LTYPE_INDEX] = {};
+			geVec3d lifted;
+			geVec3d_AddScaled(&p, &info.Normal, LIGHT_SAMPLE_EPSILON, &lifted);
+			rays += GatherLight(lifted, info.Normal, candidates, baseSlot, colors, faceNum);
+			return colors[0];
+		}
+
+		//========================================================================================
+		//	EvaluateCell()
+		//	Direct light at the center of a cell and, when it can still be split, how much
+		//	the light at its corners differs from it (0 flat, 1 a hard shadow edge)
+		//========================================================================================
+		void EvaluateCell(PatchCell& cell, geFloat finest, const std::vector<int32>& candidates, long long& rays) const {
+			const GFX_Face& face = faces[cell.Face];
+			const FaceInfo& info = faceInfos[cell.Face];
+			cell.Direct = DirectLight(PatchPoint(info, cell.U, cell.V), info, cell.Face, candidates, rays);
+			cell.Contrast = 0.0f;
+			cell.Evaluated = true;
+			if (cell.Size * 0.5f < finest) {
+				return;
+			}
+
+			// ColorNormalize() gives the largest channel, the normalized color isn't needed
+			geVec3d normalized;
+			geFloat min = ColorNormalize(&cell.Direct, &normalized), max = min;
+			const geFloat half = cell.Size * 0.5f;
+			for (int corner = 0; corner < 4; corner++) {
+				geVec3d p = PatchPoint(info, cell.U + (corner & 1 ? half : -half), cell.V + (corner & 2 ? half : -half));
+				if (!PointInFace(face, info, p)) {
+					continue;
+				}
+				geVec3d direct = DirectLight(p, info, cell.Face, candidates, rays);
+				geFloat value = ColorNormalize(&direct, &normalized);
+				min = value < min ? value : min;
+				max = value > max ? value : max;
+			}
+			cell.Contrast = (max - min) / (max + RADIOSITY_CONTRAST_FLOOR);
+		}
+
+		//========================================================================================
+		//	BuildPatches()
+		//	Covers the lit faces with cells of the coarse patch size, then keeps splitting
+		//	the cells where the direct light changes the most into four, down to the
+		//	finest size, as long as the patches fit in the memory budget. Each round splits
+		//	every cell worth it by one level, highest contrast times area first.
+		//========================================================================================
+		void BuildPatches(const std::vector<geVec3d>& reflectivity) {
+			const geFloat coarse = parms.PatchSize > 1.0f ? parms.PatchSize * (parms.FastPatch ? 2.0f : 1.0f) : 128.0f;
+			const geFloat finest = radiosity.MinPatchSize > 0.0f && radiosity.MinPatchSize < coarse ? radiosity.MinPatchSize : coarse;
+			const size_t maxPatches = radiosity.MaxMemory > 0 ? (size_t)radiosity.MaxMemory * 1024 * 1024 / sizeof(RadiosityPatch) : 0;
+
+			std::vector<PatchCell> cells;
+			std::vector<std::vector<int32>> faceCells(faces.size());
+			for (int32 i = 0; i < faces.size(); i++) {
+				const GFX_Face& face = faces[i];
+				FaceInfo& info = faceInfos[i];
+				if (!info.Lightmapped && !info.VertexLit) {
+					continue;
+				}
+
+				// same grid as SampleSurface(), with the offsets kept for splitting
+				geVec3d first = FaceVert(face, 0);
+				info.PatchAxes[0] = FaceVert(face, 1);
+				geVec3d_Subtract(&info.PatchAxes[0], &first, &info.PatchAxes[0]);
+				geVec3d_Normalize(&info.PatchAxes[0]);
+				geVec3d_CrossProduct(&info.Normal, &info.PatchAxes[0], &info.PatchAxes[1]);
+				geFloat umin = MIN_MAX_BOUNDS, umax = -MIN_MAX_BOUNDS, vmin = MIN_MAX_BOUNDS, vmax = -MIN_MAX_BOUNDS;
+				for (int32 v = 0; v < face.NumVerts; v++) {
+					geVec3d p = FaceVert(face, v);
+					geVec3d_Subtract(&p, &info.Centroid, &p);
+					geFloat du = geVec3d_DotProduct(&p, &info.PatchAxes[0]), dv = geVec3d_DotProduct(&p, &info.PatchAxes[1]);
+					umin = du < umin ? du : umin;
+					umax = du > umax ? du : umax;
+					vmin = dv < vmin ? dv : vmin;
+					vmax = dv > vmax ? dv : vmax;
+				}
+
+				PatchCell cell;
+				memset(&cell, 0, sizeof(cell));
+				cell.Face = i;
+				cell.Size = coarse;
+				for (geFloat du = umin + coarse * 0.5f; du < umax; du += coarse) {
+					for (geFloat dv = vmin + coarse * 0.5f; dv < vmax; dv += coarse) {
+						if (PointInFace(face, info, PatchPoint(info, du, dv))) {
+							cell.U = du;
+							cell.V = dv;
+							faceCells[i].push_back((int32)cells.size());
+							cells.push_back(cell);
+						}
+					}
+				}
+				if (faceCells[i].empty()) {
+					cell.U = cell.V = 0.0f;
+					faceCells[i].push_back((int32)cells.size());
+					cells.push_back(cell);
+				}
+			}
+
+			std::vector<std::vector<int32>> faceCandidates(faces.size());
+			std::atomic<long long> rays(0);
+			for (;;) {
+				WorkStealingFor(faces.size(), numThreads, [&](int faceNum) {
+					if (faceCells[faceNum].empty()) {
+						return;
+					}
+					std::vector<int32>& candidates = faceCandidates[faceNum];
+					if (candidates.empty()) {
+						FindCandidates(faceInfos[faceNum], candidates);
+					}
+					long long faceRays = 0;
+					for (int32 index : faceCells[faceNum]) {
+						if (!cells[index].Evaluated) {
+							EvaluateCell(cells[index], finest, candidates, faceRays);
+						}
+					}
+					rays += faceRays;
+				});
+
+				std::vector<int32> splits;
+				for (int32 i = 0; i < (int32)cells.size(); i++) {
+					if (cells[i].Contrast > RADIOSITY_SUBDIVIDE_CONTRAST) {
+						splits.push_back(i);
+					}
+				}
+				std::sort(splits.begin(), splits.end(), [&](int32 a, int32 b) {
+					return cells[a].Contrast * cells[a].Size * cells[a].Size > cells[b].Contrast * cells[b].Size * cells[b].Size;
+				});
+
+				// a split turns one patch into up to four
+				size_t room = maxPatches ? (maxPatches > cells.size() ? (maxPatches - cells.size()) / 3 : 0) : splits.size();
+				if (splits.size() > room) {
+					stats.PatchBudgetHit = true;
+					splits.resize(room);
+				}
+				if (splits.empty() || IsCancelRequested()) {
+					break;
+				}
+
+				for (int32 index : splits) {
+					const PatchCell parent = cells[index];
+					const GFX_Face& face = faces[parent.Face];
+					const FaceInfo& info = faceInfos[parent.Face];
+					const geFloat quarter = parent.Size * 0.25f;
+					bool first = true;
+					for (int child = 0; child < 4; child++) {
+						PatchCell cell = parent;
+						cell.U += child & 1 ? quarter : -quarter;
+						cell.V += child & 2 ? quarter : -quarter;
+						cell.Size = parent.Size * 0.5f;
+						cell.Evaluated = false;
+						if (!PointInFace(face, info, PatchPoint(info, cell.U, cell.V))) {
+							continue;
+						}
+						if (first) {
+							cells[index] = cell;
+							first = false;
+						}
+						else {
+							faceCells[parent.Face].push_back((int32)cells.size());
+							cells.push_back(cell);
+						}
+					}
+					if (first) {
+						// every child center is off the face, keep the parent as it is
+						cells[index].Contrast = 0.0f;
+					}
+					else {
+						stats.PatchSplits++;
+					}
+				}
+			}
+
+			// patches of a face are contiguous and share its area by their size
+			for (int32 i = 0; i < faces.size(); i++) {
+				const GFX_Face& face = faces[i];
+				FaceInfo& info = faceInfos[i];
+				info.FirstPatch = (int32)patches.size();
+				info.NumPatches = (int32)faceCells[i].size();
+				if (!info.NumPatches) {
+					continue;
+				}
+
+				geFloat total = 0.0f;
+				for (int32 index : faceCells[i]) {
+					total += cells[index].Size * cells[index].Size;
+				}
+				geFloat area = FaceArea(face, info);
+				for (int32 index : faceCells[i]) {
+					const PatchCell& cell = cells[index];
+					RadiosityPatch patch;
+					memset(&patch, 0, sizeof(patch));
+					geVec3d origin = PatchPoint(info, cell.U, cell.V);
+					geVec3d_AddScaled(&origin, &info.Normal, LIGHT_SAMPLE_EPSILON, &patch.Origin);
+					patch.Normal = info.Normal;
+					patch.Area = area * cell.Size * cell.Size / total;
+					patch.Size = cell.Size;
+					patch.Reflectivity = reflectivity[face.TexInfo];
+					patch.Face = i;
+					patch.Direct = cell.Direct;
+					patches.push_back(patch);
+				}
+			}
+			stats.BounceRays += rays;
+		}
+
+		//========================================================================================
+		//	SolveRadiosity()
+		//	Splits the lit faces into patches that know their direct light (base style only,
+		//	like GBSPLib) and bounces it. -bounce caps the shots at NumBounce per patch,
+		//	what NumBounce full bounces would have cost.
+		//========================================================================================
+		void SolveRadiosity(const BspFile& bsp, Checkpoint* checkpoint) {
+			std::vector<geVec3d> reflectivity;
+			LoadReflectivity(bsp, reflectivity);
+			BuildPatches(reflectivity);
+			if (IsCancelRequested()) {
+				// not every patch is there, it would spoil the checkpoint
+				return;
+			}
+
+			RadiositySolver solver(radiosity, numThreads);
+			solver.Solve(patches, bvh, (long long)parms.NumBounce * (long long)patches.size(), checkpoint);
+
+			const RadiosityStats& result = solver.GetStats();
+			stats.Patches = (int32)patches.size();
+			stats.Shots = result.Shots;
+			stats.ResumedShots = result.ResumedShots;
+			stats.Unshot = result.Remaining;
+			stats.BounceRays += result.Rays;
+		}
+
+		//========================================================================================
+		//	BounceLight()
+		//	Radiosity light at p, blended from the patches of its face with a tent filter
+		//	one and a half patches wide, or from the nearest one when none is that close
+		//========================================================================================
+		geVec3d BounceLight(const FaceInfo& info, const geVec3d& p) const {
+			geVec3d sum;
+			geVec3d_Clear(&sum);
+			if (!info.NumPatches) {
+				return sum;
+			}
+			geFloat total = 0.0f, nearest = MIN_MAX_BOUNDS2;
+			int32 closest = info.FirstPatch;
+			for (int32 i = info.FirstPatch; i < info.FirstPatch + info.NumPatches; i++) {
+				geFloat dist = geVec3d_DistanceBetween(&patches[i].Origin, &p);
+				geFloat radius = patches[i].Size * 1.5f;
+				if (dist < nearest) {
+					nearest = dist;
+					closest = i;
+				}
+				if (dist < radius) {
+					geFloat weight = 1.0f - dist / radius;
+					geVec3d_MA(&sum, weight, &patches[i].Bounce, &sum);
+					total += weight;
+				}
+			}
+			if (total <= 0.0f) {
+				return patches[closest].Bounce;
+			}
+			geVec3d_Scale(&sum, 1.0f / total, &sum);
+			return sum;
+		}
+
+		//========================================================================================
+		//	GatherLight()
+		//	Adds the light reaching point p (facing normal) from every candidate light,
+		//	one color per style slot. Shadow rays are traced in packets of
+		//	LIGHT_RAY_PACKET. Returns the number of shadow rays traced.
+		//========================================================================================
+		int GatherLight(const geVec3d& p, const geVec3d& normal, const std::vector<int32>& candidates, const std::vector<int32>& slotOf, geVec3d* colors, int32 selfFace) const {
+			geVec3d starts[LIGHT_RAY_PACKET];
+			geVec3d ends[LIGHT_RAY_PACKET];
+			geVec3d adds[LIGHT_RAY_PACKET];
+			int32 slots[LIGHT_RAY_PACKET];
+			int pending = 0;
+			int rays = 0;
+
+			auto flush = [&]() {
+				uint32 blocked = bvh.Occluded8(starts, ends, pending);
+				for (int i = 0; i < pending; i++) {
+					if (!(blocked & (1u << i))) {
+						geVec3d_Add(&colors[slots[i]], &adds[i], &colors[slots[i]]);
+					}
+				}
+				rays += pending;
+				pending = 0;
+			};
+
+			for (int32 index : candidates) {
+				const LightSource& light = lights[index];
+				int32 slot = slotOf[light.Style];
+				if (light.Face == selfFace || slot < 0) {
+					continue;
+				}
+
+				geVec3d dir;
+				geVec3d_Subtract(&light.Origin, &p, &dir);
+				geFloat dist = geVec3d_Normalize(&dir);
+				geFloat angle = geVec3d_DotProduct(&dir, &normal);
+				if (angle <= 0.0f) {
+					continue;
+				}
+
+				geFloat value;
+				if (light.Type == LIGHT_SURFACE) {
+					geFloat emit = -geVec3d_DotProduct(&dir, &light.Normal);
+					if (emit <= 0.0f) {
+						continue;
+					}
+					geFloat d = dist > LIGHT_SURFACE_MIN_DIST ? dist : LIGHT_SURFACE_MIN_DIST;
+					value = light.Intensity * light.Area * angle * emit / (d * d);
+				}
+				else {
+					if (light.Type == LIGHT_SPOT && -geVec3d_DotProduct(&dir, &light.Normal) < light.Cone) {
+						continue;
+					}
+					value = (light.Intensity - dist) * angle;
+				}
+				if (value <= 0.0f) {
+					continue;
+				}
+
+				starts[pending] = p;
+				ends[pending] = light.Origin;
+				geVec3d_Scale(&light.Color, value, &adds[pending]);
+				slots[pending] = slot;
+				if (++pending == LIGHT_RAY_PACKET) {
+					flush();
+				}
+			}
+			if (pending) {
+				flush();
+			}
+			return rays;
+		}
+
+		// Whether the light can reach the face at all: in front of it and within range of its bounds
+		static bool CanReach(const LightSource& light, const FaceInfo& info) {
+			return geVec3d_DotProduct(&light.Origin, &info.Normal) - info.Dist > 0.0f && InRange(light, info);
+		}
+
+		// The range part of CanReach()
+		static bool InRange(const LightSource& light, const FaceInfo& info) {
+			if (light.Type != LIGHT_SURFACE) {
+				geFloat dx = light.Origin.X < info.Mins.X ? info.Mins.X - light.Origin.X : (light.Origin.X > info.Maxs.X ? light.Origin.X - info.Maxs.X : 0.0f);
+				geFloat dy = light.Origin.Y < info.Mins.Y ? info.Mins.Y - light.Origin.Y : (light.Origin.Y > info.Maxs.Y ? light.Origin.Y - info.Maxs.Y : 0.0f);
+				geFloat dz = light.Origin.Z < info.Mins.Z ? info.Mins.Z - light.Origin.Z : (light.Origin.Z > info.Maxs.Z ? light.Origin.Z - info.Maxs.Z : 0.0f);
+				if (dx * dx + dy * dy + dz * dz >= light.Intensity * light.Intensity) {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		// The lights that CanReach() the face, their distances to its plane taken all at once
+		void FindCandidates(const FaceInfo& info, std::vector<int32>& candidates) const {
+			static thread_local std::vector<geFloat> dists;
+			dists.resize(lights.size());
+			GetVecKernels().PlaneDists(lightOrigins.X(), lightOrigins.Y(), lightOrigins.Z(), lightOrigins.size(), info.Normal, info.Dist, dists.data());
+			for (int32 i = 0; i < (int32)lights.size(); i++) {
+				if (dists[i] > 0.0f && InRange(lights[i], info)) {
+					candidates.push_back(i);
+				}
+			}
+		}
+
+		// World position of lightmap coordinates (s, t) on the face plane
+		geVec3d LuxelToWorld(const FaceInfo& info, geFloat s, geFloat t) const {
+			geVec3d vn, nu, uv, p;
+			geVec3d_CrossProduct(&info.Vecs[1], &info.Normal, &vn);
+			geVec3d_CrossProduct(&info.Normal, &info.Vecs[0], &nu);
+			geVec3d_CrossProduct(&info.Vecs[0], &info.Vecs[1], &uv);
+			geFloat det = geVec3d_DotProduct(&info.Vecs[0], &vn);
+			geVec3d_Scale(&vn, s, &p);
+			geVec3d_AddScaled(&p, &nu, t, &p);
+			geVec3d_AddScaled(&p, &uv, info.Dist, &p);
+			geVec3d_Scale(&p, 1.0f / det, &p);
+			return p;
+		}
+
+		// Moves a sample that fell off the face back toward the centroid and lifts it off the plane
+		geVec3d FixSample(const GFX_Face& face, const FaceInfo& info, geVec3d p) const {
+			for (int i = 0; i < 8 && !PointInFace(face, info, p); i++) {
+				geVec3d_Add(&p, &info.Centroid, &p);
+				geVec3d_Scale(&p, 0.5f, &p);
+			}
+			geVec3d_AddScaled(&p, &info.Normal, LIGHT_SAMPLE_EPSILON, &p);
+			return p;
+		}
+
+		// Side of the sample grid of a supersampled luxel, 0 when maxSamples leaves no room for one.
+		// An odd grid has the center of the luxel on it, an even one takes it on top.
+		static int SampleGrid(int32 maxSamples) {
+			int grid = 0;
+			for (int side = 2; side <= LIGHT_MAX_SAMPLE_GRID; side++) {
+				if (side * side + (side % 2 ? 0 : 1) <= maxSamples) {
+					grid = side;
+				}
+			}
+			return grid;
+		}
+
+		// Adds the light at offsets [first, last) of luxel (s, t), in luxels from its center, to sum
+		int SampleLuxel(const GFX_Face& face, const FaceInfo& info, int32 faceNum, int32 s, int32 t, const geFloat offsets[][2], int first, int last,
+			const std::vector<int32>& candidates, const std::vector<int32>& slotOf, geVec3d* sum) const {
+			int rays = 0;
+			for (int o = first; o < last; o++) {
+				geFloat ws = (info.LMins[0] + s + offsets[o][0]) * LGRID_SIZE;
+				geFloat wt = (info.LMins[1] + t + offsets[o][1]) * LGRID_SIZE;
+				geVec3d p = FixSample(face, info, LuxelToWorld(info, ws, wt));
+				rays += GatherLight(p, info.Normal, candidates, slotOf, sum, faceNum);
+				geVec3d bounce = BounceLight(info, p);
+				geVec3d_Add(&sum[0], &bounce, &sum[0]);
+			}
+			return rays;
+		}
+
+		static void StoreLuxel(const FaceInfo& info, int32 s, int32 t, const geVec3d* sum, int32 numStyles, int numSamples, geVec3d* colors) {
+			const int32 luxels = info.LWidth * info.LHeight;
+			for (int32 slot = 0; slot < numStyles; slot++) {
+				geVec3d_Scale(&sum[slot], 1.0f / numSamples, &colors[(size_t)slot * luxels + t * info.LWidth + s]);
+			}
+		}
+
+		//========================================================================================
+		//	FindContrastedLuxels()
+		//	Sets refine[i] for the luxels whose light, in any style, is more than Contrast
+		//	off the mean of their two neighbours along a row, a column or a diagonal. A
+		//	smooth falloff is close to its mean, a shadow edge isn't. Past the border of the
+		//	lightmap the luxel stands in for its missing neighbour.
+		//========================================================================================
+		void FindContrastedLuxels(const FaceInfo& info, const geVec3d* colors, int32 numStyles, std::vector<uint8>& refine) const {
+			static const int32 axes[4][2] = { { 1, 0 }, { 0, 1 }, { 1, 1 }, { 1, -1 } };
+			const int32 luxels = info.LWidth * info.LHeight;
+			refine.assign(luxels, 0);
+			for (int32 slot = 0; slot < numStyles; slot++) {
+				const geFloat* maxes = LuxelMaxes(colors + (size_t)slot * luxels, luxels);
+				auto value = [&](int32 s, int32 t, geFloat outside) {
+					if (s < 0 || s >= info.LWidth || t < 0 || t >= info.LHeight) {
+						return outside;
+					}
+					return maxes[t * info.LWidth + s] * parms.LightScale;
+				};
+				for (int32 t = 0; t < info.LHeight; t++) {
+					for (int32 s = 0; s < info.LWidth; s++) {
+						const geFloat a = value(s, t, 0.0f);
+						for (int axis = 0; axis < 4 && !refine[t * info.LWidth + s]; axis++) {
+							const geFloat b = value(s - axes[axis][0], t - axes[axis][1], a);
+							const geFloat c = value(s + axes[axis][0], t + axes[axis][1], a);
+							const geFloat max = a > b ? (a > c ? a : c) : (b > c ? b : c);
+							if (fabsf(a - (b + c) * 0.5f) / (max + LIGHT_CONTRAST_FLOOR) > sampling.Contrast) {
+								refine[t * info.LWidth + s] = 1;
+							}
+						}
+					}
+				}
+			}
+		}
+
+		// The largest channel of each of the luxels, in a buffer of the calling thread that
+		// the next call reuses
+		static const geFloat* LuxelMaxes(const geVec3d* colors, int32 luxels) {
+			static thread_local VecSoA normalized;
+			static thread_local std::vector<geFloat> maxes;
+			normalized.Assign(colors, luxels);
+			maxes.resize(luxels);
+			GetVecKernels().ColorNormalize(normalized.X(), normalized.Y(), normalized.Z(), luxels, maxes.data());
+			return maxes.data();
+		}
+
+		// Style slots of the candidates, style 0 always first since minlight goes there
+		void AssignStyles(const std::vector<int32>& candidates, FaceResult& result, std::vector<int32>& slotOf) const {
+			result.Styles[result.NumStyles] = 0;
+			slotOf[0] = result.NumStyles++;
+			for (int32 index : candidates) {
+				int32 style = lights[index].Style;
+				if (slotOf[style] >= 0) {
+					continue;
+				}
+				if (result.NumStyles == MAX_LTYPE_INDEX) {
+					result.DroppedStyles = true;
+					continue;
+				}
+				result.Styles[result.NumStyles] = (uint8)style;
+				slotOf[style] = result.NumStyles++;
+			}
+		}
+
+		void LightFace(int32 faceNum, FaceResult& result, long long& rays) const {
+			const GFX_Face& face = faces[faceNum];
+			const FaceInfo& info = faceInfos[faceNum];
+			result.NumStyles = 0;
+			result.Luxels = 0;
+			result.Supersampled = 0;
+			result.DroppedStyles = false;
+			memset(result.Styles, 255, sizeof(result.Styles));
+
+			if (!info.Lightmapped && !info.VertexLit) {
+				return;
+			}
+
+			std::vector<int32> candidates;
+			FindCandidates(info, candidates);
+			std::vector<int32> slotOf(256, -1);
+			AssignStyles(candidates, result, slotOf);
+
+			if (info.VertexLit) {
+				bool flat = (texInfos[face.TexInfo].Flags & TEXINFO_FLAT) != 0;
+				result.VertColors.resize(face.NumVerts);
+				for (int32 v = 0; v < face.NumVerts; v++) {
+					geVec3d colors[MAX_LTYPE_INDEX] = {};
+					geVec3d p = info.Centroid;
+					if (!flat) {
+						geVec3d vert = FaceVert(face, v);
+						geVec3d_Subtract(&info.Centroid, &vert, &p);
+						geVec3d_AddScaled(&vert, &p, 0.01f, &p);
+					}
+					geVec3d_AddScaled(&p, &info.Normal, LIGHT_SAMPLE_EPSILON, &p);
+					rays += GatherLight(p, info.Normal, candidates, slotOf, colors, faceNum);
+					geVec3d bounce = BounceLight(info, p);
+					geVec3d_Add(&colors[0], &bounce, &colors[0]);
+					result.VertColors[v] = FinalColor(colors[0], true);
+				}
+				return;
+			}
+
+			// the center of the luxel, then the grid of the supersampled ones
+			geFloat offsets[1 + LIGHT_MAX_SAMPLE_GRID * LIGHT_MAX_SAMPLE_GRID][2] = { { 0.0f, 0.0f } };
+			const int grid = sampling.Adaptive ? SampleGrid(sampling.MaxSamples) : (parms.ExtraSamples ? 2 : 0);
+			int numOffsets = 1;
+			for (int j = 0; j < grid; j++) {
+				for (int i = 0; i < grid; i++) {
+					if (grid % 2 && i == grid / 2 && j == grid / 2) {
+						continue;			// the center is already there
+					}
+					offsets[numOffsets][0] = (i + 0.5f) / grid - 0.5f;
+					offsets[numOffsets][1] = (j + 0.5f) / grid - 0.5f;
+					numOffsets++;
+				}
+			}
+			const int32 luxels = info.LWidth * info.LHeight;
+			std::vector<geVec3d, ArenaAllocator<geVec3d>> colors((size_t)luxels * result.NumStyles, VecOrigin, ArenaAllocator<geVec3d>(&arena));
+
+			if (!sampling.Adaptive) {
+				for (int32 t = 0; t < info.LHeight; t++) {
+					for (int32 s = 0; s < info.LWidth; s++) {
+						geVec3d sum[MAX_LTYPE_INDEX] = {};
+						rays += SampleLuxel(face, info, faceNum, s, t, offsets, 0, numOffsets, candidates, slotOf, sum);
+						StoreLuxel(info, s, t, sum, result.NumStyles, numOffsets, colors.data());
+					}
+				}
+			}
+			else {
+				for (int32 t = 0; t < info.LHeight; t++) {
+					for (int32 s = 0; s < info.LWidth; s++) {
+						geVec3d sum[MAX_LTYPE_INDEX] = {};
+						rays += SampleLuxel(face, info, faceNum, s, t, offsets, 0, 1, candidates, slotOf, sum);
+						StoreLuxel(info, s, t, sum, result.NumStyles, 1, colors.data());
+					}
+				}
+
+				// the contrast is judged on the centers alone, before any luxel changes
+				std::vector<uint8> refine;
+				if (numOffsets > 1) {
+					FindContrastedLuxels(info, colors.data(), result.NumStyles, refine);
+				}
+				for (int32 i = 0; i < (int32)refine.size(); i++) {
+					if (!refine[i]) {
+						continue;
+					}
+					const int32 s = i % info.LWidth, t = i / info.LWidth;
+					geVec3d sum[MAX_LTYPE_INDEX] = {};
+					for (int32 slot = 0; slot < result.NumStyles; slot++) {
+						sum[slot] = colors[(size_t)slot * luxels + i];
+					}
+					rays += SampleLuxel(face, info, faceNum, s, t, offsets, 1, numOffsets, candidates, slotOf, sum);
+					StoreLuxel(info, s, t, sum, result.NumStyles, numOffsets, colors.data());
+					result.Supersampled++;
+				}
+			}
+
+			// drop styles that ended up black everywhere (fully shadowed lights)
+			int32 kept = 1;
+			for (int32 slot = 1; slot < result.NumStyles; slot++) {
+				const geFloat* maxes = LuxelMaxes(colors.data() + (size_t)slot * luxels, luxels);
+				bool lit = false;
+				for (int32 i = 0; i < luxels && !lit; i++) {
+					lit = maxes[i] * parms.LightScale >= 1.0f;
+				}
+				if (!lit) {
+					continue;
+				}
+				if (kept != slot) {
+					std::copy(colors.begin() + (size_t)slot * luxels, colors.begin() + (size_t)(slot + 1) * luxels, colors.begin() + (size_t)kept * luxels);
+					result.Styles[kept] = result.Styles[slot];
+				}
+				kept++;
+			}
+			for (int32 slot = kept; slot < MAX_LTYPE_INDEX; slot++) {
+				result.Styles[slot] = 255;
+			}
+			result.NumStyles = kept;
+
+			result.Data.resize((size_t)luxels * 3 * result.NumStyles);
+			uint8* out = result.Data.data();
+			static thread_local VecSoA finalColors;
+			for (int32 slot = 0; slot < result.NumStyles; slot++) {
+				finalColors.Assign(colors.data() + (size_t)slot * luxels, luxels);
+				FinalColors(finalColors, slot == 0);
+				const geFloat* r = finalColors.X();
+				const geFloat* g = finalColors.Y();
+				const geFloat* b = finalColors.Z();
+				for (int32 i = 0; i < luxels; i++) {
+					*out++ = (uint8)(r[i] + 0.5f);
+					*out++ = (uint8)(g[i] + 0.5f);
+					*out++ = (uint8)(b[i] + 0.5f);
+				}
+			}
+			result.Luxels = luxels;
+		}
+
+		// LightScale, MinLight (base style only) and a clamp to 255 that keeps the hue, in place
+		void FinalColors(VecSoA& colors, bool baseStyle) const {
+			GetVecKernels().ColorClamp(colors.X(), colors.Y(), colors.Z(), colors.size(), parms.LightScale, baseStyle ? parms.MinLight : VecOrigin, 255.0f);
+		}
+
+		geVec3d FinalColor(const geVec3d& color, bool baseStyle) const {
+			geVec3d c = color;
+			VecScalar::ColorClamp(&c.X, &c.Y, &c.Z, 1, parms.LightScale, baseStyle ? parms.MinLight : VecOrigin, 255.0f);
+			return c;
+		}
+
+		// Everything the lighting depends on but the entities: the settings and every chunk
+		// but the entities, vis, motions and the lighting chunks themselves
+		std::string HashGeometry(const BspFile& bsp) const {
+			ContentHash hash;
+			for (const BspFile::Chunk& chunk : bsp.GetChunks()) {
+				const int32 type = chunk.Header.Type;
+				if (type == GBSP_CHUNK_ENTDATA || type == GBSP_CHUNK_VISDATA || type == GBSP_CHUNK_MOTIONS
+					|| type == GBSP_CHUNK_FACES || type == GBSP_CHUNK_LIGHTDATA || type == GBSP_CHUNK_RGB_VERTS) {
+					continue;
+				}
+				hash.AddValue(chunk.Header);
+				hash.Add(chunk.Data, (size_t)chunk.Header.Size * chunk.Header.Elements);
+			}
+			LightParms used = parms;
+			used.Verbose = GE_FALSE;
+			hash.AddValue(used);
+			hash.AddValue(sampling);
+			return hash.ToString();
+		}
+
+		static std::string HashLighting(Span<const uint8> faceData, Span<const uint8> lightData, Span<const uint8> rgbVerts) {
+			ContentHash hash;
+			for (const Span<const uint8>& chunk : { faceData, lightData, rgbVerts }) {
+				hash.AddValue(chunk.size());
+				hash.Add(chunk.GetData(), chunk.size());
+			}
+			return hash.ToString();
+		}
+
+		//========================================================================================
+		//	KeepLighting()
+		//	Takes the lighting of every face the lights of the cache and the current ones
+		//	reach alike from the .bsp, as long as the geometry and the settings are the same
+		//	and the lighting chunks are still the ones the cached run wrote. Marks them kept.
+		//========================================================================================
+		void KeepLighting(const BspFile& bsp, const LightCache& cache, const std::string& geometryHash, std::vector<FaceResult>& results, std::vector<uint8>& kept) {
+			if (cache.IsEmpty()) {
+				return;
+			}
+			if (cache.GetGeometry() != geometryHash) {
+				cacheMiss = "the geometry or the light settings changed";
+				return;
+			}
+			Span<const uint8> lightData = bsp.GetChunkData<uint8>(GBSP_CHUNK_LIGHTDATA);
+			Span<const geVec3d> rgbVerts = bsp.GetChunkData<geVec3d>(GBSP_CHUNK_RGB_VERTS);
+			if (cache.GetLighting() != HashLighting(bsp.GetChunkData<uint8>(GBSP_CHUNK_FACES), lightData, bsp.GetChunkData<uint8>(GBSP_CHUNK_RGB_VERTS))
+				|| rgbVerts.size() != vertIndex.size()) {
+				cacheMiss = "the lighting of the .bsp isn't the one the cache was made with";
+				return;
+			}
+
+			const std::vector<LightSource>& oldLights = cache.GetLights();
+			std::atomic<int32> numKept(0);
+			WorkStealingFor(faces.size(), numThreads, [&](int faceNum) {
+				const GFX_Face& face = faces[faceNum];
+				const FaceInfo& info = faceInfos[faceNum];
+				FaceResult result;
+				result.NumStyles = 0;
+				result.Luxels = 0;
+				result.Supersampled = 0;
+				result.DroppedStyles = false;
+				memset(result.Styles, 255, sizeof(result.Styles));
+				if (!info.Lightmapped && !info.VertexLit) {
+					kept[faceNum] = 1;
+					numKept++;
+					return;
+				}
+
+				// the same lights in the same order add up to the same light
+				std::vector<int32> candidates;
+				FindCandidates(info, candidates);
+				size_t same = 0;
+				for (const LightSource& light : oldLights) {
+					if (!CanReach(light, info)) {
+						continue;
+					}
+					if (same == candidates.size() || memcmp(&light, &lights[candidates[same]], sizeof(LightSource)) != 0) {
+						return;
+					}
+					same++;
+				}
+				if (same != candidates.size()) {
+					return;
+				}
+
+				std::vector<int32> slotOf(256, -1);
+				AssignStyles(candidates, result, slotOf);
+				if (info.VertexLit) {
+					result.VertColors.assign(rgbVerts.begin() + face.FirstVert, rgbVerts.begin() + face.FirstVert + face.NumVerts);
+				}
+				else {
+					if (face.LightOfs < 0 || face.LWidth != info.LWidth || face.LHeight != info.LHeight) {
+						return;
+					}
+					int32 numStyles = 0;
+					while (numStyles < MAX_LTYPE_INDEX && face.LTypes[numStyles] != 255) {
+						numStyles++;
+					}
+					const int32 luxels = info.LWidth * info.LHeight;
+					const long long size = (long long)luxels * 3 * numStyles;
+					if (!numStyles || face.LightOfs + 1 + size > lightData.size()) {
+						return;
+					}
+					const uint8* data = lightData.GetData() + face.LightOfs + 1;
+					result.Data.assign(data, data + size);
+					memcpy(result.Styles, face.LTypes, sizeof(result.Styles));
+					result.NumStyles = numStyles;
+					result.Luxels = luxels;
+				}
+				results[faceNum] = std::move(result);
+				kept[faceNum] = 1;
+				numKept++;
+			});
+			stats.KeptFaces = numKept;
+		}
+
+		bool WriteResults(BspFile& bsp, const std::vector<FaceResult>& results) {
+			std::vector<GFX_Face> newFaces(faces.begin(), faces.end());
+			std::vector<uint8> lightData;
+
+			Span<const geVec3d> oldRgbVerts = bsp.GetChunkData<geVec3d>(GBSP_CHUNK_RGB_VERTS);
+			std::vector<geVec3d> rgbVerts(vertIndex.size(), VecOrigin);
+			if (oldRgbVerts.size() == vertIndex.size()) {
+				rgbVerts.assign(oldRgbVerts.begin(), oldRgbVerts.end());
+			}
+
+			for (int32 i = 0; i < faces.size(); i++) {
+				const FaceResult& result = results[i];
+				const FaceInfo& info = faceInfos[i];
+				GFX_Face& face = newFaces[i];
+
+				face.LightOfs = -1;
+				memset(face.LTypes, 255, sizeof(face.LTypes));
+				stats.DroppedStyles += result.DroppedStyles ? 1 : 0;
+
+				if (!result.VertColors.empty()) {
+					for (int32 v = 0; v < face.NumVerts; v++) {
+						rgbVerts[face.FirstVert + v] = result.VertColors[v];
+					}
+					stats.VertexFaces++;
+					continue;
+				}
+				if (result.Data.empty()) {
+					continue;
+				}
+
+				face.LightOfs = (int32)lightData.size();
+				face.LWidth = info.LWidth;
+				face.LHeight = info.LHeight;
+				memcpy(face.LTypes, result.Styles, sizeof(face.LTypes));
+
+				lightData.push_back(1);		// RGB lightmap
+				lightData.insert(lightData.end(), result.Data.begin(), result.Data.end());
+
+				stats.LitFaces++;
+				stats.Luxels += result.Luxels;
+				stats.SupersampledLuxels += result.Supersampled;
+			}
+
+			lightingHash = HashLighting(Span<const uint8>((const uint8*)newFaces.data(), (int32)(newFaces.size() * sizeof(GFX_Face))),
+				Span<const uint8>(lightData.data(), (int32)lightData.size()), Span<const uint8>((const uint8*)rgbVerts.data(), (int32)(rgbVerts.size() * sizeof(geVec3d))));
+			bsp.SetChunkData(GBSP_CHUNK_FACES, newFaces);
+			bsp.SetChunkData(GBSP_CHUNK_LIGHTDATA, lightData);
+			bsp.SetChunkData(GBSP_CHUNK_RGB_VERTS, rgbVerts);
+			return true;
+		}
+	};
+
+	//========================================================================================
+	//	LightBsp()
+	//	Lights bsp natively, in memory. Given a cachePath (direct light only), relights
+	//	just the faces whose lights changed since the run that saved the cache there.
+	//========================================================================================
+	inline bool LightBsp(BspFile& bsp, const LightParms& parms, const RadiosityParms& radiosity, const SampleParms& sampling, int numThreads, const std::string& cachePath = std::string(), const CheckpointParms& checkpointParms = CheckpointParms()) {
+		auto start = std::chrono::steady_clock::now();
+
+		LightCache cache;
+		const bool incremental = !parms.Radiosity && !cachePath.empty();
+		if (incremental && !cache.Load(cachePath)) {
+			printf("Warning: Ignoring the light cache: %s\n", cache.GetError().c_str());
+		}
+
+		// only the radiosity is saved, the verbose flag doesn't change it
+		CheckpointParms checkpointUsed = checkpointParms;
+		ContentHash input;
+		if (!parms.Radiosity) {
+			checkpointUsed.Path.clear();
+		}
+		AddCheckpointInput(input, bsp);
+		LightParms inputParms = parms;
+		inputParms.Verbose = GE_FALSE;
+		input.AddValue(inputParms);
+		input.AddValue(radiosity);
+		Checkpoint checkpoint(checkpointUsed, "glight", input.ToString());
+		if (!checkpoint.Load()) {
+			printf("Warning: Starting over: %s\n", checkpoint.GetError().c_str());
+		}
+
+		NativeLight light(parms, radiosity, sampling, numThreads);
+		printf("Native light: %d thread(s)\n", ResolveNumThreads(numThreads));
+		if (!light.Light(bsp, incremental ? &cache : nullptr, checkpoint.IsEnabled() ? &checkpoint : nullptr)) {
+			printf("Error: Unable to light the BSP: %s\n", light.GetError().c_str());
+			if (light.GetStats().Shots > 0 && checkpoint.IsEnabled()) {
+				printf("Saved the radiosity to %s, -resume goes on from there\n", checkpoint.GetPath().c_str());
+			}
+			return false;
+		}
+
+		const LightStats& stats = light.GetStats();
+		if (!checkpoint.GetResumeData().empty()) {
+			printf("Resumed %d radiosity shots from %s\n", stats.ResumedShots, checkpoint.GetPath().c_str());
+		}
+		if (!light.GetCacheMiss().empty()) {
+			printf("Relighting every face, the light cache is out of date: %s\n", light.GetCacheMiss().c_str());
+		}
+		else if (incremental && stats.KeptFaces) {
+			const int32 numFaces = bsp.GetChunkData<GFX_Face>(GBSP_CHUNK_FACES).size();
+			printf("Relit %d of %d faces, kept the others from %s\n", numFaces - stats.KeptFaces, numFaces, cachePath.c_str());
+		}
+		if (parms.Verbose) {
+			printf("Num lights           : %d\n", stats.Lights);
+			printf("Num lit faces        : %d\n", stats.LitFaces);
+			printf("Num vertex lit faces : %d\n", stats.VertexFaces);
+			printf("Num luxels           : %d\n", stats.Luxels);
+			printf("Num shadow rays      : %lld\n", stats.Rays);
+			if (sampling.Adaptive) {
+				printf("Supersampled luxels  : %d (%.1f%%)\n", stats.SupersampledLuxels, stats.Luxels ? stats.SupersampledLuxels * 100.0 / stats.Luxels : 0.0);
+			}
+			printf("Luxel memory         : %.1f MB at most\n", stats.ArenaPeak / (1024.0 * 1024.0));
+			if (parms.Radiosity) {
+				printf("Num patches          : %d\n", stats.Patches);
+				printf("Num patch splits     : %d\n", stats.PatchSplits);
+				printf("Num shots            : %d\n", stats.Shots);
+				printf("Unshot light left    : %.2f%%\n", stats.Unshot * 100.0f);
+				printf("Num bounce rays      : %lld\n", stats.BounceRays);
+			}
+		}
+		if (stats.PatchBudgetHit) {
+			printf("Warning: the patch memory budget (%d MB) stopped subdividing at %d patches\n", radiosity.MaxMemory, stats.Patches);
+		}
+		if (stats.DroppedStyles) {
+			printf("Warning: %d faces are touched by more than %d light styles, extra styles were dropped\n", stats.DroppedStyles, MAX_LTYPE_INDEX);
+		}
+
+		checkpoint.Remove();
+		if (incremental && !cache.Save(cachePath)) {
+			printf("Warning: %s\n", cache.GetError().c_str());
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("Native light finished in %.2f seconds\n", seconds);
+		return true;
+	}
+
+	//========================================================================================
+	//	LightBspFile()
+	//	Opens the .bsp at path, lights it natively and writes the changed chunks back
+	//========================================================================================
+	inline bool LightBspFile(const std::string& path, const LightParms& parms, const RadiosityParms& radiosity, const SampleParms& sampling, int numThreads, const std::string& cachePath = std::string(), const CheckpointParms& checkpointParms = CheckpointParms()) {
+		BspFile bsp;
+		if (!bsp.Open(path)) {
+			printf("Error: %s\n", bsp.GetError().c_str());
+			return false;
+		}
+		if (!LightBsp(bsp, parms, radiosity, sampling, numThreads, cachePath, checkpointParms)) {
+			return false;
+		}
+		if (!bsp.Update()) {
+			printf("Error: %s\n", bsp.GetError().c_str());
+			return false;
+		}
+		return true;
+	}
+
+	typedef struct {
+		int32		ComparedFaces;
+		int32		MismatchedFaces;		// different size or styles, not compared
+		double		MaxDiff;
+		double		MeanDiff;
+	} LightCompareStats;
+
+	//========================================================================================
+	//	CompareLightmaps()
+	//	Per channel difference between the lightmaps of two lightings of the same BSP
+	//========================================================================================
+	inline bool CompareLightmaps(const BspFile& a, const BspFile& b, LightCompareStats& result, std::string& error) {
+		memset(&result, 0, sizeof(result));
+
+		Span<const GFX_Face> facesA = a.GetChunkData<GFX_Face>(GBSP_CHUNK_FACES);
+		Span<const GFX_Face> facesB = b.GetChunkData<GFX_Face>(GBSP_CHUNK_FACES);
+		Span<const uint8> dataA = a.GetChunkData<uint8>(GBSP_CHUNK_LIGHTDATA);
+		Span<const uint8> dataB = b.GetChunkData<uint8>(GBSP_CHUNK_LIGHTDATA);
+		if (facesA.size() != facesB.size()) {
+			error = "the files have a different number of faces";
+			return false;
+		}
+
+		double total = 0.0;
+		long long samples = 0;
+		for (int32 i = 0; i < facesA.size(); i++) {
+			const GFX_Face& fa = facesA[i];
+			const GFX_Face& fb = facesB[i];
+			if (fa.LightOfs < 0 && fb.LightOfs < 0) {
+				continue;
+			}
+			if (fa.LightOfs < 0 || fb.LightOfs < 0 || fa.LWidth != fb.LWidth || fa.LHeight != fb.LHeight || memcmp(fa.LTypes, fb.LTypes, sizeof(fa.LTypes))) {
+				result.MismatchedFaces++;
+				continue;
+			}
+
+			int32 numStyles = 0;
+			while (numStyles < MAX_LTYPE_INDEX && fa.LTypes[numStyles] != 255) {
+				numStyles++;
+			}
+			long long size = (long long)fa.LWidth * fa.LHeight * 3 * numStyles;
+			if (fa.LightOfs + 1 + size > dataA.size() || fb.LightOfs + 1 + size > dataB.size()) {
+				result.MismatchedFaces++;
+				continue;
+			}
+
+			const uint8* pa = dataA.GetData() + fa.LightOfs + 1;
+			const uint8* pb = dataB.GetData() + fb.LightOfs + 1;
+			for (long long j = 0; j < size; j++) {
+				double diff = pa[j] > pb[j] ? pa[j] - pb[j] : pb[j] - pa[j];
+				result.MaxDiff = diff > result.MaxDiff ? diff : result.MaxDiff;
+				total += diff;
+			}
+			samples += size;
+			result.ComparedFaces++;
+		}
+		result.MeanDiff = samples ? total / samples : 0.0;
+		return true;
+	}
+};
+
+#endif // GBSPTOOLS_NATIVELIGHT_H
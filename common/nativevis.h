@@ -0,0 +1,862 @@
+/****************************************************************************************/
+/*  nativevis.h
+/*
+/*  Author: rtxa
+/*  Description: Native potentially visible set of a .BSP, spread across all the cores
+/*
+/*	The .bsp keeps no portal windings, so they're rebuilt from the node tree: the
+/*	winding of every node plane, clipped by the planes above it, is filtered down both
+/*	of its subtrees and each piece that ends up between two non solid leafs of
+/*	different clusters becomes a pair of one way portals, one into each cluster.
+/*
+/*	Then, like the classic portal flow vis:
+/*	- MightSee: each portal floods through the portals that are at least partly in
+/*	  front of it, a cheap superset of what it can see.
+/*	- FullVis: each portal walks the clusters it might see, clipping the portals on
+/*	  the way by the separating planes between its own winding and the previous
+/*	  portals, and keeps what is still reachable. Portals that are done hand their
+/*	  tighter result to the ones still running.
+/*	Portals are independent so both steps run in parallel. With SortPortals the
+/*	scheduler starts with the portals that might see the most, the expensive ones.
+/*
+/*	The vis row of a cluster is every cluster its portals see, rows are
+/*	((NumClusters + 63) & ~63) / 8 bytes and stored uncompressed like GBSPLib does.
+/*
+/*	Given a VisCache, FullVis first takes the results of the portals whose
+/*	neighborhood didn't change since the last run from it, flows only the others,
+/*	then stores every result back for the next run.
+/*
+/*	Given a Checkpoint, the CanSee of the portals done so far is saved every Interval
+/*	seconds (and when canceled), and a resumed run starts with the portals it holds.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_NATIVEVIS_H
+#define GBSPTOOLS_NATIVEVIS_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "gbsplib.h"
+#include "mathlib.h"
+#include "bitset.h"
+#include "bspfile.h"
+#include "cancel.h"
+#include "checkpoint.h"
+#include "hash.h"
+#include "threads.h"
+#include "viscache.h"
+#include "winding.h"
+
+#define VIS_MODEL_PADDING		16.0f		// node windings start this far outside the world bounds
+#define VIS_MIN_PORTAL_AREA		0.5f		// slivers left by the tree are dropped
+#define VIS_HASH_GRID			16.0f		// portal points are named on a 1/16 unit grid
+#define VIS_HASH_NORMAL_GRID	1024.0f
+
+namespace GBSPTools {
+	typedef struct {
+		int32		Portals;				// one way portals
+		int32		Clusters;
+		long long	MightSee;				// clusters summed over every portal
+		long long	CanSee;					// clusters summed over every cluster row
+		int32		VisBytes;
+		int32		Reused;					// portals taken from the cache
+		int32		Resumed;				// portals taken from the checkpoint
+	} VisStats;
+
+	class NativeVis {
+	public:
+		NativeVis(const VisParms& parms, int numThreads) : parms(parms), numThreads(numThreads), bits(GetBitKernels()) {
+			memset(&stats, 0, sizeof(stats));
+		}
+
+		const std::string& GetError() const { return error; }
+		const VisStats& GetStats() const { return stats; }
+		const char* GetBitKernelsName() const { return bits.Name; }
+		bool WasCanceled() const { return canceled; }
+
+		//========================================================================================
+		//	Vis()
+		//	Computes the vis of every cluster of bsp, replacing its clusters and vis data
+		//	chunks. Nothing is written to disk, the caller saves or updates the file and
+		//	the cache, which a full vis reads from and refills. A full vis also saves its
+		//	progress to checkpoint.
+		//========================================================================================
+		bool Vis(BspFile& bsp, VisCache* cache = nullptr, Checkpoint* checkpoint = nullptr) {
+			if (!LoadTree(bsp) || !MakePortals()) {
+				return false;
+			}
+
+			ParallelFor((int)portals.size(), numThreads, [&](int portal) {
+				BasePortalVis(portal);
+			});
+			for (const VisPortal& portal : portals) {
+				stats.MightSee += portal.NumMightSee;
+			}
+
+			if (parms.FullVis) {
+				done.reset(new std::atomic<bool>[portals.size()]);
+				for (size_t i = 0; i < portals.size(); i++) {
+					done[i] = false;
+				}
+
+				if (checkpoint) {
+					stats.Resumed = ResumeCheckpoint(checkpoint->GetResumeData());
+				}
+
+				std::vector<uint64_t> clusterNames, keys;
+				if (cache) {
+					NamePortals(clusterNames, keys);
+					stats.Reused = ReuseCached(*cache, clusterNames, keys);
+				}
+
+				std::vector<int> order;
+				for (int i = 0; i < (int)portals.size(); i++) {
+					if (!done[i]) {
+						order.push_back(i);
+					}
+				}
+				if (parms.SortPortals) {
+					std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+						return portals[a].NumMightSee > portals[b].NumMightSee;
+					});
+				}
+				WorkStealingFor((int)order.size(), numThreads, [&](int portal) {
+					if (!IsCancelRequested()) {
+						PortalFlow(portal);
+					}
+					if (checkpoint && checkpoint->Claim()) {
+						SaveCheckpoint(*checkpoint);
+					}
+				}, &order);
+
+				if (cache) {
+					StoreCached(*cache, clusterNames, keys);
+				}
+
+				// the portals that finished stay in the cache, an incremental run goes on from there
+				if (IsCancelRequested()) {
+					int32 flowed = 0;
+					for (size_t i = 0; i < portals.size(); i++) {
+						flowed += done[i] ? 1 : 0;
+					}
+					canceled = true;
+					if (checkpoint && checkpoint->IsEnabled()) {
+						SaveCheckpoint(*checkpoint);
+					}
+					error = "canceled with " + std::to_string(flowed) + " of " + std::to_string(portals.size()) + " portals done";
+					return false;
+				}
+			}
+			else {
+				for (VisPortal& portal : portals) {
+					portal.CanSee = portal.MightSee;
+				}
+			}
+
+			WriteVis(bsp);
+			return true;
+		}
+
+	private:
+		typedef struct {
+			geVec3d		Normal;
+			geFloat		Dist;
+		} VisPlane;
+
+		typedef struct {
+			Winding		W;
+			VisPlane	Plane;					// the cluster the portal leads into is in front
+			int32		Cluster;				// leads into
+			int32		Owner;					// leads out of
+			BitSet		MightSee;				// cluster bits
+			BitSet		CanSee;
+			int32		NumMightSee;
+		} VisPortal;
+
+		// one step of the portal flow, Pass is the last portal walked through
+		typedef struct {
+			Winding		Source;
+			Winding		Pass;
+			bool		HasPass;
+			VisPlane	PortalPlane;
+			BitSet		MightSee;
+		} FlowStack;
+
+		typedef struct {
+			int32		Leaf;
+			Winding		W;
+		} LeafWinding;
+
+		VisParms parms;
+		int numThreads;
+		const BitKernels& bits;
+		std::string error;
+		VisStats stats;
+		bool canceled = false;
+
+		Span<const GFX_Node> nodes;
+		Span<const GFX_Leaf> leafs;
+		Span<const GFX_Plane> planes;
+		GFX_Model world;
+		int32 numClusters = 0;
+		int32 numWords = 0;						// words per cluster row, BitSets pad it to whole cache lines
+
+		std::vector<VisPortal> portals;
+		std::vector<std::vector<int32>> clusterPortals;		// portals leading out of each cluster
+		std::unique_ptr<std::atomic<bool>[]> done;
+
+		bool LoadTree(const BspFile& bsp) {
+			nodes = bsp.GetChunkData<GFX_Node>(GBSP_CHUNK_NODES);
+			leafs = bsp.GetChunkData<GFX_Leaf>(GBSP_CHUNK_LEAFS);
+			planes = bsp.GetChunkData<GFX_Plane>(GBSP_CHUNK_PLANES);
+			Span<const GFX_Model> models = bsp.GetChunkData<GFX_Model>(GBSP_CHUNK_MODELS);
+			numClusters = bsp.GetChunkData<GFX_Cluster>(GBSP_CHUNK_CLUSTERS).size();
+			if (nodes.empty() || leafs.empty() || planes.empty() || models.empty()) {
+				error = "missing or bad node, leaf, plane or model chunks";
+				return false;
+			}
+			if (numClusters <= 0) {
+				error = "the bsp has no clusters";
+				return false;
+			}
+			world = models[0];
+
+			for (const GFX_Node& node : nodes) {
+				if (node.PlaneNum < 0 || node.PlaneNum >= planes.size() || node.Children[0] >= nodes.size() || node.Children[1] >= nodes.size()
+					|| -(node.Children[0] + 1) >= leafs.size() || -(node.Children[1] + 1) >= leafs.size()) {
+					error = "bad node tree";
+					return false;
+				}
+			}
+			for (const GFX_Leaf& leaf : leafs) {
+				if (leaf.Cluster >= numClusters) {
+					error = "leaf with a bad cluster";
+					return false;
+				}
+			}
+
+			numWords = (numClusters + 63) / 64;
+			clusterPortals.resize(numClusters);
+			stats.Clusters = numClusters;
+			return true;
+		}
+
+		// Cluster vis can see through, -1 for solid leafs
+		int32 LeafCluster(int32 leaf) const {
+			if (leafs[leaf].Contents & BSP_CONTENTS_SOLID2) {
+				return -1;
+			}
+			return leafs[leaf].Cluster;
+		}
+
+		//========================================================================================
+		//	MakePortals()
+		//	Rebuilds the portals between the clusters of the world from its node tree
+		//========================================================================================
+		bool MakePortals() {
+			std::vector<VisPlane> clips;
+			for (int axis = 0; axis < 3; axis++) {
+				VisPlane plane;
+				geVec3d_Clear(&plane.Normal);
+				VectorToSUB(plane.Normal, axis) = 1.0f;
+				plane.Dist = VectorToSUB(world.Mins, axis) - VIS_MODEL_PADDING;
+				clips.push_back(plane);
+				geVec3d_Inverse(&plane.Normal);
+				plane.Dist = -(VectorToSUB(world.Maxs, axis) + VIS_MODEL_PADDING);
+				clips.push_back(plane);
+			}
+			MakeNodePortals(world.RootNode[0], clips);
+
+			// a single cluster only sees itself, which WriteVis() gives it without portals
+			stats.Portals = (int32)portals.size();
+			if (portals.empty() && numClusters > 1) {
+				error = "no portals between clusters, the map leaks";
+				return false;
+			}
+			return true;
+		}
+
+		void MakeNodePortals(int32 nodeNum, std::vector<VisPlane>& clips) {
+			if (nodeNum < 0) {
+				return;
+			}
+			const GFX_Node& node = nodes[nodeNum];
+			const GFX_Plane& plane = planes[node.PlaneNum];
+
+			Winding w = Winding::ForPlane(plane.Normal, plane.Dist);
+			for (const VisPlane& clip : clips) {
+				if (!w.Clip(clip.Normal, clip.Dist)) {
+					break;
+				}
+			}
+			if (w.size() >= 3) {
+				std::vector<LeafWinding> fronts, pieces;
+				FilterWinding(w, node.Children[0], SIDE_FRONT, fronts);
+				for (const LeafWinding& front : fronts) {
+					int32 frontCluster = LeafCluster(front.Leaf);
+					if (frontCluster < 0) {
+						continue;
+					}
+					pieces.clear();
+					FilterWinding(front.W, node.Children[1], SIDE_BACK, pieces);
+					for (const LeafWinding& back : pieces) {
+						int32 backCluster = LeafCluster(back.Leaf);
+						if (backCluster >= 0 && backCluster != frontCluster) {
+							AddPortals(back.W, plane, frontCluster, backCluster);
+						}
+					}
+				}
+			}
+
+			VisPlane side;
+			side.Normal = plane.Normal;
+			side.Dist = plane.Dist;
+			clips.push_back(side);
+			MakeNodePortals(node.Children[0], clips);
+			geVec3d_Inverse(&clips.back().Normal);
+			clips.back().Dist = -plane.Dist;
+			MakeNodePortals(node.Children[1], clips);
+			clips.pop_back();
+		}
+
+		// Splits w down the subtree into pieces per leaf, coplanar pieces keep going toward
+		void FilterWinding(const Winding& w, int32 nodeNum, int toward, std::vector<LeafWinding>& out) const {
+			if (nodeNum < 0) {
+				LeafWinding piece;
+				piece.Leaf = -(nodeNum + 1);
+				piece.W = w;
+				out.push_back(piece);
+				return;
+			}
+			const GFX_Node& node = nodes[nodeNum];
+			const GFX_Plane& plane = planes[node.PlaneNum];
+			int side = w.Side(plane.Normal, plane.Dist);
+			if (side == SIDE_ON) {
+				side = toward;
+			}
+			if (side != SIDE_CROSS) {
+				FilterWinding(w, node.Children[side == SIDE_FRONT ? 0 : 1], toward, out);
+				return;
+			}
+			Winding front, back;
+			w.Split(plane.Normal, plane.Dist, front, back);
+			if (front.size() >= 3) {
+				FilterWinding(front, node.Children[0], toward, out);
+			}
+			if (back.size() >= 3) {
+				FilterWinding(back, node.Children[1], toward, out);
+			}
+		}
+
+		void AddPortals(const Winding& w, const GFX_Plane& plane, int32 frontCluster, int32 backCluster) {
+			if (w.size() < 3 || w.Area() < VIS_MIN_PORTAL_AREA) {
+				return;
+			}
+			for (int side = 0; side < 2; side++) {
+				VisPortal portal;
+				portal.W = w;
+				portal.Plane.Normal = plane.Normal;
+				portal.Plane.Dist = plane.Dist;
+				if (side) {
+					geVec3d_Inverse(&portal.Plane.Normal);
+					portal.Plane.Dist = -plane.Dist;
+				}
+				portal.Cluster = side ? backCluster : frontCluster;
+				portal.Owner = side ? frontCluster : backCluster;
+				portal.NumMightSee = 0;
+				clusterPortals[portal.Owner].push_back((int32)portals.size());
+				portals.push_back(portal);
+			}
+		}
+
+		//========================================================================================
+		//	BasePortalVis()
+		//	MightSee of a portal: the clusters reached flooding through the portals that
+		//	have a point in front of it and that it has a point behind
+		//========================================================================================
+		void BasePortalVis(int32 portalNum) {
+			VisPortal& portal = portals[portalNum];
+			const int32 count = (int32)portals.size();
+			std::vector<uint8> front(count, 0);
+			for (int32 i = 0; i < count; i++) {
+				if (i == portalNum) {
+					continue;
+				}
+				const VisPortal& other = portals[i];
+				bool inFront = false;
+				for (const geVec3d& p : other.W.Points) {
+					if (geVec3d_DotProduct(&p, &portal.Plane.Normal) - portal.Plane.Dist > ON_EPSILON) {
+						inFront = true;
+						break;
+					}
+				}
+				bool behind = false;
+				for (const geVec3d& p : portal.W.Points) {
+					if (geVec3d_DotProduct(&p, &other.Plane.Normal) - other.Plane.Dist < -ON_EPSILON) {
+						behind = true;
+						break;
+					}
+				}
+				front[i] = inFront && behind;
+			}
+
+			portal.MightSee.Resize(numClusters);
+			std::vector<int32> stack(1, portal.Cluster);
+			portal.MightSee.Set(portal.Cluster);
+			while (!stack.empty()) {
+				int32 cluster = stack.back();
+				stack.pop_back();
+				for (int32 next : clusterPortals[cluster]) {
+					int32 to = portals[next].Cluster;
+					if (front[next] && !portal.MightSee.Test(to)) {
+						portal.MightSee.Set(to);
+						stack.push_back(to);
+					}
+				}
+			}
+			portal.NumMightSee = bits.Count(portal.MightSee.GetWords(), portal.MightSee.GetNumWords());
+		}
+
+		//========================================================================================
+		//	ClipToSeparators()
+		//	Clips target by the planes through an edge of source and a point of pass that
+		//	have all of source on one side and all of pass on the other, keeping the side
+		//	of pass (or of source when flip is set). False when nothing is left.
+		//========================================================================================
+		static bool ClipToSeparators(const Winding& source, const Winding& pass, Winding& target, bool flip) {
+			const int32 numSource = source.size();
+			const int32 numPass = pass.size();
+			for (int32 i = 0; i < numSource; i++) {
+				int32 l = (i + 1) % numSource;
+				geVec3d v1;
+				geVec3d_Subtract(&source.Points[l], &source.Points[i], &v1);
+
+				for (int32 j = 0; j < numPass; j++) {
+					geVec3d v2, normal;
+					geVec3d_Subtract(&pass.Points[j], &source.Points[i], &v2);
+					geVec3d_CrossProduct(&v1, &v2, &normal);
+					geFloat length = geVec3d_LengthSquared(&normal);
+					if (length < ON_EPSILON) {
+						continue;
+					}
+					geVec3d_Scale(&normal, 1.0f / sqrtf(length), &normal);
+					geFloat dist = geVec3d_DotProduct(&pass.Points[j], &normal);
+
+					// which side of the plane the source portal is on
+					bool flipTest = false;
+					int32 k;
+					for (k = 0; k < numSource; k++) {
+						if (k == i || k == l) {
+							continue;
+						}
+						geFloat d = geVec3d_DotProduct(&source.Points[k], &normal) - dist;
+						if (d < -ON_EPSILON) {
+							flipTest = false;
+							break;
+						}
+						if (d > ON_EPSILON) {
+							flipTest = true;
+							break;
+						}
+					}
+					if (k == numSource) {
+						continue;		// planar with source
+					}
+					if (flipTest) {
+						geVec3d_Inverse(&normal);
+						dist = -dist;
+					}
+
+					// a separating plane has all of pass on its front
+					int32 onFront = 0;
+					for (k = 0; k < numPass; k++) {
+						if (k == j) {
+							continue;
+						}
+						geFloat d = geVec3d_DotProduct(&pass.Points[k], &normal) - dist;
+						if (d < -ON_EPSILON) {
+							break;
+						}
+						if (d > ON_EPSILON) {
+							onFront++;
+						}
+					}
+					if (k != numPass || !onFront) {
+						continue;
+					}
+
+					if (flip) {
+						geVec3d_Inverse(&normal);
+						dist = -dist;
+					}
+					if (!target.Clip(normal, dist)) {
+						return false;
+					}
+					break;
+				}
+			}
+			return true;
+		}
+
+		void PortalFlow(int32 portalNum) {
+			VisPortal& base = portals[portalNum];
+			base.CanSee.Resize(numClusters);
+
+			// one entry per depth, reused by the siblings of each step
+			std::deque<FlowStack> stacks(1);
+			FlowStack& head = stacks[0];
+			head.Source = base.W;
+			head.HasPass = false;
+			head.PortalPlane = base.Plane;
+			head.MightSee = base.MightSee;
+			RecursiveClusterFlow(base, base.Cluster, stacks, 0);
+
+			done[portalNum].store(true, std::memory_order_release);
+		}
+
+		void RecursiveClusterFlow(VisPortal& base, int32 cluster, std::deque<FlowStack>& stacks, size_t depth) {
+			base.CanSee.Set(cluster);
+
+			if (stacks.size() <= depth + 1) {
+				stacks.emplace_back();
+				stacks.back().MightSee.Resize(numClusters);
+			}
+			const int32 words = base.CanSee.GetNumWords();
+			const FlowStack& prev = stacks[depth];
+			FlowStack& stack = stacks[depth + 1];
+
+			for (int32 next : clusterPortals[cluster]) {
+				const VisPortal& portal = portals[next];
+				if (!prev.MightSee.Test(portal.Cluster)) {
+					continue;
+				}
+
+				// finished portals know exactly what they see, the others only what they might
+				const BitSet& test = done[next].load(std::memory_order_acquire) ? portal.CanSee : portal.MightSee;
+				bits.And(stack.MightSee.GetWords(), prev.MightSee.GetWords(), test.GetWords(), words);
+				if (base.CanSee.Test(portal.Cluster) && !bits.AnyAndNot(stack.MightSee.GetWords(), base.CanSee.GetWords(), words)) {
+					continue;
+				}
+
+				stack.PortalPlane = portal.Plane;
+				stack.Pass = portal.W;
+				if (!stack.Pass.Clip(base.Plane.Normal, base.Plane.Dist)) {
+					continue;
+				}
+				stack.Source = prev.Source;
+				geVec3d back = portal.Plane.Normal;
+				geVec3d_Inverse(&back);
+				if (!stack.Source.Clip(back, -portal.Plane.Dist)) {
+					continue;
+				}
+				stack.HasPass = true;
+
+				// the second cluster can only be blocked when coplanar
+				if (!prev.HasPass) {
+					RecursiveClusterFlow(base, portal.Cluster, stacks, depth + 1);
+					continue;
+				}
+
+				if (!stack.Pass.Clip(prev.PortalPlane.Normal, prev.PortalPlane.Dist)) {
+					continue;
+				}
+				if (!ClipToSeparators(stack.Source, prev.Pass, stack.Pass, false)) {
+					continue;
+				}
+				if (!ClipToSeparators(prev.Pass, stack.Source, stack.Pass, true)) {
+					continue;
+				}
+				RecursiveClusterFlow(base, portal.Cluster, stacks, depth + 1);
+			}
+		}
+
+		//========================================================================================
+		//	NamePortals()
+		//	Names every portal by its winding and direction and every cluster by the
+		//	portals leading out of it, then keys every portal by its name and the names of
+		//	the clusters it might see. Sums keep the names independent of any ordering.
+		//========================================================================================
+		void NamePortals(std::vector<uint64_t>& clusterNames, std::vector<uint64_t>& keys) const {
+			auto quantize = [](geFloat value, geFloat grid) {
+				return (uint64_t)(int64_t)floor(value * grid + 0.5);
+			};
+
+			std::vector<uint64_t> names(portals.size());
+			ParallelFor((int)portals.size(), numThreads, [&](int i) {
+				const VisPortal& portal = portals[i];
+				uint64_t name = HashMix(HashMix(HashMix(HashMix(quantize(portal.Plane.Normal.X, VIS_HASH_NORMAL_GRID))
+					^ quantize(portal.Plane.Normal.Y, VIS_HASH_NORMAL_GRID)) ^ quantize(portal.Plane.Normal.Z, VIS_HASH_NORMAL_GRID)) ^ quantize(portal.Plane.Dist, VIS_HASH_GRID));
+				for (const geVec3d& p : portal.W.Points) {
+					name += HashMix(HashMix(HashMix(quantize(p.X, VIS_HASH_GRID)) ^ quantize(p.Y, VIS_HASH_GRID)) ^ quantize(p.Z, VIS_HASH_GRID));
+				}
+				names[i] = HashMix(name);
+			});
+
+			clusterNames.assign(numClusters, 0);
+			for (int32 c = 0; c < numClusters; c++) {
+				uint64_t name = 0;
+				for (int32 portal : clusterPortals[c]) {
+					name += names[portal];
+				}
+				clusterNames[c] = HashMix(name);
+			}
+
+			keys.resize(portals.size());
+			ParallelFor((int)portals.size(), numThreads, [&](int i) {
+				uint64_t key = 0;
+				for (int32 c = 0; c < numClusters; c++) {
+					if (portals[i].MightSee.Test(c)) {
+						key += clusterNames[c];
+					}
+				}
+				keys[i] = HashMix(names[i] ^ key);
+			});
+		}
+
+		// Fills the CanSee of every portal found in the cache and marks it done
+		int32 ReuseCached(const VisCache& cache, const std::vector<uint64_t>& clusterNames, const std::vector<uint64_t>& keys) {
+			// two clusters with the same name can't be told apart, their entries are dropped
+			std::unordered_map<uint64_t, int32> current;
+			for (int32 c = 0; c < numClusters; c++) {
+				auto inserted = current.insert(std::make_pair(clusterNames[c], c));
+				if (!inserted.second) {
+					inserted.first->second = -1;
+				}
+			}
+			const std::vector<uint64_t>& cached = cache.GetClusters();
+			std::vector<int32> remap(cached.size(), -1);
+			for (size_t i = 0; i < cached.size(); i++) {
+				auto it = current.find(cached[i]);
+				if (it != current.end()) {
+					remap[i] = it->second;
+				}
+			}
+
+			int32 reused = 0;
+			for (int32 i = 0; i < (int32)portals.size(); i++) {
+				const std::vector<int32>* seen = done[i] ? nullptr : cache.Find(keys[i]);
+				if (seen == nullptr) {
+					continue;
+				}
+				VisPortal& portal = portals[i];
+				portal.CanSee.Resize(numClusters);
+				bool found = true;
+				for (int32 cluster : *seen) {
+					if (remap[cluster] < 0) {
+						found = false;
+						break;
+					}
+					portal.CanSee.Set(remap[cluster]);
+				}
+				if (found) {
+					done[i] = true;
+					reused++;
+				}
+			}
+			return reused;
+		}
+
+		//========================================================================================
+		//	SaveCheckpoint()
+		//	Writes the portal count and row size, then the index and CanSee row of every
+		//	portal done so far. The flow goes on meanwhile, a portal is only read once it's
+		//	marked done.
+		//========================================================================================
+		void SaveCheckpoint(Checkpoint& checkpoint) const {
+			std::vector<int32> finished;
+			for (int32 i = 0; i < (int32)portals.size(); i++) {
+				if (done[i].load(std::memory_order_acquire)) {
+					finished.push_back(i);
+				}
+			}
+
+			CheckpointWriter writer;
+			writer.WriteValue((int32)portals.size());
+			writer.WriteValue(numWords);
+			writer.WriteValue((int32)finished.size());
+			for (int32 i : finished) {
+				writer.WriteValue(i);
+				writer.Write(portals[i].CanSee.GetWords(), numWords);
+			}
+			if (!checkpoint.Save(writer)) {
+				printf("Warning: %s\n", checkpoint.GetError().c_str());
+			}
+		}
+
+		// Marks the portals of the checkpoint done, none when it doesn't fit these portals
+		int32 ResumeCheckpoint(const std::vector<uint8>& data) {
+			if (data.empty()) {
+				return 0;
+			}
+			CheckpointReader reader(data);
+			int32 numPortals, rowWords, count;
+			if (!reader.ReadValue(numPortals) || !reader.ReadValue(rowWords) || !reader.ReadValue(count)
+				|| numPortals != (int32)portals.size() || rowWords != numWords || count < 0 || count > numPortals) {
+				return 0;
+			}
+
+			for (int32 n = 0; n < count; n++) {
+				int32 i;
+				if (!reader.ReadValue(i) || i < 0 || i >= numPortals) {
+					break;
+				}
+				portals[i].CanSee.Resize(numClusters);
+				if (!reader.Read(portals[i].CanSee.GetWords(), numWords)) {
+					break;
+				}
+				done[i] = true;
+			}
+			if (!reader.IsAtEnd()) {
+				for (int32 i = 0; i < numPortals; i++) {
+					done[i] = false;
+				}
+				return 0;
+			}
+			return count;
+		}
+
+		void StoreCached(VisCache& cache, const std::vector<uint64_t>& clusterNames, const std::vector<uint64_t>& keys) const {
+			cache.Clear();
+			cache.SetClusters(clusterNames);
+			std::vector<int32> seen;
+			for (size_t i = 0; i < portals.size(); i++) {
+				if (!done[i]) {
+					continue;
+				}
+				seen.clear();
+				for (int32 c = 0; c < numClusters; c++) {
+					if (portals[i].CanSee.Test(c)) {
+						seen.push_back(c);
+					}
+				}
+				cache.Add(keys[i], seen);
+			}
+		}
+
+		void WriteVis(BspFile& bsp) {
+			const int32 rowBytes = numWords * 8;
+			std::vector<GFX_Cluster> clusters(numClusters);
+			std::vector<uint8> visData((size_t)rowBytes * numClusters, 0);
+
+			BitSet row(numClusters);
+			const uint64_t* words = row.GetWords();
+			for (int32 c = 0; c < numClusters; c++) {
+				row.Clear();
+				row.Set(c);
+				for (int32 portal : clusterPortals[c]) {
+					bits.Or(row.GetWords(), portals[portal].CanSee.GetWords(), row.GetNumWords());
+				}
+				stats.CanSee += bits.Count(words, row.GetNumWords());
+
+				clusters[c].VisOfs = c * rowBytes;
+				uint8* out = visData.data() + (size_t)c * rowBytes;
+				for (int32 b = 0; b < rowBytes; b++) {
+					out[b] = (uint8)(words[b >> 3] >> ((b & 7) * 8));
+				}
+			}
+
+			stats.VisBytes = (int32)visData.size();
+			bsp.SetChunkData(GBSP_CHUNK_CLUSTERS, clusters);
+			bsp.SetChunkData(GBSP_CHUNK_VISDATA, visData);
+		}
+	};
+
+	//========================================================================================
+	//	VisBsp()
+	//	Computes the vis of bsp natively, in memory. With a cachePath, a full vis reuses the
+	//	portals the last run left there; with a checkpoint path, it saves its progress there
+	//	and may resume from it.
+	//========================================================================================
+	inline bool VisBsp(BspFile& bsp, const VisParms& parms, int numThreads, const std::string& cachePath = std::string(), const CheckpointParms& checkpointParms = CheckpointParms()) {
+		auto start = std::chrono::steady_clock::now();
+
+		VisCache cache;
+		const bool incremental = parms.FullVis && !cachePath.empty();
+		if (incremental && !cache.Load(cachePath)) {
+			printf("Warning: Ignoring the vis cache: %s\n", cache.GetError().c_str());
+		}
+
+		// only the portal flow of a full vis takes long enough to be worth it
+		CheckpointParms checkpointUsed = checkpointParms;
+		ContentHash input;
+		if (!parms.FullVis) {
+			checkpointUsed.Path.clear();
+		}
+		AddCheckpointInput(input, bsp);
+		input.AddValue(parms.FullVis);
+		Checkpoint checkpoint(checkpointUsed, "gvis", input.ToString());
+		if (!checkpoint.Load()) {
+			printf("Warning: Starting over: %s\n", checkpoint.GetError().c_str());
+		}
+
+		NativeVis vis(parms, numThreads);
+		printf("Native vis: %d thread(s)\n", ResolveNumThreads(numThreads));
+		if (!vis.Vis(bsp, incremental ? &cache : nullptr, checkpoint.IsEnabled() ? &checkpoint : nullptr)) {
+			printf("Error: Unable to vis the BSP: %s\n", vis.GetError().c_str());
+			if (vis.WasCanceled() && incremental && cache.Save(cachePath)) {
+				printf("Kept the finished portals in %s\n", cachePath.c_str());
+			}
+			if (vis.WasCanceled() && checkpoint.IsEnabled()) {
+				printf("Saved the finished portals to %s, -resume goes on from there\n", checkpoint.GetPath().c_str());
+			}
+			return false;
+		}
+
+		const VisStats& stats = vis.GetStats();
+		if (!checkpoint.GetResumeData().empty()) {
+			printf("Resumed %d of %d portals from %s\n", stats.Resumed, stats.Portals, checkpoint.GetPath().c_str());
+		}
+		if (incremental) {
+			printf("Reused %d of %d portals from %s\n", stats.Reused, stats.Portals, cachePath.c_str());
+		}
+		if (parms.Verbose) {
+			printf("Bitset kernels       : %s\n", vis.GetBitKernelsName());
+			printf("Num clusters         : %d\n", stats.Clusters);
+			printf("Num portals          : %d\n", stats.Portals);
+			printf("Average might see    : %.1f\n", stats.Portals ? (double)stats.MightSee / stats.Portals : 0.0);
+			printf("Average cluster see  : %.1f\n", (double)stats.CanSee / stats.Clusters);
+			printf("Vis data size        : %d\n", stats.VisBytes);
+		}
+
+		if (incremental && !cache.Save(cachePath)) {
+			printf("Warning: %s\n", cache.GetError().c_str());
+		}
+		checkpoint.Remove();
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("Native vis finished in %.2f seconds\n", seconds);
+		return true;
+	}
+
+	//========================================================================================
+	//	VisBspFile()
+	//	Opens the .bsp at path, computes its vis natively and writes the changed chunks back
+	//========================================================================================
+	inline bool VisBspFile(const std::string& path, const VisParms& parms, int numThreads, const std::string& cachePath = std::string(), const CheckpointParms& checkpointParms = CheckpointParms()) {
+		BspFile bsp;
+		if (!bsp.Open(path)) {
+			printf("Error: %s\n", bsp.GetError().c_str());
+			return false;
+		}
+		if (!VisBsp(bsp, parms, numThreads, cachePath, checkpointParms)) {
+			return false;
+		}
+		if (!bsp.Update()) {
+			printf("Error: %s\n", bsp.GetError().c_str());
+			return false;
+		}
+		return true;
+	}
+};
+
+#endif // GBSPTOOLS_NATIVEVIS_H
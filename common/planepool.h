@@ -0,0 +1,200 @@
+/****************************************************************************************/
+/*  planepool.h
+/*
+/*  Author: rtxa
+/*  Description: Deduplicated storage of the planes the native BSP compiler splits by
+/*
+/*	Planes come in pairs: the even number faces the positive side of its main axis, the
+/*	odd one right after it is the same plane flipped, so turning a plane around is num ^ 1
+/*	and the pair number (num >> 1) is the GFX plane with its side in the lowest bit.
+/*	Normals, distances and types live in separate contiguous arrays.
+/*
+/*	Finding a plane hashes its quantized normal and distance. The cells are much larger
+/*	than the tolerance and centered on the usual values (axial normals, integer
+/*	distances), so a lookup reads one bucket; only a value within the tolerance of a
+/*	cell border also reads the neighbouring cell, up to 16 buckets in the worst case.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_PLANEPOOL_H
+#define GBSPTOOLS_PLANEPOOL_H
+
+#include <math.h>
+#include <stdint.h>
+#include <vector>
+#include "bspfile.h"
+#include "hash.h"
+#include "mathlib.h"
+
+#define PLANEPOOL_NORMAL_EPSILON	0.00001f
+#define PLANEPOOL_DIST_EPSILON		0.01f
+#define PLANEPOOL_NORMAL_CELLS		256.0f		// cells per unit of a normal component
+#define PLANEPOOL_DIST_CELLS		1.0f		// cells per unit of distance
+#define PLANEPOOL_MIN_BUCKETS		1024
+
+namespace GBSPTools {
+	class PlanePool {
+	public:
+		PlanePool() {
+			buckets.assign(PLANEPOOL_MIN_BUCKETS, -1);
+		}
+
+		// Both sides of every plane
+		int32 size() const { return (int32)dists.size(); }
+
+		static int32 Flip(int32 num) { return num ^ 1; }
+
+		geVec3d GetNormal(int32 num) const {
+			geVec3d normal = { normalX[num], normalY[num], normalZ[num] };
+			return normal;
+		}
+		geFloat GetDist(int32 num) const { return dists[num]; }
+		int32 GetType(int32 num) const { return types[num]; }
+
+		geFloat Distance(int32 num, const geVec3d& p) const {
+			return normalX[num] * p.X + normalY[num] * p.Y + normalZ[num] * p.Z - dists[num];
+		}
+
+		//========================================================================================
+		//	Find()
+		//	Number of the plane, added when it's new. Normals within PLANEPOOL_NORMAL_EPSILON
+		//	of an axis become axial and distances within PLANEPOOL_DIST_EPSILON of an integer
+		//	are rounded, so planes of the same brush face from different brushes match.
+		//========================================================================================
+		int32 Find(geVec3d normal, geFloat dist) {
+			for (int axis = 0; axis < 3; axis++) {
+				geFloat n = VectorToSUB(normal, axis);
+				if (fabsf(fabsf(n) - 1.0f) < PLANEPOOL_NORMAL_EPSILON) {
+					geVec3d_Clear(&normal);
+					VectorToSUB(normal, axis) = n > 0.0f ? 1.0f : -1.0f;
+					break;
+				}
+			}
+			if (fabsf(dist - floorf(dist + 0.5f)) < PLANEPOOL_DIST_EPSILON) {
+				dist = floorf(dist + 0.5f);
+			}
+
+			int32 type = geVec3d_PlaneType(&normal);
+			int32 side = 0;
+			if (VectorToSUB(normal, type % 3) < 0.0f) {
+				geVec3d_Inverse(&normal);
+				dist = -dist;
+				side = 1;
+			}
+
+			int32 found = Lookup(normal, dist);
+			if (found >= 0) {
+				return found | side;
+			}
+			return Add(normal, dist, type) | side;
+		}
+
+		// The front planes, in pair order, as the .bsp stores them
+		std::vector<GFX_Plane> ToGFXPlanes() const {
+			std::vector<GFX_Plane> planes(dists.size() / 2);
+			for (size_t i = 0; i < planes.size(); i++) {
+				planes[i].Normal = GetNormal((int32)i * 2);
+				planes[i].Dist = dists[i * 2];
+				planes[i].Type = types[i * 2];
+			}
+			return planes;
+		}
+
+	private:
+		std::vector<geFloat> normalX;
+		std::vector<geFloat> normalY;
+		std::vector<geFloat> normalZ;
+		std::vector<geFloat> dists;
+		std::vector<int32> types;
+		std::vector<int32> buckets;			// first pair of each bucket, -1 when empty
+		std::vector<int32> next;			// next pair in the same bucket, per pair
+
+		// The cell value is in, and the neighbouring one when value is within epsilon of it
+		static int Cells(geFloat value, geFloat cellsPerUnit, geFloat epsilon, int32 cells[2]) {
+			geFloat scaled = value * cellsPerUnit;
+			geFloat center = floorf(scaled + 0.5f);
+			cells[0] = (int32)center;
+			geFloat offset = scaled - center;
+			if (offset > 0.5f - epsilon * cellsPerUnit) {
+				cells[1] = cells[0] + 1;
+				return 2;
+			}
+			if (offset < -0.5f + epsilon * cellsPerUnit) {
+				cells[1] = cells[0] - 1;
+				return 2;
+			}
+			return 1;
+		}
+
+		size_t Bucket(int32 x, int32 y, int32 z, int32 d) const {
+			uint64_t key = ((uint64_t)(uint16_t)x << 48) | ((uint64_t)(uint16_t)y << 32) | ((uint64_t)(uint16_t)z << 16) | (uint64_t)(uint16_t)d;
+			return (size_t)HashMix(key) & (buckets.size() - 1);
+		}
+
+		size_t HomeBucket(const geVec3d& normal, geFloat dist) const {
+			return Bucket((int32)floorf(normal.X * PLANEPOOL_NORMAL_CELLS + 0.5f), (int32)floorf(normal.Y * PLANEPOOL_NORMAL_CELLS + 0.5f),
+				(int32)floorf(normal.Z * PLANEPOOL_NORMAL_CELLS + 0.5f), (int32)floorf(dist * PLANEPOOL_DIST_CELLS + 0.5f));
+		}
+
+		int32 Lookup(const geVec3d& normal, geFloat dist) const {
+			int32 cx[2], cy[2], cz[2], cd[2];
+			int nx = Cells(normal.X, PLANEPOOL_NORMAL_CELLS, PLANEPOOL_NORMAL_EPSILON, cx);
+			int ny = Cells(normal.Y, PLANEPOOL_NORMAL_CELLS, PLANEPOOL_NORMAL_EPSILON, cy);
+			int nz = Cells(normal.Z, PLANEPOOL_NORMAL_CELLS, PLANEPOOL_NORMAL_EPSILON, cz);
+			int nd = Cells(dist, PLANEPOOL_DIST_CELLS, PLANEPOOL_DIST_EPSILON, cd);
+
+			for (int ix = 0; ix < nx; ix++) {
+				for (int iy = 0; iy < ny; iy++) {
+					for (int iz = 0; iz < nz; iz++) {
+						for (int id = 0; id < nd; id++) {
+							for (int32 pair = buckets[Bucket(cx[ix], cy[iy], cz[iz], cd[id])]; pair >= 0; pair = next[pair]) {
+								int32 num = pair * 2;
+								if (fabsf(normalX[num] - normal.X) < PLANEPOOL_NORMAL_EPSILON && fabsf(normalY[num] - normal.Y) < PLANEPOOL_NORMAL_EPSILON
+									&& fabsf(normalZ[num] - normal.Z) < PLANEPOOL_NORMAL_EPSILON && fabsf(dists[num] - dist) < PLANEPOOL_DIST_EPSILON) {
+									return num;
+								}
+							}
+						}
+					}
+				}
+			}
+			return -1;
+		}
+
+		int32 Add(const geVec3d& normal, geFloat dist, int32 type) {
+			int32 num = size();
+			for (int side = 0; side < 2; side++) {
+				geFloat sign = side ? -1.0f : 1.0f;
+				normalX.push_back(normal.X * sign);
+				normalY.push_back(normal.Y * sign);
+				normalZ.push_back(normal.Z * sign);
+				dists.push_back(dist * sign);
+				types.push_back(type);
+			}
+
+			// two pairs per bucket at most on average
+			if ((size_t)(num / 2 + 1) > buckets.size() * 2) {
+				Rehash(buckets.size() * 2);
+			}
+			Link(num / 2);
+			return num;
+		}
+
+		void Link(int32 pair) {
+			size_t bucket = HomeBucket(GetNormal(pair * 2), dists[pair * 2]);
+			next.resize(dists.size() / 2);
+			next[pair] = buckets[bucket];
+			buckets[bucket] = pair;
+		}
+
+		void Rehash(size_t numBuckets) {
+			buckets.assign(numBuckets, -1);
+			// the new pair is linked by Add() afterwards
+			for (int32 pair = 0; pair < size() / 2 - 1; pair++) {
+				Link(pair);
+			}
+		}
+	};
+};
+
+#endif // GBSPTOOLS_PLANEPOOL_H
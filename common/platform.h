@@ -0,0 +1,533 @@
+/****************************************************************************************/
+/*  platform.h
+/*
+/*  Author: rtxa
+/*  Description: Small layer over the few OS services the tools need (shared libraries,
+/*  directories, processes, sockets, resource usage, aligned memory, CPU features, MSVC
+/*  secure CRT functions) so they build on Windows and Linux.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_PLATFORM_H
+#define GBSPTOOLS_PLATFORM_H
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>		// before windows.h, which pulls the old winsock.h otherwise
+#include <ws2tcpip.h>
+#include <windows.h>
+#include <direct.h>
+#include <intrin.h>
+#include <malloc.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+#ifndef MAX_PATH
+#define MAX_PATH PATH_MAX
+#endif
+
+// MSVC secure CRT functions used all over the tools
+template <size_t size>
+int strcpy_s(char (&dest)[size], const char* src) {
+	if (strlen(src) >= size) {
+		dest[0] = '\0';
+		return ERANGE;
+	}
+	strcpy(dest, src);
+	return 0;
+}
+
+template <size_t size>
+int sprintf_s(char (&dest)[size], const char* format, ...) {
+	va_list argptr;
+	va_start(argptr, format);
+	int result = vsnprintf(dest, size, format, argptr);
+	va_end(argptr);
+	return result;
+}
+#endif
+
+#ifdef _WIN32
+typedef SOCKET SocketHandle;
+#define INVALID_SOCKET_HANDLE INVALID_SOCKET
+#else
+typedef int SocketHandle;
+#define INVALID_SOCKET_HANDLE (-1)
+#endif
+
+#ifdef _WIN32
+typedef HMODULE CompilerLibHandle;
+#define COMPILER_LIB_NAME "gbsplib.dll"
+#else
+typedef void* CompilerLibHandle;
+#define COMPILER_LIB_NAME "libgbsplib.so"
+#endif
+
+namespace GBSPTools {
+	inline std::string GetWorkingDirectory() {
+		char path[MAX_PATH];
+#ifdef _WIN32
+		if (!GetCurrentDirectoryA(MAX_PATH, path)) {
+#else
+		if (!getcwd(path, MAX_PATH)) {
+#endif
+			return std::string();
+		}
+		return std::string(path);
+	}
+
+	// Creates the directory at path, succeeds when it already exists
+	inline bool MakeDirectory(const std::string& path) {
+#ifdef _WIN32
+		return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+		return mkdir(path.c_str(), 0777) == 0 || errno == EEXIST;
+#endif
+	}
+
+	// fseek() to a 64 bit offset from the start, long is 32 bit on Windows
+	inline int SeekFile(FILE* fp, long long offset) {
+#ifdef _WIN32
+		return _fseeki64(fp, offset, SEEK_SET);
+#else
+		return fseeko(fp, (off_t)offset, SEEK_SET);
+#endif
+	}
+
+	// Full path of the running executable, empty when unknown
+	inline std::string GetExecutablePath() {
+		char path[MAX_PATH];
+#ifdef _WIN32
+		DWORD length = GetModuleFileNameA(NULL, path, MAX_PATH);
+		if (length == 0 || length >= MAX_PATH) {
+			return std::string();
+		}
+#else
+		ssize_t length = readlink("/proc/self/exe", path, MAX_PATH - 1);
+		if (length <= 0) {
+			return std::string();
+		}
+		path[length] = '\0';
+#endif
+		return std::string(path);
+	}
+
+	// Installed memory in megabytes, 0 when unknown
+	inline long long GetPhysicalMemory() {
+#ifdef _WIN32
+		MEMORYSTATUSEX status;
+		status.dwLength = sizeof(status);
+		if (!GlobalMemoryStatusEx(&status)) {
+			return 0;
+		}
+		return (long long)(status.ullTotalPhys >> 20);
+#else
+		long pages = sysconf(_SC_PHYS_PAGES);
+		long pageSize = sysconf(_SC_PAGE_SIZE);
+		if (pages <= 0 || pageSize <= 0) {
+			return 0;
+		}
+		return ((long long)pages * pageSize) >> 20;
+#endif
+	}
+
+	// CPU time the process used so far, all its threads added up, in seconds
+	inline double GetProcessCpuTime() {
+#ifdef _WIN32
+		FILETIME creation, exit, kernel, user;
+		if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+			return 0.0;
+		}
+		auto toSeconds = [](const FILETIME& time) {
+			return (double)(((unsigned long long)time.dwHighDateTime << 32) | time.dwLowDateTime) * 1e-7;
+		};
+		return toSeconds(kernel) + toSeconds(user);
+#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0) {
+			return 0.0;
+		}
+		return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+	}
+
+	// Most memory the process ever had resident, in bytes, 0 when unknown
+	inline long long GetPeakMemoryUsage() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+			return 0;
+		}
+		return (long long)counters.PeakWorkingSetSize;
+#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0) {
+			return 0;
+		}
+		return (long long)usage.ru_maxrss * 1024;	// kilobytes on Linux
+#endif
+	}
+
+	//========================================================================================
+	//	RunProcess()
+	//	Runs args[0] with the rest of args, sending its output to logPath, and waits for it.
+	//	With a memoryLimit (in megabytes) the process can't allocate past it. Returns its
+	//	exit code, -1 when it couldn't be started or didn't exit by itself.
+	//========================================================================================
+	inline int RunProcess(const std::vector<std::string>& args, const std::string& logPath, int memoryLimit) {
+		if (args.empty()) {
+			return -1;
+		}
+#ifdef _WIN32
+		// quote every argument, a trailing backslash would escape the closing quote
+		std::string commandLine;
+		for (const std::string& arg : args) {
+			std::string quoted(arg);
+			if (!quoted.empty() && quoted.back() == '\\') {
+				quoted += '\\';
+			}
+			commandLine += (commandLine.empty() ? "\"" : " \"") + quoted + "\"";
+		}
+		std::vector<char> commandBuffer(commandLine.begin(), commandLine.end());
+		commandBuffer.push_back('\0');
+
+		SECURITY_ATTRIBUTES security = { sizeof(security), NULL, TRUE };
+		HANDLE log = CreateFileA(logPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, &security, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (log == INVALID_HANDLE_VALUE) {
+			return -1;
+		}
+
+		// the limit lives on a job object the process is put in before it starts running
+		HANDLE job = NULL;
+		if (memoryLimit > 0) {
+			JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits;
+			ZeroMemory(&limits, sizeof(limits));
+			limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_PROCESS_MEMORY | JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+			limits.ProcessMemoryLimit = (SIZE_T)memoryLimit << 20;
+			job = CreateJobObjectA(NULL, NULL);
+			if (job == NULL || !SetInformationJobObject(job, JobObjectExtendedLimitInformation, &limits, sizeof(limits))) {
+				if (job != NULL) {
+					CloseHandle(job);
+				}
+				CloseHandle(log);
+				return -1;
+			}
+		}
+
+		STARTUPINFOA startup;
+		ZeroMemory(&startup, sizeof(startup));
+		startup.cb = sizeof(startup);
+		startup.dwFlags = STARTF_USESTDHANDLES;
+		startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+		startup.hStdOutput = log;
+		startup.hStdError = log;
+
+		PROCESS_INFORMATION process;
+		BOOL started = CreateProcessA(NULL, commandBuffer.data(), NULL, NULL, TRUE, CREATE_SUSPENDED, NULL, NULL, &startup, &process);
+		CloseHandle(log);
+		if (!started) {
+			if (job != NULL) {
+				CloseHandle(job);
+			}
+			return -1;
+		}
+		if (job != NULL && !AssignProcessToJobObject(job, process.hProcess)) {
+			TerminateProcess(process.hProcess, (UINT)-1);
+		}
+		ResumeThread(process.hThread);
+		WaitForSingleObject(process.hProcess, INFINITE);
+
+		DWORD exitCode;
+		if (!GetExitCodeProcess(process.hProcess, &exitCode)) {
+			exitCode = (DWORD)-1;
+		}
+		CloseHandle(process.hThread);
+		CloseHandle(process.hProcess);
+		if (job != NULL) {
+			CloseHandle(job);
+		}
+		return (int)exitCode;
+#else
+		// built before fork(), the child may only make async signal safe calls
+		std::vector<char*> argv;
+		for (const std::string& arg : args) {
+			argv.push_back((char*)arg.c_str());
+		}
+		argv.push_back(nullptr);
+
+		pid_t pid = fork();
+		if (pid < 0) {
+			return -1;
+		}
+		if (pid == 0) {
+			int log = open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+			if (log < 0) {
+				_exit(127);
+			}
+			dup2(log, STDOUT_FILENO);
+			dup2(log, STDERR_FILENO);
+			close(log);
+			if (memoryLimit > 0) {
+				struct rlimit limit;
+				limit.rlim_cur = limit.rlim_max = (rlim_t)memoryLimit << 20;
+				setrlimit(RLIMIT_AS, &limit);
+			}
+			execv(argv[0], argv.data());
+			_exit(127);
+		}
+
+		int status;
+		while (waitpid(pid, &status, 0) < 0) {
+			if (errno != EINTR) {
+				return -1;
+			}
+		}
+		return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+	}
+
+	inline void CloseSocket(SocketHandle handle) {
+		if (handle == INVALID_SOCKET_HANDLE) {
+			return;
+		}
+#ifdef _WIN32
+		closesocket(handle);
+#else
+		close(handle);
+#endif
+	}
+
+	// Connects to a TCP port, INVALID_SOCKET_HANDLE when nothing listens there
+	inline SocketHandle ConnectSocket(const std::string& host, int port) {
+#ifdef _WIN32
+		static bool started = false;
+		if (!started) {
+			WSADATA data;
+			if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+				return INVALID_SOCKET_HANDLE;
+			}
+			started = true;
+		}
+#endif
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		struct addrinfo* addresses = nullptr;
+		if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) {
+			return INVALID_SOCKET_HANDLE;
+		}
+
+		SocketHandle handle = INVALID_SOCKET_HANDLE;
+		for (struct addrinfo* address = addresses; address != nullptr; address = address->ai_next) {
+			handle = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+			if (handle == INVALID_SOCKET_HANDLE) {
+				continue;
+			}
+			if (connect(handle, address->ai_addr, (int)address->ai_addrlen) == 0) {
+				break;
+			}
+			CloseSocket(handle);
+			handle = INVALID_SOCKET_HANDLE;
+		}
+		freeaddrinfo(addresses);
+		return handle;
+	}
+
+	// false once the other end went away
+	inline bool SendSocket(SocketHandle handle, const char* data, size_t size) {
+		while (size > 0) {
+#ifdef _WIN32
+			int sent = send(handle, data, (int)size, 0);
+#else
+			ssize_t sent = send(handle, data, size, MSG_NOSIGNAL);	// no SIGPIPE, just the error
+#endif
+			if (sent <= 0) {
+				return false;
+			}
+			data += sent;
+			size -= (size_t)sent;
+		}
+		return true;
+	}
+
+	inline CompilerLibHandle OpenLibrary(const std::string& path) {
+#ifdef _WIN32
+		return LoadLibraryA(path.c_str());
+#else
+		return dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+	}
+
+	inline void* GetLibrarySymbol(CompilerLibHandle handle, const char* name) {
+#ifdef _WIN32
+		return (void*)GetProcAddress(handle, name);
+#else
+		return dlsym(handle, name);
+#endif
+	}
+
+	inline void CloseLibrary(CompilerLibHandle handle) {
+		if (handle == nullptr) {
+			return;
+		}
+#ifdef _WIN32
+		FreeLibrary(handle);
+#else
+		dlclose(handle);
+#endif
+	}
+
+	// Last loader error as text, for the failure messages
+	inline std::string GetLibraryError() {
+#ifdef _WIN32
+		char buffer[256];
+		DWORD error = GetLastError();
+		if (!FormatMessageA(FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS, NULL, error, 0, buffer, sizeof(buffer), NULL)) {
+			return "error " + std::to_string(error);
+		}
+		std::string message(buffer);
+		while (!message.empty() && (message.back() == '\n' || message.back() == '\r')) {
+			message.pop_back();
+		}
+		return message;
+#else
+		const char* message = dlerror();
+		return message ? std::string(message) : std::string();
+#endif
+	}
+
+	// What the processor running the tools supports, for kernels picked at run time
+	inline bool CpuHasSse2() {
+#if defined(_M_X64) || defined(__x86_64__)
+		return true;
+#elif defined(_MSC_VER) && defined(_M_IX86)
+		int info[4];
+		__cpuid(info, 1);
+		return (info[3] & (1 << 26)) != 0;
+#elif defined(__GNUC__) && defined(__i386__)
+		return __builtin_cpu_supports("sse2");
+#else
+		return false;
+#endif
+	}
+
+	inline bool CpuHasAvx() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		int info[4];
+		__cpuid(info, 1);
+		// the OS has to save the ymm registers too
+		return (info[2] & (1 << 28)) && (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		return __builtin_cpu_supports("avx");
+#else
+		return false;
+#endif
+	}
+
+	inline bool CpuHasAvx2() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) {
+			return false;
+		}
+		// the OS has to save the ymm registers too
+		__cpuid(info, 1);
+		if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6) {
+			return false;
+		}
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		return __builtin_cpu_supports("avx2");
+#else
+		return false;
+#endif
+	}
+
+	// alignment must be a power of two, the memory goes back through AlignedFree()
+	inline void* AlignedAlloc(size_t size, size_t alignment) {
+#ifdef _WIN32
+		return _aligned_malloc(size ? size : 1, alignment);
+#else
+		void* memory = nullptr;
+		if (posix_memalign(&memory, alignment < sizeof(void*) ? sizeof(void*) : alignment, size ? size : 1) != 0) {
+			return nullptr;
+		}
+		return memory;
+#endif
+	}
+
+	inline void AlignedFree(void* memory) {
+#ifdef _WIN32
+		_aligned_free(memory);
+#else
+		free(memory);
+#endif
+	}
+
+	//========================================================================================
+	//	AlignedArray
+	//	Fixed size array of plain structs starting on an Alignment boundary, for data
+	//	read with SIMD loads or kept on its own cache lines
+	//========================================================================================
+	template <typename T, size_t Alignment>
+	class AlignedArray {
+	public:
+		AlignedArray() {}
+		~AlignedArray() { AlignedFree(data); }
+
+		AlignedArray(const AlignedArray&) = delete;
+		AlignedArray& operator=(const AlignedArray&) = delete;
+
+		// contents are zeroed
+		bool Resize(size_t newCount) {
+			AlignedFree(data);
+			data = (T*)AlignedAlloc(newCount * sizeof(T), Alignment);
+			count = data ? newCount : 0;
+			if (data) {
+				memset(data, 0, newCount * sizeof(T));
+			}
+			return data != nullptr;
+		}
+
+		T& operator[](size_t index) { return data[index]; }
+		const T& operator[](size_t index) const { return data[index]; }
+		T* GetData() { return data; }
+		const T* GetData() const { return data; }
+		size_t size() const { return count; }
+
+		void Swap(AlignedArray& other) {
+			std::swap(data, other.data);
+			std::swap(count, other.count);
+		}
+
+	private:
+		T* data = nullptr;
+		size_t count = 0;
+	};
+};
+
+#endif // GBSPTOOLS_PLATFORM_H
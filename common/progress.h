@@ -0,0 +1,403 @@
+/****************************************************************************************/
+/*  progress.h
+/*
+/*  Author: rtxa
+/*  Description: Structured progress events of a compile, recognized in what GBSPLib
+/*  prints and sent to the console, a JSON lines file or a local TCP socket
+/*
+/*	GBSPLib only reports through its Printf callback, so the reporter reads the lines
+/*	it prints: "--- Title ---" starts a phase, "Label : 123" is a counter, "45%" or
+/*	"12 of 340" (also "12/340") is how far the current phase got, from which the time
+/*	left is estimated. Other lines make no event. The stages themselves are reported
+/*	by the tools, which know when they begin and end.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_PROGRESS_H
+#define GBSPTOOLS_PROGRESS_H
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "platform.h"
+
+#define PROGRESS_CONSOLE		"console"
+#define PROGRESS_TCP_PREFIX		"tcp:"
+
+namespace GBSPTools {
+	typedef enum {
+		PROGRESS_STAGE_BEGIN,
+		PROGRESS_STAGE_END,			// Value is the result, 0 when it succeeded
+		PROGRESS_PHASE,
+		PROGRESS_COUNTER,
+		PROGRESS_PERCENT,
+		PROGRESS_ERROR				// Name is the message
+	} ProgressEventType;
+
+	typedef struct {
+		ProgressEventType	Type;
+		double				Time;		// seconds since the reporter started
+		std::string			Map;
+		std::string			Stage;
+		std::string			Name;		// phase, counter or error message
+		double				Value;
+		double				Eta;		// seconds left in the phase, negative when unknown
+	} ProgressEvent;
+
+	//========================================================================================
+	//	ProgressSink
+	//	Where the events go, picked by the target given to Open(): "console", "tcp:port"
+	//	or "tcp:host:port" for a dashboard listening on a socket, anything else is a file
+	//	the events are appended to, one JSON object per line. Each event is a single write,
+	//	so the worker processes of a batch can share a file or a socket.
+	//========================================================================================
+	class ProgressSink {
+	public:
+		ProgressSink() {}
+		~ProgressSink() { Close(); }
+
+		ProgressSink(const ProgressSink&) = delete;
+		ProgressSink& operator=(const ProgressSink&) = delete;
+
+		const std::string& GetError() const { return error; }
+		bool IsOpen() const { return kind != SINK_NONE; }
+
+		bool Open(const std::string& target) {
+			Close();
+			if (target == PROGRESS_CONSOLE) {
+				kind = SINK_CONSOLE;
+				return true;
+			}
+
+			if (!target.compare(0, strlen(PROGRESS_TCP_PREFIX), PROGRESS_TCP_PREFIX)) {
+				std::string address = target.substr(strlen(PROGRESS_TCP_PREFIX));
+				std::string host("127.0.0.1");
+				std::string::size_type colon = address.rfind(':');
+				if (colon != std::string::npos) {
+					host = address.substr(0, colon);
+					address = address.substr(colon + 1);
+				}
+				int port = atoi(address.c_str());
+				if (port <= 0 || port > 65535) {
+					error = "bad port in " + target;
+					return false;
+				}
+				socket = ConnectSocket(host, port);
+				if (socket == INVALID_SOCKET_HANDLE) {
+					error = "unable to connect to " + target;
+					return false;
+				}
+				kind = SINK_SOCKET;
+				return true;
+			}
+
+			file = fopen(target.c_str(), "a");
+			if (file == nullptr) {
+				error = "unable to write " + target;
+				return false;
+			}
+			kind = SINK_FILE;
+			return true;
+		}
+
+		void Close() {
+			if (kind == SINK_FILE) {
+				fclose(file);
+				file = nullptr;
+			}
+			else if (kind == SINK_SOCKET) {
+				CloseSocket(socket);
+				socket = INVALID_SOCKET_HANDLE;
+			}
+			kind = SINK_NONE;
+		}
+
+		void Send(const ProgressEvent& event) {
+			if (kind == SINK_CONSOLE) {
+				printf("%s\n", FormatText(event).c_str());
+				return;
+			}
+
+			std::string line = FormatJson(event);
+			if (kind == SINK_FILE) {
+				fwrite(line.c_str(), 1, line.size(), file);
+				fflush(file);
+			}
+			else if (kind == SINK_SOCKET && !SendSocket(socket, line.c_str(), line.size())) {
+				// the dashboard went away, the compile goes on without it
+				Close();
+			}
+		}
+
+	private:
+		enum { SINK_NONE, SINK_CONSOLE, SINK_FILE, SINK_SOCKET } kind = SINK_NONE;
+		FILE* file = nullptr;
+		SocketHandle socket = INVALID_SOCKET_HANDLE;
+		std::string error;
+
+		static const char* GetTypeName(ProgressEventType type) {
+			static const char* names[] = { "stage_begin", "stage_end", "phase", "counter", "percent", "error" };
+			return names[type];
+		}
+
+		static std::string Escape(const std::string& text) {
+			std::string escaped;
+			for (char c : text) {
+				if (c == '"' || c == '\\') {
+					escaped += '\\';
+				}
+				if ((unsigned char)c >= 0x20) {
+					escaped += c;
+				}
+			}
+			return escaped;
+		}
+
+		static std::string FormatJson(const ProgressEvent& event) {
+			char numbers[128];
+			std::string line = "{\"time\":";
+			snprintf(numbers, sizeof(numbers), "%.3f", event.Time);
+			line += numbers;
+			line += ",\"event\":\"";
+			line += GetTypeName(event.Type);
+			line += "\",\"map\":\"" + Escape(event.Map) + "\",\"stage\":\"" + Escape(event.Stage) + "\"";
+			if (!event.Name.empty()) {
+				line += ",\"name\":\"" + Escape(event.Name) + "\"";
+			}
+			if (event.Type == PROGRESS_STAGE_END || event.Type == PROGRESS_COUNTER || event.Type == PROGRESS_PERCENT) {
+				snprintf(numbers, sizeof(numbers), ",\"value\":%g", event.Value);
+				line += numbers;
+			}
+			if (event.Eta >= 0.0) {
+				snprintf(numbers, sizeof(numbers), ",\"eta\":%.1f", event.Eta);
+				line += numbers;
+			}
+			return line + "}\n";
+		}
+
+		static std::string FormatText(const ProgressEvent& event) {
+			char text[512];
+			switch (event.Type) {
+			case PROGRESS_STAGE_BEGIN:
+				snprintf(text, sizeof(text), "[progress] %s: begins on %s", event.Stage.c_str(), event.Map.c_str());
+				break;
+			case PROGRESS_STAGE_END:
+				snprintf(text, sizeof(text), "[progress] %s: ends with result %g", event.Stage.c_str(), event.Value);
+				break;
+			case PROGRESS_PHASE:
+				snprintf(text, sizeof(text), "[progress] %s: %s", event.Stage.c_str(), event.Name.c_str());
+				break;
+			case PROGRESS_COUNTER:
+				snprintf(text, sizeof(text), "[progress] %s: %s = %g", event.Stage.c_str(), event.Name.c_str(), event.Value);
+				break;
+			case PROGRESS_PERCENT:
+				if (event.Eta >= 0.0) {
+					snprintf(text, sizeof(text), "[progress] %s: %.0f%%, %.0f s left", event.Stage.c_str(), event.Value, event.Eta);
+				}
+				else {
+					snprintf(text, sizeof(text), "[progress] %s: %.0f%%", event.Stage.c_str(), event.Value);
+				}
+				break;
+			default:
+				snprintf(text, sizeof(text), "[progress] %s: error: %s", event.Stage.c_str(), event.Name.c_str());
+				break;
+			}
+			return std::string(text);
+		}
+	};
+
+	//========================================================================================
+	//	ProgressReporter
+	//	Turns the stages and the library output of a compile into events for a sink
+	//========================================================================================
+	class ProgressReporter {
+	public:
+		explicit ProgressReporter(ProgressSink& sink) : sink(sink), origin(std::chrono::steady_clock::now()) {}
+
+		void SetMap(const std::string& name) { map = name; }
+
+		void BeginStage(const std::string& name) {
+			stage = name;
+			phase.clear();
+			phaseStart = Now();
+			lastPercent = -1;
+			Send(PROGRESS_STAGE_BEGIN, std::string(), 0.0, -1.0);
+		}
+
+		void EndStage(int result) {
+			FlushLine();
+			Send(PROGRESS_STAGE_END, std::string(), result, -1.0);
+			stage.clear();
+		}
+
+		// Text as printed by the library, lines may come in pieces
+		void Feed(const char* text) {
+			for (; *text; text++) {
+				if (*text == '\n' || *text == '\r') {
+					FlushLine();
+				}
+				else {
+					line += *text;
+				}
+			}
+		}
+
+		// Where the running stage got to, to tell how far it was when stopped
+		const std::string& GetPhase() const { return phase; }
+		int GetPercent() const { return lastPercent; }
+
+		void Error(const char* text) {
+			std::string message = Trim(text);
+			if (!message.empty()) {
+				Send(PROGRESS_ERROR, message, 0.0, -1.0);
+			}
+		}
+
+	private:
+		ProgressSink& sink;
+		std::chrono::steady_clock::time_point origin;
+		std::string map;
+		std::string stage;
+		std::string line;
+		std::string phase;
+		double phaseStart = 0.0;
+		int lastPercent = -1;
+
+		double Now() const {
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - origin).count();
+		}
+
+		void Send(ProgressEventType type, const std::string& name, double value, double eta) {
+			if (!sink.IsOpen()) {
+				return;
+			}
+			ProgressEvent event;
+			event.Type = type;
+			event.Time = Now();
+			event.Map = map;
+			event.Stage = stage;
+			event.Name = name;
+			event.Value = value;
+			event.Eta = eta;
+			sink.Send(event);
+		}
+
+		static std::string Trim(const std::string& text) {
+			std::string::size_type start = 0;
+			std::string::size_type end = text.size();
+			while (start < end && isspace((unsigned char)text[start])) {
+				start++;
+			}
+			while (end > start && isspace((unsigned char)text[end - 1])) {
+				end--;
+			}
+			return text.substr(start, end - start);
+		}
+
+		// a name, not a path or a number: starts with a letter, then words
+		static bool IsLabel(const std::string& text) {
+			if (text.empty() || !isalpha((unsigned char)text[0])) {
+				return false;
+			}
+			for (char c : text) {
+				if (!isalnum((unsigned char)c) && c != ' ' && c != '_' && c != '-' && c != '(' && c != ')') {
+					return false;
+				}
+			}
+			return true;
+		}
+
+		static bool ParseNumber(const std::string& text, double& value) {
+			if (text.empty()) {
+				return false;
+			}
+			char* end;
+			value = strtod(text.c_str(), &end);
+			return end != text.c_str() && *end == '\0';
+		}
+
+		void FlushLine() {
+			std::string text = Trim(line);
+			line.clear();
+			if (!text.empty()) {
+				ParseLine(text);
+			}
+		}
+
+		void ParseLine(const std::string& text) {
+			// "--- Title ---"
+			if (text.size() > 6 && !text.compare(0, 3, "---") && !text.compare(text.size() - 3, 3, "---")) {
+				std::string title = Trim(text.substr(3, text.size() - 6));
+				if (!title.empty()) {
+					phase = title;
+					phaseStart = Now();
+					lastPercent = -1;
+					Send(PROGRESS_PHASE, title, 0.0, -1.0);
+				}
+				return;
+			}
+
+			// "Label : 123"
+			std::string::size_type colon = text.find(':');
+			if (colon != std::string::npos) {
+				std::string label = Trim(text.substr(0, colon));
+				double value;
+				if (IsLabel(label) && ParseNumber(Trim(text.substr(colon + 1)), value)) {
+					Send(PROGRESS_COUNTER, label, value, -1.0);
+					return;
+				}
+			}
+
+			// "45%", "12 of 340" or "12/340", anywhere in the line
+			std::vector<std::string> words;
+			std::string::size_type start = 0;
+			while (start < text.size()) {
+				std::string::size_type end = text.find_first_of(" \t,", start);
+				end = end == std::string::npos ? text.size() : end;
+				if (end > start) {
+					words.push_back(text.substr(start, end - start));
+				}
+				start = end + 1;
+			}
+			for (size_t i = 0; i < words.size(); i++) {
+				const std::string& word = words[i];
+				double done, total;
+				if (word.size() > 1 && word.back() == '%' && ParseNumber(word.substr(0, word.size() - 1), done)) {
+					SendPercent(done);
+					return;
+				}
+				std::string::size_type slash = word.find('/');
+				if (slash != std::string::npos && ParseNumber(word.substr(0, slash), done) && ParseNumber(word.substr(slash + 1), total) && total > 0.0) {
+					SendPercent(100.0 * done / total);
+					return;
+				}
+				if (i + 2 < words.size() && words[i + 1] == "of" && ParseNumber(word, done) && ParseNumber(words[i + 2], total) && total > 0.0) {
+					SendPercent(100.0 * done / total);
+					return;
+				}
+			}
+		}
+
+		// one event per whole percent, a drop means the library started another pass
+		void SendPercent(double percent) {
+			percent = percent < 0.0 ? 0.0 : (percent > 100.0 ? 100.0 : percent);
+			int whole = (int)percent;
+			if (whole == lastPercent) {
+				return;
+			}
+			if (whole < lastPercent) {
+				phaseStart = Now();
+			}
+			lastPercent = whole;
+
+			double elapsed = Now() - phaseStart;
+			double eta = percent > 0.0 ? elapsed * (100.0 - percent) / percent : -1.0;
+			Send(PROGRESS_PERCENT, std::string(), percent, eta);
+		}
+	};
+};
+
+#endif // GBSPTOOLS_PROGRESS_H
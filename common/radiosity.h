@@ -0,0 +1,246 @@
+/****************************************************************************************/
+/*  radiosity.h
+/*
+/*  Author: rtxa
+/*  Description: Progressive refinement radiosity between the patches of a .BSP
+/*
+/*	Every patch starts with the direct light it receives times its reflectivity as
+/*	unshot light. Each step shoots the patch holding the most unshot power (color
+/*	times area) at every other patch it can see, which adds to their bounce light
+/*	and, scaled by their reflectivity, to their own unshot light. It stops once the
+/*	unshot power left drops below Threshold times the power there was at the start,
+/*	so bright areas converge first and dim corners don't cost full bounces.
+/*
+/*	Form factors use the disc approximation: shooter i gives patch j
+/*	cos(i) cos(j) Area(i) / (PI r^2 + Area(i)) of its light, which stays finite for
+/*	close patches.
+/*
+/*	Given a Checkpoint, the Bounce and Unshot light of every patch is saved between
+/*	shots every Interval seconds, when canceled and at the end; a resumed solve takes
+/*	them back and goes on shooting from there.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_RADIOSITY_H
+#define GBSPTOOLS_RADIOSITY_H
+
+#include <string.h>
+#include <atomic>
+#include <vector>
+#include "bvh.h"
+#include "cancel.h"
+#include "checkpoint.h"
+#include "threads.h"
+#include "vec3d.h"
+
+#define RADIOSITY_DEFAULT_THRESHOLD		0.01f
+#define RADIOSITY_DEFAULT_MIN_PATCH		32.0f
+#define RADIOSITY_DEFAULT_MAX_MEMORY	256			// MB
+#define RADIOSITY_SHOOT_BATCH			64			// receivers per work item while shooting
+#define RADIOSITY_RAY_PACKET			8			// see Bvh::Occluded8()
+#define RADIOSITY_PI					3.14159265f
+
+namespace GBSPTools {
+	typedef struct {
+		geFloat		Threshold;				// fraction of the starting unshot power left when shooting stops
+		geFloat		MinPatchSize;			// smallest patch edge, PatchSize or more turns subdivision off
+		int32		MaxMemory;				// MB the patches may take, 0 for no limit
+	} RadiosityParms;
+
+	typedef struct {
+		geVec3d		Origin;					// lifted off the face
+		geVec3d		Normal;
+		geFloat		Area;
+		geFloat		Size;					// edge length
+		geVec3d		Reflectivity;			// 0-1 per channel, already scaled by ReflectiveScale
+		int32		Face;
+		geVec3d		Direct;					// light from the light sources
+		geVec3d		Bounce;					// light from other patches
+		geVec3d		Unshot;					// reflected light not shot yet
+	} RadiosityPatch;
+
+	typedef struct {
+		int32		Shots;
+		geFloat		Remaining;				// unshot power left, as a fraction of the starting one
+		long long	Rays;
+		int32		ResumedShots;			// shots taken from the checkpoint
+	} RadiosityStats;
+
+	class RadiositySolver {
+	public:
+		RadiositySolver(const RadiosityParms& parms, int numThreads) : parms(parms), numThreads(numThreads) {
+			memset(&stats, 0, sizeof(stats));
+		}
+
+		const RadiosityStats& GetStats() const { return stats; }
+
+		//========================================================================================
+		//	Solve()
+		//	Fills the Bounce light of every patch, shooting at most maxShots times.
+		//	Direct and Reflectivity must be set, the rest is overwritten.
+		//========================================================================================
+		void Solve(std::vector<RadiosityPatch>& patches, const Bvh& bvh, long long maxShots, Checkpoint* checkpoint = nullptr) {
+			double start = 0.0;
+			for (RadiosityPatch& patch : patches) {
+				geVec3d_Clear(&patch.Bounce);
+				Reflect(patch.Direct, patch, patch.Unshot);
+				start += Power(patch);
+			}
+			stats.Remaining = start > 0.0 ? 1.0f : 0.0f;
+			if (checkpoint) {
+				stats.ResumedShots = ResumeCheckpoint(checkpoint->GetResumeData(), patches);
+				stats.Shots = stats.ResumedShots;
+			}
+
+			while (stats.Shots < maxShots && start > 0.0 && !IsCancelRequested()) {
+				int32 shooter = -1;
+				double best = 0.0, left = 0.0;
+				for (int32 i = 0; i < (int32)patches.size(); i++) {
+					double power = Power(patches[i]);
+					left += power;
+					if (power > best) {
+						best = power;
+						shooter = i;
+					}
+				}
+				stats.Remaining = (geFloat)(left / start);
+				if (shooter < 0 || left <= parms.Threshold * start) {
+					break;
+				}
+				Shoot(patches, bvh, shooter);
+				stats.Shots++;
+				if (checkpoint && checkpoint->Claim()) {
+					SaveCheckpoint(*checkpoint, patches);
+				}
+			}
+
+			// the face lighting after it takes long too, it shouldn't have to shoot again
+			if (checkpoint && checkpoint->IsEnabled()) {
+				SaveCheckpoint(*checkpoint, patches);
+			}
+		}
+
+	private:
+		RadiosityParms parms;
+		int numThreads;
+		RadiosityStats stats;
+
+		// Shots so far, then the face, bounce and unshot light of every patch
+		void SaveCheckpoint(Checkpoint& checkpoint, const std::vector<RadiosityPatch>& patches) const {
+			CheckpointWriter writer;
+			writer.WriteValue(stats.Shots);
+			writer.WriteValue((int32)patches.size());
+			for (const RadiosityPatch& patch : patches) {
+				writer.WriteValue(patch.Face);
+				writer.WriteValue(patch.Bounce);
+				writer.WriteValue(patch.Unshot);
+			}
+			if (!checkpoint.Save(writer)) {
+				printf("Warning: %s\n", checkpoint.GetError().c_str());
+			}
+		}
+
+		// Returns the shots the checkpoint took, 0 when it doesn't fit these patches
+		static int32 ResumeCheckpoint(const std::vector<uint8>& data, std::vector<RadiosityPatch>& patches) {
+			if (data.empty()) {
+				return 0;
+			}
+			CheckpointReader reader(data);
+			int32 shots, count;
+			if (!reader.ReadValue(shots) || !reader.ReadValue(count) || shots < 0 || count != (int32)patches.size()) {
+				return 0;
+			}
+
+			std::vector<geVec3d> light(patches.size() * 2);
+			for (size_t i = 0; i < patches.size(); i++) {
+				int32 face;
+				if (!reader.ReadValue(face) || face != patches[i].Face || !reader.Read(&light[i * 2], 2)) {
+					return 0;
+				}
+			}
+			if (!reader.IsAtEnd()) {
+				return 0;
+			}
+			for (size_t i = 0; i < patches.size(); i++) {
+				patches[i].Bounce = light[i * 2];
+				patches[i].Unshot = light[i * 2 + 1];
+			}
+			return shots;
+		}
+
+		// The part of light the patch sends back out, per channel
+		static void Reflect(const geVec3d& light, const RadiosityPatch& patch, geVec3d& out) {
+			geVec3d_Set(&out, light.X * patch.Reflectivity.X, light.Y * patch.Reflectivity.Y, light.Z * patch.Reflectivity.Z);
+		}
+
+		static double Power(const RadiosityPatch& patch) {
+			return ((double)patch.Unshot.X + patch.Unshot.Y + patch.Unshot.Z) * patch.Area;
+		}
+
+		void Shoot(std::vector<RadiosityPatch>& patches, const Bvh& bvh, int32 shooter) {
+			const RadiosityPatch source = patches[shooter];
+			geVec3d_Clear(&patches[shooter].Unshot);
+
+			const int32 count = (int32)patches.size();
+			std::atomic<long long> rays(0);
+
+			ParallelFor((count + RADIOSITY_SHOOT_BATCH - 1) / RADIOSITY_SHOOT_BATCH, numThreads, [&](int batch) {
+				geVec3d starts[RADIOSITY_RAY_PACKET];
+				geVec3d ends[RADIOSITY_RAY_PACKET];
+				int32 targets[RADIOSITY_RAY_PACKET];
+				geFloat factors[RADIOSITY_RAY_PACKET];
+				int pending = 0;
+				long long batchRays = 0;
+
+				auto flush = [&]() {
+					uint32 blocked = bvh.Occluded8(starts, ends, pending);
+					for (int k = 0; k < pending; k++) {
+						if (blocked & (1u << k)) {
+							continue;
+						}
+						RadiosityPatch& patch = patches[targets[k]];
+						geVec3d received, reflected;
+						geVec3d_Scale(&source.Unshot, factors[k], &received);
+						geVec3d_Add(&patch.Bounce, &received, &patch.Bounce);
+						Reflect(received, patch, reflected);
+						geVec3d_Add(&patch.Unshot, &reflected, &patch.Unshot);
+					}
+					batchRays += pending;
+					pending = 0;
+				};
+
+				int32 end = (batch + 1) * RADIOSITY_SHOOT_BATCH < count ? (batch + 1) * RADIOSITY_SHOOT_BATCH : count;
+				for (int32 j = batch * RADIOSITY_SHOOT_BATCH; j < end; j++) {
+					const RadiosityPatch& patch = patches[j];
+					if (patch.Face == source.Face) {
+						continue;
+					}
+					geVec3d dir;
+					geVec3d_Subtract(&patch.Origin, &source.Origin, &dir);
+					geFloat dist = geVec3d_Normalize(&dir);
+					geFloat cosSource = geVec3d_DotProduct(&dir, &source.Normal);
+					geFloat cosPatch = -geVec3d_DotProduct(&dir, &patch.Normal);
+					if (cosSource <= 0.0f || cosPatch <= 0.0f) {
+						continue;
+					}
+
+					starts[pending] = source.Origin;
+					ends[pending] = patch.Origin;
+					targets[pending] = j;
+					factors[pending] = cosSource * cosPatch * source.Area / (RADIOSITY_PI * dist * dist + source.Area);
+					if (++pending == RADIOSITY_RAY_PACKET) {
+						flush();
+					}
+				}
+				if (pending) {
+					flush();
+				}
+				rays += batchRays;
+			});
+
+			stats.Rays += rays;
+		}
+	};
+};
+
+#endif // GBSPTOOLS_RADIOSITY_H
@@ -0,0 +1,141 @@
+/****************************************************************************************/
+/*  stagecache.h
+/*
+/*  Author: rtxa
+/*  Description: Content addressed cache of the .bsp every compile stage outputs
+/*
+/*	The key of a stage hashes everything its output depends on: the key of the stage
+/*	before it (or the input file bytes for the first one), its exact parameter
+/*	structs, the tools version and, when GBSPLib runs it, the library version. The
+/*	output is kept as <dir>/<key>.bsp, so a stage whose inputs didn't change is
+/*	replaced by that output. Entries are never modified, stale ones just stop being hit
+/*	and the directory can be wiped at any time.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_STAGECACHE_H
+#define GBSPTOOLS_STAGECACHE_H
+
+#include <stdio.h>
+#include <string>
+#include "platform.h"
+#include "bspfile.h"
+#include "hash.h"
+#include "mappedfile.h"
+#include "utils.h"
+
+#define STAGECACHE_EXTENSION	".bsp"
+
+namespace GBSPTools {
+	typedef struct {
+		int32		Hits;				// stages skipped
+		int32		Misses;				// stages run
+		long long	BytesFetched;		// output taken from the cache instead of computed
+		long long	BytesStored;
+	} StageCacheStats;
+
+	class StageCache {
+	public:
+		StageCache() { memset(&stats, 0, sizeof(stats)); }
+
+		const std::string& GetError() const { return error; }
+		const std::string& GetDirectory() const { return directory; }
+		const StageCacheStats& GetStats() const { return stats; }
+		bool IsOpen() const { return !directory.empty(); }
+
+		// Uses dir as the cache, creating it if needed
+		bool Open(const std::string& dir) {
+			directory.clear();
+			if (dir.empty() || !MakeDirectory(dir)) {
+				error = "unable to create the cache directory " + dir;
+				return false;
+			}
+			directory = dir;
+			if (directory.back() != '/' && directory.back() != '\\') {
+				directory += '/';
+			}
+			return true;
+		}
+
+		bool Contains(const std::string& key) const {
+			MappedFile file;
+			return IsOpen() && !key.empty() && file.Open(EntryPath(key));
+		}
+
+		// Keeps a copy of the output at path under key
+		bool Store(const std::string& key, const std::string& path) {
+			long long bytes = 0;
+			if (!IsOpen() || key.empty() || !CopyEntry(path, EntryPath(key), bytes)) {
+				return false;
+			}
+			stats.BytesStored += bytes;
+			return true;
+		}
+
+		// Maps the output cached under key into bsp, false when there is none. Entries
+		// never change, so there's no need to copy it.
+		bool Fetch(const std::string& key, BspFile& bsp) {
+			if (!Contains(key) || !bsp.Open(EntryPath(key))) {
+				return false;
+			}
+			stats.BytesFetched += (long long)bsp.GetSize();
+			return true;
+		}
+
+		// Keeps a copy of bsp, as it is in memory, under key
+		bool Store(const std::string& key, BspFile& bsp) {
+			if (!IsOpen() || key.empty()) {
+				return false;
+			}
+			if (!bsp.SaveCopy(EntryPath(key))) {
+				error = bsp.GetError();
+				return false;
+			}
+			stats.BytesStored += (long long)bsp.GetSize();
+			return true;
+		}
+
+		void CountHit() { stats.Hits++; }
+		void CountMiss() { stats.Misses++; }
+
+	private:
+		std::string directory;
+		std::string error;
+		StageCacheStats stats;
+
+		std::string EntryPath(const std::string& key) const {
+			return directory + key + STAGECACHE_EXTENSION;
+		}
+
+		// Through a temporary file, so a reader never sees half a .bsp
+		bool CopyEntry(const std::string& from, const std::string& to, long long& bytes) {
+			MappedFile source;
+			if (!source.Open(from)) {
+				error = "unable to read " + from;
+				return false;
+			}
+
+			const std::string tempPath = to + ".tmp";
+			FILE* fp = fopen(tempPath.c_str(), "wb");
+			if (fp == nullptr) {
+				error = "unable to write " + tempPath;
+				return false;
+			}
+			bool ok = source.GetSize() == 0 || fwrite(source.GetData(), 1, source.GetSize(), fp) == source.GetSize();
+			ok = fclose(fp) == 0 && ok;
+			bytes = (long long)source.GetSize();
+			source.Close();
+
+			if (ok) {
+				ok = CommitFile(tempPath, to);
+			}
+			if (!ok) {
+				remove(tempPath.c_str());
+				error = "unable to write " + to;
+			}
+			return ok;
+		}
+	};
+};
+
+#endif // GBSPTOOLS_STAGECACHE_H
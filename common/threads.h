@@ -0,0 +1,189 @@
+/****************************************************************************************/
+/*  threads.h
+/*
+/*  Author: rtxa
+/*  Description: Helpers to spread independent work items across all the cores
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_THREADS_H
+#define GBSPTOOLS_THREADS_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace GBSPTools {
+	inline int GetNumCores() {
+		unsigned int cores = std::thread::hardware_concurrency();
+		return cores ? (int)cores : 1;
+	}
+
+	// numThreads <= 0 means one thread per core
+	inline int ResolveNumThreads(int numThreads) {
+		return numThreads > 0 ? numThreads : GetNumCores();
+	}
+
+	//========================================================================================
+	//	ParallelFor()
+	//	Calls func(index) for every index in [0, count), handing out small batches of
+	//	indices to each thread as they finish, so uneven items still balance out
+	//========================================================================================
+	template <typename Func>
+	void ParallelFor(int count, int numThreads, Func func) {
+		numThreads = ResolveNumThreads(numThreads);
+		if (numThreads > count) {
+			numThreads = count;
+		}
+
+		if (numThreads <= 1) {
+			for (int i = 0; i < count; i++) {
+				func(i);
+			}
+			return;
+		}
+
+		// a few batches per thread keeps the atomic counter out of the way
+		const int batchSize = count / (numThreads * 16) + 1;
+		std::atomic<int> next(0);
+
+		auto worker = [&]() {
+			for (;;) {
+				int start = next.fetch_add(batchSize);
+				if (start >= count) {
+					break;
+				}
+				int end = start + batchSize < count ? start + batchSize : count;
+				for (int i = start; i < end; i++) {
+					func(i);
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		threads.reserve(numThreads - 1);
+		for (int t = 1; t < numThreads; t++) {
+			threads.emplace_back(worker);
+		}
+		worker();
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+	}
+
+	//========================================================================================
+	//	WorkStealingFor()
+	//	Calls func(index) for every index in [0, count). Each thread starts with its own
+	//	queue of indices and, once it runs dry, steals the back half of the fullest queue,
+	//	so a few very expensive items don't leave the other threads idle.
+	//	Without an order each thread gets a contiguous range, neighbouring items share
+	//	data. With an order (most expensive first) the items are dealt round robin so
+	//	every thread starts with the expensive ones.
+	//========================================================================================
+	template <typename Func>
+	void WorkStealingFor(int count, int numThreads, Func func, const std::vector<int>* order = nullptr) {
+		numThreads = ResolveNumThreads(numThreads);
+		if (numThreads > count) {
+			numThreads = count;
+		}
+
+		if (numThreads <= 1) {
+			for (int i = 0; i < count; i++) {
+				func(order ? (*order)[i] : i);
+			}
+			return;
+		}
+
+		struct WorkQueue {
+			std::mutex lock;
+			std::vector<int> items;
+			std::atomic<size_t> head;
+			std::atomic<size_t> tail;
+			WorkQueue() : head(0), tail(0) {}
+		};
+
+		std::vector<WorkQueue> queues(numThreads);
+		for (int t = 0; t < numThreads; t++) {
+			WorkQueue& queue = queues[t];
+			if (order) {
+				for (int i = t; i < count; i += numThreads) {
+					queue.items.push_back((*order)[i]);
+				}
+			}
+			else {
+				int start = (int)((long long)count * t / numThreads);
+				int end = (int)((long long)count * (t + 1) / numThreads);
+				for (int i = start; i < end; i++) {
+					queue.items.push_back(i);
+				}
+			}
+			queue.tail = queue.items.size();
+		}
+
+		auto worker = [&](int self) {
+			WorkQueue& own = queues[self];
+			for (;;) {
+				int item = -1;
+				{
+					std::lock_guard<std::mutex> guard(own.lock);
+					if (own.head < own.tail) {
+						item = own.items[own.head];
+						own.head++;
+					}
+				}
+				if (item >= 0) {
+					func(item);
+					continue;
+				}
+
+				// pick the fullest queue, the sizes are only a hint until it's locked
+				int victim = -1;
+				size_t most = 0;
+				for (int t = 0; t < numThreads; t++) {
+					size_t head = queues[t].head.load(std::memory_order_relaxed);
+					size_t tail = queues[t].tail.load(std::memory_order_relaxed);
+					size_t left = tail > head ? tail - head : 0;
+					if (t != self && left > most) {
+						most = left;
+						victim = t;
+					}
+				}
+				if (victim < 0) {
+					break;
+				}
+
+				std::vector<int> stolen;
+				{
+					std::lock_guard<std::mutex> guard(queues[victim].lock);
+					WorkQueue& other = queues[victim];
+					size_t tail = other.tail;
+					size_t left = tail - other.head;
+					if (left == 0) {
+						continue;
+					}
+					size_t mid = tail - (left + 1) / 2;
+					stolen.assign(other.items.begin() + mid, other.items.begin() + tail);
+					other.tail = mid;
+				}
+
+				std::lock_guard<std::mutex> guard(own.lock);
+				own.items.swap(stolen);
+				own.head = 0;
+				own.tail = own.items.size();
+			}
+		};
+
+		std::vector<std::thread> threads;
+		threads.reserve(numThreads - 1);
+		for (int t = 1; t < numThreads; t++) {
+			threads.emplace_back(worker, t);
+		}
+		worker(0);
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+	}
+};
+
+#endif // GBSPTOOLS_THREADS_H
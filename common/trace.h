@@ -0,0 +1,210 @@
+/****************************************************************************************/
+/*  trace.h
+/*
+/*  Author: rtxa
+/*  Description: Records how long the parts of a compile take and how much memory and
+/*  CPU they use, printed as a summary or written as a Chrome trace (chrome://tracing,
+/*  ui.perfetto.dev)
+/*
+/*	The peak memory of a span is the high-water mark of the whole process when it ended,
+/*	neither Windows nor Linux can reset it, so the growth tells which span raised it.
+/*	CPU time adds up every thread, above the wall time when a stage runs in parallel.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_TRACE_H
+#define GBSPTOOLS_TRACE_H
+
+#include <stdio.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "platform.h"
+#include "basetype.h"
+
+namespace GBSPTools {
+	typedef struct {
+		std::string Name;
+		std::string Category;
+		int32		Lane;				// a row of the trace, the batch job slot
+		int32		Depth;				// spans open on the lane when it began
+		double		Start;				// seconds since the trace began
+		double		Wall;				// negative while still open
+		double		Cpu;				// negative when not measured
+		long long	PeakMemory;			// bytes
+		long long	PeakGrowth;			// bytes
+		std::string	Detail;				// extra text shown with the span
+	} TraceSpan;
+
+	class Trace {
+	public:
+		Trace() : origin(std::chrono::steady_clock::now()) {}
+
+		double Now() const {
+			return std::chrono::duration<double>(std::chrono::steady_clock::now() - origin).count();
+		}
+
+		const std::vector<TraceSpan>& GetSpans() const { return spans; }
+
+		// Opens a span measured in this process, returns what End() takes
+		int Begin(const std::string& name, const char* category, int lane = 0) {
+			std::lock_guard<std::mutex> guard(lock);
+			TraceSpan span;
+			span.Name = name;
+			span.Category = category;
+			span.Lane = lane;
+			span.Depth = GetOpenSpans(lane);
+			span.Start = Now();
+			span.Wall = -1.0;
+			span.Cpu = GetProcessCpuTime();
+			span.PeakMemory = GetPeakMemoryUsage();
+			span.PeakGrowth = 0;
+			spans.push_back(span);
+			return (int)spans.size() - 1;
+		}
+
+		// Closes a span, returns its wall time in seconds
+		double End(int index) {
+			std::lock_guard<std::mutex> guard(lock);
+			TraceSpan& span = spans[index];
+			long long peak = GetPeakMemoryUsage();
+			span.Wall = Now() - span.Start;
+			span.Cpu = GetProcessCpuTime() - span.Cpu;
+			span.PeakGrowth = peak - span.PeakMemory;
+			span.PeakMemory = peak;
+			return span.Wall;
+		}
+
+		// Adds a span measured elsewhere, like a worker process, with only its times
+		void Add(const std::string& name, const char* category, int lane, double start, double wall, const std::string& detail) {
+			std::lock_guard<std::mutex> guard(lock);
+			TraceSpan span;
+			span.Name = name;
+			span.Category = category;
+			span.Lane = lane;
+			span.Depth = GetOpenSpans(lane);
+			span.Start = start;
+			span.Wall = wall;
+			span.Cpu = -1.0;
+			span.PeakMemory = 0;
+			span.PeakGrowth = 0;
+			span.Detail = detail;
+			spans.push_back(span);
+		}
+
+		//========================================================================================
+		//	ShowSummary()
+		//	Prints every closed span, nested ones indented under their parent
+		//========================================================================================
+		void ShowSummary() const {
+			printf("TIMINGS:\n");
+			printf("%-20s|%12s |%12s |%12s |%12s \n", "Name", "Wall (s)", "CPU (s)", "Peak (MB)", "Growth (MB)");
+			printf("%-20s|%13s|%13s|%13s|%13s\n", "--------------------", "-------------", "-------------", "-------------", "-------------");
+			for (const TraceSpan& span : spans) {
+				if (span.Wall < 0.0) {
+					continue;
+				}
+				std::string name = std::string(span.Depth * 2, ' ') + span.Name;
+				if (span.Cpu < 0.0) {
+					printf("%-20s|%12.2f |%12s |%12s |%12s \n", name.c_str(), span.Wall, "-", "-", "-");
+				}
+				else {
+					printf("%-20s|%12.2f |%12.2f |%12.1f |%12.1f \n", name.c_str(), span.Wall, span.Cpu, span.PeakMemory / 1048576.0, span.PeakGrowth / 1048576.0);
+				}
+			}
+			printf("\n");
+		}
+
+		//========================================================================================
+		//	WriteChromeTrace()
+		//	Writes the closed spans in the Chrome trace event format, with a counter track
+		//	of the peak memory
+		//========================================================================================
+		bool WriteChromeTrace(const std::string& path) {
+			std::lock_guard<std::mutex> guard(lock);
+			FILE* fp = fopen(path.c_str(), "w");
+			if (fp == nullptr) {
+				error = "unable to write " + path;
+				return false;
+			}
+
+			fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+			fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"gbsptools\"}}");
+			for (const TraceSpan& span : spans) {
+				if (span.Wall < 0.0) {
+					continue;
+				}
+				const long long start = (long long)(span.Start * 1e6);
+				const long long duration = (long long)(span.Wall * 1e6);
+				fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld,\"args\":{",
+					Escape(span.Name).c_str(), Escape(span.Category).c_str(), span.Lane, start, duration);
+				if (span.Cpu >= 0.0) {
+					fprintf(fp, "\"cpu_s\":%.3f,\"peak_mb\":%.1f,\"growth_mb\":%.1f", span.Cpu, span.PeakMemory / 1048576.0, span.PeakGrowth / 1048576.0);
+				}
+				if (!span.Detail.empty()) {
+					fprintf(fp, "%s\"detail\":\"%s\"", span.Cpu >= 0.0 ? "," : "", Escape(span.Detail).c_str());
+				}
+				fprintf(fp, "}}");
+				if (span.Cpu >= 0.0) {
+					fprintf(fp, ",\n{\"name\":\"peak memory\",\"ph\":\"C\",\"pid\":1,\"ts\":%lld,\"args\":{\"MB\":%.1f}}", start + duration, span.PeakMemory / 1048576.0);
+				}
+			}
+			fprintf(fp, "\n]}\n");
+
+			if (fclose(fp) != 0) {
+				error = "unable to write " + path;
+				return false;
+			}
+			return true;
+		}
+
+		const std::string& GetError() const { return error; }
+
+	private:
+		std::chrono::steady_clock::time_point origin;
+		std::vector<TraceSpan> spans;
+		std::mutex lock;
+		std::string error;
+
+		int32 GetOpenSpans(int lane) const {
+			int32 count = 0;
+			for (const TraceSpan& span : spans) {
+				count += span.Lane == lane && span.Wall < 0.0;
+			}
+			return count;
+		}
+
+		static std::string Escape(const std::string& text) {
+			std::string escaped;
+			for (char c : text) {
+				if (c == '"' || c == '\\') {
+					escaped += '\\';
+				}
+				if ((unsigned char)c >= 0x20) {
+					escaped += c;
+				}
+			}
+			return escaped;
+		}
+	};
+
+	//========================================================================================
+	//	TraceScope
+	//	Span covering the rest of a block, closed on every return
+	//========================================================================================
+	class TraceScope {
+	public:
+		TraceScope(Trace& trace, const std::string& name, const char* category) : trace(trace), index(trace.Begin(name, category)) {}
+		~TraceScope() { trace.End(index); }
+
+		TraceScope(const TraceScope&) = delete;
+		TraceScope& operator=(const TraceScope&) = delete;
+
+	private:
+		Trace& trace;
+		int index;
+	};
+};
+
+#endif // GBSPTOOLS_TRACE_H
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <stdio.h>
 #include <string>
+#include "platform.h"
 
 namespace GBSPTools {
     constexpr char PathSeparator = '/';
@@ -54,4 +56,13 @@ namespace GBSPTools {
     void PathToUnix(std::string& path) {
         GBSPTools::ReplaceAll(path, "\\", "/");
     }
+
+    // Moves from over to in a single step, to is never missing in between
+    bool CommitFile(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+        return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        return rename(from.c_str(), to.c_str()) == 0;
+#endif
+    }
 };
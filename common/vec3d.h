@@ -22,6 +22,8 @@
 #ifndef GE_VEC3D_H
 #define GE_VEC3D_H
 
+#include <math.h>
+#include <stddef.h>
 #include "basetype.h"
 
 #ifdef __cplusplus
@@ -62,6 +64,172 @@ GENESISAPI geFloat GENESISCC		geVec3d_DistanceBetween(const geVec3d *V1, const g
 
 GENESISAPI geBoolean GENESISCC geVec3d_IsValid(const geVec3d *V);
 
+//========================================================================================
+//	The native stages do their vector math through these. Every tool is built as a
+//	single translation unit, so they're defined here rather than in a Vec3d.c of
+//	their own, where the compiler can inline them.
+//========================================================================================
+#ifndef NDEBUG
+GENESISAPI geFloat GENESISCC geVec3d_GetElement(geVec3d *V, int Index)
+{
+	return *(&V->X + Index);
+}
+#endif
+
+GENESISAPI void GENESISCC geVec3d_Set(geVec3d *V, geFloat X, geFloat Y, geFloat Z)
+{
+	V->X = X;
+	V->Y = Y;
+	V->Z = Z;
+}
+
+GENESISAPI void GENESISCC geVec3d_Get(const geVec3d *V, geFloat *X, geFloat *Y, geFloat *Z)
+{
+	*X = V->X;
+	*Y = V->Y;
+	*Z = V->Z;
+}
+
+GENESISAPI geFloat GENESISCC geVec3d_DotProduct(const geVec3d *V1, const geVec3d *V2)
+{
+	return V1->X * V2->X + V1->Y * V2->Y + V1->Z * V2->Z;
+}
+
+GENESISAPI void GENESISCC geVec3d_CrossProduct(const geVec3d *V1, const geVec3d *V2, geVec3d *VResult)
+{
+	geVec3d Result;
+
+	Result.X = V1->Y * V2->Z - V1->Z * V2->Y;
+	Result.Y = V1->Z * V2->X - V1->X * V2->Z;
+	Result.Z = V1->X * V2->Y - V1->Y * V2->X;
+
+	*VResult = Result;
+}
+
+GENESISAPI geBoolean GENESISCC geVec3d_Compare(const geVec3d *V1, const geVec3d *V2, geFloat Tolerance)
+{
+	if (fabsf(V2->X - V1->X) > Tolerance)
+		return GE_FALSE;
+	if (fabsf(V2->Y - V1->Y) > Tolerance)
+		return GE_FALSE;
+	if (fabsf(V2->Z - V1->Z) > Tolerance)
+		return GE_FALSE;
+
+	return GE_TRUE;
+}
+
+GENESISAPI geFloat GENESISCC geVec3d_LengthSquared(const geVec3d *V1)
+{
+	return geVec3d_DotProduct(V1, V1);
+}
+
+GENESISAPI geFloat GENESISCC geVec3d_Length(const geVec3d *V1)
+{
+	return sqrtf(geVec3d_DotProduct(V1, V1));
+}
+
+// Normalizes V1 in place and returns its length before, a zero vector is left alone
+GENESISAPI geFloat GENESISCC geVec3d_Normalize(geVec3d *V1)
+{
+	geFloat Length = geVec3d_Length(V1);
+
+	if (Length > 0.0f)
+	{
+		geFloat OneOverLength = 1.0f / Length;
+
+		V1->X *= OneOverLength;
+		V1->Y *= OneOverLength;
+		V1->Z *= OneOverLength;
+	}
+
+	return Length;
+}
+
+GENESISAPI geBoolean GENESISCC geVec3d_IsNormalized(const geVec3d *V)
+{
+	geFloat Length = geVec3d_Length(V);
+
+	if (Length >= 1.0f - 0.001f && Length <= 1.0f + 0.001f)
+		return GE_TRUE;
+
+	return GE_FALSE;
+}
+
+GENESISAPI void GENESISCC geVec3d_Scale(const geVec3d *VSrc, geFloat Scale, geVec3d *VDst)
+{
+	VDst->X = VSrc->X * Scale;
+	VDst->Y = VSrc->Y * Scale;
+	VDst->Z = VSrc->Z * Scale;
+}
+
+GENESISAPI void GENESISCC geVec3d_Subtract(const geVec3d *V1, const geVec3d *V2, geVec3d *V1MinusV2)
+{
+	V1MinusV2->X = V1->X - V2->X;
+	V1MinusV2->Y = V1->Y - V2->Y;
+	V1MinusV2->Z = V1->Z - V2->Z;
+}
+
+GENESISAPI void GENESISCC geVec3d_Add(const geVec3d *V1, const geVec3d *V2, geVec3d *VSum)
+{
+	VSum->X = V1->X + V2->X;
+	VSum->Y = V1->Y + V2->Y;
+	VSum->Z = V1->Z + V2->Z;
+}
+
+GENESISAPI void GENESISCC geVec3d_Copy(const geVec3d *Vsrc, geVec3d *Vdst)
+{
+	*Vdst = *Vsrc;
+}
+
+GENESISAPI void GENESISCC geVec3d_Clear(geVec3d *V)
+{
+	V->X = 0.0f;
+	V->Y = 0.0f;
+	V->Z = 0.0f;
+}
+
+GENESISAPI void GENESISCC geVec3d_Inverse(geVec3d *V)
+{
+	V->X = -V->X;
+	V->Y = -V->Y;
+	V->Z = -V->Z;
+}
+
+// V1 + V2 * Scale
+GENESISAPI void GENESISCC geVec3d_MA(geVec3d *V1, geFloat Scale, const geVec3d *V2, geVec3d *V1PlusV2Scaled)
+{
+	V1PlusV2Scaled->X = V1->X + V2->X * Scale;
+	V1PlusV2Scaled->Y = V1->Y + V2->Y * Scale;
+	V1PlusV2Scaled->Z = V1->Z + V2->Z * Scale;
+}
+
+// V1 + V2 * Scale, like geVec3d_MA() with a const V1
+GENESISAPI void GENESISCC geVec3d_AddScaled(const geVec3d *V1, const geVec3d *V2, geFloat Scale, geVec3d *V1PlusV2Scaled)
+{
+	V1PlusV2Scaled->X = V1->X + V2->X * Scale;
+	V1PlusV2Scaled->Y = V1->Y + V2->Y * Scale;
+	V1PlusV2Scaled->Z = V1->Z + V2->Z * Scale;
+}
+
+GENESISAPI geFloat GENESISCC geVec3d_DistanceBetween(const geVec3d *V1, const geVec3d *V2)
+{
+	geVec3d B;
+
+	geVec3d_Subtract(V1, V2, &B);
+	return geVec3d_Length(&B);
+}
+
+// False for NaNs and infinities
+GENESISAPI geBoolean GENESISCC geVec3d_IsValid(const geVec3d *V)
+{
+	if (V == NULL)
+		return GE_FALSE;
+	if (!(V->X - V->X == 0.0f) || !(V->Y - V->Y == 0.0f) || !(V->Z - V->Z == 0.0f))
+		return GE_FALSE;
+
+	return GE_TRUE;
+}
+
 #ifdef __cplusplus
 }
 #endif
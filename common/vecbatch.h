@@ -0,0 +1,443 @@
+/****************************************************************************************/
+/*  vecbatch.h
+/*
+/*  Author: rtxa
+/*  Description: geVec3d math on whole arrays at once, for the inner loops of the native
+/*  stages
+/*
+/*	A VecSoA keeps its vectors as three arrays, one per component, each starting on a
+/*	32 byte boundary and padded to whole groups of VECBATCH_WIDTH, so a kernel loads
+/*	four (SSE2) or eight (AVX) X, Y or Z with a single aligned load and never shuffles.
+/*	The kernels come in scalar, SSE2 and AVX versions and GetVecKernels() picks the
+/*	best one the processor has at run time, like the bit set ones. What doesn't fill
+/*	a whole group goes through the scalar version, which does the very same math, so
+/*	the results don't depend on where a vector falls in the array. The scalar versions
+/*	are the geVec3d_ and mathlib.h functions run over each vector in turn.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_VECBATCH_H
+#define GBSPTOOLS_VECBATCH_H
+
+#include <string.h>
+#include <new>
+#include "basetype.h"
+#include "platform.h"
+#include "mathlib.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define VECBATCH_X86 1
+#include <immintrin.h>
+#if defined(__GNUC__)
+// lets the SIMD kernels be built without -msse2 / -mavx, they're only called when supported
+#define VECBATCH_TARGET_SSE2 __attribute__((target("sse2")))
+#define VECBATCH_TARGET_AVX __attribute__((target("avx")))
+#else
+#define VECBATCH_TARGET_SSE2
+#define VECBATCH_TARGET_AVX
+#endif
+#endif
+
+#define VECBATCH_WIDTH			8			// floats per AVX register, the arrays are padded to it
+#define VECBATCH_ALIGNMENT		32
+
+#define VECBATCH_SCALAR			0
+#define VECBATCH_SSE2			1
+#define VECBATCH_AVX			2
+
+namespace GBSPTools {
+	//========================================================================================
+	//	VecSoA
+	//	Growable array of vectors kept as separate X, Y and Z arrays
+	//========================================================================================
+	class VecSoA {
+	public:
+		VecSoA() {}
+		VecSoA(const VecSoA&) = delete;
+		VecSoA& operator=(const VecSoA&) = delete;
+
+		int32 size() const { return count; }
+		bool empty() const { return count == 0; }
+		void clear() { count = 0; }
+
+		geFloat* X() { return floats.GetData(); }
+		geFloat* Y() { return floats.GetData() + capacity; }
+		geFloat* Z() { return floats.GetData() + 2 * capacity; }
+		const geFloat* X() const { return floats.GetData(); }
+		const geFloat* Y() const { return floats.GetData() + capacity; }
+		const geFloat* Z() const { return floats.GetData() + 2 * capacity; }
+
+		geVec3d Get(int32 i) const {
+			geVec3d v = { X()[i], Y()[i], Z()[i] };
+			return v;
+		}
+
+		void Set(int32 i, const geVec3d& v) {
+			X()[i] = v.X;
+			Y()[i] = v.Y;
+			Z()[i] = v.Z;
+		}
+
+		// Adds num vectors from a geVec3d array at the end
+		void Append(const geVec3d* v, int32 num) {
+			Reserve(count + num);
+			geFloat* x = X() + count;
+			geFloat* y = Y() + count;
+			geFloat* z = Z() + count;
+			for (int32 i = 0; i < num; i++) {
+				x[i] = v[i].X;
+				y[i] = v[i].Y;
+				z[i] = v[i].Z;
+			}
+			count += num;
+		}
+
+		// Replaces the contents with num vectors from a geVec3d array
+		void Assign(const geVec3d* v, int32 num) {
+			count = 0;
+			Append(v, num);
+		}
+
+		// Room for num vectors, keeps the ones there
+		void Reserve(int32 num) {
+			if (num <= capacity) {
+				return;
+			}
+			int32 newCapacity = capacity ? capacity : VECBATCH_WIDTH * 4;
+			while (newCapacity < num) {
+				newCapacity *= 2;
+			}
+			AlignedArray<geFloat, VECBATCH_ALIGNMENT> grown;
+			if (!grown.Resize((size_t)newCapacity * 3)) {
+				throw std::bad_alloc();
+			}
+			for (int c = 0; c < 3 && count; c++) {
+				memcpy(grown.GetData() + (size_t)c * newCapacity, floats.GetData() + (size_t)c * capacity, count * sizeof(geFloat));
+			}
+			floats.Swap(grown);
+			capacity = newCapacity;
+		}
+
+	private:
+		AlignedArray<geFloat, VECBATCH_ALIGNMENT> floats;		// X, then Y, then Z, capacity each
+		int32 capacity = 0;										// a multiple of VECBATCH_WIDTH
+		int32 count = 0;
+	};
+
+	// Every kernel works on the components of count vectors, x, y and z as a VecSoA has them
+	typedef struct {
+		const char*	Name;
+		int			Level;
+		// dists[i] is the distance of point i to the plane, like geVec3d_DotProduct() - dist
+		void		(*PlaneDists)(const geFloat* x, const geFloat* y, const geFloat* z, int32 count, const geVec3d& normal, geFloat dist, geFloat* dists);
+		// widens [minDist, maxDist] to the distances of the points to the plane
+		void		(*PlaneRange)(const geFloat* x, const geFloat* y, const geFloat* z, int32 count, const geVec3d& normal, geFloat dist, geFloat& minDist, geFloat& maxDist);
+		// widens mins and maxs to hold the points, like AddPointToBounds()
+		void		(*Bounds)(const geFloat* x, const geFloat* y, const geFloat* z, int32 count, geVec3d& mins, geVec3d& maxs);
+		// ColorNormalize() in place, maxes gets the largest channel of each color when not null
+		void		(*ColorNormalize)(geFloat* x, geFloat* y, geFloat* z, int32 count, geFloat* maxes);
+		// color * scale + bias with negative channels at 0 and, like ColorClamp(), scaled
+		// down to keep the hue when a channel goes over clamp, in place
+		void		(*ColorClamp)(geFloat* x, geFloat* y, geFloat* z, int32 count, geFloat scale, const geVec3d& bias, geFloat clamp);
+	} VecKernels;
+
+	struct VecScalar {
+		static void PlaneDists(const geFloat* x, const geFloat* y, const geFloat* z, int32 count, const geVec3d& normal, geFloat dist, geFloat* dists) {
+			for (int32 i = 0; i < count; i++) {
+				geVec3d p = { x[i], y[i], z[i] };
+				dists[i] = geVec3d_DotProduct(&p, &normal) - dist;
+			}
+		}
+
+		static void PlaneRange(const geFloat* x, const geFloat* y, const geFloat* z, int32 count, const geVec3d& normal, geFloat dist, geFloat& minDist, geFloat& maxDist) {
+			for (int32 i = 0; i < count; i++) {
+				geVec3d p = { x[i], y[i], z[i] };
+				geFloat d = geVec3d_DotProduct(&p, &normal) - dist;
+				minDist = d < minDist ? d : minDist;
+				maxDist = d > maxDist ? d : maxDist;
+			}
+		}
+
+		static void Bounds(const geFloat* x, const geFloat* y, const geFloat* z, int32 count, geVec3d& mins, geVec3d& maxs) {
+			for (int32 i = 0; i < count; i++) {
+				geVec3d p = { x[i], y[i], z[i] };
+				AddPointToBounds(&p, &mins, &maxs);
+			}
+			// which of 0 and -0 wins a tie depends on the order the points went through,
+			// adding 0 makes both 0 so every level gives the same bounds
+			geVec3d_Set(&mins, mins.X + 0.0f, mins.Y + 0.0f, mins.Z + 0.0f);
+			geVec3d_Set(&maxs, maxs.X + 0.0f, maxs.Y + 0.0f, maxs.Z + 0.0f);
+		}
+
+		static void ColorNormalize(geFloat* x, geFloat* y, geFloat* z, int32 count, geFloat* maxes) {
+			for (int32 i = 0; i < count; i++) {
+				geVec3d c = { x[i], y[i], z[i] };
+				geFloat max = ::ColorNormalize(&c, &c);
+				x[i] = c.X;
+				y[i] = c.Y;
+				z[i] = c.Z;
+				if (maxes) {
+					maxes[i] = max;
+				}
+			}
+		}
+
+		static void ColorClamp(geFloat* x, geFloat* y, geFloat* z, int32 count, geFloat scale, const geVec3d& bias, geFloat clamp) {
+			for (int32 i = 0; i < count; i++) {
+				geVec3d c = { x[i] * scale + bias.X, y[i] * scale + bias.Y, z[i] * scale + bias.Z };
+				::ColorClamp(&c, clamp, &c);
+				x[i] = c.X;
+				y[i] = c.Y;
+				z[i] = c.Z;
+			}
+		}
+	};
+
+#ifdef VECBATCH_X86
+	struct VecSse2 {
+		enum { Width = 4 };
+
+		VECBATCH_TARGET_SSE2 static geFloat HorizontalMin(__m128 v) {
+			v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+			v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+			return _mm_cvtss_f32(v);
+		}
+
+		VECBATCH_TARGET_SSE2 static geFloat HorizontalMax(__m128 v) {
+			v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+			v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+			return _mm_cvtss_f32(v);
+		}
+
+		VECBATCH_TARGET_SSE2 static void PlaneDists(const geFloat* x, const geFloat* y, const geFloat* z, int32 count, const geVec3d& normal, geFloat dist, geFloat* dists) {
+			const __m128 nx = _mm_set1_ps(normal.X), ny = _mm_set1_ps(normal.Y), nz = _mm_set1_ps(normal.Z), d0 = _mm_set1_ps(dist);
+			int32 i = 0;
+			for (; i + Width <= count; i += Width) {
+				__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(x + i), nx), _mm_mul_ps(_mm_load_ps(y + i), ny)), _mm_mul_ps(_mm_load_ps(z + i), nz));
+				_mm_storeu_ps(dists + i, _mm_sub_ps(d, d0));
+			}
+			VecScalar::PlaneDists(x + i, y + i, z + i, count - i, normal, dist, dists + i);
+		}
+
+		VECBATCH_TARGET_SSE2 static void PlaneRange(const geFloat* x, const geFloat* y, const geFloat* z, int32 count, const geVec3d& normal, geFloat dist, geFloat& minDist, geFloat& maxDist) {
+			int32 i = 0;
+			if (count >= Width) {
+				const __m128 nx = _mm_set1_ps(normal.X), ny = _mm_set1_ps(normal.Y), nz = _mm_set1_ps(normal.Z), d0 = _mm_set1_ps(dist);
+				__m128 lo = _mm_set1_ps(minDist), hi = _mm_set1_ps(maxDist);
+				for (; i + Width <= count; i += Width) {
+					__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(x + i), nx), _mm_mul_ps(_mm_load_ps(y + i), ny)), _mm_mul_ps(_mm_load_ps(z + i), nz));
+					d = _mm_sub_ps(d, d0);
+					lo = _mm_min_ps(d, lo);
+					hi = _mm_max_ps(d, hi);
+				}
+				minDist = HorizontalMin(lo);
+				maxDist = HorizontalMax(hi);
+			}
+			VecScalar::PlaneRange(x + i, y + i, z + i, count - i, normal, dist, minDist, maxDist);
+		}
+
+		VECBATCH_TARGET_SSE2 static void Bounds(const geFloat* x, const geFloat* y, const geFloat* z, int32 count, geVec3d& mins, geVec3d& maxs) {
+			int32 i = 0;
+			if (count >= Width) {
+				__m128 loX = _mm_set1_ps(mins.X), loY = _mm_set1_ps(mins.Y), loZ = _mm_set1_ps(mins.Z);
+				__m128 hiX = _mm_set1_ps(maxs.X), hiY = _mm_set1_ps(maxs.Y), hiZ = _mm_set1_ps(maxs.Z);
+				for (; i + Width <= count; i += Width) {
+					__m128 px = _mm_load_ps(x + i), py = _mm_load_ps(y + i), pz = _mm_load_ps(z + i);
+					loX = _mm_min_ps(px, loX);
+					loY = _mm_min_ps(py, loY);
+					loZ = _mm_min_ps(pz, loZ);
+					hiX = _mm_max_ps(px, hiX);
+					hiY = _mm_max_ps(py, hiY);
+					hiZ = _mm_max_ps(pz, hiZ);
+				}
+				geVec3d_Set(&mins, HorizontalMin(loX), HorizontalMin(loY), HorizontalMin(loZ));
+				geVec3d_Set(&maxs, HorizontalMax(hiX), HorizontalMax(hiY), HorizontalMax(hiZ));
+			}
+			VecScalar::Bounds(x + i, y + i, z + i, count - i, mins, maxs);
+		}
+
+		VECBATCH_TARGET_SSE2 static void ColorNormalize(geFloat* x, geFloat* y, geFloat* z, int32 count, geFloat* maxes) {
+			const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+			int32 i = 0;
+			for (; i + Width <= count; i += Width) {
+				__m128 r = _mm_load_ps(x + i), g = _mm_load_ps(y + i), b = _mm_load_ps(z + i);
+				__m128 max = _mm_max_ps(b, _mm_max_ps(g, r));
+				// black stays as it is, like ColorNormalize()
+				__m128 black = _mm_cmpeq_ps(max, zero);
+				__m128 factor = _mm_or_ps(_mm_and_ps(black, one), _mm_andnot_ps(black, _mm_div_ps(one, max)));
+				_mm_store_ps(x + i, _mm_mul_ps(r, factor));
+				_mm_store_ps(y + i, _mm_mul_ps(g, factor));
+				_mm_store_ps(z + i, _mm_mul_ps(b, factor));
+				if (maxes) {
+					_mm_storeu_ps(maxes + i, _mm_andnot_ps(black, max));
+				}
+			}
+			VecScalar::ColorNormalize(x + i, y + i, z + i, count - i, maxes ? maxes + i : nullptr);
+		}
+
+		VECBATCH_TARGET_SSE2 static void ColorClamp(geFloat* x, geFloat* y, geFloat* z, int32 count, geFloat scale, const geVec3d& bias, geFloat clamp) {
+			const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+			const __m128 s = _mm_set1_ps(scale), c = _mm_set1_ps(clamp);
+			const __m128 bx = _mm_set1_ps(bias.X), by = _mm_set1_ps(bias.Y), bz = _mm_set1_ps(bias.Z);
+			int32 i = 0;
+			for (; i + Width <= count; i += Width) {
+				__m128 r = _mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(x + i), s), bx), zero);
+				__m128 g = _mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(y + i), s), by), zero);
+				__m128 b = _mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(z + i), s), bz), zero);
+				__m128 max = _mm_max_ps(_mm_max_ps(r, g), b);
+				__m128 over = _mm_cmpgt_ps(max, c);
+				__m128 factor = _mm_or_ps(_mm_and_ps(over, _mm_div_ps(c, max)), _mm_andnot_ps(over, one));
+				_mm_store_ps(x + i, _mm_mul_ps(r, factor));
+				_mm_store_ps(y + i, _mm_mul_ps(g, factor));
+				_mm_store_ps(z + i, _mm_mul_ps(b, factor));
+			}
+			VecScalar::ColorClamp(x + i, y + i, z + i, count - i, scale, bias, clamp);
+		}
+	};
+
+	struct VecAvx {
+		enum { Width = 8 };
+
+		VECBATCH_TARGET_AVX static geFloat HorizontalMin(__m256 v) {
+			__m128 h = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+			h = _mm_min_ps(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(1, 0, 3, 2)));
+			h = _mm_min_ps(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(2, 3, 0, 1)));
+			return _mm_cvtss_f32(h);
+		}
+
+		VECBATCH_TARGET_AVX static geFloat HorizontalMax(__m256 v) {
+			__m128 h = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+			h = _mm_max_ps(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(1, 0, 3, 2)));
+			h = _mm_max_ps(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(2, 3, 0, 1)));
+			return _mm_cvtss_f32(h);
+		}
+
+		VECBATCH_TARGET_AVX static void PlaneDists(const geFloat* x, const geFloat* y, const geFloat* z, int32 count, const geVec3d& normal, geFloat dist, geFloat* dists) {
+			const __m256 nx = _mm256_set1_ps(normal.X), ny = _mm256_set1_ps(normal.Y), nz = _mm256_set1_ps(normal.Z), d0 = _mm256_set1_ps(dist);
+			int32 i = 0;
+			for (; i + Width <= count; i += Width) {
+				__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(x + i), nx), _mm256_mul_ps(_mm256_load_ps(y + i), ny)), _mm256_mul_ps(_mm256_load_ps(z + i), nz));
+				_mm256_storeu_ps(dists + i, _mm256_sub_ps(d, d0));
+			}
+			VecScalar::PlaneDists(x + i, y + i, z + i, count - i, normal, dist, dists + i);
+		}
+
+		VECBATCH_TARGET_AVX static void PlaneRange(const geFloat* x, const geFloat* y, const geFloat* z, int32 count, const geVec3d& normal, geFloat dist, geFloat& minDist, geFloat& maxDist) {
+			int32 i = 0;
+			if (count >= Width) {
+				const __m256 nx = _mm256_set1_ps(normal.X), ny = _mm256_set1_ps(normal.Y), nz = _mm256_set1_ps(normal.Z), d0 = _mm256_set1_ps(dist);
+				__m256 lo = _mm256_set1_ps(minDist), hi = _mm256_set1_ps(maxDist);
+				for (; i + Width <= count; i += Width) {
+					__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(x + i), nx), _mm256_mul_ps(_mm256_load_ps(y + i), ny)), _mm256_mul_ps(_mm256_load_ps(z + i), nz));
+					d = _mm256_sub_ps(d, d0);
+					lo = _mm256_min_ps(d, lo);
+					hi = _mm256_max_ps(d, hi);
+				}
+				minDist = HorizontalMin(lo);
+				maxDist = HorizontalMax(hi);
+			}
+			VecScalar::PlaneRange(x + i, y + i, z + i, count - i, normal, dist, minDist, maxDist);
+		}
+
+		VECBATCH_TARGET_AVX static void Bounds(const geFloat* x, const geFloat* y, const geFloat* z, int32 count, geVec3d& mins, geVec3d& maxs) {
+			int32 i = 0;
+			if (count >= Width) {
+				__m256 loX = _mm256_set1_ps(mins.X), loY = _mm256_set1_ps(mins.Y), loZ = _mm256_set1_ps(mins.Z);
+				__m256 hiX = _mm256_set1_ps(maxs.X), hiY = _mm256_set1_ps(maxs.Y), hiZ = _mm256_set1_ps(maxs.Z);
+				for (; i + Width <= count; i += Width) {
+					__m256 px = _mm256_load_ps(x + i), py = _mm256_load_ps(y + i), pz = _mm256_load_ps(z + i);
+					loX = _mm256_min_ps(px, loX);
+					loY = _mm256_min_ps(py, loY);
+					loZ = _mm256_min_ps(pz, loZ);
+					hiX = _mm256_max_ps(px, hiX);
+					hiY = _mm256_max_ps(py, hiY);
+					hiZ = _mm256_max_ps(pz, hiZ);
+				}
+				geVec3d_Set(&mins, HorizontalMin(loX), HorizontalMin(loY), HorizontalMin(loZ));
+				geVec3d_Set(&maxs, HorizontalMax(hiX), HorizontalMax(hiY), HorizontalMax(hiZ));
+			}
+			VecScalar::Bounds(x + i, y + i, z + i, count - i, mins, maxs);
+		}
+
+		VECBATCH_TARGET_AVX static void ColorNormalize(geFloat* x, geFloat* y, geFloat* z, int32 count, geFloat* maxes) {
+			const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+			int32 i = 0;
+			for (; i + Width <= count; i += Width) {
+				__m256 r = _mm256_load_ps(x + i), g = _mm256_load_ps(y + i), b = _mm256_load_ps(z + i);
+				__m256 max = _mm256_max_ps(b, _mm256_max_ps(g, r));
+				__m256 black = _mm256_cmp_ps(max, zero, _CMP_EQ_OQ);
+				__m256 factor = _mm256_blendv_ps(_mm256_div_ps(one, max), one, black);
+				_mm256_store_ps(x + i, _mm256_mul_ps(r, factor));
+				_mm256_store_ps(y + i, _mm256_mul_ps(g, factor));
+				_mm256_store_ps(z + i, _mm256_mul_ps(b, factor));
+				if (maxes) {
+					_mm256_storeu_ps(maxes + i, _mm256_andnot_ps(black, max));
+				}
+			}
+			VecScalar::ColorNormalize(x + i, y + i, z + i, count - i, maxes ? maxes + i : nullptr);
+		}
+
+		VECBATCH_TARGET_AVX static void ColorClamp(geFloat* x, geFloat* y, geFloat* z, int32 count, geFloat scale, const geVec3d& bias, geFloat clamp) {
+			const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+			const __m256 s = _mm256_set1_ps(scale), c = _mm256_set1_ps(clamp);
+			const __m256 bx = _mm256_set1_ps(bias.X), by = _mm256_set1_ps(bias.Y), bz = _mm256_set1_ps(bias.Z);
+			int32 i = 0;
+			for (; i + Width <= count; i += Width) {
+				__m256 r = _mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(x + i), s), bx), zero);
+				__m256 g = _mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(y + i), s), by), zero);
+				__m256 b = _mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(z + i), s), bz), zero);
+				__m256 max = _mm256_max_ps(_mm256_max_ps(r, g), b);
+				__m256 over = _mm256_cmp_ps(max, c, _CMP_GT_OQ);
+				__m256 factor = _mm256_blendv_ps(one, _mm256_div_ps(c, max), over);
+				_mm256_store_ps(x + i, _mm256_mul_ps(r, factor));
+				_mm256_store_ps(y + i, _mm256_mul_ps(g, factor));
+				_mm256_store_ps(z + i, _mm256_mul_ps(b, factor));
+			}
+			VecScalar::ColorClamp(x + i, y + i, z + i, count - i, scale, bias, clamp);
+		}
+	};
+#endif
+
+	// Best level the processor running the tools has
+	inline int GetVecKernelsLevel() {
+#ifdef VECBATCH_X86
+		if (CpuHasAvx()) {
+			return VECBATCH_AVX;
+		}
+		if (CpuHasSse2()) {
+			return VECBATCH_SSE2;
+		}
+#endif
+		return VECBATCH_SCALAR;
+	}
+
+	//========================================================================================
+	//	GetVecKernels()
+	//	The kernels of the given level, or of the best one below it the processor has
+	//========================================================================================
+	inline const VecKernels& GetVecKernels(int level) {
+		static const VecKernels scalar = { "scalar", VECBATCH_SCALAR, VecScalar::PlaneDists, VecScalar::PlaneRange, VecScalar::Bounds, VecScalar::ColorNormalize, VecScalar::ColorClamp };
+#ifdef VECBATCH_X86
+		static const VecKernels sse2 = { "sse2", VECBATCH_SSE2, VecSse2::PlaneDists, VecSse2::PlaneRange, VecSse2::Bounds, VecSse2::ColorNormalize, VecSse2::ColorClamp };
+		static const VecKernels avx = { "avx", VECBATCH_AVX, VecAvx::PlaneDists, VecAvx::PlaneRange, VecAvx::Bounds, VecAvx::ColorNormalize, VecAvx::ColorClamp };
+		int best = GetVecKernelsLevel();
+		if (level > best) {
+			level = best;
+		}
+		if (level == VECBATCH_AVX) {
+			return avx;
+		}
+		if (level == VECBATCH_SSE2) {
+			return sse2;
+		}
+#endif
+		return scalar;
+	}
+
+	inline const VecKernels& GetVecKernels() {
+		static const VecKernels& best = GetVecKernels(VECBATCH_AVX);
+		return best;
+	}
+};
+
+#endif // GBSPTOOLS_VECBATCH_H
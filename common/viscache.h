@@ -0,0 +1,174 @@
+/****************************************************************************************/
+/*  viscache.h
+/*
+/*  Author: rtxa
+/*  Description: Full vis results of every portal, kept next to the .bsp between runs
+/*
+/*	Cluster numbers change on every compile, so clusters are named by a hash of the
+/*	portals around them and a portal's result is the list of those names it sees.
+/*	The entry of a portal is keyed by its own winding plus the names of every
+/*	cluster it might see: the flow only ever walks those, so as long as none of them
+/*	changed its result is still right, wherever else the map was edited.
+/*
+/*	File layout: VisCacheHeader, NumClusters cluster names, then NumEntries times
+/*	{ uint64_t Key, int32 Count, int32 Clusters[Count] } with indices into the names.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_VISCACHE_H
+#define GBSPTOOLS_VISCACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "basetype.h"
+#include "mappedfile.h"
+#include "utils.h"
+
+#define VISCACHE_TAG			"GVCH"
+#define VISCACHE_VERSION		1
+#define VISCACHE_EXTENSION		".viscache"
+
+namespace GBSPTools {
+	typedef struct {
+		char		Tag[4];
+		int32		Version;
+		int32		NumClusters;
+		int32		NumEntries;
+	} VisCacheHeader;
+
+	class VisCache {
+	public:
+		const std::string& GetError() const { return error; }
+		int32 GetNumEntries() const { return (int32)entries.size(); }
+		const std::vector<uint64_t>& GetClusters() const { return clusters; }
+
+		void Clear() {
+			clusters.clear();
+			entries.clear();
+		}
+
+		void SetClusters(const std::vector<uint64_t>& names) {
+			clusters = names;
+		}
+
+		// clusters are indices into the names given to SetClusters()
+		void Add(uint64_t key, const std::vector<int32>& seen) {
+			entries[key] = seen;
+		}
+
+		const std::vector<int32>* Find(uint64_t key) const {
+			auto it = entries.find(key);
+			return it != entries.end() ? &it->second : nullptr;
+		}
+
+		//========================================================================================
+		//	Load()
+		//	Replaces the contents with the cache at path. A missing file is an empty cache.
+		//========================================================================================
+		bool Load(const std::string& path) {
+			Clear();
+			MappedFile file;
+			if (!file.Open(path)) {
+				return true;
+			}
+
+			const uint8* data = file.GetData();
+			const size_t size = file.GetSize();
+			size_t offset = sizeof(VisCacheHeader);
+			VisCacheHeader header;
+			if (size < offset) {
+				return Fail("truncated header in " + path);
+			}
+			memcpy(&header, data, sizeof(header));
+			if (memcmp(header.Tag, VISCACHE_TAG, 4) != 0 || header.Version != VISCACHE_VERSION || header.NumClusters < 0 || header.NumEntries < 0) {
+				return Fail(path + " is not a vis cache of this version");
+			}
+
+			if ((size - offset) / sizeof(uint64_t) < (size_t)header.NumClusters) {
+				return Fail("truncated cluster names in " + path);
+			}
+			clusters.resize(header.NumClusters);
+			memcpy(clusters.data(), data + offset, header.NumClusters * sizeof(uint64_t));
+			offset += header.NumClusters * sizeof(uint64_t);
+
+			for (int32 i = 0; i < header.NumEntries; i++) {
+				uint64_t key;
+				int32 count;
+				if (size - offset < sizeof(key) + sizeof(count)) {
+					return Fail("truncated entry in " + path);
+				}
+				memcpy(&key, data + offset, sizeof(key));
+				memcpy(&count, data + offset + sizeof(key), sizeof(count));
+				offset += sizeof(key) + sizeof(count);
+				if (count < 0 || (size - offset) / sizeof(int32) < (size_t)count) {
+					return Fail("truncated entry in " + path);
+				}
+
+				std::vector<int32>& seen = entries[key];
+				seen.resize(count);
+				memcpy(seen.data(), data + offset, count * sizeof(int32));
+				offset += count * sizeof(int32);
+				for (int32 cluster : seen) {
+					if (cluster < 0 || cluster >= header.NumClusters) {
+						return Fail("bad cluster in " + path);
+					}
+				}
+			}
+			return true;
+		}
+
+		//========================================================================================
+		//	Save()
+		//	Writes the cache to a temporary file that then replaces path, so an interrupted
+		//	run never leaves half a cache behind
+		//========================================================================================
+		bool Save(const std::string& path) {
+			const std::string tempPath = path + ".tmp";
+			FILE* fp = fopen(tempPath.c_str(), "wb");
+			if (fp == nullptr) {
+				error = "unable to write " + tempPath;
+				return false;
+			}
+
+			VisCacheHeader header;
+			memcpy(header.Tag, VISCACHE_TAG, 4);
+			header.Version = VISCACHE_VERSION;
+			header.NumClusters = (int32)clusters.size();
+			header.NumEntries = (int32)entries.size();
+			bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+			ok = ok && fwrite(clusters.data(), sizeof(uint64_t), clusters.size(), fp) == clusters.size();
+			for (auto it = entries.begin(); ok && it != entries.end(); ++it) {
+				int32 count = (int32)it->second.size();
+				ok = fwrite(&it->first, sizeof(uint64_t), 1, fp) == 1 && fwrite(&count, sizeof(count), 1, fp) == 1
+					&& fwrite(it->second.data(), sizeof(int32), count, fp) == (size_t)count;
+			}
+			ok = fclose(fp) == 0 && ok;
+
+			if (ok) {
+				ok = CommitFile(tempPath, path);
+			}
+			if (!ok) {
+				remove(tempPath.c_str());
+				error = "unable to write " + path;
+			}
+			return ok;
+		}
+
+	private:
+		std::vector<uint64_t> clusters;
+		std::unordered_map<uint64_t, std::vector<int32>> entries;
+		std::string error;
+
+		bool Fail(const std::string& message) {
+			Clear();
+			error = message;
+			return false;
+		}
+	};
+};
+
+#endif // GBSPTOOLS_VISCACHE_H
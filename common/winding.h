@@ -0,0 +1,453 @@
+/****************************************************************************************/
+/*  winding.h
+/*
+/*  Author: rtxa
+/*  Description: Convex polygons on a plane and the clipping the native stages do on them
+/*
+/*	The points of a winding live inside of it up to WINDING_INLINE_POINTS, which is
+/*	what nearly every brush side and portal needs, so making, copying and cutting them
+/*	doesn't touch the heap. Bigger ones take a block from a per thread pool and give it
+/*	back there when they're done. Cutting classifies all the points at once, four at a
+/*	time with SSE2.
+/*
+/****************************************************************************************/
+
+#ifndef GBSPTOOLS_WINDING_H
+#define GBSPTOOLS_WINDING_H
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include "mathlib.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WINDING_SSE
+#include <emmintrin.h>
+#endif
+
+#define SIDE_FRONT			0
+#define SIDE_BACK			1
+#define SIDE_ON				2
+#define SIDE_CROSS			3
+
+#define WINDING_INLINE_POINTS	12
+#define WINDING_POOL_CLASSES	8			// pooled blocks of 32 up to 4096 points, bigger ones aren't kept
+#define WINDING_POOL_KEEP		64			// free blocks kept per thread and class
+
+namespace GBSPTools {
+	// Blocks for the points of big windings, each thread keeps the ones it frees
+	class WindingPool {
+	public:
+		// A block of at least count points, capacity is set to its actual size
+		static geVec3d* Alloc(int32 count, int32& capacity) {
+			int c = 0;
+			while (c < WINDING_POOL_CLASSES && ClassSize(c) < count) {
+				c++;
+			}
+			if (c == WINDING_POOL_CLASSES) {
+				capacity = count;
+				return new geVec3d[count];
+			}
+			capacity = ClassSize(c);
+			std::vector<geVec3d*>& list = GetLists().Free[c];
+			if (list.empty()) {
+				return new geVec3d[capacity];
+			}
+			geVec3d* block = list.back();
+			list.pop_back();
+			return block;
+		}
+
+		static void Free(geVec3d* block, int32 capacity) {
+			for (int c = 0; c < WINDING_POOL_CLASSES; c++) {
+				if (ClassSize(c) == capacity) {
+					std::vector<geVec3d*>& list = GetLists().Free[c];
+					if (list.size() < WINDING_POOL_KEEP) {
+						list.push_back(block);
+						return;
+					}
+					break;
+				}
+			}
+			delete[] block;
+		}
+
+	private:
+		struct Lists {
+			std::vector<geVec3d*> Free[WINDING_POOL_CLASSES];
+
+			~Lists() {
+				for (std::vector<geVec3d*>& list : Free) {
+					for (geVec3d* block : list) {
+						delete[] block;
+					}
+				}
+			}
+		};
+
+		static int32 ClassSize(int c) { return 32 << c; }
+
+		static Lists& GetLists() {
+			static thread_local Lists lists;
+			return lists;
+		}
+	};
+
+	// The points of a winding, a std::vector of geVec3d as far as the stages are concerned
+	class WindingPoints {
+	public:
+		WindingPoints() {}
+
+		WindingPoints(const WindingPoints& other) {
+			assign(other.begin(), other.end());
+		}
+
+		WindingPoints(WindingPoints&& other) {
+			*this = std::move(other);
+		}
+
+		~WindingPoints() {
+			Release();
+		}
+
+		WindingPoints& operator=(const WindingPoints& other) {
+			if (this != &other) {
+				assign(other.begin(), other.end());
+			}
+			return *this;
+		}
+
+		WindingPoints& operator=(WindingPoints&& other) {
+			if (this == &other) {
+				return *this;
+			}
+			if (other.points == other.local) {
+				assign(other.begin(), other.end());
+			}
+			else {
+				Release();
+				points = other.points;
+				capacity = other.capacity;
+				count = other.count;
+				other.points = other.local;
+				other.capacity = WINDING_INLINE_POINTS;
+			}
+			other.count = 0;
+			return *this;
+		}
+
+		size_t size() const { return (size_t)count; }
+		bool empty() const { return count == 0; }
+
+		geVec3d* data() { return points; }
+		const geVec3d* data() const { return points; }
+		geVec3d* begin() { return points; }
+		geVec3d* end() { return points + count; }
+		const geVec3d* begin() const { return points; }
+		const geVec3d* end() const { return points + count; }
+		geVec3d& operator[](size_t i) { return points[i]; }
+		const geVec3d& operator[](size_t i) const { return points[i]; }
+		geVec3d& back() { return points[count - 1]; }
+		const geVec3d& back() const { return points[count - 1]; }
+
+		void clear() { count = 0; }
+
+		void reserve(size_t size) {
+			if ((int32)size <= capacity) {
+				return;
+			}
+			int32 newCapacity;
+			geVec3d* block = WindingPool::Alloc((int32)size, newCapacity);
+			memcpy(block, points, count * sizeof(geVec3d));
+			Release();
+			points = block;
+			capacity = newCapacity;
+		}
+
+		void resize(size_t size) {
+			reserve(size);
+			for (int32 i = count; i < (int32)size; i++) {
+				geVec3d_Clear(&points[i]);
+			}
+			count = (int32)size;
+		}
+
+		void push_back(const geVec3d& p) {
+			if (count == capacity) {
+				reserve((size_t)capacity * 2);
+			}
+			points[count++] = p;
+		}
+
+		void assign(const geVec3d* first, const geVec3d* last) {
+			count = 0;
+			reserve(last - first);
+			memcpy(points, first, (last - first) * sizeof(geVec3d));
+			count = (int32)(last - first);
+		}
+
+		void swap(WindingPoints& other) {
+			WindingPoints temp(std::move(other));
+			other = std::move(*this);
+			*this = std::move(temp);
+		}
+
+	private:
+		geVec3d local[WINDING_INLINE_POINTS];
+		geVec3d* points = local;
+		int32 count = 0;
+		int32 capacity = WINDING_INLINE_POINTS;
+
+		void Release() {
+			if (points != local) {
+				WindingPool::Free(points, capacity);
+				points = local;
+				capacity = WINDING_INLINE_POINTS;
+			}
+		}
+	};
+
+	class Winding {
+	public:
+		WindingPoints Points;
+
+		int32 size() const { return (int32)Points.size(); }
+		bool empty() const { return Points.empty(); }
+
+		//========================================================================================
+		//	ForPlane()
+		//	A square on the plane, big enough to cover the whole world
+		//========================================================================================
+		static Winding ForPlane(const geVec3d& normal, geFloat dist) {
+			// the axis the normal points along the least makes the most stable up vector
+			int axis = 0;
+			geFloat least = fabsf(normal.X);
+			if (fabsf(normal.Y) < least) {
+				least = fabsf(normal.Y);
+				axis = 1;
+			}
+			if (fabsf(normal.Z) < least) {
+				axis = 2;
+			}
+			geVec3d up, right, origin, p;
+			geVec3d_Clear(&up);
+			VectorToSUB(up, axis) = 1.0f;
+			geVec3d_AddScaled(&up, &normal, -geVec3d_DotProduct(&up, &normal), &up);
+			geVec3d_Normalize(&up);
+			geVec3d_CrossProduct(&up, &normal, &right);
+
+			geVec3d_Scale(&normal, dist, &origin);
+			geVec3d_Scale(&up, MIN_MAX_BOUNDS2, &up);
+			geVec3d_Scale(&right, MIN_MAX_BOUNDS2, &right);
+
+			Winding w;
+			geVec3d_Subtract(&origin, &right, &p);
+			geVec3d_Add(&p, &up, &p);
+			w.Points.push_back(p);
+			geVec3d_Add(&origin, &right, &p);
+			geVec3d_Add(&p, &up, &p);
+			w.Points.push_back(p);
+			geVec3d_Add(&origin, &right, &p);
+			geVec3d_Subtract(&p, &up, &p);
+			w.Points.push_back(p);
+			geVec3d_Subtract(&origin, &right, &p);
+			geVec3d_Subtract(&p, &up, &p);
+			w.Points.push_back(p);
+			return w;
+		}
+
+		// SIDE_FRONT, SIDE_BACK, SIDE_ON (every point within epsilon) or SIDE_CROSS
+		int Side(const geVec3d& normal, geFloat dist, geFloat epsilon = ON_EPSILON) const {
+			Classification c(size());
+			Classify(normal, dist, epsilon, c);
+			if (c.Counts[SIDE_FRONT] && c.Counts[SIDE_BACK]) {
+				return SIDE_CROSS;
+			}
+			return c.Counts[SIDE_FRONT] ? SIDE_FRONT : (c.Counts[SIDE_BACK] ? SIDE_BACK : SIDE_ON);
+		}
+
+		//========================================================================================
+		//	Split()
+		//	Cuts the winding along the plane. Points within epsilon of it go to both halves,
+		//	a winding lying on the plane goes to the front only.
+		//========================================================================================
+		void Split(const geVec3d& normal, geFloat dist, Winding& front, Winding& back, geFloat epsilon = ON_EPSILON) const {
+			front.Points.clear();
+			back.Points.clear();
+
+			Classification c(size());
+			Classify(normal, dist, epsilon, c);
+			if (!c.Counts[SIDE_BACK]) {
+				front = *this;
+				return;
+			}
+			if (!c.Counts[SIDE_FRONT]) {
+				back = *this;
+				return;
+			}
+			Cut(normal, dist, c, &front, &back);
+		}
+
+		//========================================================================================
+		//	Clip()
+		//	Keeps the part in front of the plane. Returns false when nothing is left, a
+		//	winding lying on the plane is kept.
+		//========================================================================================
+		bool Clip(const geVec3d& normal, geFloat dist, geFloat epsilon = ON_EPSILON) {
+			Classification c(size());
+			Classify(normal, dist, epsilon, c);
+			if (!c.Counts[SIDE_BACK]) {
+				return true;
+			}
+			if (!c.Counts[SIDE_FRONT]) {
+				Points.clear();
+				return false;
+			}
+			Winding front;
+			Cut(normal, dist, c, &front, nullptr);
+			Points = std::move(front.Points);
+			return Points.size() >= 3;
+		}
+
+		geVec3d Center() const {
+			geVec3d center;
+			geVec3d_Clear(&center);
+			for (const geVec3d& p : Points) {
+				geVec3d_Add(&center, &p, &center);
+			}
+			if (!Points.empty()) {
+				geVec3d_Scale(&center, 1.0f / Points.size(), &center);
+			}
+			return center;
+		}
+
+		geFloat Area() const {
+			geFloat area = 0.0f;
+			for (int32 i = 2; i < size(); i++) {
+				geVec3d a, b, cross;
+				geVec3d_Subtract(&Points[i - 1], &Points[0], &a);
+				geVec3d_Subtract(&Points[i], &Points[0], &b);
+				geVec3d_CrossProduct(&a, &b, &cross);
+				area += geVec3d_Length(&cross) * 0.5f;
+			}
+			return area;
+		}
+
+	private:
+		// Distance and side of every point, on the stack unless the winding is big
+		struct Classification {
+			geFloat		LocalDists[WINDING_INLINE_POINTS];
+			uint8		LocalSides[WINDING_INLINE_POINTS];
+			std::vector<geFloat> HeapDists;
+			std::vector<uint8> HeapSides;
+			geFloat*	Dists;
+			uint8*		Sides;
+			int32		Counts[3] = { 0, 0, 0 };
+
+			explicit Classification(int32 count) : Dists(LocalDists), Sides(LocalSides) {
+				if (count > WINDING_INLINE_POINTS) {
+					HeapDists.resize(count);
+					HeapSides.resize(count);
+					Dists = HeapDists.data();
+					Sides = HeapSides.data();
+				}
+			}
+		};
+
+#ifdef WINDING_SSE
+		// The components of the four points at v, transposed into one register each
+		static void Load4(const geVec3d* v, __m128& x, __m128& y, __m128& z) {
+			const geFloat* f = &v->X;
+			__m128 a = _mm_loadu_ps(f);			// x0 y0 z0 x1
+			__m128 b = _mm_loadu_ps(f + 4);		// y1 z1 x2 y2
+			__m128 c = _mm_loadu_ps(f + 8);		// z2 x3 y3 z3
+			x = _mm_shuffle_ps(a, _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 3, 0));
+			y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)), _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+			z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+		}
+
+		// x * nx + y * ny + z * nz - dist, in the same order as geVec3d_DotProduct()
+		static __m128 PlaneDist4(__m128 x, __m128 y, __m128 z, const geVec3d& normal, geFloat dist) {
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(normal.X)), _mm_mul_ps(y, _mm_set1_ps(normal.Y))), _mm_mul_ps(z, _mm_set1_ps(normal.Z)));
+			return _mm_sub_ps(d, _mm_set1_ps(dist));
+		}
+#endif
+
+		void Classify(const geVec3d& normal, geFloat dist, geFloat epsilon, Classification& c) const {
+			const int32 count = size();
+			int32 i = 0;
+#ifdef WINDING_SSE
+			const __m128 front = _mm_set1_ps(epsilon), back = _mm_set1_ps(-epsilon);
+			for (; i + 4 <= count; i += 4) {
+				__m128 x, y, z;
+				Load4(Points.data() + i, x, y, z);
+				__m128 d = PlaneDist4(x, y, z, normal, dist);
+				_mm_storeu_ps(c.Dists + i, d);
+				int frontMask = _mm_movemask_ps(_mm_cmpgt_ps(d, front));
+				int backMask = _mm_movemask_ps(_mm_cmplt_ps(d, back));
+				for (int k = 0; k < 4; k++) {
+					uint8 side = (frontMask >> k) & 1 ? SIDE_FRONT : ((backMask >> k) & 1 ? SIDE_BACK : SIDE_ON);
+					c.Sides[i + k] = side;
+					c.Counts[side]++;
+				}
+			}
+#endif
+			for (; i < count; i++) {
+				geFloat d = geVec3d_DotProduct(&Points[i], &normal) - dist;
+				uint8 side = d > epsilon ? SIDE_FRONT : (d < -epsilon ? SIDE_BACK : SIDE_ON);
+				c.Dists[i] = d;
+				c.Sides[i] = side;
+				c.Counts[side]++;
+			}
+		}
+
+		// The halves of a winding with points on both sides, back is skipped when null
+		void Cut(const geVec3d& normal, geFloat dist, const Classification& c, Winding* front, Winding* back) const {
+			const int32 count = size();
+			front->Points.reserve(count + 4);
+			if (back != nullptr) {
+				back->Points.reserve(count + 4);
+			}
+			for (int32 i = 0; i < count; i++) {
+				const geVec3d& p1 = Points[i];
+				if (c.Sides[i] == SIDE_ON) {
+					front->Points.push_back(p1);
+					if (back != nullptr) {
+						back->Points.push_back(p1);
+					}
+					continue;
+				}
+				if (c.Sides[i] == SIDE_FRONT) {
+					front->Points.push_back(p1);
+				}
+				else if (back != nullptr) {
+					back->Points.push_back(p1);
+				}
+
+				int32 next = (i + 1) % count;
+				if (c.Sides[next] == SIDE_ON || c.Sides[next] == c.Sides[i]) {
+					continue;
+				}
+				const geVec3d& p2 = Points[next];
+				geFloat t = c.Dists[i] / (c.Dists[i] - c.Dists[next]);
+				geVec3d mid;
+				geVec3d_Subtract(&p2, &p1, &mid);
+				geVec3d_AddScaled(&p1, &mid, t, &mid);
+
+				// keep axial coordinates exact
+				for (int axis = 0; axis < 3; axis++) {
+					geFloat n = VectorToSUB(normal, axis);
+					if (n == 1.0f || n == -1.0f) {
+						VectorToSUB(mid, axis) = dist * n;
+					}
+				}
+				front->Points.push_back(mid);
+				if (back != nullptr) {
+					back->Points.push_back(mid);
+				}
+			}
+		}
+	};
+};
+
+#endif // GBSPTOOLS_WINDING_H
@@ -6,11 +6,14 @@
 /*                                                                                      
 /****************************************************************************************/
 
+#include <errno.h>
 #include <stdio.h>
-#include <windows.h> // needed for "LoadLibrary" declarations, get current directory, etc.
+#include <stdlib.h>
 #include "gbsp.h"
 #include "gbsplib.h"
 #include "gbsptools.h"
+#include "entupdate.h"
+#include "nativebsp.h"
 #include "utils.h"
 
 int main(int argc, char *argv[]) {
@@ -19,22 +22,23 @@ int main(int argc, char *argv[]) {
 	printf("Check readme.md for more info abouts these tools.\n");
 	printf("Submit detailed bug reports to %s\n", GBSPTOOLS_CONTACT);
 
-	char path[MAX_PATH];
-	GetCurrentDirectory(MAX_PATH, path);
-	printf("Command line: \"%s\"\n", path);
+	printf("Command line: \"%s\"\n", GBSPTools::GetWorkingDirectory().c_str());
 
 	CompilerParms compParms;
 	InitCompilerParms(&compParms);
 	ParseCmdArgs(argc, argv, &compParms);
 
-	// load gbsplib.dll to access the map compiler functions
-	HINSTANCE compHandle;
-	GBSP_FuncHook* compFHook;
+	// load the compiler library (gbsplib) to access the map compiler functions
+	CompilerLibHandle compHandle = nullptr;
+	GBSP_FuncHook* compFHook = nullptr;
 
-	CompilerErrorEnum result = Compiler_LoadCompilerDLL(compFHook, compHandle, Compiler_ErrorfCallback, Compiler_PrintfCallback);
+	// the native compiler and the entity update don't need it
+	if (!compParms.native && compParms.updateEnts != GE_TRUE) {
+		CompilerErrorEnum result = Compiler_LoadCompilerLib(compFHook, compHandle, Compiler_ErrorfCallback, Compiler_PrintfCallback, compParms.libPath);
 
-	if (result != CompilerErrorEnum::COMPILER_ERROR_NONE) {
-		return result;
+		if (result != CompilerErrorEnum::COMPILER_ERROR_NONE) {
+			return result;
+		}
 	}
 
 	std::string mapPath(compParms.mapName);
@@ -63,12 +67,19 @@ int main(int argc, char *argv[]) {
 	// Begin with GBSP
 
 	if (compParms.updateEnts == GE_TRUE) {
-		if (compFHook->GBSP_UpdateEntities(mapPath.c_str(), bspPath.c_str()) == GE_TRUE) {
-			return COMPILER_ERROR_NONE;
-		} else {
-			fprintf(stdout, "Compile Failed:  GBSP_UpdateEntities returned an error, GBSPLib.Dll.\n");
+		if (!GBSPTools::UpdateEntitiesFile(mapPath, bspPath, compParms.numThreads)) {
 			return COMPILER_ERROR_BSPFAIL;
 		}
+		printf("\n");
+		return COMPILER_ERROR_NONE;
+	}
+
+	if (compParms.native) {
+		if (!GBSPTools::CreateBspFile(mapPath, bspPath, compParms.bsp, compParms.numThreads)) {
+			return COMPILER_ERROR_BSPFAIL;
+		}
+		printf("\n");
+		return COMPILER_ERROR_NONE;
 	}
 
 	GBSP_RETVAL gbspResult = compFHook->GBSP_CreateBSP(mapPath.c_str(), &compParms.bsp);
@@ -87,7 +98,7 @@ int main(int argc, char *argv[]) {
 
 	compFHook->GBSP_FreeBSP();
 
-	FreeLibrary(compHandle);
+	Compiler_FreeCompilerLib(compHandle);
 
 	return COMPILER_ERROR_NONE;
 }
@@ -105,6 +116,35 @@ void ParseCmdArgs(int argc, char *argv[], CompilerParms *parms) {
 
 	printf("Arguments:");
 	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-lib")) {
+			printf(" -lib");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				strcpy_s(parms->libPath, argv[++i]);
+			} else {
+				fprintf(stdout, "\nError: Missing argument for -lib\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+
+		if (!strcmp(argv[i], "-threads")) {
+			printf(" -threads");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->numThreads = strtol(argv[++i], NULL, 10);
+				if (errno == ERANGE || parms->numThreads < 0) {
+					fprintf(stdout, "\nError: Bad argument for -threads\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -threads\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+
 		if (!strcmp(argv[i], "-verbose")) {
 			parms->bsp.Verbose = GE_TRUE;
 			printf(" -verbose");
@@ -114,6 +154,9 @@ void ParseCmdArgs(int argc, char *argv[], CompilerParms *parms) {
 		} else if (!strcmp(argv[i], "-onlyents")) {
 			parms->updateEnts = GE_TRUE;
 			printf(" -onlyents");
+		} else if (!strcmp(argv[i], "-native")) {
+			parms->native = true;
+			printf(" -native");
 		} else {
 			if (!hasLoadMap) {
 				strcpy_s(parms->mapName, argv[i]);
@@ -145,6 +188,11 @@ void ShowUsage(void) {
 	printf("    %-20s : %s\n", "-verbose",		"Outputs detailed compilation progress information.");
 	printf("    %-20s : %s\n", "-entverbose",	"Outputs detailed entity information.");
 	printf("    %-20s : %s\n", "-onlyents",		"Do an entity update from .map to .bsp.");
+	printf("    %-20s : %s\n", "-native",		"Builds the map with the native multithreaded compiler instead of GBSPLib (no portal file or texture data, gvis and glight need -native).");
+	printf("\n");
+	printf("\n--- Common Options ---\n");
+	printf("    %-20s : %s\n", "-threads #", "Number of threads used by the native stages (default: one per core).");
+	printf("    %-20s : %s\n", "-lib path", "Compiler library or directory containing it (default: search GBSPLIB_PATH, then the system).");
 	printf("\n");
 	exit(0);
 };
@@ -163,5 +211,7 @@ void ShowSettings(CompilerParms parms) {
 	printf("%-20s|%12s |%12s \n", "verbose", parms.bsp.Verbose ? "on" : "off", defaultParms.bsp.Verbose ? "on" : "off");
 	printf("%-20s|%12s |%12s \n", "entverbose", parms.bsp.EntityVerbose ? "on" : "off", defaultParms.bsp.EntityVerbose ? "on" : "off");
 	printf("%-20s|%12s |%12s \n", "onlyents", parms.updateEnts ? "on" : "off", defaultParms.updateEnts ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "native", parms.native ? "on" : "off", defaultParms.native ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "threads", parms.numThreads ? std::to_string(parms.numThreads).c_str() : "auto", "auto");
 	printf("\n");
 };
\ No newline at end of file
@@ -1,20 +1,26 @@
 #ifndef GBSP_H
 #define GBSP_H
 
-#include <windows.h>
+#include "platform.h"
 #include "gbsplib.h"
 
 typedef struct {
 	char mapName[MAX_PATH];
+	char libPath[MAX_PATH];
 	char bspName[MAX_PATH];
 	BspParms bsp;
 	geBoolean updateEnts;
+	bool native;
+	int numThreads;		// 0 means one per core
 } CompilerParms;
 
 void InitCompilerParms(CompilerParms *parms) {
+	parms->libPath[0] = '\0';
 	parms->bsp.Verbose = GE_FALSE;
 	parms->bsp.EntityVerbose = GE_FALSE;
 	parms->updateEnts = GE_FALSE;
+	parms->native = false;
+	parms->numThreads = 0;
 	parms->bspName[0] = '\0';
 }
 
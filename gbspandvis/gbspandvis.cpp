@@ -7,7 +7,6 @@
 /****************************************************************************************/
 
 #include <stdio.h>
-#include <windows.h> // needed for "LoadLibrary" declarations, get current directory, etc.
 #include "gbspandvis.h"
 #include "gbsplib.h"
 #include "gbsptools.h"
@@ -19,19 +18,17 @@ int main(int argc, char *argv[]) {
 	printf("Check readme.md for more info abouts these tools.\n");
 	printf("Submit detailed bug reports to %s\n", GBSPTOOLS_CONTACT);
 
-	char path[MAX_PATH];
-	GetCurrentDirectory(MAX_PATH, path);
-	printf("Command line: \"%s\"\n", path);
+	printf("Command line: \"%s\"\n", GBSPTools::GetWorkingDirectory().c_str());
 
 	CompilerParms compParms;
 	InitCompilerParms(&compParms);
 	ParseCmdArgs(argc, argv, &compParms);
 
-	// load gbsplib.dll to access the map compiler functions
-	HINSTANCE compHandle;
+	// load the compiler library (gbsplib) to access the map compiler functions
+	CompilerLibHandle compHandle;
 	GBSP_FuncHook* compFHook;
 
-	CompilerErrorEnum result = Compiler_LoadCompilerDLL(compFHook, compHandle, Compiler_ErrorfCallback, Compiler_PrintfCallback);
+	CompilerErrorEnum result = Compiler_LoadCompilerLib(compFHook, compHandle, Compiler_ErrorfCallback, Compiler_PrintfCallback, compParms.libPath);
 
 	if (result != CompilerErrorEnum::COMPILER_ERROR_NONE) {
 		return result;
@@ -95,7 +92,7 @@ int main(int argc, char *argv[]) {
 		return COMPILER_ERROR_BSPFAIL;
 	}
 
-	FreeLibrary(compHandle);
+	Compiler_FreeCompilerLib(compHandle);
 
 	return COMPILER_ERROR_NONE;
 }
@@ -116,6 +113,18 @@ void ParseCmdArgs(int argc, char *argv[], CompilerParms *parms) {
 
 	printf("Arguments:");
 	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-lib")) {
+			printf(" -lib");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				strcpy_s(parms->libPath, argv[++i]);
+			} else {
+				fprintf(stdout, "\nError: Missing argument for -lib\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+
 		if (!strcmp(argv[i], "-gbsp")) {
 			readingBsp = true;
 			readingVis = false;
@@ -161,7 +170,7 @@ void ParseCmdArgs(int argc, char *argv[], CompilerParms *parms) {
 				parms->vis.FullVis = GE_TRUE;
 				printf(" -full");
 			} else if (!strcmp(argv[i], "-sortportals")) {
-				parms->vis.SortPortals = GE_FALSE;
+				parms->vis.SortPortals = GE_TRUE;
 				printf(" -sortportals");
 			}
 		}	
@@ -194,6 +203,10 @@ void ShowUsage(void) {
 	printf("    %-20s : %s\n", "-sortportals", "Sort the portals with MightSee.");
 	printf("\n");
 
+	printf("\n--- Common Options ---\n");
+	printf("    %-20s : %s\n", "-lib path", "Compiler library or directory containing it (default: search GBSPLIB_PATH, then the system).");
+	printf("\n");
+
 	exit(0);
 };
 
@@ -1,11 +1,12 @@
 #ifndef GBSP_H
 #define GBSP_H
 
-#include <windows.h>
+#include "platform.h"
 #include "gbsplib.h"
 
 typedef struct {
 	char mapName[MAX_PATH];
+	char libPath[MAX_PATH];
 	char bspName[MAX_PATH];
 	BspParms bsp;
 	VisParms vis;
@@ -13,6 +14,7 @@ typedef struct {
 } CompilerParms;
 
 void InitCompilerParms(CompilerParms *parms) {
+	parms->libPath[0] = '\0';
 	parms->bsp.Verbose = GE_FALSE;
 	parms->bsp.EntityVerbose = GE_FALSE;
 	parms->vis.FullVis = GE_FALSE;
@@ -6,11 +6,22 @@
 /*
 /****************************************************************************************/
 
+#include <ctype.h>
 #include <stdio.h>
-#include <windows.h> // needed for "LoadLibrary" declarations, get current directory, etc.
+#include <algorithm>
+#include <chrono>
+#include <mutex>
 #include "main.h"
 #include "gbsplib.h"
 #include "gbsptools.h"
+#include "bspfile.h"
+#include "entupdate.h"
+#include "mapfile.h"
+#include "nativebsp.h"
+#include "nativelight.h"
+#include "nativevis.h"
+#include "hash.h"
+#include "threads.h"
 #include "utils.h"
 
 int main(int argc, char* argv[]) {
@@ -20,35 +31,87 @@ int main(int argc, char* argv[]) {
 	printf("Submit detailed bug reports to %s\n", GBSPTOOLS_CONTACT);
 
 	// Get current directory
-	char path[MAX_PATH];
-	GetCurrentDirectory(MAX_PATH, path);
-	printf("Command line: \"%s\"\n", path);
+	printf("Command line: \"%s\"\n", GBSPTools::GetWorkingDirectory().c_str());
 
 	// Initialize compiler parameters
 	CompilerParms compParms;
 	InitCompilerParms(&compParms);
 	ParseCmdArgs(argc, argv, &compParms);
 
-	// Load the compiler DLL (GBSPLib.dll)
-	HINSTANCE compHandle;
-	GBSP_FuncHook* compFHook;
-	CompilerErrorEnum result = Compiler_LoadCompilerDLL(compFHook, compHandle, Compiler_ErrorfCallback, Compiler_PrintfCallback);
+	// The library output goes through a buffer written by a background thread; static so
+	// it's still flushed when something calls exit()
+	static GBSPTools::AsyncLog compilerLog;
+	if (compParms.logBuffer > 0) {
+		compilerLog.Start(stdout, (size_t)compParms.logBuffer * 1024);
+		Compiler_Log = &compilerLog;
+	}
 
-	if (result != CompilerErrorEnum::COMPILER_ERROR_NONE) {
-		return result;
+	// Progress events of the library output, for build dashboards; followed even without
+	// a sink to tell how far a stopped stage got
+	GBSPTools::ProgressSink progressSink;
+	GBSPTools::ProgressReporter progress(progressSink);
+	if (compParms.progressTarget[0] && !progressSink.Open(compParms.progressTarget)) {
+		fprintf(stdout, "Warning: Progress events are off: %s\n", progressSink.GetError().c_str());
 	}
+	Compiler_Progress = &progress;
 
-	std::string mapPath(compParms.mapName);
-	std::string bspPath;
+	// Ctrl+C and the stage time budgets stop the running stage instead of the process
+	GBSPTools::CancelWatchdog watchdog;
+	watchdog.Start();
+
+	if (compParms.batchName[0]) {
+		return RunBatch(argc, argv, &compParms, watchdog);
+	}
+
+	// Load the compiler library (gbsplib.dll or libgbsplib.so), unless only native stages run
+	CompilerLibHandle compHandle = nullptr;
+	GBSP_FuncHook* compFHook = nullptr;
+	CompilerErrorEnum result = COMPILER_ERROR_NONE;
+	GBSPTools::Trace trace;
+	if ((compParms.isBspEnabled && !compParms.nativeBsp && compParms.updateEnts != GE_TRUE) || (compParms.isVisEnabled && !compParms.nativeVis) || (compParms.isLightEnabled && !compParms.nativeLight)) {
+		int span = trace.Begin("load library", "gbsplib");
+		result = Compiler_LoadCompilerLib(compFHook, compHandle, Compiler_ErrorfCallback, Compiler_PrintfCallback, compParms.libPath);
+		trace.End(span);
+
+		if (result != CompilerErrorEnum::COMPILER_ERROR_NONE) {
+			return result;
+		}
+	}
+
+	StageTimes times;
+	result = CompileMap(compFHook, &compParms, compParms.mapName, compParms.bspName, times, trace, watchdog);
+
+	trace.ShowSummary();
+	WriteTrace(trace, compParms.traceName);
+	if (compilerLog.GetDropped() > 0) {
+		fprintf(stdout, "Warning: %zu library messages were dropped, the console couldn't keep up (see -logbuffer).\n", compilerLog.GetDropped());
+	}
+
+	// a batch reads how long every stage took from here
+	if (compParms.reportName[0] && !WriteStageTimes(compParms.reportName, times)) {
+		fprintf(stdout, "Warning: Unable to write the stage times to %s\n", compParms.reportName);
+	}
+
+	Compiler_FreeCompilerLib(compHandle);
+
+	return result;
+}
+
+//========================================================================================
+//	MakeCompilePaths()
+//	The .map and .bsp a compile works on, the .bsp defaults to the name of the .map
+//========================================================================================
+void MakeCompilePaths(const std::string& mapName, const std::string& bspName, std::string& mapPath, std::string& bspPath) {
+	mapPath = mapName;
 
 	// Create destination name if not specified
-	if (!compParms.bspName[0]) {
+	if (bspName.empty()) {
 		bspPath = std::string(mapPath);
 		GBSPTools::StripExtension(bspPath);
 		bspPath.append(".bsp");
 	}
 	else {
-		bspPath = std::string(compParms.bspName);
+		bspPath = bspName;
 	}
 
 	// Convert paths to Unix format (GBSPLib expects that) and set defaults
@@ -56,55 +119,940 @@ int main(int argc, char* argv[]) {
 	GBSPTools::PathToUnix(bspPath);
 	GBSPTools::DefaultExtension(mapPath, ".map");
 	GBSPTools::DefaultExtension(bspPath, ".bsp");
+}
 
-	// Begin with GBSP
-	if (compParms.isBspEnabled) {
-		ShowSettingsBsp(compParms);
-		if (compParms.updateEnts == GE_TRUE) {
-			if (compFHook->GBSP_UpdateEntities(mapPath.c_str(), bspPath.c_str()) != GE_TRUE) {
-				fprintf(stdout, "Compile Failed:  GBSP_UpdateEntities returned an error, GBSPLib.Dll.\n");
-				return COMPILER_ERROR_BSPFAIL;
+//========================================================================================
+//	CompileMap()
+//	Runs the enabled stages on one map, with the library already loaded, and times them
+//========================================================================================
+CompilerErrorEnum CompileMap(GBSP_FuncHook* compFHook, CompilerParms* parms, const std::string& mapName, const std::string& bspName, StageTimes& times, GBSPTools::Trace& trace, GBSPTools::CancelWatchdog& watchdog) {
+	CompilerErrorEnum result = COMPILER_ERROR_NONE;
+	for (int stage = STAGE_BSP; stage < NUM_STAGES; stage++) {
+		times.seconds[stage] = -1.0;
+		times.cached[stage] = false;
+	}
+
+	std::string mapPath;
+	std::string bspPath;
+	MakeCompilePaths(mapName, bspName, mapPath, bspPath);
+	if (Compiler_Progress != nullptr) {
+		Compiler_Progress->SetMap(mapPath);
+	}
+
+	// The stages hand the BSP to each other in memory, the destination .bsp is only
+	// written once all the enabled stages succeeded, so a failed vis or light never
+	// leaves a half processed file behind. GBSPLib stages go through the destination
+	// itself instead, since GBSPLib vis finds the portal file by the name of the .bsp:
+	// the old one is moved aside and put back if the pipeline fails. Updating entities
+	// or running vis/light alone works in place since the input has to be the existing
+	// .bsp anyway.
+	WorkBsp work;
+	work.path = bspPath;
+	work.ownsFile = false;
+	work.inMemory = false;
+	const bool usesLibrary = !parms->nativeBsp || (parms->isVisEnabled && !parms->nativeVis) || (parms->isLightEnabled && !parms->nativeLight);
+	if (parms->isBspEnabled && parms->updateEnts != GE_TRUE && usesLibrary) {
+		FILE* existing = fopen(bspPath.c_str(), "rb");
+		if (existing != nullptr) {
+			fclose(existing);
+			work.backup = bspPath + ".bak";
+			if (!GBSPTools::CommitFile(bspPath, work.backup)) {
+				fprintf(stdout, "Compile Failed: Unable to move %s aside\n", bspPath.c_str());
+				return COMPILER_ERROR_BSPSAVE;
 			}
 		}
+		work.ownsFile = true;
+	}
+
+	// With a stage cache, the pipeline resumes after the last enabled stage whose
+	// output is already there, starting from that output
+	GBSPTools::StageCache stageCache;
+	std::string stageKeys[NUM_STAGES];
+	const bool stageEnabled[NUM_STAGES] = { parms->isBspEnabled, parms->isVisEnabled, parms->isLightEnabled };
+	int firstStage = STAGE_BSP;
+	if (parms->cacheDir[0]) {
+		if (!stageCache.Open(parms->cacheDir)) {
+			fprintf(stdout, "Warning: %s, compiling without the stage cache.\n", stageCache.GetError().c_str());
+		}
 		else {
-			GBSP_RETVAL gbspResult = compFHook->GBSP_CreateBSP(mapPath.c_str(), &compParms.bsp);
-			if (gbspResult == GBSP_ERROR) {
-				fprintf(stdout, "Compile Failed: GBSP_CreateBSP encountered an error, GBSPLib.Dll.\n");
-				return COMPILER_ERROR_BSPFAIL;
+			MakeStageKeys(compFHook, parms, mapPath, bspPath, stageKeys);
+			for (int stage = NUM_STAGES - 1; stage >= STAGE_BSP; stage--) {
+				if (stageEnabled[stage] && stageCache.Fetch(stageKeys[stage], work.bsp)) {
+					work.inMemory = true;
+					firstStage = stage + 1;
+					break;
+				}
 			}
-
-			gbspResult = compFHook->GBSP_SaveGBSPFile(bspPath.c_str());
-			if (gbspResult == GBSP_ERROR) {
-				fprintf(stdout, "Compile Failed: GBSP_SaveGBSPFile for file: %s, GBSPLib.Dll.\n", bspPath.c_str());
-				return COMPILER_ERROR_BSPSAVE;
+			for (int stage = STAGE_BSP; stage < firstStage; stage++) {
+				if (stageEnabled[stage]) {
+					stageCache.CountHit();
+					times.seconds[stage] = 0.0;
+					times.cached[stage] = true;
+				}
 			}
 		}
-		compFHook->GBSP_FreeBSP();
+	}
+
+	// Begin with GBSP
+	if (parms->isBspEnabled && firstStage > STAGE_BSP) {
+		printf("gbsp output found in the stage cache, skipping it.\n\n");
+	}
+	else if (parms->isBspEnabled) {
+		ShowSettingsBsp(*parms);
+		if (parms->showMapInfo) {
+			ShowMapInfo(mapPath, parms->numThreads);
+		}
+		if (!ArmStage(compFHook, parms, STAGE_BSP, watchdog)) {
+			DiscardWorkFile(work, bspPath);
+			return COMPILER_ERROR_CANCEL;
+		}
+		int span = trace.Begin("gbsp", "stage");
+		Compiler_BeginStage("gbsp");
+		result = RunBspStage(compFHook, parms, mapPath, work, trace);
+		times.seconds[STAGE_BSP] = trace.End(span);
+		result = DisarmStage(parms, STAGE_BSP, result, times.seconds[STAGE_BSP], watchdog);
+		Compiler_EndStage(result);
+		if (result != COMPILER_ERROR_NONE) {
+			DiscardWorkFile(work, bspPath);
+			return result;
+		}
+		StoreStage(stageCache, stageKeys[STAGE_BSP], work);
 		printf("\n");
 	}
 
 	// Begin with GVIS
-	if (compParms.isVisEnabled) {
-		ShowSettingsVis(compParms);
-		if (compFHook->GBSP_VisGBSPFile(bspPath.c_str(), &compParms.vis) == GBSP_ERROR) {
-			fprintf(stderr, "Warning: GBSP_VisGBSPFile failed for file : %s, GBSPLib.Dll.\n", bspPath.c_str());
-			return COMPILER_ERROR_BSPFAIL;
+	if (parms->isVisEnabled && firstStage > STAGE_VIS) {
+		printf("gvis output found in the stage cache, skipping it.\n\n");
+	}
+	else if (parms->isVisEnabled) {
+		ShowSettingsVis(*parms);
+		// the cache is named after the destination
+		std::string cachePath;
+		if (parms->incrementalVis) {
+			cachePath = bspPath;
+			GBSPTools::StripExtension(cachePath);
+			cachePath.append(VISCACHE_EXTENSION);
+		}
+		if (!ArmStage(compFHook, parms, STAGE_VIS, watchdog)) {
+			DiscardWorkFile(work, bspPath);
+			return COMPILER_ERROR_CANCEL;
+		}
+		int span = trace.Begin("gvis", "stage");
+		Compiler_BeginStage("gvis");
+		result = RunVisStage(compFHook, parms, work, cachePath, MakeCheckpointParms(parms, bspPath, VIS_CHECKPOINT_EXTENSION), trace);
+		times.seconds[STAGE_VIS] = trace.End(span);
+		result = DisarmStage(parms, STAGE_VIS, result, times.seconds[STAGE_VIS], watchdog);
+		Compiler_EndStage(result);
+		if (result != COMPILER_ERROR_NONE) {
+			DiscardWorkFile(work, bspPath);
+			return result;
 		}
+		StoreStage(stageCache, stageKeys[STAGE_VIS], work);
 		printf("\n");
 	}
 
 	// Begin with GLIGHT
-	if (compParms.isLightEnabled) {
-		ShowSettingsLight(compParms);
-		if (compFHook->GBSP_LightGBSPFile(bspPath.c_str(), &compParms.light) == GBSP_ERROR) {
-			fprintf(stdout, "Warning: GBSP_LightGBSPFile failed for file: %s, GBSPLib.Dll.\n", bspPath.c_str());
-			return COMPILER_ERROR_BSPFAIL;
+	if (parms->isLightEnabled && firstStage > STAGE_LIGHT) {
+		printf("glight output found in the stage cache, skipping it.\n\n");
+	}
+	else if (parms->isLightEnabled) {
+		ShowSettingsLight(*parms);
+		std::string cachePath;
+		if (parms->incrementalLight) {
+			cachePath = bspPath;
+			GBSPTools::StripExtension(cachePath);
+			cachePath.append(LIGHTCACHE_EXTENSION);
+		}
+		if (!ArmStage(compFHook, parms, STAGE_LIGHT, watchdog)) {
+			DiscardWorkFile(work, bspPath);
+			return COMPILER_ERROR_CANCEL;
+		}
+		int span = trace.Begin("glight", "stage");
+		Compiler_BeginStage("glight");
+		result = RunLightStage(compFHook, parms, work, cachePath, MakeCheckpointParms(parms, bspPath, LIGHT_CHECKPOINT_EXTENSION), trace);
+		times.seconds[STAGE_LIGHT] = trace.End(span);
+		result = DisarmStage(parms, STAGE_LIGHT, result, times.seconds[STAGE_LIGHT], watchdog);
+		Compiler_EndStage(result);
+		if (result != COMPILER_ERROR_NONE) {
+			DiscardWorkFile(work, bspPath);
+			return result;
 		}
+		StoreStage(stageCache, stageKeys[STAGE_LIGHT], work);
 		printf("\n");
 	}
 
-	FreeLibrary(compHandle);
+	// Write the final .bsp only once, after the whole pipeline
+	if (!CommitWorkBsp(work, bspPath)) {
+		fprintf(stdout, "Compile Failed: Unable to write file: %s\n", bspPath.c_str());
+		DiscardWorkFile(work, bspPath);
+		return COMPILER_ERROR_BSPSAVE;
+	}
+
+	if (parms->showBspInfo) {
+		ShowBspInfo(bspPath);
+	}
+
+	if (stageCache.IsOpen()) {
+		ShowStageCacheStats(stageCache);
+	}
+
+	return COMPILER_ERROR_NONE;
+}
+
+//========================================================================================
+//	RunBatch()
+//	Compiles every map of the batch list with the stages of the command line. With a
+//	single job the maps compile one after another in this process, which loads the
+//	library only once. More jobs run as worker processes, since GBSPLib keeps the map
+//	it compiles in globals: each one writes its log next to its .bsp and may use at
+//	most jobMemory megabytes.
+//========================================================================================
+int RunBatch(int argc, char* argv[], CompilerParms* parms, GBSPTools::CancelWatchdog& watchdog) {
+	std::vector<BatchJob> jobs;
+	if (!LoadBatchList(parms->batchName, jobs)) {
+		return COMPILER_ERROR_BADARG;
+	}
+
+	// as many jobs as cores, as long as their memory budgets fit in the installed memory
+	int numJobs = parms->numJobs > 0 ? parms->numJobs : GBSPTools::GetNumCores();
+	if (parms->jobMemory > 0) {
+		long long memory = GBSPTools::GetPhysicalMemory();
+		int fit = memory > 0 ? (int)(memory / parms->jobMemory) : numJobs;
+		fit = fit > 1 ? fit : 1;
+		if (numJobs > fit) {
+			printf("Only %d jobs of %d MB fit in %lld MB of memory.\n", fit, parms->jobMemory, memory);
+			numJobs = fit;
+		}
+	}
+	numJobs = numJobs < (int)jobs.size() ? numJobs : (int)jobs.size();
+	printf("\nBATCH: %d maps from %s, %d jobs\n\n", (int)jobs.size(), parms->batchName, numJobs);
+
+	GBSPTools::Trace trace;
+	if (numJobs <= 1) {
+		CompilerLibHandle compHandle = nullptr;
+		GBSP_FuncHook* compFHook = nullptr;
+		if ((parms->isBspEnabled && !parms->nativeBsp && parms->updateEnts != GE_TRUE) || (parms->isVisEnabled && !parms->nativeVis) || (parms->isLightEnabled && !parms->nativeLight)) {
+			int span = trace.Begin("load library", "gbsplib");
+			CompilerErrorEnum result = Compiler_LoadCompilerLib(compFHook, compHandle, Compiler_ErrorfCallback, Compiler_PrintfCallback, parms->libPath);
+			trace.End(span);
+			if (result != COMPILER_ERROR_NONE) {
+				return result;
+			}
+		}
+
+		for (size_t i = 0; i < jobs.size() && !watchdog.WasInterrupted(); i++) {
+			BatchJob& job = jobs[i];
+			printf("BATCH JOB %d/%d: %s\n\n", (int)i + 1, (int)jobs.size(), job.mapName.c_str());
+			int span = trace.Begin(job.mapName, "map");
+			job.result = CompileMap(compFHook, parms, job.mapName, job.bspName, job.times, trace, watchdog);
+			job.seconds = trace.End(span);
+			printf("\n");
+
+			// GBSPLib has no way to clear its cancel request, loading it again does
+			if (job.result == COMPILER_ERROR_TIMEOUT && compHandle != nullptr) {
+				Compiler_FreeCompilerLib(compHandle);
+				CompilerErrorEnum result = Compiler_LoadCompilerLib(compFHook, compHandle, Compiler_ErrorfCallback, Compiler_PrintfCallback, parms->libPath);
+				if (result != COMPILER_ERROR_NONE) {
+					return result;
+				}
+			}
+		}
+
+		Compiler_FreeCompilerLib(compHandle);
+	}
+	else {
+		std::string exePath = GBSPTools::GetExecutablePath();
+		if (exePath.empty()) {
+			exePath = argv[0];
+		}
+
+		// the workers get the options of the command line, minus the batch ones
+		std::vector<std::string> options;
+		for (int i = 1; i < argc; i++) {
+			if (!strcmp(argv[i], "-batch") || !strcmp(argv[i], "-jobs") || !strcmp(argv[i], "-jobmemory") || !strcmp(argv[i], "-report") || !strcmp(argv[i], "-trace")) {
+				i++;
+				continue;
+			}
+			options.push_back(argv[i]);
+		}
+
+		// and share the cores, unless told otherwise
+		if (parms->numThreads == 0) {
+			int threads = GBSPTools::GetNumCores() / numJobs;
+			options.push_back("-threads");
+			options.push_back(std::to_string(threads > 1 ? threads : 1));
+		}
+
+		// the biggest maps start first, so a long one doesn't hold up the end of the batch
+		std::vector<long long> sizes(jobs.size(), 0);
+		std::vector<int> order(jobs.size());
+		for (size_t i = 0; i < jobs.size(); i++) {
+			std::string mapPath, bspPath;
+			MakeCompilePaths(jobs[i].mapName, jobs[i].bspName, mapPath, bspPath);
+			GBSPTools::MappedFile map;
+			if (map.Open(mapPath)) {
+				sizes[i] = (long long)map.GetSize();
+			}
+			order[i] = (int)i;
+		}
+		std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return sizes[a] > sizes[b]; });
+
+		// every job takes the first free lane of the trace
+		std::mutex printLock;
+		int numDone = 0;
+		std::vector<bool> lanes(numJobs, false);
+		GBSPTools::WorkStealingFor((int)jobs.size(), numJobs, [&](int index) {
+			// Ctrl+C reaches the running workers too, the others don't start
+			if (watchdog.WasInterrupted()) {
+				return;
+			}
+			BatchJob& job = jobs[index];
+			std::string mapPath, bspPath;
+			MakeCompilePaths(job.mapName, job.bspName, mapPath, bspPath);
+			std::string basePath(bspPath);
+			GBSPTools::StripExtension(basePath);
+			const std::string logPath = basePath + ".log";
+			const std::string reportPath = basePath + ".times";
+
+			std::vector<std::string> args;
+			args.push_back(exePath);
+			args.push_back(job.mapName);
+			if (!job.bspName.empty()) {
+				args.push_back(job.bspName);
+			}
+			args.insert(args.end(), options.begin(), options.end());
+			args.push_back("-report");
+			args.push_back(reportPath);
+
+			int lane;
+			{
+				std::lock_guard<std::mutex> guard(printLock);
+				lane = (int)(std::find(lanes.begin(), lanes.end(), false) - lanes.begin());
+				lanes[lane] = true;
+			}
+
+			remove(reportPath.c_str());
+			double start = trace.Now();
+			job.result = GBSPTools::RunProcess(args, logPath, parms->jobMemory);
+			job.seconds = trace.Now() - start;
+			ReadStageTimes(reportPath, job.times);
+			remove(reportPath.c_str());
+
+			// the worker's own stages only come back as times
+			std::string detail;
+			const char* stageNames[NUM_STAGES] = { "gbsp", "gvis", "glight" };
+			for (int stage = STAGE_BSP; stage < NUM_STAGES; stage++) {
+				char text[64];
+				if (job.times.cached[stage]) {
+					sprintf_s(text, "%s cached, ", stageNames[stage]);
+					detail += text;
+				}
+				else if (job.times.seconds[stage] >= 0.0) {
+					sprintf_s(text, "%s %.2f s, ", stageNames[stage], job.times.seconds[stage]);
+					detail += text;
+				}
+			}
+			detail += "exit code " + std::to_string(job.result);
+			trace.Add(job.mapName, "map", lane, start, job.seconds, detail);
+
+			std::lock_guard<std::mutex> guard(printLock);
+			lanes[lane] = false;
+			numDone++;
+			printf("BATCH JOB %d/%d: %s %s in %.1f s, log: %s\n", numDone, (int)jobs.size(), job.mapName.c_str(),
+				job.result == COMPILER_ERROR_NONE ? "done" : "FAILED", job.seconds, logPath.c_str());
+			fflush(stdout);
+		}, &order);
+		printf("\n");
+	}
+
+	ShowBatchSummary(jobs, trace.Now());
+	WriteTrace(trace, parms->traceName);
+
+	if (watchdog.WasInterrupted()) {
+		return COMPILER_ERROR_CANCEL;
+	}
+	for (const BatchJob& job : jobs) {
+		if (job.result != COMPILER_ERROR_NONE) {
+			return COMPILER_ERROR_BSPFAIL;
+		}
+	}
+	return COMPILER_ERROR_NONE;
+}
+
+//========================================================================================
+//	LoadBatchList()
+//	Reads the maps of a batch, one "mapname [destname]" per line. Names with spaces go
+//	between double quotes, empty lines and lines starting with # or // are skipped.
+//========================================================================================
+bool LoadBatchList(const std::string& listPath, std::vector<BatchJob>& jobs) {
+	FILE* fp = fopen(listPath.c_str(), "r");
+	if (fp == nullptr) {
+		fprintf(stdout, "\nError: Unable to read the batch list %s\n\n\n\n", listPath.c_str());
+		return false;
+	}
+
+	char line[4096];
+	int lineNumber = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), fp)) {
+		lineNumber++;
+		std::vector<std::string> tokens;
+		const char* c = line;
+		for (;;) {
+			while (isspace((unsigned char)*c)) {
+				c++;
+			}
+			if (!*c) {
+				break;
+			}
+			std::string token;
+			if (*c == '"') {
+				for (c++; *c && *c != '"' && *c != '\n' && *c != '\r'; c++) {
+					token += *c;
+				}
+				c += *c == '"';
+			}
+			else {
+				for (; *c && !isspace((unsigned char)*c); c++) {
+					token += *c;
+				}
+			}
+			tokens.push_back(token);
+		}
+
+		if (tokens.empty() || tokens[0][0] == '#' || !tokens[0].compare(0, 2, "//")) {
+			continue;
+		}
+		if (tokens.size() > 2 || tokens[0].empty()) {
+			fprintf(stdout, "\nError: Bad line %d in the batch list %s\n\n\n\n", lineNumber, listPath.c_str());
+			ok = false;
+			break;
+		}
+
+		BatchJob job;
+		job.mapName = tokens[0];
+		job.bspName = tokens.size() > 1 ? tokens[1] : std::string();
+		for (int stage = STAGE_BSP; stage < NUM_STAGES; stage++) {
+			job.times.seconds[stage] = -1.0;
+			job.times.cached[stage] = false;
+		}
+		job.seconds = 0.0;
+		job.result = -1;
+		jobs.push_back(job);
+	}
+	fclose(fp);
+
+	if (ok && jobs.empty()) {
+		fprintf(stdout, "\nError: The batch list %s has no maps\n\n\n\n", listPath.c_str());
+		ok = false;
+	}
+	return ok;
+}
+
+//========================================================================================
+//	WriteStageTimes() / ReadStageTimes()
+//	How long each stage of a worker took, one "seconds cached" line per stage
+//========================================================================================
+bool WriteStageTimes(const std::string& path, const StageTimes& times) {
+	FILE* fp = fopen(path.c_str(), "w");
+	if (fp == nullptr) {
+		return false;
+	}
+	for (int stage = STAGE_BSP; stage < NUM_STAGES; stage++) {
+		fprintf(fp, "%f %d\n", times.seconds[stage], times.cached[stage] ? 1 : 0);
+	}
+	return fclose(fp) == 0;
+}
+
+bool ReadStageTimes(const std::string& path, StageTimes& times) {
+	FILE* fp = fopen(path.c_str(), "r");
+	if (fp == nullptr) {
+		return false;
+	}
+	bool ok = true;
+	for (int stage = STAGE_BSP; ok && stage < NUM_STAGES; stage++) {
+		double seconds;
+		int cached;
+		ok = fscanf(fp, "%lf %d", &seconds, &cached) == 2;
+		if (ok) {
+			times.seconds[stage] = seconds;
+			times.cached[stage] = cached != 0;
+		}
+	}
+	fclose(fp);
+	return ok;
+}
+
+//========================================================================================
+//	ShowBatchSummary()
+//	Prints the stage times and exit code of every map of the batch
+//========================================================================================
+void ShowBatchSummary(const std::vector<BatchJob>& jobs, double seconds) {
+	printf("BATCH SUMMARY:\n");
+	printf("%-20s|%12s |%12s |%12s |%12s |%12s \n", "Map", "gbsp", "gvis", "glight", "total", "exit code");
+	printf("%-20s|%13s|%13s|%13s|%13s|%13s\n", "--------------------", "-------------", "-------------", "-------------", "-------------", "-------------");
+
+	int numFailed = 0;
+	for (const BatchJob& job : jobs) {
+		std::string name(job.mapName);
+		GBSPTools::PathToUnix(name);
+		name = name.substr(name.find_last_of(GBSPTools::PathSeparator) + 1);
+
+		char cells[NUM_STAGES][32];
+		for (int stage = STAGE_BSP; stage < NUM_STAGES; stage++) {
+			if (job.times.cached[stage]) {
+				sprintf_s(cells[stage], "cached");
+			}
+			else if (job.times.seconds[stage] < 0.0) {
+				sprintf_s(cells[stage], "-");
+			}
+			else {
+				sprintf_s(cells[stage], "%.1f s", job.times.seconds[stage]);
+			}
+		}
+		char total[32];
+		sprintf_s(total, "%.1f s", job.seconds);
+
+		printf("%-20s|%12s |%12s |%12s |%12s |%12d \n", name.c_str(), cells[STAGE_BSP], cells[STAGE_VIS], cells[STAGE_LIGHT], total, job.result);
+		numFailed += job.result != COMPILER_ERROR_NONE;
+	}
+	printf("%d of %d maps compiled in %.1f s, %d failed.\n", (int)jobs.size() - numFailed, (int)jobs.size(), seconds, numFailed);
+	printf("\n");
+}
+
+//========================================================================================
+//	WriteTrace()
+//	Writes the Chrome trace of the compile when asked to
+//========================================================================================
+void WriteTrace(GBSPTools::Trace& trace, const char* traceName) {
+	if (!traceName[0]) {
+		return;
+	}
+	if (!trace.WriteChromeTrace(traceName)) {
+		fprintf(stdout, "Warning: Unable to write the trace: %s\n", trace.GetError().c_str());
+		return;
+	}
+	printf("Trace written to %s\n", traceName);
+}
+
+//========================================================================================
+//	ShowBspInfo()
+//	Prints the chunks of a .bsp, straight from the file mapping
+//========================================================================================
+void ShowBspInfo(const std::string& bspPath) {
+	GBSPTools::BspFile bsp;
+	if (!bsp.Open(bspPath)) {
+		fprintf(stdout, "Warning: Unable to read bsp info: %s\n\n", bsp.GetError().c_str());
+		return;
+	}
+
+	printf("BSP INFO: %s\n", bspPath.c_str());
+	printf("%-20s|%12s |%12s |%12s \n", "Chunk", "Elements", "Size", "Bytes");
+	printf("%-20s|%13s|%13s|%13s\n", "--------------------", "-------------", "-------------", "-------------");
+	size_t total = 0;
+	for (const GBSPTools::BspFile::Chunk& chunk : bsp.GetChunks()) {
+		size_t bytes = (size_t)chunk.Header.Size * chunk.Header.Elements;
+		total += bytes;
+		printf("%-20s|%12d |%12d |%12zu \n", GBSPTools::GetChunkName(chunk.Header.Type), chunk.Header.Elements, chunk.Header.Size, bytes);
+	}
+	printf("%-20s|%12s |%12s |%12zu \n", "total", "", "", total);
+	printf("\n");
+}
+
+//========================================================================================
+//	MakeStageKeys()
+//	Hashes what the output of every enabled stage depends on. Each key includes the
+//	one of the stage before it, so it covers the whole pipeline up to that stage.
+//	The keys stay empty when an input can't be read.
+//========================================================================================
+void MakeStageKeys(GBSP_FuncHook* compFHook, CompilerParms* parms, const std::string& mapPath, const std::string& bspPath, std::string keys[NUM_STAGES]) {
+	// vis and light alone, or an entity update, start from the existing .bsp
+	std::string previous;
+	if (!parms->isBspEnabled || parms->updateEnts == GE_TRUE) {
+		GBSPTools::ContentHash input;
+		if (!input.AddFile(bspPath)) {
+			return;
+		}
+		previous = input.ToString();
+	}
+
+	for (int stage = STAGE_BSP; stage < NUM_STAGES; stage++) {
+		GBSPTools::ContentHash hash;
+		hash.AddValue(GBSPTOOLS_VERSION);
+		hash.AddValue(stage);
+		hash.AddString(previous);
+
+		bool native;
+		if (stage == STAGE_BSP) {
+			if (!parms->isBspEnabled) {
+				continue;
+			}
+			if (!hash.AddFile(mapPath)) {
+				return;
+			}
+			hash.AddValue(parms->bsp);
+			hash.AddValue(parms->updateEnts);
+			hash.AddValue(parms->nativeBsp);
+			native = parms->nativeBsp || parms->updateEnts == GE_TRUE;
+		}
+		else if (stage == STAGE_VIS) {
+			if (!parms->isVisEnabled) {
+				continue;
+			}
+			hash.AddValue(parms->vis);
+			hash.AddValue(parms->nativeVis);
+			native = parms->nativeVis;
+		}
+		else {
+			if (!parms->isLightEnabled) {
+				continue;
+			}
+			hash.AddValue(parms->light);
+			hash.AddValue(parms->nativeLight);
+			if (parms->nativeLight) {
+				hash.AddValue(parms->radiosity);
+				hash.AddValue(parms->sampling);
+			}
+			native = parms->nativeLight;
+		}
+
+		// another build of the library may compile differently
+		if (!native && compFHook != nullptr) {
+			hash.AddValue(compFHook->VersionMajor);
+			hash.AddValue(compFHook->VersionMinor);
+		}
+
+		keys[stage] = hash.ToString();
+		previous = keys[stage];
+	}
+}
+
+//========================================================================================
+//	StoreStage()
+//	Keeps the output of a stage that just ran in the stage cache, when there is one
+//========================================================================================
+void StoreStage(GBSPTools::StageCache& cache, const std::string& key, WorkBsp& work) {
+	if (!cache.IsOpen()) {
+		return;
+	}
+	cache.CountMiss();
+	bool stored = work.inMemory ? cache.Store(key, work.bsp) : cache.Store(key, work.path);
+	if (!key.empty() && !stored) {
+		fprintf(stdout, "Warning: Unable to fill the stage cache: %s\n", cache.GetError().c_str());
+	}
+}
+
+//========================================================================================
+//	ShowStageCacheStats()
+//	Prints how many stages the stage cache saved
+//========================================================================================
+void ShowStageCacheStats(const GBSPTools::StageCache& cache) {
+	const GBSPTools::StageCacheStats& stats = cache.GetStats();
+	printf("STAGE CACHE: %s\n", cache.GetDirectory().c_str());
+	printf("%-20s|%12s \n", "Name", "Value");
+	printf("%-20s|%13s\n", "--------------------", "-------------");
+	printf("%-20s|%12d \n", "hits", stats.Hits);
+	printf("%-20s|%12d \n", "misses", stats.Misses);
+	printf("%-20s|%12lld \n", "bytes saved", stats.BytesFetched);
+	printf("%-20s|%12lld \n", "bytes stored", stats.BytesStored);
+	printf("\n");
+}
+
+//========================================================================================
+//	LoadWorkBsp()
+//	Makes the BSP in memory the current one for a native stage, reading the work file
+//	when a GBSPLib stage wrote it last
+//========================================================================================
+bool LoadWorkBsp(WorkBsp& work) {
+	if (work.inMemory) {
+		return true;
+	}
+	if (!work.bsp.Open(work.path)) {
+		fprintf(stdout, "Compile Failed: %s\n", work.bsp.GetError().c_str());
+		return false;
+	}
+	work.inMemory = true;
+	return true;
+}
+
+//========================================================================================
+//	SaveWorkBsp()
+//	Writes the BSP in memory to the work file for a GBSPLib stage and lets go of it
+//========================================================================================
+bool SaveWorkBsp(WorkBsp& work) {
+	if (work.inMemory) {
+		bool saved = work.bsp.GetPath() == work.path ? work.bsp.Update() : work.bsp.Save(work.path);
+		if (!saved) {
+			fprintf(stdout, "Compile Failed: %s\n", work.bsp.GetError().c_str());
+			return false;
+		}
+	}
+	work.bsp.Close();
+	work.inMemory = false;
+	return true;
+}
+
+//========================================================================================
+//	CommitWorkBsp()
+//	Writes the output of the pipeline to bspPath and drops the old one GBSPLib moved
+//	aside. Vis or light alone only write back what they changed, everything else
+//	replaces it whole.
+//========================================================================================
+bool CommitWorkBsp(WorkBsp& work, const std::string& bspPath) {
+	if (work.inMemory) {
+		bool saved = work.bsp.GetPath() == bspPath ? work.bsp.Update() : work.bsp.Save(bspPath);
+		if (!saved) {
+			fprintf(stdout, "Error: %s\n", work.bsp.GetError().c_str());
+			return false;
+		}
+		work.bsp.Close();
+		work.inMemory = false;
+	}
+
+	if (!work.backup.empty()) {
+		remove(work.backup.c_str());
+		work.backup.clear();
+	}
+	work.ownsFile = false;
+	return true;
+}
+
+//========================================================================================
+//	DiscardWorkFile()
+//	Drops the BSP of a failed pipeline. A destination GBSPLib wrote from scratch is
+//	removed and the old one put back, one worked on in place stays as it is.
+//========================================================================================
+void DiscardWorkFile(WorkBsp& work, const std::string& bspPath) {
+	work.bsp.Close();
+	work.inMemory = false;
+	if (!work.ownsFile) {
+		return;
+	}
+	remove(bspPath.c_str());
+	if (!work.backup.empty()) {
+		GBSPTools::CommitFile(work.backup, bspPath);
+		work.backup.clear();
+	}
+	work.ownsFile = false;
+}
+
+//========================================================================================
+//	ShowMapInfo()
+//	Reads the .map natively and prints what it contains
+//========================================================================================
+void ShowMapInfo(const std::string& mapPath, int numThreads) {
+	auto start = std::chrono::steady_clock::now();
+
+	GBSPTools::MapFile map;
+	if (!map.Load(mapPath, numThreads)) {
+		fprintf(stdout, "Warning: Unable to read map info: %s\n\n", map.GetError().c_str());
+		return;
+	}
+
+	double loadTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	geVec3d mins = { MIN_MAX_BOUNDS, MIN_MAX_BOUNDS, MIN_MAX_BOUNDS };
+	geVec3d maxs = { -MIN_MAX_BOUNDS, -MIN_MAX_BOUNDS, -MIN_MAX_BOUNDS };
+	for (const geVec3d& point : map.Points) {
+		mins.X = point.X < mins.X ? point.X : mins.X;
+		mins.Y = point.Y < mins.Y ? point.Y : mins.Y;
+		mins.Z = point.Z < mins.Z ? point.Z : mins.Z;
+		maxs.X = point.X > maxs.X ? point.X : maxs.X;
+		maxs.Y = point.Y > maxs.Y ? point.Y : maxs.Y;
+		maxs.Z = point.Z > maxs.Z ? point.Z : maxs.Z;
+	}
+
+	printf("MAP INFO:\n");
+	printf("%-20s|%12s \n", "Name", "Value");
+	printf("%-20s|%13s\n", "--------------------", "-------------");
+	printf("%-20s|%12d \n", "version", map.Version);
+	printf("%-20s|%12zu \n", "entities", map.Entities.size());
+	printf("%-20s|%12zu \n", "brushes", map.Brushes.size());
+	printf("%-20s|%12zu \n", "faces", map.Faces.size());
+	printf("%-20s|%12zu \n", "points", map.Points.size());
+	printf("%-20s|%12zu \n", "textures", map.Textures.size());
+	if (!map.Points.empty()) {
+		printf("%-20s| %.0f %.0f %.0f\n", "mins", mins.X, mins.Y, mins.Z);
+		printf("%-20s| %.0f %.0f %.0f\n", "maxs", maxs.X, maxs.Y, maxs.Z);
+	}
+	printf("%-20s|%10.1fms \n", "read time", loadTime);
+	printf("\n");
+}
+
+//========================================================================================
+//	ArmStage()
+//	Gives the stage about to run its time budget, false when Ctrl+C was pressed
+//	before it could start
+//========================================================================================
+bool ArmStage(GBSP_FuncHook* compFHook, CompilerParms* parms, int stage, GBSPTools::CancelWatchdog& watchdog) {
+	const char* stageNames[NUM_STAGES] = { "gbsp", "gvis", "glight" };
+	if (watchdog.WasInterrupted()) {
+		printf("Interrupted, %s didn't run.\n", stageNames[stage]);
+		return false;
+	}
+
+	// the native stages only look at the cancel flag
+	const bool native = (stage == STAGE_BSP && (parms->nativeBsp || parms->updateEnts == GE_TRUE)) || (stage == STAGE_VIS && parms->nativeVis) || (stage == STAGE_LIGHT && parms->nativeLight);
+	watchdog.Arm(parms->timeout[stage], native || compFHook == nullptr ? nullptr : compFHook->GBSP_Cancel);
+	return true;
+}
+
+//========================================================================================
+//	DisarmStage()
+//	Tells how far a stage got when it was stopped, it fails even if it managed to end
+//	since its output may be partial
+//========================================================================================
+CompilerErrorEnum DisarmStage(CompilerParms* parms, int stage, CompilerErrorEnum result, double seconds, GBSPTools::CancelWatchdog& watchdog) {
+	GBSPTools::CancelReason reason = watchdog.Disarm();
+	if (reason == GBSPTools::CANCEL_NONE) {
+		return result;
+	}
+
+	const char* stageNames[NUM_STAGES] = { "gbsp", "gvis", "glight" };
+	Compiler_FlushLog();
+	if (reason == GBSPTools::CANCEL_TIMEOUT) {
+		printf("\n%s stopped after %.1f s, over its budget of %g s", stageNames[stage], seconds, parms->timeout[stage]);
+	}
+	else {
+		printf("\n%s interrupted after %.1f s", stageNames[stage], seconds);
+	}
+	if (Compiler_Progress != nullptr && !Compiler_Progress->GetPhase().empty()) {
+		printf(", during %s", Compiler_Progress->GetPhase().c_str());
+	}
+	if (Compiler_Progress != nullptr && Compiler_Progress->GetPercent() >= 0) {
+		printf(" (%d%% done)", Compiler_Progress->GetPercent());
+	}
+	printf(".\n");
+
+	return reason == GBSPTools::CANCEL_TIMEOUT ? COMPILER_ERROR_TIMEOUT : COMPILER_ERROR_CANCEL;
+}
+
+//========================================================================================
+//	RunBspStage()
+//	Creates the BSP from the .map (or updates its entities) and hands it to the next
+//	stage, in memory when native and through the work file otherwise
+//========================================================================================
+CompilerErrorEnum RunBspStage(GBSP_FuncHook* compFHook, CompilerParms* parms, const std::string& mapPath, WorkBsp& work, GBSPTools::Trace& trace) {
+	if (parms->updateEnts == GE_TRUE) {
+		if (!LoadWorkBsp(work)) {
+			return COMPILER_ERROR_BSPFAIL;
+		}
+		GBSPTools::TraceScope scope(trace, "UpdateEntities", "native");
+		if (!GBSPTools::UpdateEntities(mapPath, work.bsp, parms->numThreads)) {
+			return COMPILER_ERROR_BSPFAIL;
+		}
+		return COMPILER_ERROR_NONE;
+	}
+
+	if (parms->nativeBsp) {
+		GBSPTools::TraceScope scope(trace, "CreateBsp", "native");
+		if (!GBSPTools::CreateBsp(mapPath, work.bsp, parms->bsp, parms->numThreads)) {
+			return COMPILER_ERROR_BSPFAIL;
+		}
+		work.inMemory = true;
+		return COMPILER_ERROR_NONE;
+	}
 
+	if (!SaveWorkBsp(work)) {
+		return COMPILER_ERROR_BSPSAVE;
+	}
+	int span = trace.Begin("GBSP_CreateBSP", "gbsplib");
+	GBSP_RETVAL gbspResult = compFHook->GBSP_CreateBSP(mapPath.c_str(), &parms->bsp);
+	Compiler_FlushLog();
+	trace.End(span);
+	if (gbspResult != GBSP_OK) {
+		fprintf(stdout, "Compile Failed: GBSP_CreateBSP encountered an error, GBSPLib.Dll.\n");
+		compFHook->GBSP_FreeBSP();
+		return COMPILER_ERROR_BSPFAIL;
+	}
+
+	span = trace.Begin("GBSP_SaveGBSPFile", "gbsplib");
+	gbspResult = compFHook->GBSP_SaveGBSPFile(work.path.c_str());
+	compFHook->GBSP_FreeBSP();
+	Compiler_FlushLog();
+	trace.End(span);
+	if (gbspResult != GBSP_OK) {
+		fprintf(stdout, "Compile Failed: GBSP_SaveGBSPFile for file: %s, GBSPLib.Dll.\n", work.path.c_str());
+		return COMPILER_ERROR_BSPSAVE;
+	}
+
+	return COMPILER_ERROR_NONE;
+}
+
+//========================================================================================
+//	MakeCheckpointParms()
+//	Where a native stage saves its progress: next to the destination .bsp, named after
+//	it
+//========================================================================================
+GBSPTools::CheckpointParms MakeCheckpointParms(CompilerParms* parms, const std::string& bspPath, const char* extension) {
+	GBSPTools::CheckpointParms checkpoint;
+	checkpoint.Interval = parms->checkpointInterval;
+	checkpoint.Resume = parms->resume;
+	if (parms->checkpointInterval > 0.0 || parms->resume) {
+		checkpoint.Path = bspPath;
+		GBSPTools::StripExtension(checkpoint.Path);
+		checkpoint.Path.append(extension);
+	}
+	return checkpoint;
+}
+
+//========================================================================================
+//	RunVisStage()
+//	Computes the visibility of the work BSP, the native one reuses the results in
+//	cachePath when given and saves its progress to the checkpoint
+//========================================================================================
+CompilerErrorEnum RunVisStage(GBSP_FuncHook* compFHook, CompilerParms* parms, WorkBsp& work, const std::string& cachePath, const GBSPTools::CheckpointParms& checkpoint, GBSPTools::Trace& trace) {
+	if (parms->nativeVis) {
+		if (!LoadWorkBsp(work)) {
+			return COMPILER_ERROR_BSPFAIL;
+		}
+		GBSPTools::TraceScope scope(trace, "VisBsp", "native");
+		if (!GBSPTools::VisBsp(work.bsp, parms->vis, parms->numThreads, cachePath, checkpoint)) {
+			return COMPILER_ERROR_BSPFAIL;
+		}
+		return COMPILER_ERROR_NONE;
+	}
+
+	if (!SaveWorkBsp(work)) {
+		return COMPILER_ERROR_BSPSAVE;
+	}
+	GBSPTools::TraceScope scope(trace, "GBSP_VisGBSPFile", "gbsplib");
+	GBSP_RETVAL gbspResult = compFHook->GBSP_VisGBSPFile(work.path.c_str(), &parms->vis);
+	Compiler_FlushLog();
+	if (gbspResult != GBSP_OK) {
+		fprintf(stderr, "Warning: GBSP_VisGBSPFile failed for file : %s, GBSPLib.Dll.\n", work.path.c_str());
+		return COMPILER_ERROR_BSPFAIL;
+	}
+	return COMPILER_ERROR_NONE;
+}
+
+//========================================================================================
+//	RunLightStage()
+//	Lights the work BSP, the native radiosity saves its progress to the checkpoint and
+//	the native direct light keeps what it lit in the cache when given one
+//========================================================================================
+CompilerErrorEnum RunLightStage(GBSP_FuncHook* compFHook, CompilerParms* parms, WorkBsp& work, const std::string& cachePath, const GBSPTools::CheckpointParms& checkpoint, GBSPTools::Trace& trace) {
+	if (parms->nativeLight) {
+		if (!LoadWorkBsp(work)) {
+			return COMPILER_ERROR_BSPFAIL;
+		}
+		GBSPTools::TraceScope scope(trace, "LightBsp", "native");
+		if (!GBSPTools::LightBsp(work.bsp, parms->light, parms->radiosity, parms->sampling, parms->numThreads, cachePath, checkpoint)) {
+			return COMPILER_ERROR_BSPFAIL;
+		}
+		return COMPILER_ERROR_NONE;
+	}
+
+	if (!SaveWorkBsp(work)) {
+		return COMPILER_ERROR_BSPSAVE;
+	}
+	GBSPTools::TraceScope scope(trace, "GBSP_LightGBSPFile", "gbsplib");
+	GBSP_RETVAL gbspResult = compFHook->GBSP_LightGBSPFile(work.path.c_str(), &parms->light);
+	Compiler_FlushLog();
+	if (gbspResult != GBSP_OK) {
+		fprintf(stdout, "Warning: GBSP_LightGBSPFile failed for file: %s, GBSPLib.Dll.\n", work.path.c_str());
+		return COMPILER_ERROR_BSPFAIL;
+	}
 	return COMPILER_ERROR_NONE;
 }
 
@@ -127,6 +1075,187 @@ void ParseCmdArgs(int argc, char* argv[], CompilerParms* parms) {
 
 	printf("Arguments:");
 	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-lib")) {
+			printf(" -lib");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				strcpy_s(parms->libPath, argv[++i]);
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -lib\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+		else if (!strcmp(argv[i], "-cache")) {
+			printf(" -cache");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				strcpy_s(parms->cacheDir, argv[++i]);
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -cache\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+		else if (!strcmp(argv[i], "-batch")) {
+			printf(" -batch");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				strcpy_s(parms->batchName, argv[++i]);
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -batch\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+		else if (!strcmp(argv[i], "-jobs")) {
+			printf(" -jobs");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->numJobs = strtol(argv[++i], NULL, 10);
+				if (errno == ERANGE || parms->numJobs < 0) {
+					fprintf(stdout, "\nError: Bad argument for -jobs\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -jobs\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+		else if (!strcmp(argv[i], "-jobmemory")) {
+			printf(" -jobmemory");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->jobMemory = strtol(argv[++i], NULL, 10);
+				if (errno == ERANGE || parms->jobMemory < 0) {
+					fprintf(stdout, "\nError: Bad argument for -jobmemory\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -jobmemory\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+		else if (!strcmp(argv[i], "-report")) {
+			printf(" -report");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				strcpy_s(parms->reportName, argv[++i]);
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -report\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+		else if (!strcmp(argv[i], "-trace")) {
+			printf(" -trace");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				strcpy_s(parms->traceName, argv[++i]);
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -trace\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+		else if (!strcmp(argv[i], "-progress")) {
+			printf(" -progress");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				strcpy_s(parms->progressTarget, argv[++i]);
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -progress\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+		else if (!strcmp(argv[i], "-logbuffer")) {
+			printf(" -logbuffer");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->logBuffer = strtol(argv[++i], NULL, 10);
+				if (errno == ERANGE || parms->logBuffer < 0) {
+					fprintf(stdout, "\nError: Bad argument for -logbuffer\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -logbuffer\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+		else if (!strcmp(argv[i], "-checkpoint")) {
+			printf(" -checkpoint");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->checkpointInterval = strtod(argv[++i], NULL);
+				if (errno == ERANGE || parms->checkpointInterval < 0.0) {
+					fprintf(stdout, "\nError: Bad argument for -checkpoint\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -checkpoint\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+		else if (!strcmp(argv[i], "-resume")) {
+			printf(" -resume");
+			parms->resume = true;
+			continue;
+		}
+		else if (!strcmp(argv[i], "-timeout-bsp") || !strcmp(argv[i], "-timeout-vis") || !strcmp(argv[i], "-timeout-light")) {
+			const char* option = argv[i];
+			const int stage = !strcmp(option, "-timeout-bsp") ? STAGE_BSP : (!strcmp(option, "-timeout-vis") ? STAGE_VIS : STAGE_LIGHT);
+			printf(" %s", option);
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->timeout[stage] = strtod(argv[++i], NULL);
+				if (errno == ERANGE || parms->timeout[stage] < 0.0) {
+					fprintf(stdout, "\nError: Bad argument for %s\n\n\n\n", option);
+					exit(COMPILER_ERROR_BADARG);
+				}
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for %s\n\n\n\n", option);
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+		else if (!strcmp(argv[i], "-bspinfo")) {
+			parms->showBspInfo = true;
+			printf(" -bspinfo");
+			continue;
+		}
+		else if (!strcmp(argv[i], "-threads")) {
+			printf(" -threads");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->numThreads = strtol(argv[++i], NULL, 10);
+				if (errno == ERANGE || parms->numThreads < 0) {
+					fprintf(stdout, "\nError: Bad argument for -threads\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -threads\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+
 		if (!strcmp(argv[i], "-gbsp")) {
 			parms->isBspEnabled = true;
 			currentFlag = READING_BSP;
@@ -174,6 +1303,14 @@ void ParseCmdArgs(int argc, char* argv[], CompilerParms* parms) {
 				parms->updateEnts = GE_TRUE;
 				printf(" -onlyents");
 			}
+			else if (!strcmp(argv[i], "-mapinfo")) {
+				parms->showMapInfo = true;
+				printf(" -mapinfo");
+			}
+			else if (!strcmp(argv[i], "-native")) {
+				parms->nativeBsp = true;
+				printf(" -native");
+			}
 		}
 		else if (currentFlag == READING_VIS) {
 			if (!strcmp(argv[i], "-verbose")) {
@@ -185,9 +1322,17 @@ void ParseCmdArgs(int argc, char* argv[], CompilerParms* parms) {
 				printf(" -full");
 			}
 			else if (!strcmp(argv[i], "-sortportals")) {
-				parms->vis.SortPortals = GE_FALSE;
+				parms->vis.SortPortals = GE_TRUE;
 				printf(" -sortportals");
 			}
+			else if (!strcmp(argv[i], "-native")) {
+				parms->nativeVis = true;
+				printf(" -native");
+			}
+			else if (!strcmp(argv[i], "-incremental")) {
+				parms->incrementalVis = true;
+				printf(" -incremental");
+			}
 		}
 		else if (currentFlag == READING_LIGHT) {
 			if (!strcmp(argv[i], "-verbose")) {
@@ -198,6 +1343,10 @@ void ParseCmdArgs(int argc, char* argv[], CompilerParms* parms) {
 				parms->light.ExtraSamples = GE_TRUE;
 				printf(" -extra");
 			}
+			else if (!strcmp(argv[i], "-adaptive")) {
+				parms->sampling.Adaptive = GE_TRUE;
+				printf(" -adaptive");
+			}
 			else if (!strcmp(argv[i], "-radiosity")) {
 				parms->light.Radiosity = GE_TRUE;
 				printf(" -radiosity");
@@ -274,6 +1423,14 @@ void ParseCmdArgs(int argc, char* argv[], CompilerParms* parms) {
 					exit(COMPILER_ERROR_BADARG);
 				}
 			}
+			else if (!strcmp(argv[i], "-native")) {
+				parms->nativeLight = true;
+				printf(" -native");
+			}
+			else if (!strcmp(argv[i], "-incremental")) {
+				parms->incrementalLight = true;
+				printf(" -incremental");
+			}
 			else if (!strcmp(argv[i], "-bounce")) {
 				printf(" -bounce");
 				if (i + 1 < argc) {
@@ -289,6 +1446,81 @@ void ParseCmdArgs(int argc, char* argv[], CompilerParms* parms) {
 					exit(COMPILER_ERROR_BADARG);
 				}
 			}
+			else if (!strcmp(argv[i], "-radiositythreshold")) {
+				printf(" -radiositythreshold");
+				if (i + 1 < argc) {
+					printf(" %s", argv[i + 1]);
+					parms->radiosity.Threshold = strtof(argv[++i], NULL);
+					if (errno == ERANGE || parms->radiosity.Threshold < 0.0f) {
+						fprintf(stdout, "\nError: Bad argument for -radiositythreshold\n\n\n\n");
+						exit(COMPILER_ERROR_BADARG);
+					}
+				}
+				else {
+					fprintf(stdout, "\nError: Missing argument for -radiositythreshold\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			}
+			else if (!strcmp(argv[i], "-minpatchsize")) {
+				printf(" -minpatchsize");
+				if (i + 1 < argc) {
+					printf(" %s", argv[i + 1]);
+					parms->radiosity.MinPatchSize = strtof(argv[++i], NULL);
+					if (errno == ERANGE || parms->radiosity.MinPatchSize < 1.0f) {
+						fprintf(stdout, "\nError: Bad argument for -minpatchsize\n\n\n\n");
+						exit(COMPILER_ERROR_BADARG);
+					}
+				}
+				else {
+					fprintf(stdout, "\nError: Missing argument for -minpatchsize\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			}
+			else if (!strcmp(argv[i], "-patchmemory")) {
+				printf(" -patchmemory");
+				if (i + 1 < argc) {
+					printf(" %s", argv[i + 1]);
+					parms->radiosity.MaxMemory = strtol(argv[++i], NULL, 10);
+					if (errno == ERANGE || parms->radiosity.MaxMemory < 0) {
+						fprintf(stdout, "\nError: Bad argument for -patchmemory\n\n\n\n");
+						exit(COMPILER_ERROR_BADARG);
+					}
+				}
+				else {
+					fprintf(stdout, "\nError: Missing argument for -patchmemory\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			}
+			else if (!strcmp(argv[i], "-samplecontrast")) {
+				printf(" -samplecontrast");
+				if (i + 1 < argc) {
+					printf(" %s", argv[i + 1]);
+					parms->sampling.Contrast = strtof(argv[++i], NULL);
+					if (errno == ERANGE || parms->sampling.Contrast < 0.0f) {
+						fprintf(stdout, "\nError: Bad argument for -samplecontrast\n\n\n\n");
+						exit(COMPILER_ERROR_BADARG);
+					}
+				}
+				else {
+					fprintf(stdout, "\nError: Missing argument for -samplecontrast\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			}
+			else if (!strcmp(argv[i], "-maxsamples")) {
+				printf(" -maxsamples");
+				if (i + 1 < argc) {
+					printf(" %s", argv[i + 1]);
+					parms->sampling.MaxSamples = strtol(argv[++i], NULL, 10);
+					if (errno == ERANGE || parms->sampling.MaxSamples < 1) {
+						fprintf(stdout, "\nError: Bad argument for -maxsamples\n\n\n\n");
+						exit(COMPILER_ERROR_BADARG);
+					}
+				}
+				else {
+					fprintf(stdout, "\nError: Missing argument for -maxsamples\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			}
 			else {
 				if (!hasLoadMap) {
 					strcpy_s(parms->mapName, argv[i]);
@@ -302,10 +1534,21 @@ void ParseCmdArgs(int argc, char* argv[], CompilerParms* parms) {
 		}
 	}
 
-	if (!hasLoadMap) {
+	// a batch takes its maps from the list
+	if (hasLoadMap && parms->batchName[0]) {
+		fprintf(stdout, "\nError: -batch takes the maps from its list, not from the command line\n\n\n\n");
+		exit(COMPILER_ERROR_BADARG);
+	}
+	if (!hasLoadMap && !parms->batchName[0]) {
 		ShowUsage();
 	}
 
+	// GBSPLib vis reads the portal file and light the texture data, the native bsp writes neither
+	if (parms->isBspEnabled && parms->nativeBsp && parms->updateEnts != GE_TRUE && ((parms->isVisEnabled && !parms->nativeVis) || (parms->isLightEnabled && !parms->nativeLight))) {
+		fprintf(stdout, "\nError: gbsp -native writes no portal file or texture data, run gvis and glight with -native too\n\n\n\n");
+		exit(COMPILER_ERROR_BADARG);
+	}
+
 	printf("\n");
 }
 
@@ -320,6 +1563,8 @@ void ShowUsage(void) {
 	printf("    %-20s : %s\n", "-verbose", "Outputs detailed compilation progress information.");
 	printf("    %-20s : %s\n", "-entverbose", "Outputs detailed entity information.");
 	printf("    %-20s : %s\n", "-onlyents", "Do an entity update from .map to .bsp.");
+	printf("    %-20s : %s\n", "-mapinfo", "Print what the .map contains before compiling it.");
+	printf("    %-20s : %s\n", "-native", "Builds the map with the native multithreaded compiler instead of GBSPLib (no portal file or texture data, gvis and glight need -native).");
 	printf("\n");
 
 	printf("\n--- gvis Options ---\n");
@@ -327,6 +1572,8 @@ void ShowUsage(void) {
 	printf("    %-20s : %s\n", "-verbose", "Outputs detailed compilation progress information.");
 	printf("    %-20s : %s\n", "-full", "Performs full visibility calculations. Use it only in final compiles.");
 	printf("    %-20s : %s\n", "-sortportals", "Sort the portals with MightSee.");
+	printf("    %-20s : %s\n", "-native", "Computes visibility with the native multithreaded engine instead of GBSPLib.");
+	printf("    %-20s : %s\n", "-incremental", "With -native -full, reuses the portals an edit didn't affect from the last run.");
 	printf("\n");
 
 	printf("\n--- glight Options ---\n");
@@ -336,10 +1583,37 @@ void ShowUsage(void) {
 	printf("    %-20s : %s\n", "-lightscale #", "Light intensity multiplier for the entire level (higher = brighter, lower = darker).");
 	printf("    %-20s : %s\n", "-reflectscale #", "Face reflectivity multiplier. Higher numbers make the level brighter and more colorful.");
 	printf("    %-20s : %s\n", "-extra", "Uses more samples to give finer lighting effects.");
+	printf("    %-20s : %s\n", "-adaptive", "With -native, uses more samples only where the light changes between luxels (shadow edges), instead of -extra.");
+	printf("    %-20s : %s\n", "-samplecontrast #", "Luxels whose light differs from a neighbour by more than this get more samples with -adaptive (default: 0.05).");
+	printf("    %-20s : %s\n", "-maxsamples #", "Samples a luxel may take with -adaptive, 5 matches -extra (default: 5, at most 65).");
 	printf("    %-20s : %s\n", "-radiosity", "Performs radiosity lighting of the level.");
 	printf("    %-20s : %s\n", "-bounce #", "Set number of radiosity bounces.");
+	printf("    %-20s : %s\n", "-radiositythreshold #", "Native radiosity stops when less than this fraction of the bounced light is left (default: 0.01).");
 	printf("    %-20s : %s\n", "-patchsize #", "Set radiosity patch size grid (larger = lower quality, smaller = higher quality).");
+	printf("    %-20s : %s\n", "-minpatchsize #", "Native radiosity splits patches down to this size where the light changes (default: 32).");
+	printf("    %-20s : %s\n", "-patchmemory #", "Megabytes the native radiosity patches may take, 0 for no limit (default: 256).");
 	printf("    %-20s : %s\n", "-fastpatch", "Set fast patching for fast compiles.");
+	printf("    %-20s : %s\n", "-native", "Computes lighting and radiosity with the native multithreaded engine instead of GBSPLib.");
+	printf("    %-20s : %s\n", "-incremental", "With -native and no -radiosity, relights only the faces the lights changed since the last run reach.");
+	printf("\n");
+
+	printf("\n--- Common Options ---\n");
+	printf("    %-20s : %s\n", "-bspinfo", "Print the chunks of the resulting .bsp.");
+	printf("    %-20s : %s\n", "-cache dir", "Reuses the output of the stages whose inputs didn't change from this directory.");
+	printf("    %-20s : %s\n", "-threads #", "Number of threads used by the native stages (default: one per core).");
+	printf("    %-20s : %s\n", "-lib path", "Compiler library or directory containing it (default: search GBSPLIB_PATH, then the system).");
+	printf("    %-20s : %s\n", "-batch listfile", "Compiles every map of the list (one \"mapname [destname]\" per line) instead of a single one.");
+	printf("    %-20s : %s\n", "-jobs #", "Maps a batch compiles at once, as worker processes when more than 1 (default: one per core).");
+	printf("    %-20s : %s\n", "-jobmemory #", "Megabytes each batch job may use, fewer jobs run if they don't fit in memory (default: 0, no limit).");
+	printf("    %-20s : %s\n", "-report file", "Writes how long each stage took to this file.");
+	printf("    %-20s : %s\n", "-logbuffer #", "Kilobytes of library output written to the console in the background, 0 to write it right away (default: 1024).");
+	printf("    %-20s : %s\n", "-progress target", "Sends progress events to console, tcp:[host:]port or appends them to a JSON lines file.");
+	printf("    %-20s : %s\n", "-checkpoint #", "Seconds between the checkpoints of native full vis and radiosity, 0 for none (default: 300).");
+	printf("    %-20s : %s\n", "-resume", "Native full vis and radiosity go on from the checkpoint a crashed or canceled run of the same .bsp saved.");
+	printf("    %-20s : %s\n", "-timeout-bsp #", "Seconds gbsp may take before it's stopped, 0 for no limit (default: 0). Ctrl+C stops the running stage too.");
+	printf("    %-20s : %s\n", "-timeout-vis #", "Seconds gvis may take before it's stopped, 0 for no limit (default: 0).");
+	printf("    %-20s : %s\n", "-timeout-light #", "Seconds glight may take before it's stopped, 0 for no limit (default: 0).");
+	printf("    %-20s : %s\n", "-trace file", "Writes the times, CPU time and peak memory of the compile as a Chrome trace (.json).");
 	printf("\n");
 
 	exit(0);
@@ -359,6 +1633,8 @@ void ShowSettingsBsp(CompilerParms parms) {
 	printf("%-20s|%12s |%12s \n", "verbose", parms.bsp.Verbose ? "on" : "off", defaultParms.bsp.Verbose ? "on" : "off");
 	printf("%-20s|%12s |%12s \n", "entverbose", parms.bsp.EntityVerbose ? "on" : "off", defaultParms.bsp.EntityVerbose ? "on" : "off");
 	printf("%-20s|%12s |%12s \n", "onlyents", parms.updateEnts ? "on" : "off", defaultParms.updateEnts ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "mapinfo", parms.showMapInfo ? "on" : "off", defaultParms.showMapInfo ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "native", parms.nativeBsp ? "on" : "off", defaultParms.nativeBsp ? "on" : "off");
 	printf("\n");
 };
 
@@ -375,6 +1651,8 @@ void ShowSettingsVis(CompilerParms parms) {
 	printf("%-20s|%12s |%12s \n", "verbose", parms.vis.Verbose ? "on" : "off", defaultParms.vis.Verbose ? "on" : "off");
 	printf("%-20s|%12s |%12s \n", "full", parms.vis.FullVis ? "on" : "off", defaultParms.vis.FullVis ? "on" : "off");
 	printf("%-20s|%12s |%12s \n", "sortportals", parms.vis.SortPortals ? "on" : "off", defaultParms.vis.SortPortals ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "native", parms.nativeVis ? "on" : "off", defaultParms.nativeVis ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "incremental", parms.incrementalVis ? "on" : "off", defaultParms.incrementalVis ? "on" : "off");
 	printf("\n");
 };
 
@@ -399,10 +1677,18 @@ void ShowSettingsLight(CompilerParms parms) {
 	printf("%-20s|%12s |%12s \n", "lightscale", std::to_string(parms.light.LightScale).c_str(), std::to_string(defaultParms.light.LightScale).c_str());
 	printf("%-20s|%12s |%12s \n", "reflectscale", std::to_string(parms.light.ReflectiveScale).c_str(), std::to_string(defaultParms.light.ReflectiveScale).c_str());
 	printf("%-20s|%12s |%12s \n", "extra", parms.light.ExtraSamples ? "on" : "off", defaultParms.light.ExtraSamples ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "adaptive", parms.sampling.Adaptive ? "on" : "off", defaultParms.sampling.Adaptive ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "samplecontrast", std::to_string(parms.sampling.Contrast).c_str(), std::to_string(defaultParms.sampling.Contrast).c_str());
+	printf("%-20s|%12s |%12s \n", "maxsamples", std::to_string(parms.sampling.MaxSamples).c_str(), std::to_string(defaultParms.sampling.MaxSamples).c_str());
 	printf("%-20s|%12s |%12s \n", "radiosity", parms.light.Radiosity ? "on" : "off", defaultParms.light.Radiosity ? "on" : "off");
 	printf("%-20s|%12s |%12s \n", "bounce", std::to_string(parms.light.NumBounce).c_str(), std::to_string(defaultParms.light.NumBounce).c_str());
+	printf("%-20s|%12s |%12s \n", "radiositythreshold", std::to_string(parms.radiosity.Threshold).c_str(), std::to_string(defaultParms.radiosity.Threshold).c_str());
 	printf("%-20s|%12s |%12s \n", "patchsize", std::to_string(parms.light.PatchSize).c_str(), std::to_string(defaultParms.light.PatchSize).c_str());
+	printf("%-20s|%12s |%12s \n", "minpatchsize", std::to_string(parms.radiosity.MinPatchSize).c_str(), std::to_string(defaultParms.radiosity.MinPatchSize).c_str());
+	printf("%-20s|%12s |%12s \n", "patchmemory", std::to_string(parms.radiosity.MaxMemory).c_str(), std::to_string(defaultParms.radiosity.MaxMemory).c_str());
 	printf("%-20s|%12s |%12s \n", "fastpatch", parms.light.FastPatch ? "on" : "off", defaultParms.light.FastPatch ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "native", parms.nativeLight ? "on" : "off", defaultParms.nativeLight ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "incremental", parms.incrementalLight ? "on" : "off", defaultParms.incrementalLight ? "on" : "off");
 
 	printf("\n");
 };
\ No newline at end of file
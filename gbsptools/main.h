@@ -3,11 +3,23 @@
 #ifndef GBSP_H
 #define GBSP_H
 
-#include <windows.h>
+#include "platform.h"
+#include <string>
+#include <vector>
+#include "cancel.h"
+#include "checkpoint.h"
 #include "gbsplib.h"
+#include "gbsptools.h"
+#include "nativelight.h"
+#include "radiosity.h"
+#include "stagecache.h"
+#include "trace.h"
+
+enum { STAGE_BSP, STAGE_VIS, STAGE_LIGHT, NUM_STAGES };
 
 typedef struct {
 	char mapName[MAX_PATH];
+	char libPath[MAX_PATH];
 	char bspName[MAX_PATH];
 	bool isBspEnabled;
 	bool isVisEnabled;
@@ -15,10 +27,55 @@ typedef struct {
 	BspParms bsp;
 	VisParms vis;
 	LightParms light;
+	GBSPTools::RadiosityParms radiosity;
+	GBSPTools::SampleParms sampling;
 	geBoolean updateEnts;
+	bool showMapInfo;
+	bool showBspInfo;
+	int numThreads;		// 0 means one per core
+	bool nativeBsp;
+	bool nativeVis;
+	bool incrementalVis;
+	bool nativeLight;
+	bool incrementalLight;
+	char cacheDir[MAX_PATH];	// stage cache, empty when off
+	char batchName[MAX_PATH];	// list of maps to compile, empty when off
+	int numJobs;		// 0 means as many as the cores and memory allow
+	int jobMemory;		// megabytes per batch job, 0 means no limit
+	char reportName[MAX_PATH];	// where to write the stage times, empty when off
+	char traceName[MAX_PATH];	// Chrome trace of the compile, empty when off
+	char progressTarget[MAX_PATH];	// progress events sink, empty when off
+	int logBuffer;		// kilobytes of library output buffered, 0 writes it right away
+	double timeout[NUM_STAGES];	// seconds every stage may take, 0 means no limit
+	double checkpointInterval;	// seconds between checkpoints of the native stages, 0 means none
+	bool resume;		// native stages go on from their checkpoint
 } CompilerParms;
 
+typedef struct {
+	double seconds[NUM_STAGES];		// negative when the stage didn't run
+	bool cached[NUM_STAGES];		// taken from the stage cache instead
+} StageTimes;
+
+// The BSP the stages hand to each other. The native stages work on bsp in memory; the
+// GBSPLib ones only take files, so around them it goes through the work file.
+typedef struct {
+	GBSPTools::BspFile bsp;
+	std::string path;		// work file
+	std::string backup;		// the old destination while GBSPLib writes over it, empty if none
+	bool ownsFile;		// the work file is written from scratch, removed when the pipeline fails
+	bool inMemory;		// bsp is newer than the work file
+} WorkBsp;
+
+typedef struct {
+	std::string mapName;
+	std::string bspName;
+	StageTimes times;
+	double seconds;
+	int result;				// exit code, -1 when it didn't run to the end
+} BatchJob;
+
 void InitCompilerParms(CompilerParms* parms) {
+	parms->libPath[0] = '\0';
 	parms->isBspEnabled = false;
 	parms->isVisEnabled = false;
 	parms->isLightEnabled = false;
@@ -36,10 +93,61 @@ void InitCompilerParms(CompilerParms* parms) {
 	parms->light.NumBounce = 10;
 	parms->light.PatchSize = 128.0;
 	parms->light.FastPatch = GE_FALSE;
+	parms->radiosity.Threshold = RADIOSITY_DEFAULT_THRESHOLD;
+	parms->radiosity.MinPatchSize = RADIOSITY_DEFAULT_MIN_PATCH;
+	parms->radiosity.MaxMemory = RADIOSITY_DEFAULT_MAX_MEMORY;
+	parms->sampling.Adaptive = GE_FALSE;
+	parms->sampling.Contrast = LIGHT_DEFAULT_CONTRAST;
+	parms->sampling.MaxSamples = LIGHT_DEFAULT_MAX_SAMPLES;
 	parms->updateEnts = GE_FALSE;
+	parms->showMapInfo = false;
+	parms->showBspInfo = false;
+	parms->numThreads = 0;
+	parms->nativeBsp = false;
+	parms->nativeVis = false;
+	parms->incrementalVis = false;
+	parms->nativeLight = false;
+	parms->incrementalLight = false;
+	parms->cacheDir[0] = '\0';
+	parms->batchName[0] = '\0';
+	parms->numJobs = 0;
+	parms->jobMemory = 0;
+	parms->reportName[0] = '\0';
+	parms->traceName[0] = '\0';
+	parms->progressTarget[0] = '\0';
+	parms->logBuffer = ASYNCLOG_DEFAULT_SIZE;
+	for (int stage = STAGE_BSP; stage < NUM_STAGES; stage++) {
+		parms->timeout[stage] = 0.0;
+	}
+	parms->checkpointInterval = CHECKPOINT_DEFAULT_INTERVAL;
+	parms->resume = false;
 	parms->bspName[0] = '\0';
 }
 
+CompilerErrorEnum CompileMap(GBSP_FuncHook* compFHook, CompilerParms* parms, const std::string& mapName, const std::string& bspName, StageTimes& times, GBSPTools::Trace& trace, GBSPTools::CancelWatchdog& watchdog);
+void MakeCompilePaths(const std::string& mapName, const std::string& bspName, std::string& mapPath, std::string& bspPath);
+int RunBatch(int argc, char* argv[], CompilerParms* parms, GBSPTools::CancelWatchdog& watchdog);
+bool LoadBatchList(const std::string& listPath, std::vector<BatchJob>& jobs);
+bool WriteStageTimes(const std::string& path, const StageTimes& times);
+bool ReadStageTimes(const std::string& path, StageTimes& times);
+void ShowBatchSummary(const std::vector<BatchJob>& jobs, double seconds);
+void WriteTrace(GBSPTools::Trace& trace, const char* traceName);
+void ShowMapInfo(const std::string& mapPath, int numThreads);
+void ShowBspInfo(const std::string& bspPath);
+bool LoadWorkBsp(WorkBsp& work);
+bool SaveWorkBsp(WorkBsp& work);
+bool CommitWorkBsp(WorkBsp& work, const std::string& bspPath);
+void DiscardWorkFile(WorkBsp& work, const std::string& bspPath);
+void MakeStageKeys(GBSP_FuncHook* compFHook, CompilerParms* parms, const std::string& mapPath, const std::string& bspPath, std::string keys[NUM_STAGES]);
+void StoreStage(GBSPTools::StageCache& cache, const std::string& key, WorkBsp& work);
+void ShowStageCacheStats(const GBSPTools::StageCache& cache);
+bool ArmStage(GBSP_FuncHook* compFHook, CompilerParms* parms, int stage, GBSPTools::CancelWatchdog& watchdog);
+CompilerErrorEnum DisarmStage(CompilerParms* parms, int stage, CompilerErrorEnum result, double seconds, GBSPTools::CancelWatchdog& watchdog);
+CompilerErrorEnum RunBspStage(GBSP_FuncHook* compFHook, CompilerParms* parms, const std::string& mapPath, WorkBsp& work, GBSPTools::Trace& trace);
+GBSPTools::CheckpointParms MakeCheckpointParms(CompilerParms* parms, const std::string& bspPath, const char* extension);
+CompilerErrorEnum RunVisStage(GBSP_FuncHook* compFHook, CompilerParms* parms, WorkBsp& work, const std::string& cachePath, const GBSPTools::CheckpointParms& checkpoint, GBSPTools::Trace& trace);
+CompilerErrorEnum RunLightStage(GBSP_FuncHook* compFHook, CompilerParms* parms, WorkBsp& work, const std::string& cachePath, const GBSPTools::CheckpointParms& checkpoint, GBSPTools::Trace& trace);
+
 void ParseCmdArgs(int, char* [], CompilerParms*);
 void ShowUsage(void);
 void ShowSettingsBsp(CompilerParms parms);
@@ -11,10 +11,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <windows.h> // needed for "LoadLibrary" declarations, get current directory, etc.
+#include <chrono>
 #include "glight.h"
 #include "gbsplib.h"
 #include "gbsptools.h"
+#include "bsptree.h"
+#include "nativelight.h"
 #include "utils.h"
 
 int main(int argc, char *argv[]) {
@@ -23,22 +25,31 @@ int main(int argc, char *argv[]) {
 	printf("Check readme.md for more info abouts these tools.\n");
 	printf("Submit detailed bug reports to %s\n", GBSPTOOLS_CONTACT);
 
-	char path[MAX_PATH];
-	GetCurrentDirectory(MAX_PATH, path);
-	printf("Command line: \"%s\"\n", path);
+	printf("Command line: \"%s\"\n", GBSPTools::GetWorkingDirectory().c_str());
 
 	CompilerParms compParms;
 	InitCompilerParms(&compParms);
 	ParseCmdArgs(argc, argv, &compParms);
 
-	// load gbsplib.dll to access the map compiler functions
-	HINSTANCE compHandle;
-	GBSP_FuncHook* compFHook;
+	// the benchmark only reads the .bsp
+	if (compParms.bvhBench) {
+		std::string benchPath(compParms.mapName);
+		GBSPTools::PathToUnix(benchPath);
+		GBSPTools::DefaultExtension(benchPath, ".bsp");
+		RunBvhBenchmark(benchPath);
+		return COMPILER_ERROR_NONE;
+	}
+
+	// load the compiler library (gbsplib) to access the map compiler functions
+	CompilerLibHandle compHandle = nullptr;
+	GBSP_FuncHook* compFHook = nullptr;
 
-	CompilerErrorEnum result = Compiler_LoadCompilerDLL(compFHook, compHandle, Compiler_ErrorfCallback, Compiler_PrintfCallback);
+	if (!compParms.native) {
+		CompilerErrorEnum result = Compiler_LoadCompilerLib(compFHook, compHandle, Compiler_ErrorfCallback, Compiler_PrintfCallback, compParms.libPath);
 
-	if (result != CompilerErrorEnum::COMPILER_ERROR_NONE) {
-		return result;
+		if (result != CompilerErrorEnum::COMPILER_ERROR_NONE) {
+			return result;
+		}
 	}
 
 	ShowSettings(compParms);
@@ -49,18 +60,197 @@ int main(int argc, char *argv[]) {
 	GBSPTools::PathToUnix(bspPath);
 	GBSPTools::DefaultExtension(bspPath, ".bsp");
 
-	if (compFHook->GBSP_LightGBSPFile(bspPath.c_str(), &compParms.light) == GBSP_ERROR) {
+	// the radiosity checkpoint sits next to the .bsp, named after it
+	GBSPTools::CheckpointParms checkpoint;
+	checkpoint.Interval = compParms.checkpointInterval;
+	checkpoint.Resume = compParms.resume;
+	if (compParms.checkpointInterval > 0.0 || compParms.resume) {
+		checkpoint.Path = bspPath;
+		GBSPTools::StripExtension(checkpoint.Path);
+		checkpoint.Path.append(LIGHT_CHECKPOINT_EXTENSION);
+	}
+
+	// so is the light cache
+	std::string cachePath;
+	if (compParms.incremental) {
+		cachePath = bspPath;
+		GBSPTools::StripExtension(cachePath);
+		cachePath.append(LIGHTCACHE_EXTENSION);
+	}
+
+	if (compParms.native) {
+		if (!GBSPTools::LightBspFile(bspPath, compParms.light, compParms.radiosity, compParms.sampling, compParms.numThreads, cachePath, checkpoint)) {
+			return COMPILER_ERROR_BSPFAIL;
+		}
+	}
+	else if (compFHook->GBSP_LightGBSPFile(bspPath.c_str(), &compParms.light) == GBSP_ERROR) {
 		fprintf(stdout, "Warning: GBSP_LightGBSPFile failed for file: %s, GBSPLib.Dll.\n", bspPath.c_str());
 		return COMPILER_ERROR_BSPFAIL;
 	}
 
 	printf("\n");
 
-	FreeLibrary(compHandle);
+	if (compParms.compareName[0]) {
+		CompareLightmaps(bspPath, compParms.compareName);
+	}
+
+	Compiler_FreeCompilerLib(compHandle);
 
 	return COMPILER_ERROR_NONE;
 }
 
+//========================================================================================
+//	CompareLightmaps()
+//	Reports how far the lightmaps of bspPath are from the ones of a reference lighting
+//========================================================================================
+void CompareLightmaps(const std::string& bspPath, const std::string& refPath) {
+	GBSPTools::BspFile bsp, ref;
+	if (!bsp.Open(bspPath) || !ref.Open(refPath)) {
+		fprintf(stdout, "Warning: Unable to compare lightmaps: %s\n\n", (bsp.GetError() + ref.GetError()).c_str());
+		return;
+	}
+
+	GBSPTools::LightCompareStats stats;
+	std::string error;
+	if (!GBSPTools::CompareLightmaps(bsp, ref, stats, error)) {
+		fprintf(stdout, "Warning: Unable to compare lightmaps: %s\n\n", error.c_str());
+		return;
+	}
+
+	printf("LIGHTMAP COMPARISON: %s\n", refPath.c_str());
+	printf("%-20s|%12s \n", "Name", "Value");
+	printf("%-20s|%13s\n", "--------------------", "-------------");
+	printf("%-20s|%12d \n", "compared faces", stats.ComparedFaces);
+	printf("%-20s|%12d \n", "mismatched faces", stats.MismatchedFaces);
+	printf("%-20s|%12.0f \n", "max difference", stats.MaxDiff);
+	printf("%-20s|%12.3f \n", "mean difference", stats.MeanDiff);
+	printf("\n");
+}
+
+//========================================================================================
+//	RunBvhBenchmark()
+//	Times shadow ray queries on a .bsp: the BSP tree walk, then the BVH one ray at a
+//	time and in packets. Rays go between random points on the faces of the world,
+//	eight from each start like the rays of one lightmap sample.
+//========================================================================================
+void RunBvhBenchmark(const std::string& bspPath) {
+	const int numStarts = 1 << 17;
+	const int raysPerStart = 8;
+	const int numRays = numStarts * raysPerStart;
+
+	GBSPTools::BspFile bsp;
+	if (!bsp.Open(bspPath)) {
+		fprintf(stdout, "Warning: Unable to run the benchmark: %s\n\n", bsp.GetError().c_str());
+		return;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	GBSPTools::Bvh bvh;
+	GBSPTools::BspTree tree;
+	if (!bvh.Build(bsp) || !tree.Init(bsp)) {
+		fprintf(stdout, "Warning: Unable to run the benchmark: %s\n\n", bvh.GetError().empty() ? "bad bsp tree" : bvh.GetError().c_str());
+		return;
+	}
+	double buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	// random points on the faces, lifted off them like lightmap samples
+	GBSPTools::Span<const GFX_Face> faces = bsp.GetChunkData<GFX_Face>(GBSP_CHUNK_FACES);
+	GBSPTools::Span<const GFX_Plane> planes = bsp.GetChunkData<GFX_Plane>(GBSP_CHUNK_PLANES);
+	GBSPTools::Span<const int32> vertIndex = bsp.GetChunkData<int32>(GBSP_CHUNK_VERT_INDEX);
+	GBSPTools::Span<const geVec3d> verts = bsp.GetChunkData<geVec3d>(GBSP_CHUNK_VERTS);
+	const GFX_Model& world = bsp.GetChunkData<GFX_Model>(GBSP_CHUNK_MODELS)[0];
+	std::vector<geVec3d> points;
+	uint32 seed = 12345;
+	auto random = [&]() {
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) * (1.0f / 16777216.0f);
+	};
+	while (world.NumFaces > 0 && (int)points.size() < numStarts + numRays) {
+		const GFX_Face& face = faces[world.FirstFace + (int)(random() * world.NumFaces) % world.NumFaces];
+		if (face.NumVerts < 3 || face.PlaneNum < 0 || face.PlaneNum >= planes.size()) {
+			continue;
+		}
+		int v = 2 + (int)(random() * (face.NumVerts - 2)) % (face.NumVerts - 2);
+		geVec3d a = verts[vertIndex[face.FirstVert]], b = verts[vertIndex[face.FirstVert + v - 1]], c = verts[vertIndex[face.FirstVert + v]];
+		geFloat u = random(), w = random();
+		if (u + w > 1.0f) {
+			u = 1.0f - u;
+			w = 1.0f - w;
+		}
+		geVec3d normal = planes[face.PlaneNum].Normal;
+		if (face.PlaneSide) {
+			geVec3d_Inverse(&normal);
+		}
+		geVec3d ab, ac, p;
+		geVec3d_Subtract(&b, &a, &ab);
+		geVec3d_Subtract(&c, &a, &ac);
+		geVec3d_Scale(&ab, u, &p);
+		geVec3d_AddScaled(&p, &ac, w, &p);
+		geVec3d_Add(&a, &p, &p);
+		geVec3d_AddScaled(&p, &normal, LIGHT_SAMPLE_EPSILON, &p);
+		points.push_back(p);
+	}
+	if (points.empty()) {
+		fprintf(stdout, "Warning: Unable to run the benchmark: the world has no faces\n\n");
+		return;
+	}
+
+	std::vector<geVec3d> starts(numRays), ends(numRays);
+	for (int i = 0; i < numRays; i++) {
+		starts[i] = points[i / raysPerStart];
+		ends[i] = points[numStarts + i];
+	}
+
+	// packet 0 is the bsp tree, the first run is what the others are checked against
+	std::vector<uint8> reference;
+	auto run = [&](const char* name, int packet) {
+		std::vector<uint8> blocked(numRays);
+		int step = packet ? packet : 1;
+		auto runStart = std::chrono::steady_clock::now();
+		for (int i = 0; i < numRays; i += step) {
+			uint32 mask;
+			if (packet == 8) {
+				mask = bvh.Occluded8(&starts[i], &ends[i], 8);
+			}
+			else if (packet == 4) {
+				mask = bvh.Occluded4(&starts[i], &ends[i], 4);
+			}
+			else if (packet == 1) {
+				mask = bvh.Occluded(starts[i], ends[i]) ? 1 : 0;
+			}
+			else {
+				mask = tree.IsLineBlocked(starts[i], ends[i]) ? 1 : 0;
+			}
+			for (int j = 0; j < step; j++) {
+				blocked[i + j] = (mask >> j) & 1;
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - runStart).count();
+		if (reference.empty()) {
+			reference = blocked;
+		}
+		int differ = 0;
+		for (int i = 0; i < numRays; i++) {
+			differ += blocked[i] != reference[i];
+		}
+		printf("%-20s|%12.2f |%12.2f |%12d \n", name, seconds * 1000.0, numRays / seconds / 1e6, differ);
+	};
+
+	printf("BVH BENCHMARK: %s\n", bspPath.c_str());
+	printf("%-20s|%12d \n", "triangles", bvh.GetNumTriangles());
+	printf("%-20s|%12d \n", "nodes", bvh.GetNumNodes());
+	printf("%-20s|%10.1fms \n", "build time", buildTime);
+	printf("%-20s|%12s \n", "packets", GBSPTools::Bvh::GetPacketName());
+	printf("\n");
+	printf("%-20s|%12s |%12s |%12s \n", "Query", "Time (ms)", "Mrays/s", "Differ");
+	printf("%-20s|%13s|%13s|%13s\n", "--------------------", "-------------", "-------------", "-------------");
+	run("bvh single", 1);
+	run("bvh packet 4", 4);
+	run("bvh packet 8", 8);
+	run("bsp tree", 0);
+	printf("\n");
+}
+
 //========================================================================================
 //	ParseCmdArgs()
 //	This parse command line arguments to load them into the compiler parameters
@@ -73,12 +263,60 @@ void ParseCmdArgs(int argc, char *argv[], CompilerParms *parms) {
 
 	printf("Arguments:");
 	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-lib")) {
+			printf(" -lib");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				strcpy_s(parms->libPath, argv[++i]);
+			} else {
+				fprintf(stdout, "\nError: Missing argument for -lib\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+
+		if (!strcmp(argv[i], "-threads")) {
+			printf(" -threads");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->numThreads = strtol(argv[++i], NULL, 10);
+				if (errno == ERANGE || parms->numThreads < 0) {
+					fprintf(stdout, "\nError: Bad argument for -threads\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			} else {
+				fprintf(stdout, "\nError: Missing argument for -threads\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+
+		if (!strcmp(argv[i], "-checkpoint")) {
+			printf(" -checkpoint");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->checkpointInterval = strtod(argv[++i], NULL);
+				if (errno == ERANGE || parms->checkpointInterval < 0.0) {
+					fprintf(stdout, "\nError: Bad argument for -checkpoint\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -checkpoint\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+
 		if (!strcmp(argv[i], "-verbose")) {
 			parms->light.Verbose = GE_TRUE;
 			printf(" -verbose");
 		} else if (!strcmp(argv[i], "-extra")) {
 			parms->light.ExtraSamples = GE_TRUE;
 			printf(" -extra");
+		} else if (!strcmp(argv[i], "-adaptive")) {
+			parms->sampling.Adaptive = GE_TRUE;
+			printf(" -adaptive");
 		} else if (!strcmp(argv[i], "-radiosity")) {
 			parms->light.Radiosity = GE_TRUE;
 			printf(" -radiosity");
@@ -142,6 +380,27 @@ void ParseCmdArgs(int argc, char *argv[], CompilerParms *parms) {
 				fprintf(stdout, "\nError: Missing argument for -patchsize\n\n\n\n");
 				exit(COMPILER_ERROR_BADARG);
 			}
+		} else if (!strcmp(argv[i], "-native")) {
+			parms->native = true;
+			printf(" -native");
+		} else if (!strcmp(argv[i], "-resume")) {
+			parms->resume = true;
+			printf(" -resume");
+		} else if (!strcmp(argv[i], "-incremental")) {
+			parms->incremental = true;
+			printf(" -incremental");
+		} else if (!strcmp(argv[i], "-bvhbench")) {
+			parms->bvhBench = true;
+			printf(" -bvhbench");
+		} else if (!strcmp(argv[i], "-compare")) {
+			printf(" -compare");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				strcpy_s(parms->compareName, argv[++i]);
+			} else {
+				fprintf(stdout, "\nError: Missing argument for -compare\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
 		} else if (!strcmp(argv[i], "-bounce")) {
 			printf(" -bounce");
 			if (i + 1 < argc) {
@@ -155,6 +414,71 @@ void ParseCmdArgs(int argc, char *argv[], CompilerParms *parms) {
 				fprintf(stdout, "\nError: Missing argument for -bounce\n\n\n\n");
 				exit(COMPILER_ERROR_BADARG);
 			}
+		} else if (!strcmp(argv[i], "-radiositythreshold")) {
+			printf(" -radiositythreshold");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->radiosity.Threshold = strtof(argv[++i], NULL);
+				if (errno == ERANGE || parms->radiosity.Threshold < 0.0f) {
+					fprintf(stdout, "\nError: Bad argument for -radiositythreshold\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			} else {
+				fprintf(stdout, "\nError: Missing argument for -radiositythreshold\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+		} else if (!strcmp(argv[i], "-minpatchsize")) {
+			printf(" -minpatchsize");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->radiosity.MinPatchSize = strtof(argv[++i], NULL);
+				if (errno == ERANGE || parms->radiosity.MinPatchSize < 1.0f) {
+					fprintf(stdout, "\nError: Bad argument for -minpatchsize\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			} else {
+				fprintf(stdout, "\nError: Missing argument for -minpatchsize\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+		} else if (!strcmp(argv[i], "-patchmemory")) {
+			printf(" -patchmemory");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->radiosity.MaxMemory = strtol(argv[++i], NULL, 10);
+				if (errno == ERANGE || parms->radiosity.MaxMemory < 0) {
+					fprintf(stdout, "\nError: Bad argument for -patchmemory\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			} else {
+				fprintf(stdout, "\nError: Missing argument for -patchmemory\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+		} else if (!strcmp(argv[i], "-samplecontrast")) {
+			printf(" -samplecontrast");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->sampling.Contrast = strtof(argv[++i], NULL);
+				if (errno == ERANGE || parms->sampling.Contrast < 0.0f) {
+					fprintf(stdout, "\nError: Bad argument for -samplecontrast\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			} else {
+				fprintf(stdout, "\nError: Missing argument for -samplecontrast\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+		} else if (!strcmp(argv[i], "-maxsamples")) {
+			printf(" -maxsamples");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->sampling.MaxSamples = strtol(argv[++i], NULL, 10);
+				if (errno == ERANGE || parms->sampling.MaxSamples < 1) {
+					fprintf(stdout, "\nError: Bad argument for -maxsamples\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			} else {
+				fprintf(stdout, "\nError: Missing argument for -maxsamples\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
 		} else {
 			if (!hasLoadMap) {
 				strcpy_s(parms->mapName, argv[i]);
@@ -182,10 +506,26 @@ void ShowUsage(void) {
 	printf("    %-20s : %s\n", "-lightscale #",		"Light intensity multiplier for the entire level (higher = brighter, lower = darker).");
 	printf("    %-20s : %s\n", "-reflectscale #",	"Face reflectivity multiplier. Higher numbers make the level brighter and more colorful.");
 	printf("    %-20s : %s\n", "-extra",			"Uses more samples to give finer lighting effects.");
+	printf("    %-20s : %s\n", "-adaptive",			"With -native, uses more samples only where the light changes between luxels (shadow edges), instead of -extra.");
+	printf("    %-20s : %s\n", "-samplecontrast #",	"Luxels whose light differs from a neighbour by more than this get more samples with -adaptive (default: 0.05).");
+	printf("    %-20s : %s\n", "-maxsamples #",		"Samples a luxel may take with -adaptive, 5 matches -extra (default: 5, at most 65).");
 	printf("    %-20s : %s\n", "-radiosity",		"Performs radiosity lighting of the level.");
 	printf("    %-20s : %s\n", "-bounce #",			"Set number of radiosity bounces.");
+	printf("    %-20s : %s\n", "-radiositythreshold #", "Native radiosity stops when less than this fraction of the bounced light is left (default: 0.01).");
 	printf("    %-20s : %s\n", "-patchsize #",		"Set radiosity patch size grid (larger = lower quality, smaller = higher quality).");
+	printf("    %-20s : %s\n", "-minpatchsize #",	"Native radiosity splits patches down to this size where the light changes (default: 32).");
+	printf("    %-20s : %s\n", "-patchmemory #",	"Megabytes the native radiosity patches may take, 0 for no limit (default: 256).");
 	printf("    %-20s : %s\n", "-fastpatch",		"Set fast patching for fast compiles.");
+	printf("    %-20s : %s\n", "-native",			"Computes lighting and radiosity with the native multithreaded engine instead of GBSPLib.");
+	printf("    %-20s : %s\n", "-checkpoint #",		"With -native -radiosity, saves the bounced light every # seconds, 0 to never (default: 300).");
+	printf("    %-20s : %s\n", "-resume",			"With -native -radiosity, goes on from the checkpoint a crashed or canceled run of the same .bsp saved.");
+	printf("    %-20s : %s\n", "-incremental",		"With -native and no -radiosity, relights only the faces the lights changed since the last run reach.");
+	printf("    %-20s : %s\n", "-compare file",		"Prints how far the resulting lightmaps are from the ones of another lighting.");
+	printf("    %-20s : %s\n", "-bvhbench",			"Measures shadow rays per second on the .bsp instead of lighting it.");
+	printf("\n");
+	printf("\n--- Common Options ---\n");
+	printf("    %-20s : %s\n", "-threads #", "Number of threads used by the native stages (default: one per core).");
+	printf("    %-20s : %s\n", "-lib path", "Compiler library or directory containing it (default: search GBSPLIB_PATH, then the system).");
 	printf("\n");
 	exit(0);
 };
@@ -211,10 +551,21 @@ void ShowSettings(CompilerParms parms) {
 	printf("%-20s|%12s |%12s \n", "lightscale", std::to_string(parms.light.LightScale).c_str(), std::to_string(defaultParms.light.LightScale).c_str());
 	printf("%-20s|%12s |%12s \n", "reflectscale", std::to_string(parms.light.ReflectiveScale).c_str(), std::to_string(defaultParms.light.ReflectiveScale).c_str());
 	printf("%-20s|%12s |%12s \n", "extra", parms.light.ExtraSamples ? "on" : "off", defaultParms.light.ExtraSamples ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "adaptive", parms.sampling.Adaptive ? "on" : "off", defaultParms.sampling.Adaptive ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "samplecontrast", std::to_string(parms.sampling.Contrast).c_str(), std::to_string(defaultParms.sampling.Contrast).c_str());
+	printf("%-20s|%12s |%12s \n", "maxsamples", std::to_string(parms.sampling.MaxSamples).c_str(), std::to_string(defaultParms.sampling.MaxSamples).c_str());
 	printf("%-20s|%12s |%12s \n", "radiosity", parms.light.Radiosity ? "on" : "off", defaultParms.light.Radiosity ? "on" : "off");
 	printf("%-20s|%12s |%12s \n", "bounce", std::to_string(parms.light.NumBounce).c_str(), std::to_string(defaultParms.light.NumBounce).c_str());
+	printf("%-20s|%12s |%12s \n", "radiositythreshold", std::to_string(parms.radiosity.Threshold).c_str(), std::to_string(defaultParms.radiosity.Threshold).c_str());
 	printf("%-20s|%12s |%12s \n", "patchsize", std::to_string(parms.light.PatchSize).c_str(), std::to_string(defaultParms.light.PatchSize).c_str());
+	printf("%-20s|%12s |%12s \n", "minpatchsize", std::to_string(parms.radiosity.MinPatchSize).c_str(), std::to_string(defaultParms.radiosity.MinPatchSize).c_str());
+	printf("%-20s|%12s |%12s \n", "patchmemory", std::to_string(parms.radiosity.MaxMemory).c_str(), std::to_string(defaultParms.radiosity.MaxMemory).c_str());
 	printf("%-20s|%12s |%12s \n", "fastpatch", parms.light.FastPatch ? "on" : "off", defaultParms.light.FastPatch ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "native", parms.native ? "on" : "off", defaultParms.native ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "threads", parms.numThreads ? std::to_string(parms.numThreads).c_str() : "auto", "auto");
+	printf("%-20s|%12s |%12s \n", "checkpoint", parms.checkpointInterval > 0.0 ? std::to_string((int)parms.checkpointInterval).c_str() : "off", std::to_string((int)defaultParms.checkpointInterval).c_str());
+	printf("%-20s|%12s |%12s \n", "resume", parms.resume ? "on" : "off", defaultParms.resume ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "incremental", parms.incremental ? "on" : "off", defaultParms.incremental ? "on" : "off");
 
 	printf("\n");
 };
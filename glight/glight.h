@@ -1,15 +1,31 @@
 #ifndef GLIGHT_H
 #define GLIGHT_H
 
-#include <windows.h>
+#include "platform.h"
+#include <string>
 #include "gbsplib.h"
+#include "checkpoint.h"
+#include "nativelight.h"
+#include "radiosity.h"
 
 typedef struct {
 	char mapName[MAX_PATH];
+	char libPath[MAX_PATH];
+	char compareName[MAX_PATH];
 	LightParms light;
+	GBSPTools::RadiosityParms radiosity;
+	GBSPTools::SampleParms sampling;
+	bool native;
+	bool incremental;
+	bool bvhBench;
+	int numThreads;		// 0 means one per core
+	double checkpointInterval;	// seconds between checkpoints, 0 means none
+	bool resume;
 } CompilerParms;
 
 void InitCompilerParms(CompilerParms *parms) {
+	parms->libPath[0] = '\0';
+	parms->compareName[0] = '\0';
 	parms->light.Verbose = GE_FALSE;
 	parms->light.ExtraSamples = GE_FALSE;
 	parms->light.MinLight = { 0.0, 0.0, 0.0 };
@@ -19,10 +35,24 @@ void InitCompilerParms(CompilerParms *parms) {
 	parms->light.NumBounce = 10;
 	parms->light.PatchSize = 128.0;
 	parms->light.FastPatch = GE_FALSE;
+	parms->radiosity.Threshold = RADIOSITY_DEFAULT_THRESHOLD;
+	parms->radiosity.MinPatchSize = RADIOSITY_DEFAULT_MIN_PATCH;
+	parms->radiosity.MaxMemory = RADIOSITY_DEFAULT_MAX_MEMORY;
+	parms->sampling.Adaptive = GE_FALSE;
+	parms->sampling.Contrast = LIGHT_DEFAULT_CONTRAST;
+	parms->sampling.MaxSamples = LIGHT_DEFAULT_MAX_SAMPLES;
+	parms->native = false;
+	parms->incremental = false;
+	parms->bvhBench = false;
+	parms->numThreads = 0;
+	parms->checkpointInterval = CHECKPOINT_DEFAULT_INTERVAL;
+	parms->resume = false;
 }
 
 void ParseCmdArgs(int, char *[], CompilerParms *);
 void ShowUsage(void);
 void ShowSettings(CompilerParms parms);
+void CompareLightmaps(const std::string& bspPath, const std::string& refPath);
+void RunBvhBenchmark(const std::string& bspPath);
 
 #endif // GLIGHT_H
\ No newline at end of file
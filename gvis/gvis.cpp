@@ -10,10 +10,13 @@
 /****************************************************************************************/
 
 #include <stdio.h>
-#include <windows.h> // needed for "LoadLibrary" declarations, get current directory, etc.
+#include <stdlib.h>
+#include <chrono>
 #include "gvis.h"
 #include "gbsplib.h"
 #include "gbsptools.h"
+#include "bitset.h"
+#include "nativevis.h"
 #include "utils.h"
 
 int main(int argc, char *argv[]) {
@@ -22,22 +25,28 @@ int main(int argc, char *argv[]) {
 	printf("Check readme.md for more info abouts these tools.\n");
 	printf("Submit detailed bug reports to %s\n", GBSPTOOLS_CONTACT);
 
-	char path[MAX_PATH];
-	GetCurrentDirectory(MAX_PATH, path);
-	printf("Command line: \"%s\"\n", path);
+	printf("Command line: \"%s\"\n", GBSPTools::GetWorkingDirectory().c_str());
 
 	CompilerParms compParms;
 	InitCompilerParms(&compParms);
 	ParseCmdArgs(argc, argv, &compParms);
 
-	// load gbsplib.dll to access the map compiler functions
-	HINSTANCE compHandle;
-	GBSP_FuncHook* compFHook;
+	// the benchmark needs no map
+	if (compParms.bitBench) {
+		RunBitSetBenchmark();
+		return COMPILER_ERROR_NONE;
+	}
+
+	// load the compiler library (gbsplib) to access the map compiler functions
+	CompilerLibHandle compHandle = nullptr;
+	GBSP_FuncHook* compFHook = nullptr;
 
-	CompilerErrorEnum result = Compiler_LoadCompilerDLL(compFHook, compHandle, Compiler_ErrorfCallback, Compiler_PrintfCallback);
+	if (!compParms.native) {
+		CompilerErrorEnum result = Compiler_LoadCompilerLib(compFHook, compHandle, Compiler_ErrorfCallback, Compiler_PrintfCallback, compParms.libPath);
 
-	if (result != CompilerErrorEnum::COMPILER_ERROR_NONE) {
-		return result;
+		if (result != CompilerErrorEnum::COMPILER_ERROR_NONE) {
+			return result;
+		}
 	}
 
 	std::string bspPath(compParms.mapName);
@@ -48,18 +57,125 @@ int main(int argc, char *argv[]) {
 
 	ShowSettings(compParms);
 
-	if (compFHook->GBSP_VisGBSPFile(bspPath.c_str(), &compParms.vis) == GBSP_ERROR) {
+	// the cache sits next to the .bsp, named after it
+	std::string cachePath;
+	if (compParms.incremental) {
+		cachePath = bspPath;
+		GBSPTools::StripExtension(cachePath);
+		cachePath.append(VISCACHE_EXTENSION);
+	}
+
+	// so is the checkpoint of a full vis
+	GBSPTools::CheckpointParms checkpoint;
+	checkpoint.Interval = compParms.checkpointInterval;
+	checkpoint.Resume = compParms.resume;
+	if (compParms.checkpointInterval > 0.0 || compParms.resume) {
+		checkpoint.Path = bspPath;
+		GBSPTools::StripExtension(checkpoint.Path);
+		checkpoint.Path.append(VIS_CHECKPOINT_EXTENSION);
+	}
+
+	if (compParms.native) {
+		if (!GBSPTools::VisBspFile(bspPath, compParms.vis, compParms.numThreads, cachePath, checkpoint)) {
+			return COMPILER_ERROR_BSPFAIL;
+		}
+	}
+	else if (compFHook->GBSP_VisGBSPFile(bspPath.c_str(), &compParms.vis) == GBSP_ERROR) {
 		fprintf(stdout, "Warning: GBSP_VisGBSPFile failed for file : %s, GBSPLib.Dll.\n", bspPath.c_str());
 		return COMPILER_ERROR_BSPFAIL;
 	}
 
 	printf("\n");
 
-	FreeLibrary(compHandle);
+	Compiler_FreeCompilerLib(compHandle);
 
 	return COMPILER_ERROR_NONE;
 }
 
+//========================================================================================
+//	RunBitSetBenchmark()
+//	Times every bitset kernel the processor has on cluster rows of the sizes maps
+//	have, from a small level to a huge one. The sets are a quarter full like the
+//	MightSee of a portal, and the any test gets sets it has to scan to the end.
+//========================================================================================
+void RunBitSetBenchmark(void) {
+	const int32 sizes[] = { 256, 1024, 4096, 16384 };
+	const int numSets = 64;
+	const long long wordsPerRun = 1 << 26;
+
+	printf("BITSET BENCHMARK\n");
+	printf("%-20s|%12s \n", "best kernels", GBSPTools::GetBitKernels().Name);
+	printf("\n");
+	printf("%-20s|%12s |%12s |%12s |%12s |%12s |%12s \n", "Clusters", "and (ns)", "andnot (ns)", "or (ns)", "any (ns)", "count (ns)", "Differ");
+	printf("%-20s|%13s|%13s|%13s|%13s|%13s|%13s\n", "--------------------", "-------------", "-------------", "-------------", "-------------", "-------------", "-------------");
+
+	uint32 seed = 12345;
+	auto random = [&]() {
+		seed = seed * 1664525u + 1013904223u;
+		return seed >> 8;
+	};
+
+	for (int32 numBits : sizes) {
+		std::vector<GBSPTools::BitSet> sets(numSets), supersets(numSets);
+		for (int s = 0; s < numSets; s++) {
+			sets[s].Resize(numBits);
+			for (int32 bit = 0; bit < numBits; bit++) {
+				if (random() % 4 == 0) {
+					sets[s].Set(bit);
+				}
+			}
+		}
+		for (int s = 0; s < numSets; s++) {
+			supersets[s] = sets[s];
+			GBSPTools::GetBitKernels(BITSET_SCALAR).Or(supersets[s].GetWords(), sets[(s + 1) % numSets].GetWords(), sets[s].GetNumWords());
+		}
+		const int32 numWords = sets[0].GetNumWords();
+		const long long runs = wordsPerRun / numWords;
+		GBSPTools::BitSet dst(numBits);
+
+		// everything a level computes adds up here, the scalar one is the reference
+		long long reference = 0;
+		for (int level = BITSET_SCALAR; level <= GBSPTools::GetBitKernelsLevel(); level++) {
+			const GBSPTools::BitKernels& bits = GBSPTools::GetBitKernels(level);
+			long long check = 0;
+			double times[5];
+
+			for (int op = 0; op < 5; op++) {
+				auto start = std::chrono::steady_clock::now();
+				for (long long run = 0; run < runs; run++) {
+					const uint64_t* a = sets[run % numSets].GetWords();
+					const uint64_t* b = sets[(run + 7) % numSets].GetWords();
+					if (op == 0) {
+						bits.And(dst.GetWords(), a, b, numWords);
+					}
+					else if (op == 1) {
+						bits.AndNot(dst.GetWords(), a, b, numWords);
+					}
+					else if (op == 2) {
+						bits.Or(dst.GetWords(), a, numWords);
+					}
+					else if (op == 3) {
+						check += bits.AnyAndNot(a, supersets[run % numSets].GetWords(), numWords) ? 1 : 0;
+					}
+					else {
+						check += bits.Count(a, numWords);
+					}
+				}
+				times[op] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / runs;
+				check += GBSPTools::GetBitKernels(BITSET_SCALAR).Count(dst.GetWords(), numWords);
+				dst.Clear();
+			}
+			if (level == BITSET_SCALAR) {
+				reference = check;
+			}
+
+			std::string name = std::to_string(numBits) + " " + bits.Name;
+			printf("%-20s|%12.1f |%12.1f |%12.1f |%12.1f |%12.1f |%12s \n", name.c_str(), times[0], times[1], times[2], times[3], times[4], check == reference ? "no" : "yes");
+		}
+	}
+	printf("\n");
+}
+
 //========================================================================================
 //	ParseCmdArgs()
 //	This parse command line arguments to load them into the compiler parameters
@@ -72,6 +188,53 @@ void ParseCmdArgs(int argc, char *argv[], CompilerParms *parms) {
 
 	printf("Arguments:");
 	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-lib")) {
+			printf(" -lib");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				strcpy_s(parms->libPath, argv[++i]);
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -lib\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+
+		if (!strcmp(argv[i], "-threads")) {
+			printf(" -threads");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->numThreads = strtol(argv[++i], NULL, 10);
+				if (errno == ERANGE || parms->numThreads < 0) {
+					fprintf(stdout, "\nError: Bad argument for -threads\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -threads\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+
+		if (!strcmp(argv[i], "-checkpoint")) {
+			printf(" -checkpoint");
+			if (i + 1 < argc) {
+				printf(" %s", argv[i + 1]);
+				parms->checkpointInterval = strtod(argv[++i], NULL);
+				if (errno == ERANGE || parms->checkpointInterval < 0.0) {
+					fprintf(stdout, "\nError: Bad argument for -checkpoint\n\n\n\n");
+					exit(COMPILER_ERROR_BADARG);
+				}
+			}
+			else {
+				fprintf(stdout, "\nError: Missing argument for -checkpoint\n\n\n\n");
+				exit(COMPILER_ERROR_BADARG);
+			}
+			continue;
+		}
+
 		if (!strcmp(argv[i], "-verbose")) {
 			parms->vis.Verbose = GE_TRUE;
 			printf(" -verbose");
@@ -81,8 +244,24 @@ void ParseCmdArgs(int argc, char *argv[], CompilerParms *parms) {
 			printf(" -full");
 		}
 		else if (!strcmp(argv[i], "-sortportals")) {
-			parms->vis.SortPortals = GE_FALSE;
+			parms->vis.SortPortals = GE_TRUE;
 			printf(" -sortportals");
+		}
+		else if (!strcmp(argv[i], "-native")) {
+			parms->native = true;
+			printf(" -native");
+		}
+		else if (!strcmp(argv[i], "-incremental")) {
+			parms->incremental = true;
+			printf(" -incremental");
+		}
+		else if (!strcmp(argv[i], "-resume")) {
+			parms->resume = true;
+			printf(" -resume");
+		}
+		else if (!strcmp(argv[i], "-bitbench")) {
+			parms->bitBench = true;
+			printf(" -bitbench");
 		} else {
 			if (!hasLoadMap) {
 				strcpy_s(parms->mapName, argv[i]);
@@ -93,7 +272,7 @@ void ParseCmdArgs(int argc, char *argv[], CompilerParms *parms) {
 			}
 		}
 	}
-	if (!hasLoadMap)
+	if (!hasLoadMap && !parms->bitBench)
 		ShowUsage();
 	printf("\n");
 }
@@ -108,6 +287,15 @@ void ShowUsage(void) {
 	printf("    %-20s : %s\n", "-verbose",		"Outputs detailed compilation progress information.");
 	printf("    %-20s : %s\n", "-full",			"Performs full visibility calculations. Use it only in final compiles.");
 	printf("    %-20s : %s\n", "-sortportals",	"Sort the portals with MightSee.");
+	printf("    %-20s : %s\n", "-native",			"Computes visibility with the native multithreaded engine instead of GBSPLib.");
+	printf("    %-20s : %s\n", "-incremental",	"With -native -full, reuses the portals an edit didn't affect from the last run.");
+	printf("    %-20s : %s\n", "-checkpoint #",	"With -native -full, saves the finished portals every # seconds, 0 to never (default: 300).");
+	printf("    %-20s : %s\n", "-resume",		"With -native -full, goes on from the checkpoint a crashed or canceled run of the same .bsp saved.");
+	printf("    %-20s : %s\n", "-bitbench",		"Measures the bitset kernels used by the native vis instead of computing the vis.");
+	printf("\n");
+	printf("\n--- Common Options ---\n");
+	printf("    %-20s : %s\n", "-threads #", "Number of threads used by the native stages (default: one per core).");
+	printf("    %-20s : %s\n", "-lib path", "Compiler library or directory containing it (default: search GBSPLIB_PATH, then the system).");
 	printf("\n");
 	exit(0);
 };
@@ -125,5 +313,10 @@ void ShowSettings(CompilerParms parms) {
 	printf("%-20s|%12s |%12s \n", "verbose", parms.vis.Verbose ? "on" : "off", defaultParms.vis.Verbose ? "on" : "off");
 	printf("%-20s|%12s |%12s \n", "full", parms.vis.FullVis ? "on" : "off", defaultParms.vis.FullVis ? "on" : "off");
 	printf("%-20s|%12s |%12s \n", "sortportals", parms.vis.SortPortals ? "on" : "off", defaultParms.vis.SortPortals ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "native", parms.native ? "on" : "off", defaultParms.native ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "incremental", parms.incremental ? "on" : "off", defaultParms.incremental ? "on" : "off");
+	printf("%-20s|%12s |%12s \n", "threads", parms.numThreads ? std::to_string(parms.numThreads).c_str() : "auto", "auto");
+	printf("%-20s|%12s |%12s \n", "checkpoint", parms.checkpointInterval > 0.0 ? std::to_string((int)parms.checkpointInterval).c_str() : "off", std::to_string((int)defaultParms.checkpointInterval).c_str());
+	printf("%-20s|%12s |%12s \n", "resume", parms.resume ? "on" : "off", defaultParms.resume ? "on" : "off");
 	printf("\n");
 };
\ No newline at end of file
@@ -1,22 +1,38 @@
 #ifndef GVIS_H
 #define GVIS_H
 
-#include <windows.h>
+#include "platform.h"
 #include "gbsplib.h"
+#include "checkpoint.h"
 
 typedef struct {
 	char mapName[MAX_PATH];
+	char libPath[MAX_PATH];
 	VisParms vis;
+	bool native;
+	bool incremental;
+	bool bitBench;
+	int numThreads;		// 0 means one per core
+	double checkpointInterval;	// seconds between checkpoints, 0 means none
+	bool resume;
 } CompilerParms;
 
 void InitCompilerParms(CompilerParms *parms) {
+	parms->libPath[0] = '\0';
 	parms->vis.Verbose = GE_FALSE;
 	parms->vis.FullVis = GE_FALSE;
 	parms->vis.SortPortals = GE_FALSE;
+	parms->native = false;
+	parms->incremental = false;
+	parms->bitBench = false;
+	parms->numThreads = 0;
+	parms->checkpointInterval = CHECKPOINT_DEFAULT_INTERVAL;
+	parms->resume = false;
 }
 
 void ParseCmdArgs(int, char *[], CompilerParms *);
 void ShowUsage(void);
 void ShowSettings(CompilerParms parms);
+void RunBitSetBenchmark(void);
 
 #endif // GVIS_H
\ No newline at end of file
@@ -0,0 +1,1048 @@
+/****************************************************************************************/
+/*  tests.cpp
+/*
+/*  Author: rtxa
+/*  Description: Regression checks of the native stages
+/*
+/*	Builds a small test map, runs it through the native stages and checks what they
+/*	write: the same on one thread as on several, after a trip through the disk, and
+/*	with the caches as without them.
+/*
+/*	Usage: tests [scratch dir]. Returns the number of failed tests.
+/*
+/****************************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+#include "gbsptools.h"
+#include "arena.h"
+#include "bitset.h"
+#include "bspfile.h"
+#include "entities.h"
+#include "entupdate.h"
+#include "mapfile.h"
+#include "mappedfile.h"
+#include "nativebsp.h"
+#include "nativelight.h"
+#include "nativevis.h"
+#include "planepool.h"
+#include "platform.h"
+#include "stagecache.h"
+#include "utils.h"
+#include "vecbatch.h"
+#include "winding.h"
+
+#define TEST_THREADS		4			// compared against a single thread
+#define TEST_BOXES			24			// small enough for a full vis in a few seconds
+
+#define CHECK(expr) \
+	do { \
+		if (!(expr)) { \
+			printf("    %s:%d: %s\n", __FILE__, __LINE__, #expr); \
+			return false; \
+		} \
+	} while (0)
+
+using namespace GBSPTools;
+
+static std::string scratchDir;
+
+static std::string ScratchPath(const char* name) {
+	return scratchDir + "gbsptests_" + name;
+}
+
+//========================================================================================
+//	Test map
+//	A closed room with a pillar, a window in a wall, rows of solid and detail boxes and a
+//	door, written in the G3D binary .map format (see mapfile.h)
+//========================================================================================
+class TestMapWriter {
+public:
+	bool Write(const std::string& path, int numBoxes, const char* lightOrigin) {
+		fp = fopen(path.c_str(), "wb");
+		if (fp == nullptr) {
+			return false;
+		}
+
+		Int(1);
+		fwrite(MAP_TAG, 5, 1, fp);
+		Int(4);
+
+		// worldspawn
+		const float s = 512.0f, t = 16.0f;
+		Int(8 + numBoxes);
+		Box(-s - t, -s - t, -s - t, -s, s + t, s + t, BSP_CONTENTS_SOLID2);
+		Box(s, -s - t, -s - t, s + t, s + t, s + t, BSP_CONTENTS_SOLID2);
+		Box(-s, -s - t, -s - t, s, -s, s + t, BSP_CONTENTS_SOLID2);
+		Box(-s, s, -s - t, s, s + t, s + t, BSP_CONTENTS_SOLID2);
+		Box(-s, -s, -s - t, s, s, -s, BSP_CONTENTS_SOLID2);
+		Box(-s, -s, s, s, s, s + t, BSP_CONTENTS_SOLID2);
+		Box(-64, -64, -s, 64, 64, s, BSP_CONTENTS_SOLID2);
+		Box(200, -s - 8, 0, 300, -s + 8, 100, BSP_CONTENTS_WINDOW2);
+		for (int i = 0; i < numBoxes; i++) {
+			float x = -400.0f + (i % 20) * 40.0f, y = -400.0f + (i / 20 % 20) * 40.0f, z = -500.0f + (i / 400) * 40.0f;
+			uint32 contents = i % 5 == 0 ? BSP_CONTENTS_SOLID2 | BSP_CONTENTS_DETAIL2 : BSP_CONTENTS_SOLID2;
+			Box(x, y, z, x + 20.0f, y + 20.0f, z + 20.0f + (i % 7) * 5.0f, contents);
+		}
+		Int(2);
+		Key("classname", "worldspawn");
+		Key("sky", "none");
+
+		Int(0);
+		Int(3);
+		Key("classname", "light");
+		Key("origin", lightOrigin);
+		Key("light", "300");
+
+		Int(0);
+		Int(2);
+		Key("classname", "info_player_start");
+		Key("origin", "-200 -200 0");
+
+		Int(1);
+		Box(100, 100, -100, 160, 160, 0, BSP_CONTENTS_SOLID2);
+		Int(2);
+		Key("classname", "door");
+		Key("origin", "130 130 -50");
+
+		return fclose(fp) == 0;
+	}
+
+private:
+	FILE* fp = nullptr;
+
+	void Int(int32 value) { fwrite(&value, sizeof(value), 1, fp); }
+	void Float(float value) { fwrite(&value, sizeof(value), 1, fp); }
+	void Vec(float x, float y, float z) { Float(x); Float(y); Float(z); }
+
+	void Key(const char* key, const char* value) {
+		Int((int32)strlen(key) + 1);
+		fwrite(key, strlen(key) + 1, 1, fp);
+		Int((int32)strlen(value) + 1);
+		fwrite(value, strlen(value) + 1, 1, fp);
+	}
+
+	// An axial box, its faces as quads wound the way the map editors write them
+	void Box(float x0, float y0, float z0, float x1, float y1, float z1, uint32 contents) {
+		static const int quads[6][4] = { { 0, 2, 6, 4 }, { 1, 5, 7, 3 }, { 0, 4, 5, 1 }, { 2, 3, 7, 6 }, { 0, 1, 3, 2 }, { 4, 6, 7, 5 } };
+		Int(6);
+		Int((int32)contents);
+		for (int f = 0; f < 6; f++) {
+			Int(4);
+			Int(0);
+			Float(0.0f);
+			Float(0.0f);
+			Float(255.0f);
+			Float(1.0f);
+			for (int k = 0; k < 4; k++) {
+				int c = quads[f][k];
+				Vec(c & 1 ? x1 : x0, c & 2 ? y1 : y0, c & 4 ? z1 : z0);
+			}
+			char texName[MAP_TEXNAME_SIZE] = { 0 };
+			strcpy_s(texName, f == 5 ? "ceil" : "wall");
+			fwrite(texName, sizeof(texName), 1, fp);
+			// texture axes on the plane of the face, like the editors project them
+			Vec(f < 2 ? 0.0f : 1.0f, f < 2 ? 1.0f : 0.0f, 0.0f);
+			Vec(0.0f, f < 4 ? 0.0f : 1.0f, f < 4 ? 1.0f : 0.0f);
+			Float(0.0f);
+			Float(0.0f);
+		}
+	}
+};
+
+static bool ReadBytes(const std::string& path, std::vector<uint8>& bytes) {
+	MappedFile file;
+	if (!file.Open(path)) {
+		return false;
+	}
+	bytes.assign(file.GetData(), file.GetData() + file.GetSize());
+	return true;
+}
+
+static bool SameFiles(const std::string& a, const std::string& b) {
+	std::vector<uint8> bytesA, bytesB;
+	return ReadBytes(a, bytesA) && ReadBytes(b, bytesB) && bytesA == bytesB;
+}
+
+static bool SameChunk(const BspFile& a, const BspFile& b, int32 type) {
+	Span<const uint8> dataA = a.GetChunkData<uint8>(type);
+	Span<const uint8> dataB = b.GetChunkData<uint8>(type);
+	return dataA.size() == dataB.size() && (dataA.empty() || !memcmp(dataA.GetData(), dataB.GetData(), dataA.size()));
+}
+
+static bool SameLighting(const BspFile& a, const BspFile& b) {
+	return SameChunk(a, b, GBSP_CHUNK_FACES) && SameChunk(a, b, GBSP_CHUNK_LIGHTDATA) && SameChunk(a, b, GBSP_CHUNK_RGB_VERTS);
+}
+
+static void InitParms(BspParms& bspParms, VisParms& visParms, LightParms& lightParms, RadiosityParms& radiosity, SampleParms& sampling) {
+	memset(&bspParms, 0, sizeof(bspParms));
+	memset(&visParms, 0, sizeof(visParms));
+	visParms.FullVis = GE_TRUE;
+	visParms.SortPortals = GE_TRUE;
+	memset(&lightParms, 0, sizeof(lightParms));
+	lightParms.LightScale = 1.0f;
+	lightParms.ReflectiveScale = 1.0f;
+	lightParms.NumBounce = 10;
+	lightParms.PatchSize = 128.0f;
+	radiosity.Threshold = RADIOSITY_DEFAULT_THRESHOLD;
+	radiosity.MinPatchSize = RADIOSITY_DEFAULT_MIN_PATCH;
+	radiosity.MaxMemory = RADIOSITY_DEFAULT_MAX_MEMORY;
+	sampling.Adaptive = GE_FALSE;
+	sampling.Contrast = LIGHT_DEFAULT_CONTRAST;
+	sampling.MaxSamples = LIGHT_DEFAULT_MAX_SAMPLES;
+}
+
+// The test map compiled on numThreads threads, then saved to path
+static bool CompileTestMap(const std::string& mapPath, const std::string& path, int numThreads) {
+	BspParms bspParms;
+	VisParms visParms;
+	LightParms lightParms;
+	RadiosityParms radiosity;
+	SampleParms sampling;
+	InitParms(bspParms, visParms, lightParms, radiosity, sampling);
+	BspFile bsp;
+	return CreateBsp(mapPath, bsp, bspParms, numThreads) && bsp.Save(path);
+}
+
+//========================================================================================
+//	TestMapFile()
+//	Every entity, brush, face and point of the test map where the writer put it, the
+//	same on one thread as on several, and a cut off file fails to load
+//========================================================================================
+static bool TestMapFile(const std::string& mapPath) {
+	MapFile map;
+	CHECK(map.Load(mapPath, 1));
+	CHECK(map.Version == 1);
+	CHECK(map.Entities.size() == 4);
+	CHECK(map.Entities[0].NumBrushes == 8 + TEST_BOXES && map.Entities[1].NumBrushes == 0 && map.Entities[3].NumBrushes == 1);
+	CHECK(map.Brushes.size() == 9 + TEST_BOXES);
+	CHECK(map.Faces.size() == map.Brushes.size() * 6);
+	CHECK(map.Points.size() == map.Faces.size() * 4);
+	CHECK(map.Textures.size() == 2);
+	CHECK(map.ValueForKey(0, "classname") == "worldspawn");
+	CHECK(map.ValueForKey(1, "light") == "300");
+	CHECK(map.ValueForKey(3, "origin") == "130 130 -50");
+	CHECK(map.ValueForKey(3, "missing").empty());
+
+	for (int32 e = 0; e < (int32)map.Entities.size(); e++) {
+		for (int32 b = map.Entities[e].FirstBrush; b < map.Entities[e].FirstBrush + map.Entities[e].NumBrushes; b++) {
+			CHECK(map.Brushes[b].Entity == e);
+		}
+	}
+	CHECK(map.Brushes[7].Contents == BSP_CONTENTS_WINDOW2);
+	CHECK(map.Brushes[8].Contents == (BSP_CONTENTS_SOLID2 | BSP_CONTENTS_DETAIL2));
+	const MapFace& face = map.Faces[map.Brushes[0].FirstFace + 5];
+	CHECK(face.NumPoints == 4 && face.Translucency == 255.0f && face.TexVecs[1].Y == 1.0f);
+	CHECK(map.GetString(map.Textures[face.Texture].Name) == "ceil");
+	const geVec3d& corner = map.Points[map.Faces[map.Brushes[0].FirstFace].FirstPoint];
+	CHECK(corner.X == -528.0f && corner.Y == -528.0f && corner.Z == -528.0f);
+
+	MapFile threaded;
+	CHECK(threaded.Load(mapPath, TEST_THREADS));
+	CHECK(threaded.Faces.size() == map.Faces.size() && !memcmp(threaded.Faces.data(), map.Faces.data(), map.Faces.size() * sizeof(MapFace)));
+	CHECK(threaded.Points.size() == map.Points.size() && !memcmp(threaded.Points.data(), map.Points.data(), map.Points.size() * sizeof(geVec3d)));
+
+	std::vector<uint8> bytes;
+	CHECK(ReadBytes(mapPath, bytes));
+	const std::string cut = ScratchPath("cut.map");
+	FILE* fp = fopen(cut.c_str(), "wb");
+	CHECK(fp != nullptr);
+	fwrite(bytes.data(), 1, bytes.size() / 2, fp);
+	fclose(fp);
+	MapFile broken;
+	CHECK(!broken.Load(cut) && !broken.GetError().empty());
+	remove(cut.c_str());
+	return true;
+}
+
+//========================================================================================
+//	TestEntityUpdate()
+//	Update() rewrites a chunk of the same size in place and saves the whole file when
+//	the size changes, with more chunks than a single writev() takes. UpdateEntities()
+//	only takes a .map with the models of the .bsp.
+//========================================================================================
+static bool TestEntityUpdate(const std::string& mapPath) {
+	const std::string path = ScratchPath("update.bsp");
+	const std::string expected = ScratchPath("expected.bsp");
+	GBSP_Header header = {};
+	memcpy(header.TAG, GBSP_TAG, 4);
+	header.Version = GBSP_VERSION;
+	std::vector<GFX_Model> models(2);
+	const std::string oldEnts = "{\n\"classname\" \"worldspawn\"\n}\n";
+
+	BspFile bsp;
+	bsp.SetChunkData(GBSP_CHUNK_HEADER, &header, 1);
+	bsp.SetChunkData(GBSP_CHUNK_MODELS, models);
+	bsp.SetChunkData(GBSP_CHUNK_ENTDATA, oldEnts.c_str(), (int32)oldEnts.size() + 1);
+	for (int32 i = 0; i < 600; i++) {
+		// unknown chunk types are carried along untouched
+		bsp.SetChunkData(1000 + i, &i, 1);
+	}
+	CHECK(bsp.Save(path));
+	CHECK(bsp.Open(path));
+	CHECK(bsp.GetChunks().size() == 603);
+	CHECK(bsp.GetChunkData<int32>(1599).size() == 1 && bsp.GetChunkData<int32>(1599)[0] == 599);
+
+	// same size, only the entities change
+	std::string sameSize = oldEnts;
+	sameSize[3] = 'C';
+	bsp.SetChunkData(GBSP_CHUNK_ENTDATA, sameSize.c_str(), (int32)sameSize.size() + 1);
+	CHECK(bsp.SaveCopy(expected));
+	CHECK(bsp.Update());
+	bsp.Close();
+	CHECK(SameFiles(path, expected));
+
+	// the .map has two models like the .bsp
+	CHECK(bsp.Open(path));
+	CHECK(UpdateEntities(mapPath, bsp, TEST_THREADS));
+	CHECK(bsp.Update());
+	bsp.Close();
+	MapFile map;
+	CHECK(map.Load(mapPath));
+	const std::string mapEnts = MapEntityData(map);
+	CHECK(bsp.Open(path));
+	Span<const char> entData = bsp.GetChunkData<char>(GBSP_CHUNK_ENTDATA);
+	CHECK(entData.size() == (int32)mapEnts.size() + 1 && !strcmp(entData.GetData(), mapEnts.c_str()));
+	CHECK(bsp.GetChunks().size() == 603 && bsp.GetChunkData<int32>(1599)[0] == 599);
+
+	// a model less refuses the update
+	bsp.SetChunkData(GBSP_CHUNK_MODELS, models.data(), 1);
+	CHECK(!UpdateEntities(mapPath, bsp, TEST_THREADS));
+	bsp.Close();
+
+	remove(path.c_str());
+	remove(expected.c_str());
+	return true;
+}
+
+// Same random numbers on every platform
+static uint32 NextRandom(uint32& seed) {
+	seed = seed * 1664525u + 1013904223u;
+	return seed;
+}
+
+//========================================================================================
+//	TestBitKernels()
+//	Every kernel level the processor has gives what the scalar one gives, for every
+//	length around the vector widths and from unaligned words
+//========================================================================================
+static bool TestBitKernels() {
+	const BitKernels& scalar = GetBitKernels(BITSET_SCALAR);
+	uint32 seed = 1;
+	std::vector<uint64_t> a(41), b(41), expected(41), result(41);
+	for (int level = BITSET_SSE2; level <= GetBitKernelsLevel(); level++) {
+		const BitKernels& kernels = GetBitKernels(level);
+		CHECK(kernels.Level == level);
+		for (int32 numWords = 0; numWords <= 40; numWords++) {
+			for (int32 i = 0; i < 41; i++) {
+				a[i] = (uint64_t)NextRandom(seed) << 32 | NextRandom(seed);
+				b[i] = (uint64_t)NextRandom(seed) << 32 | NextRandom(seed);
+			}
+			const uint64_t* srcA = a.data() + (numWords & 1);
+			const uint64_t* srcB = b.data() + (numWords & 1);
+
+			scalar.And(expected.data(), srcA, srcB, numWords);
+			kernels.And(result.data(), srcA, srcB, numWords);
+			CHECK(std::equal(expected.begin(), expected.begin() + numWords, result.begin()));
+			scalar.AndNot(expected.data(), srcA, srcB, numWords);
+			kernels.AndNot(result.data(), srcA, srcB, numWords);
+			CHECK(std::equal(expected.begin(), expected.begin() + numWords, result.begin()));
+			kernels.Or(result.data(), srcB, numWords);
+			scalar.Or(expected.data(), srcB, numWords);
+			CHECK(std::equal(expected.begin(), expected.begin() + numWords, result.begin()));
+			CHECK(kernels.Count(srcA, numWords) == scalar.Count(srcA, numWords));
+
+			// a subset of b, then with the lowest bit b doesn't have in its last word
+			CHECK(kernels.AnyAndNot(srcA, srcB, numWords) == scalar.AnyAndNot(srcA, srcB, numWords));
+			scalar.And(expected.data(), srcA, srcB, numWords);
+			CHECK(!kernels.AnyAndNot(expected.data(), srcB, numWords));
+			if (numWords) {
+				expected[numWords - 1] |= ~srcB[numWords - 1] & (0 - ~srcB[numWords - 1]);
+				CHECK(kernels.AnyAndNot(expected.data(), srcB, numWords) == (srcB[numWords - 1] != ~0ull));
+			}
+		}
+	}
+	return true;
+}
+
+//========================================================================================
+//	TestPlanePool()
+//	Planes within the tolerance are one plane wherever they fall in the hash cells,
+//	flipping is num ^ 1 and the numbers hold across growing the table
+//========================================================================================
+static bool TestPlanePool() {
+	PlanePool pool;
+
+	int32 floor = pool.Find(geVec3d{ 0.0f, 0.0f, 1.0f }, 64.0f);
+	CHECK(floor == 0);
+	CHECK(pool.Find(geVec3d{ 0.0f, 0.0f, -1.0f }, -64.0f) == PlanePool::Flip(floor));
+	CHECK(pool.GetType(floor) == PLANE_Z);
+	CHECK(pool.Distance(floor, geVec3d{ 10.0f, 20.0f, 70.0f }) == 6.0f);
+
+	// snapped to the axis and to the integer distance
+	CHECK(pool.Find(geVec3d{ 0.000001f, 0.0f, 0.999999f }, 64.004f) == floor);
+	CHECK(pool.GetDist(floor) == 64.0f);
+
+	// on both sides of a distance cell border, and of a normal one
+	int32 border = pool.Find(geVec3d{ 1.0f, 0.0f, 0.0f }, 10.497f);
+	CHECK(pool.Find(geVec3d{ 1.0f, 0.0f, 0.0f }, 10.503f) == border);
+	const geFloat x = 154.5f / PLANEPOOL_NORMAL_CELLS, z = sqrtf(1.0f - x * x);
+	int32 slope = pool.Find(geVec3d{ x - PLANEPOOL_NORMAL_EPSILON * 0.2f, 0.0f, z }, 32.0f);
+	CHECK(pool.Find(geVec3d{ x + PLANEPOOL_NORMAL_EPSILON * 0.2f, 0.0f, z }, 32.0f) == slope);
+	CHECK(pool.GetType(slope) == PLANE_ANYZ);
+
+	// just outside the tolerance is another plane
+	CHECK(pool.Find(geVec3d{ 1.0f, 0.0f, 0.0f }, 10.53f) != border);
+	CHECK(pool.Find(geVec3d{ 0.0f, 0.0f, 1.0f }, 65.0f) != floor);
+
+	// enough planes to rehash several times, every one found again where it was
+	std::vector<int32> nums;
+	for (int i = 0; i < 5000; i++) {
+		geVec3d normal = { (geFloat)(i % 17) - 8.0f, (geFloat)(i % 13) - 6.0f, 3.0f };
+		geVec3d_Normalize(&normal);
+		nums.push_back(pool.Find(normal, (geFloat)(i / 221) * 8.0f));
+	}
+	for (int i = 0; i < 5000; i++) {
+		geVec3d normal = { (geFloat)(i % 17) - 8.0f, (geFloat)(i % 13) - 6.0f, 3.0f };
+		geVec3d_Normalize(&normal);
+		CHECK(pool.Find(normal, (geFloat)(i / 221) * 8.0f) == nums[i]);
+		geVec3d_Inverse(&normal);
+		CHECK(pool.Find(normal, -(geFloat)(i / 221) * 8.0f) == PlanePool::Flip(nums[i]));
+	}
+	CHECK(pool.Find(geVec3d{ 0.0f, 0.0f, 1.0f }, 64.0f) == floor);
+	CHECK((int32)pool.ToGFXPlanes().size() == pool.size() / 2);
+	CHECK(pool.ToGFXPlanes()[floor >> 1].Dist == 64.0f);
+	return true;
+}
+
+// count random vectors, components in [-scale, scale] or [0, scale] when positive
+static void RandomVectors(VecSoA& vectors, int32 count, geFloat scale, bool positive, uint32& seed) {
+	vectors.clear();
+	for (int32 i = 0; i < count; i++) {
+		geVec3d v;
+		geFloat* c = &v.X;
+		for (int k = 0; k < 3; k++) {
+			geFloat unit = (geFloat)(NextRandom(seed) >> 8) / (geFloat)(1 << 24);
+			c[k] = positive ? unit * scale : (unit * 2.0f - 1.0f) * scale;
+		}
+		vectors.Append(&v, 1);
+	}
+}
+
+static bool SameFloats(const geFloat* a, const geFloat* b, int32 count) {
+	return count == 0 || !memcmp(a, b, count * sizeof(geFloat));
+}
+
+static bool SameVectors(const VecSoA& a, const VecSoA& b) {
+	return a.size() == b.size() && SameFloats(a.X(), b.X(), a.size()) && SameFloats(a.Y(), b.Y(), a.size()) && SameFloats(a.Z(), b.Z(), a.size());
+}
+
+//========================================================================================
+//	TestVecKernels()
+//	Every kernel level the processor has gives bit for bit what the scalar one gives,
+//	for every count around the vector widths, black and overbright colors included
+//========================================================================================
+static bool TestVecKernels() {
+	const VecKernels& scalar = GetVecKernels(VECBATCH_SCALAR);
+	uint32 seed = 7;
+	VecSoA points, expected, result;
+	std::vector<geFloat> expectedFloats(40), resultFloats(40);
+	const geVec3d bias = { 0.5f, -20.0f, 3.0f };
+	for (int level = VECBATCH_SSE2; level <= GetVecKernelsLevel(); level++) {
+		const VecKernels& kernels = GetVecKernels(level);
+		CHECK(kernels.Level == level);
+		for (int32 count = 0; count <= 40; count++) {
+			RandomVectors(points, count, 4096.0f, false, seed);
+			geVec3d normal = { 0.3f, -0.5f, 0.7f };
+			geVec3d_Normalize(&normal);
+
+			scalar.PlaneDists(points.X(), points.Y(), points.Z(), count, normal, 12.5f, expectedFloats.data());
+			kernels.PlaneDists(points.X(), points.Y(), points.Z(), count, normal, 12.5f, resultFloats.data());
+			CHECK(SameFloats(expectedFloats.data(), resultFloats.data(), count));
+
+			geFloat expectedMin = 0.0f, expectedMax = 0.0f, resultMin = 0.0f, resultMax = 0.0f;
+			scalar.PlaneRange(points.X(), points.Y(), points.Z(), count, normal, 12.5f, expectedMin, expectedMax);
+			kernels.PlaneRange(points.X(), points.Y(), points.Z(), count, normal, 12.5f, resultMin, resultMax);
+			CHECK(expectedMin == resultMin && expectedMax == resultMax);
+
+			geVec3d expectedMins, expectedMaxs, resultMins, resultMaxs;
+			ClearBounds(&expectedMins, &expectedMaxs);
+			ClearBounds(&resultMins, &resultMaxs);
+			scalar.Bounds(points.X(), points.Y(), points.Z(), count, expectedMins, expectedMaxs);
+			kernels.Bounds(points.X(), points.Y(), points.Z(), count, resultMins, resultMaxs);
+			CHECK(!memcmp(&expectedMins, &resultMins, sizeof(geVec3d)) && !memcmp(&expectedMaxs, &resultMaxs, sizeof(geVec3d)));
+
+			RandomVectors(expected, count, 400.0f, true, seed);
+			if (count > 2) {
+				expected.Set(count / 2, geVec3d{ 0.0f, 0.0f, 0.0f });
+			}
+			result.clear();
+			for (int32 i = 0; i < count; i++) {
+				geVec3d color = expected.Get(i);
+				result.Append(&color, 1);
+			}
+			scalar.ColorClamp(expected.X(), expected.Y(), expected.Z(), count, 1.5f, bias, 255.0f);
+			kernels.ColorClamp(result.X(), result.Y(), result.Z(), count, 1.5f, bias, 255.0f);
+			CHECK(SameVectors(expected, result));
+			scalar.ColorNormalize(expected.X(), expected.Y(), expected.Z(), count, expectedFloats.data());
+			kernels.ColorNormalize(result.X(), result.Y(), result.Z(), count, resultFloats.data());
+			CHECK(SameVectors(expected, result));
+			CHECK(SameFloats(expectedFloats.data(), resultFloats.data(), count));
+		}
+	}
+	return true;
+}
+
+// What Winding::Split() gives, one point at a time without SSE
+static void ReferenceSplit(const std::vector<geVec3d>& points, const geVec3d& normal, geFloat dist, std::vector<geVec3d>& front, std::vector<geVec3d>& back, int& side) {
+	const int32 count = (int32)points.size();
+	std::vector<geFloat> dists(count);
+	std::vector<int> sides(count);
+	int counts[3] = { 0, 0, 0 };
+	for (int32 i = 0; i < count; i++) {
+		dists[i] = geVec3d_DotProduct(&points[i], &normal) - dist;
+		sides[i] = dists[i] > ON_EPSILON ? SIDE_FRONT : (dists[i] < -ON_EPSILON ? SIDE_BACK : SIDE_ON);
+		counts[sides[i]]++;
+	}
+	front.clear();
+	back.clear();
+	side = counts[SIDE_FRONT] && counts[SIDE_BACK] ? SIDE_CROSS : (counts[SIDE_FRONT] ? SIDE_FRONT : (counts[SIDE_BACK] ? SIDE_BACK : SIDE_ON));
+	if (side != SIDE_CROSS) {
+		(side == SIDE_BACK ? back : front) = points;
+		return;
+	}
+	for (int32 i = 0; i < count; i++) {
+		if (sides[i] != SIDE_BACK) {
+			front.push_back(points[i]);
+		}
+		if (sides[i] != SIDE_FRONT) {
+			back.push_back(points[i]);
+		}
+		int32 next = (i + 1) % count;
+		if (sides[i] == SIDE_ON || sides[next] == SIDE_ON || sides[next] == sides[i]) {
+			continue;
+		}
+		geFloat t = dists[i] / (dists[i] - dists[next]);
+		geVec3d mid;
+		geVec3d_Subtract(&points[next], &points[i], &mid);
+		geVec3d_AddScaled(&points[i], &mid, t, &mid);
+		for (int axis = 0; axis < 3; axis++) {
+			if (VectorToSUB(normal, axis) == 1.0f || VectorToSUB(normal, axis) == -1.0f) {
+				VectorToSUB(mid, axis) = dist * VectorToSUB(normal, axis);
+			}
+		}
+		front.push_back(mid);
+		back.push_back(mid);
+	}
+}
+
+static bool SamePoints(const Winding& w, const std::vector<geVec3d>& points) {
+	return w.size() == (int32)points.size() && (points.empty() || !memcmp(w.Points.data(), points.data(), points.size() * sizeof(geVec3d)));
+}
+
+//========================================================================================
+//	TestWindings()
+//	Side(), Split() and Clip() give bit for bit what a plain scalar split gives, on
+//	polygons around the four point steps of the SSE classification and past the inline
+//	points, cut by slanted and axial planes and by planes through their corners
+//========================================================================================
+static bool TestWindings() {
+	uint32 seed = 11;
+	std::vector<geVec3d> points, expectedFront, expectedBack;
+	int numCross = 0, numOn = 0;
+	for (int32 count = 3; count <= 2 * WINDING_INLINE_POINTS; count++) {
+		for (int trial = 0; trial < 40; trial++) {
+			// a regular polygon on the z = 0 plane, turned and moved about
+			VecSoA random;
+			RandomVectors(random, 2, 1.0f, false, seed);
+			geVec3d u = random.Get(0), v, n = random.Get(1), center;
+			geVec3d_Normalize(&n);
+			geVec3d_AddScaled(&u, &n, -geVec3d_DotProduct(&u, &n), &u);
+			geVec3d_Normalize(&u);
+			geVec3d_CrossProduct(&n, &u, &v);
+			RandomVectors(random, 1, 256.0f, false, seed);
+			center = random.Get(0);
+			Winding w;
+			points.clear();
+			for (int32 i = 0; i < count; i++) {
+				geFloat angle = (geFloat)i * 6.2831853f / count;
+				geVec3d p;
+				geVec3d_AddScaled(&center, &u, 128.0f * cosf(angle), &p);
+				geVec3d_AddScaled(&p, &v, 128.0f * sinf(angle), &p);
+				points.push_back(p);
+				w.Points.push_back(p);
+			}
+
+			geVec3d normal = { 0.0f, 0.0f, 0.0f };
+			geFloat dist;
+			if (trial % 4 == 0) {
+				VectorToSUB(normal, trial / 4 % 3) = trial & 4 ? -1.0f : 1.0f;
+				dist = geVec3d_DotProduct(&center, &normal) + (geFloat)(trial % 3) * 20.0f;
+			}
+			else {
+				RandomVectors(random, 1, 1.0f, false, seed);
+				normal = random.Get(0);
+				geVec3d_Normalize(&normal);
+				dist = trial % 4 == 1 ? geVec3d_DotProduct(&points[trial % count], &normal) : geVec3d_DotProduct(&center, &normal) + (geFloat)(trial % 5 - 2) * 50.0f;
+			}
+
+			int side;
+			ReferenceSplit(points, normal, dist, expectedFront, expectedBack, side);
+			CHECK(w.Side(normal, dist) == side);
+			Winding front, back;
+			w.Split(normal, dist, front, back);
+			CHECK(SamePoints(front, expectedFront) && SamePoints(back, expectedBack));
+			Winding clipped = w;
+			CHECK(clipped.Clip(normal, dist) == (expectedFront.size() >= 3));
+			CHECK(SamePoints(clipped, expectedFront));
+			numCross += side == SIDE_CROSS;
+			numOn += trial % 4 == 1 && side == SIDE_CROSS && (int32)(expectedFront.size() + expectedBack.size()) == count + 3;
+		}
+	}
+	CHECK(numCross > 100 && numOn > 10);
+	return true;
+}
+
+//========================================================================================
+//	TestArena()
+//	What a thread frees is handed out again by the next one once the first ends, and
+//	nothing of before Reset() comes back after it
+//========================================================================================
+static bool TestArena() {
+	Arena arena;
+	std::vector<void*> items;
+	std::thread([&]() {
+		for (int i = 0; i < 100; i++) {
+			items.push_back(arena.Alloc(64));
+		}
+	}).join();
+	const long long allocated = arena.GetStats().Allocated;
+	std::thread([&]() {
+		for (void* p : items) {
+			arena.Free(p, 64);
+		}
+	}).join();
+
+	std::vector<void*> again;
+	std::thread([&]() {
+		for (int i = 0; i < 100; i++) {
+			again.push_back(arena.Alloc(64));
+		}
+	}).join();
+	CHECK(arena.GetStats().Allocated == allocated);
+	std::sort(items.begin(), items.end());
+	std::sort(again.begin(), again.end());
+	CHECK(items == again);
+
+	// a thread moving on to another arena gives its lists back too
+	Arena other;
+	for (void* p : again) {
+		arena.Free(p, 64);
+	}
+	other.Alloc(64);
+	std::thread([&]() {
+		for (int i = 0; i < 100; i++) {
+			arena.Alloc(64);
+		}
+	}).join();
+	CHECK(arena.GetStats().Allocated == allocated);
+
+	// the lists of before Reset() point into freed blocks and are dropped
+	void* stale = arena.Alloc(64);
+	arena.Free(stale, 64);
+	arena.Reset();
+	CHECK(arena.GetStats().Reserved == 0 && arena.GetStats().Blocks == 0);
+	arena.Alloc(64);
+	CHECK(arena.GetStats().Blocks == 1 && arena.GetStats().Allocated == 64);
+	return true;
+}
+
+//========================================================================================
+//	TestBspRoundTrip()
+//	The same .bsp on one thread and on several, after Save() and Open() and after a
+//	trip through the stage cache
+//========================================================================================
+static bool TestBspRoundTrip(const std::string& mapPath) {
+	const std::string single = ScratchPath("single.bsp");
+	const std::string threaded = ScratchPath("threaded.bsp");
+	CHECK(CompileTestMap(mapPath, single, 1));
+	CHECK(CompileTestMap(mapPath, threaded, TEST_THREADS));
+	CHECK(SameFiles(single, threaded));
+
+	BspFile bsp;
+	CHECK(bsp.Open(single));
+	CHECK(bsp.GetChunkData<GFX_Leaf>(GBSP_CHUNK_LEAFS).size() > 1);
+	CHECK(!bsp.GetChunkData<GFX_Face>(GBSP_CHUNK_FACES).empty());
+	const std::string copy = ScratchPath("copy.bsp");
+	CHECK(bsp.SaveCopy(copy));
+	CHECK(SameFiles(single, copy));
+
+	const std::string cacheDir = ScratchPath("cache");
+	StageCache cache;
+	CHECK(cache.Open(cacheDir));
+	CHECK(cache.Store("bsp", bsp));
+	bsp.Close();
+	BspFile fetched;
+	CHECK(cache.Fetch("bsp", fetched));
+	CHECK(fetched.Save(copy));
+	fetched.Close();
+	CHECK(SameFiles(single, copy));
+
+	remove(threaded.c_str());
+	remove(copy.c_str());
+	remove((cacheDir + "/bsp" STAGECACHE_EXTENSION).c_str());
+	remove(cacheDir.c_str());
+	return true;
+}
+
+//========================================================================================
+//	TestModels()
+//	The door is a model of its own after the world, with its own root, leafs and faces
+//	and no clusters, and no empty leaf of the world is outside the room
+//========================================================================================
+static bool TestModels(const std::string& bspPath) {
+	BspFile bsp;
+	CHECK(bsp.Open(bspPath));
+	Span<const GFX_Model> models = bsp.GetChunkData<GFX_Model>(GBSP_CHUNK_MODELS);
+	Span<const GFX_Node> nodes = bsp.GetChunkData<GFX_Node>(GBSP_CHUNK_NODES);
+	Span<const GFX_Leaf> leafs = bsp.GetChunkData<GFX_Leaf>(GBSP_CHUNK_LEAFS);
+	Span<const GFX_Face> faces = bsp.GetChunkData<GFX_Face>(GBSP_CHUNK_FACES);
+	CHECK(models.size() == 2);
+
+	const GFX_Model& world = models[0];
+	const GFX_Model& door = models[1];
+	CHECK(world.RootNode[0] == 0 && world.FirstFace == 0 && world.FirstLeaf == 0);
+	CHECK(world.NumClusters == bsp.GetChunkData<GFX_Cluster>(GBSP_CHUNK_CLUSTERS).size());
+	CHECK(door.RootNode[0] > 0 && door.RootNode[0] < nodes.size());
+	CHECK(door.FirstFace == world.NumFaces && door.FirstFace + door.NumFaces == faces.size());
+	CHECK(door.FirstLeaf == world.NumLeafs && door.FirstLeaf + door.NumLeafs == leafs.size());
+	CHECK(door.NumFaces == 6 && door.NumClusters == 0);
+	CHECK(door.Mins.X == 100.0f && door.Maxs.Z == 0.0f);
+	CHECK(door.Origin.X == 130.0f && door.Origin.Y == 130.0f && door.Origin.Z == -50.0f);
+	for (int32 i = door.FirstLeaf; i < door.FirstLeaf + door.NumLeafs; i++) {
+		CHECK(leafs[i].Cluster == -1);
+	}
+
+	// the room is sealed, the outside of the world is all solid
+	int32 numEmpty = 0;
+	for (int32 i = world.FirstLeaf; i < world.FirstLeaf + world.NumLeafs; i++) {
+		if (leafs[i].Contents & BSP_CONTENTS_SOLID2) {
+			continue;
+		}
+		numEmpty++;
+		CHECK(leafs[i].Mins.X >= -512.0f && leafs[i].Mins.Y >= -512.0f && leafs[i].Mins.Z >= -512.0f);
+		CHECK(leafs[i].Maxs.X <= 512.0f && leafs[i].Maxs.Y <= 512.0f && leafs[i].Maxs.Z <= 512.0f);
+	}
+	CHECK(numEmpty > 0);
+
+	// the node children of each model stay in its own ranges
+	for (int32 m = 0; m < 2; m++) {
+		const int32 firstNode = m ? door.RootNode[0] : 0;
+		const int32 endNode = m ? (int32)nodes.size() : door.RootNode[0];
+		for (int32 n = firstNode; n < endNode; n++) {
+			for (int i = 0; i < 2; i++) {
+				int32 child = nodes[n].Children[i];
+				if (child >= 0) {
+					CHECK(child > n && child < endNode);
+				}
+				else {
+					CHECK(-(child + 1) >= models[m].FirstLeaf && -(child + 1) < models[m].FirstLeaf + models[m].NumLeafs);
+				}
+			}
+			if (nodes[n].NumFaces) {
+				CHECK(nodes[n].FirstFace >= models[m].FirstFace && nodes[n].FirstFace + nodes[n].NumFaces <= models[m].FirstFace + models[m].NumFaces);
+			}
+		}
+	}
+	return true;
+}
+
+//========================================================================================
+//	TestVisRoundTrip()
+//	A full vis on one thread and on several where every cluster sees itself, written
+//	back with Update()
+//========================================================================================
+static bool TestVisRoundTrip(const std::string& bspPath) {
+	BspParms bspParms;
+	VisParms visParms;
+	LightParms lightParms;
+	RadiosityParms radiosity;
+	SampleParms sampling;
+	InitParms(bspParms, visParms, lightParms, radiosity, sampling);
+
+	BspFile single, threaded;
+	CHECK(single.Open(bspPath));
+	CHECK(threaded.Open(bspPath));
+	CHECK(VisBsp(single, visParms, 1));
+	CHECK(VisBsp(threaded, visParms, TEST_THREADS));
+	CHECK(!single.GetChunkData<uint8>(GBSP_CHUNK_VISDATA).empty());
+	CHECK(SameChunk(single, threaded, GBSP_CHUNK_VISDATA));
+	CHECK(SameChunk(single, threaded, GBSP_CHUNK_CLUSTERS));
+
+	// every cluster sees itself
+	Span<const GFX_Cluster> clusters = single.GetChunkData<GFX_Cluster>(GBSP_CHUNK_CLUSTERS);
+	Span<const uint8> visData = single.GetChunkData<uint8>(GBSP_CHUNK_VISDATA);
+	CHECK(clusters.size() > 1);
+	for (int32 c = 0; c < clusters.size(); c++) {
+		CHECK(clusters[c].VisOfs >= 0 && clusters[c].VisOfs + (c >> 3) < visData.size());
+		CHECK(visData[clusters[c].VisOfs + (c >> 3)] & (1 << (c & 7)));
+	}
+
+	threaded.Close();
+	CHECK(single.Update());
+	BspFile reopened;
+	CHECK(reopened.Open(bspPath));
+	CHECK(SameChunk(single, reopened, GBSP_CHUNK_VISDATA));
+	CHECK(SameChunk(single, reopened, GBSP_CHUNK_CLUSTERS));
+	return true;
+}
+
+//========================================================================================
+//	TestVisCache()
+//	A second full vis takes every portal from the cache, also after a trip through the
+//	disk, and writes the same vis data as without it
+//========================================================================================
+static bool TestVisCache(const std::string& bspPath) {
+	BspParms bspParms;
+	VisParms visParms;
+	LightParms lightParms;
+	RadiosityParms radiosity;
+	SampleParms sampling;
+	InitParms(bspParms, visParms, lightParms, radiosity, sampling);
+
+	BspFile reference;
+	CHECK(reference.Open(bspPath));
+	NativeVis fresh(visParms, TEST_THREADS);
+	CHECK(fresh.Vis(reference));
+
+	VisCache cache;
+	BspFile first;
+	CHECK(first.Open(bspPath));
+	NativeVis firstVis(visParms, TEST_THREADS);
+	CHECK(firstVis.Vis(first, &cache));
+	CHECK(firstVis.GetStats().Reused == 0);
+	CHECK(cache.GetNumEntries() == firstVis.GetStats().Portals);
+	CHECK(SameChunk(reference, first, GBSP_CHUNK_VISDATA));
+
+	const std::string cachePath = ScratchPath("vis" VISCACHE_EXTENSION);
+	CHECK(cache.Save(cachePath));
+	VisCache loaded;
+	CHECK(loaded.Load(cachePath));
+	CHECK(loaded.GetNumEntries() == cache.GetNumEntries());
+	CHECK(loaded.GetClusters() == cache.GetClusters());
+
+	BspFile second;
+	CHECK(second.Open(bspPath));
+	NativeVis secondVis(visParms, TEST_THREADS);
+	CHECK(secondVis.Vis(second, &loaded));
+	CHECK(secondVis.GetStats().Reused == secondVis.GetStats().Portals);
+	CHECK(SameChunk(reference, second, GBSP_CHUNK_VISDATA));
+	CHECK(SameChunk(reference, second, GBSP_CHUNK_CLUSTERS));
+
+	// a cache of another file is no reason to fail
+	FILE* fp = fopen(cachePath.c_str(), "wb");
+	CHECK(fp != nullptr);
+	fputs("not a cache", fp);
+	fclose(fp);
+	CHECK(!loaded.Load(cachePath));
+	CHECK(loaded.GetNumEntries() == 0);
+
+	remove(cachePath.c_str());
+	return true;
+}
+
+//========================================================================================
+//	TestLightRoundTrip()
+//	Direct light and radiosity on one thread and on several, written back with Update()
+//========================================================================================
+static bool TestLightRoundTrip(const std::string& bspPath) {
+	BspParms bspParms;
+	VisParms visParms;
+	LightParms lightParms;
+	RadiosityParms radiosity;
+	SampleParms sampling;
+	InitParms(bspParms, visParms, lightParms, radiosity, sampling);
+	lightParms.ExtraSamples = GE_TRUE;
+
+	for (int pass = 0; pass < 2; pass++) {
+		lightParms.Radiosity = pass ? GE_TRUE : GE_FALSE;
+		BspFile single, threaded;
+		CHECK(single.Open(bspPath));
+		CHECK(threaded.Open(bspPath));
+		CHECK(LightBsp(single, lightParms, radiosity, sampling, 1));
+		CHECK(LightBsp(threaded, lightParms, radiosity, sampling, TEST_THREADS));
+		CHECK(!single.GetChunkData<uint8>(GBSP_CHUNK_LIGHTDATA).empty());
+		CHECK(SameLighting(single, threaded));
+	}
+
+	BspFile lit;
+	CHECK(lit.Open(bspPath));
+	CHECK(LightBsp(lit, lightParms, radiosity, sampling, TEST_THREADS));
+	CHECK(lit.Update());
+	BspFile reopened;
+	CHECK(reopened.Open(bspPath));
+	CHECK(SameLighting(lit, reopened));
+	CHECK(SameChunk(lit, reopened, GBSP_CHUNK_VISDATA));
+	return true;
+}
+
+//========================================================================================
+//	TestAdaptiveSampling()
+//	With MaxSamples 5 the supersampled luxels take the samples of ExtraSamples, so
+//	supersampling every one of them lights the .bsp exactly as ExtraSamples does
+//========================================================================================
+static bool TestAdaptiveSampling(const std::string& bspPath) {
+	BspParms bspParms;
+	VisParms visParms;
+	LightParms lightParms;
+	RadiosityParms radiosity;
+	SampleParms sampling;
+	InitParms(bspParms, visParms, lightParms, radiosity, sampling);
+
+	BspFile extra, everyLuxel, edges;
+	CHECK(extra.Open(bspPath));
+	CHECK(everyLuxel.Open(bspPath));
+	CHECK(edges.Open(bspPath));
+	lightParms.ExtraSamples = GE_TRUE;
+	CHECK(LightBsp(extra, lightParms, radiosity, sampling, TEST_THREADS));
+
+	lightParms.ExtraSamples = GE_FALSE;
+	sampling.Adaptive = GE_TRUE;
+	sampling.MaxSamples = 5;
+	sampling.Contrast = -1.0f;
+	NativeLight all(lightParms, radiosity, sampling, TEST_THREADS);
+	CHECK(all.Light(everyLuxel));
+	CHECK(all.GetStats().SupersampledLuxels == all.GetStats().Luxels);
+	CHECK(SameLighting(extra, everyLuxel));
+
+	// only the shadow edges are supersampled
+	sampling.Contrast = LIGHT_DEFAULT_CONTRAST;
+	NativeLight adaptive(lightParms, radiosity, sampling, TEST_THREADS);
+	CHECK(adaptive.Light(edges));
+	CHECK(adaptive.GetStats().SupersampledLuxels > 0 && adaptive.GetStats().SupersampledLuxels < adaptive.GetStats().Luxels);
+	return true;
+}
+
+//========================================================================================
+//	TestLightCache()
+//	Relighting an unchanged .bsp keeps every face; after a light moved, relighting only
+//	the faces it reaches gives the same .bsp as lighting all of them
+//========================================================================================
+static bool TestLightCache(const std::string& bspPath) {
+	BspParms bspParms;
+	VisParms visParms;
+	LightParms lightParms;
+	RadiosityParms radiosity;
+	SampleParms sampling;
+	InitParms(bspParms, visParms, lightParms, radiosity, sampling);
+
+	const std::string cachePath = ScratchPath("light" LIGHTCACHE_EXTENSION);
+	remove(cachePath.c_str());
+	BspFile bsp;
+	CHECK(bsp.Open(bspPath));
+	CHECK(LightBsp(bsp, lightParms, radiosity, sampling, TEST_THREADS, cachePath));
+	CHECK(bsp.Update());
+
+	LightCache cache;
+	CHECK(cache.Load(cachePath));
+	CHECK(!cache.IsEmpty());
+	CHECK(cache.GetLights().size() == 1);
+
+	const int32 numFaces = bsp.GetChunkData<GFX_Face>(GBSP_CHUNK_FACES).size();
+	BspFile unchanged;
+	CHECK(unchanged.Open(bspPath));
+	NativeLight again(lightParms, radiosity, sampling, TEST_THREADS);
+	CHECK(again.Light(unchanged, &cache));
+	CHECK(again.GetCacheMiss().empty());
+	CHECK(again.GetStats().KeptFaces == numFaces);
+	CHECK(SameLighting(bsp, unchanged));
+	unchanged.Close();
+
+	// the light goes to another corner of the room
+	Span<const char> entData = bsp.GetChunkData<char>(GBSP_CHUNK_ENTDATA);
+	std::vector<Entity> entities;
+	CHECK(ParseEntities(entData.GetData(), entData.size(), entities));
+	for (Entity& entity : entities) {
+		for (auto& pair : entity.Keys) {
+			if (entity.IsClass("light") && pair.first == "origin") {
+				pair.second = "-300 300 -300";
+			}
+		}
+	}
+	const std::string moved = UnparseEntities(entities);
+	bsp.SetChunkData(GBSP_CHUNK_ENTDATA, moved.c_str(), (int32)moved.size() + 1);
+	CHECK(bsp.Update());
+	bsp.Close();
+
+	BspFile incremental, full;
+	CHECK(incremental.Open(bspPath));
+	CHECK(full.Open(bspPath));
+	NativeLight relight(lightParms, radiosity, sampling, TEST_THREADS);
+	CHECK(relight.Light(incremental, &cache));
+	CHECK(relight.GetCacheMiss().empty());
+	CHECK(relight.GetStats().KeptFaces > 0 && relight.GetStats().KeptFaces < numFaces);
+	CHECK(LightBsp(full, lightParms, radiosity, sampling, TEST_THREADS));
+	CHECK(SameLighting(incremental, full));
+
+	// other settings relight everything
+	lightParms.LightScale = 2.0f;
+	NativeLight miss(lightParms, radiosity, sampling, TEST_THREADS);
+	CHECK(miss.Light(full, &cache));
+	CHECK(!miss.GetCacheMiss().empty());
+	CHECK(miss.GetStats().KeptFaces == 0);
+
+	remove(cachePath.c_str());
+	return true;
+}
+
+static int numTests = 0;
+static int numFailed = 0;
+
+static void RunTest(const char* name, bool passed) {
+	printf("%-20s %s\n", name, passed ? "ok" : "FAILED");
+	numTests++;
+	if (!passed) {
+		numFailed++;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	scratchDir = argc > 1 ? argv[1] : "";
+	if (!scratchDir.empty() && scratchDir.back() != '/' && scratchDir.back() != '\\') {
+		scratchDir += '/';
+	}
+
+	const std::string mapPath = ScratchPath("test.map");
+	const std::string bspPath = ScratchPath("test.bsp");
+	TestMapWriter writer;
+	if (!writer.Write(mapPath, TEST_BOXES, "200 200 200") || !CompileTestMap(mapPath, bspPath, TEST_THREADS)) {
+		printf("Error: unable to compile the test map in %s\n", scratchDir.empty() ? "the working directory" : scratchDir.c_str());
+		return 1;
+	}
+
+	RunTest("map file", TestMapFile(mapPath));
+	RunTest("entity update", TestEntityUpdate(mapPath));
+	RunTest("bit kernels", TestBitKernels());
+	RunTest("plane pool", TestPlanePool());
+	RunTest("vec kernels", TestVecKernels());
+	RunTest("windings", TestWindings());
+	RunTest("arena", TestArena());
+	RunTest("bsp round trip", TestBspRoundTrip(mapPath));
+	RunTest("models", TestModels(bspPath));
+	RunTest("vis round trip", TestVisRoundTrip(bspPath));
+	RunTest("vis cache", TestVisCache(bspPath));
+	RunTest("light round trip", TestLightRoundTrip(bspPath));
+	RunTest("adaptive sampling", TestAdaptiveSampling(bspPath));
+	RunTest("light cache", TestLightCache(bspPath));
+
+	remove(mapPath.c_str());
+	remove(bspPath.c_str());
+	remove(ScratchPath("single.bsp").c_str());
+	printf("%d of %d tests failed\n", numFailed, numTests);
+	return numFailed;
+}